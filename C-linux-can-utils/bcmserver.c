@@ -35,6 +35,21 @@
  * Send a single CAN frame without cyclic transmission
  * < can0 S 0 0 123 0 >
  *
+ * The 'M'ultiplex command adds a cyclic job with a sequence of up to 256
+ * frames, which are sent one after the other (one frame per interval):
+ *
+ * < interface M ival_s ival_us can_id nframes [can_dlc [data]*]* >
+ *
+ * Send 123#0111, 123#0222 and 123#0333 in turn every 100 msecs on vcan1
+ * < vcan1 M 0 100000 123 3 2 01 11 2 02 22 2 03 33 >
+ *
+ * A new 'A', 'U' or 'M' command for the same can_id updates the job, 'D'
+ * deletes it. When the new 'M' sequence is longer than the one the job was
+ * created with the job is deleted and set up again. Whole schedules with
+ * hundreds of cyclic jobs are loaded by sending all 'A'/'M' commands with
+ * one write() - they are handed to the BCM in batches and the BCM does the
+ * timing in the kernel.
+ *
  * When the socket is closed the cyclic transmissions are terminated.
  *
  * ## RX path:
@@ -54,7 +69,16 @@
  * Filter for CAN ID 0x123 from vcan1 without content filtering
  * < vcan1 F 0 0 123 0 >
  *
- * Delete receive filter ('R' or 'F') for CAN ID 0x123
+ * The 'P' command sets up a multiplex receive filter with the same
+ * frame list as 'M'. The first frame holds the multiplex mask, each
+ * following frame the multiplex value (at the mask bits) and the mask for
+ * the content change detection (at the other bits).
+ *
+ * Receive CAN ID 0x123 from vcan1 with multiplexer byte 0: check the
+ * second byte of multiplex 01 and the low nibble of the second byte of 02
+ * < vcan1 P 0 0 123 3 1 FF 2 01 FF 2 02 0F >
+ *
+ * Delete receive filter ('R', 'F' or 'P') for CAN ID 0x123
  * < vcan1 X 0 0 123 0 >
  *
  * CAN messages received by the given filters are send in the format:
@@ -65,6 +89,17 @@
  *
  * < vcan1 123 4 11 22 33 44 >
  *
+ * Commands the BCM rejects (or for unknown interfaces) are answered with
+ * < error interface can_id errno >
+ *
+ * e.g. an 'R' command for CAN ID 0x123 on the non-existing vcan9
+ *
+ * < error vcan9 123 19 >
+ *
+ * Several commands may be sent at once. The server handles all clients in
+ * one process - each client gets its own BCM socket, so the cyclic jobs of
+ * a client are terminated when its connection is closed.
+ *
  * ##
  *
  * Authors:
@@ -111,106 +146,594 @@
  *
  */
 
+#define _GNU_SOURCE /* sendmmsg(), recvmmsg() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
 #include <net/if.h>
 #include <netinet/in.h>
 
 #include <linux/can.h>
 #include <linux/can/bcm.h>
 
-#define MAXLEN 100
+#define MAXLEN 8192      /* one command - up to MAXFRAMES frames */
 #define PORT 28600
 
-void childdied(int i)
+#define MAXCLIENTS 64
+#define MAXIFC 32        /* cached interface index <-> name entries */
+#define MAXBATCH 64      /* BCM messages per sendmmsg() / recvmmsg() */
+#define MAXFRAMES 256    /* frames of a multiplex message (BCM limit) */
+#define INSIZE 16384     /* received command data */
+#define OUTSIZE 16384    /* pending CAN messages for the client */
+#define MAXRXMSG 64      /* one formatted CAN message */
+
+/* epoll event tags */
+#define TAG_LISTEN 0x10000
+#define TAG_TCP    0x20000
+#define TAG_BCM    0x30000
+
+struct bcm_msg {
+	struct bcm_msg_head msg_head;
+	struct can_frame frame[MAXFRAMES];
+};
+
+struct client {
+	int sa;                  /* TCP connection */
+	int sc;                  /* BCM socket */
+	char in[INSIZE];
+	int inlen;
+	char out[OUTSIZE];
+	int outlen, outoff;
+	int rxpaused;            /* out[] full - BCM socket not polled */
+	int pollout;             /* waiting for EPOLLOUT */
+};
+
+static struct client client[MAXCLIENTS];
+static int epfd;
+
+/* interface index <-> name cache - saves an ioctl() per message */
+static struct {
+	int ifindex;
+	char name[IFNAMSIZ];
+} ifc[MAXIFC];
+static int nifc, ifc_next;
+
+static const char hex[] = "0123456789ABCDEF";
+
+static const char *cache_add(int ifindex, const char *name)
 {
-	wait(NULL);
+	int i = (nifc < MAXIFC) ? nifc++ : ifc_next++ % MAXIFC;
+
+	ifc[i].ifindex = ifindex;
+	snprintf(ifc[i].name, IFNAMSIZ, "%s", name);
+
+	return ifc[i].name;
 }
 
-int main(int argc, char **argv)
+static void cache_drop(int ifindex)
 {
+	int i;
 
-	int sl, sa, sc;
-	int i, ret;
-	int idx = 0;
-	struct sockaddr_in  saddr, clientaddr;
-	struct sockaddr_can caddr;
-	socklen_t caddrlen = sizeof(caddr);
+	for (i = 0; i < nifc; i++)
+		if (ifc[i].ifindex == ifindex)
+			ifc[i] = ifc[--nifc];
+}
+
+/* returns 0 when the interface does not exist */
+static int cache_ifindex(int sock, const char *name)
+{
 	struct ifreq ifr;
-	fd_set readfds;
-	socklen_t sin_size = sizeof(clientaddr);
-	struct sigaction signalaction;
-	sigset_t sigset;
+	int i;
 
-	char buf[MAXLEN];
-	char rxmsg[50];
+	for (i = 0; i < nifc; i++)
+		if (!strcmp(ifc[i].name, name))
+			return ifc[i].ifindex;
 
-	struct {
-		struct bcm_msg_head msg_head;
-		struct can_frame frame;
-	} msg;
+	strcpy(ifr.ifr_name, name);
+	if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+		return 0;
 
-	sigemptyset(&sigset);
-	signalaction.sa_handler = &childdied;
-	signalaction.sa_mask = sigset;
-	signalaction.sa_flags = 0;
-	sigaction(SIGCHLD, &signalaction, NULL);  /* signal for dying child */
+	cache_add(ifr.ifr_ifindex, name);
 
-	if((sl = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-		perror("inetsocket");
-		exit(1);
-	}
+	return ifr.ifr_ifindex;
+}
 
-	saddr.sin_family = AF_INET;
-	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	saddr.sin_port = htons(PORT);
+static const char *cache_ifname(int sock, int ifindex)
+{
+	struct ifreq ifr;
+	int i;
 
-	while(bind(sl,(struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
-		printf(".");fflush(NULL);
-		usleep(100000);
+	for (i = 0; i < nifc; i++)
+		if (ifc[i].ifindex == ifindex)
+			return ifc[i].name;
+
+	ifr.ifr_ifindex = ifindex;
+	if (ioctl(sock, SIOCGIFNAME, &ifr) < 0)
+		return "?";
+
+	return cache_add(ifindex, ifr.ifr_name);
+}
+
+/*
+ * parses '< interface command ival_s ival_us can_id can_dlc [data]* >'
+ * or '< interface command ival_s ival_us can_id nframes [can_dlc [data]*]* >'
+ * for the multiplex commands 'M' and 'P'
+ * returns the command character or 0 on a malformed command
+ */
+static int parse_cmd(const char *buf, char *ifname, struct bcm_msg *msg)
+{
+	const char *p = buf + 1; /* behind '<' */
+	struct can_frame *cf;
+	char *end;
+	unsigned long val;
+	int cmd, len, i, n;
+
+	while (*p == ' ')
+		p++;
+	len = strcspn(p, " >");
+	if (!len || len >= IFNAMSIZ)
+		return 0;
+	memcpy(ifname, p, len);
+	ifname[len] = 0;
+	p += len;
+
+	while (*p == ' ')
+		p++;
+	cmd = *p++;
+	if (*p != ' ')
+		return 0;
+
+	msg->msg_head.ival2.tv_sec = strtoul(p, &end, 10);
+	if (end == p)
+		return 0;
+	p = end;
+
+	msg->msg_head.ival2.tv_usec = strtoul(p, &end, 10);
+	if (end == p)
+		return 0;
+	p = end;
+
+	msg->msg_head.can_id = strtoul(p, &end, 16);
+	if (end == p)
+		return 0;
+	p = end;
+
+	if (cmd == 'M' || cmd == 'P') {
+		val = strtoul(p, &end, 10);
+		if (end == p || !val || val > MAXFRAMES)
+			return 0;
+		msg->msg_head.nframes = val;
+		p = end;
 	}
 
-	if (listen(sl,3) != 0) {
-		perror("listen");
-		exit(1);
+	for (n = 0; n < msg->msg_head.nframes; n++) {
+		cf = &msg->frame[n];
+		memset(cf, 0, sizeof(*cf));
+		cf->can_id = msg->msg_head.can_id;
+
+		val = strtoul(p, &end, 10);
+		if (end == p || val > 8)
+			return 0;
+		cf->can_dlc = val;
+		p = end;
+
+		for (i = 0; i < cf->can_dlc; i++) {
+			cf->data[i] = strtoul(p, &end, 16);
+			if (end == p)
+				return 0;
+			p = end;
+		}
 	}
 
-	while (1) { 
-		sa = accept(sl,(struct sockaddr *)&clientaddr, &sin_size);
-		if (sa > 0 ){
+	while (*p == ' ')
+		p++;
+	if (*p != '>')
+		return 0;
+
+	return cmd;
+}
+
+static void close_client(struct client *c)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->sa, NULL);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->sc, NULL);
+	close(c->sa);
+	close(c->sc); /* terminates the cyclic jobs of this client */
+	c->sa = -1;
+}
 
-			if (fork())
-				close(sa);
-			else
+static void set_events(struct client *c)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | ((c->pollout) ? EPOLLOUT : 0);
+	ev.data.u32 = TAG_TCP + (c - client);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->sa, &ev);
+
+	ev.events = (c->rxpaused) ? 0 : EPOLLIN;
+	ev.data.u32 = TAG_BCM + (c - client);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->sc, &ev);
+}
+
+/*
+ * send the pending CAN messages to the client
+ * returns -1 when the client has been closed
+ */
+static int flush_out(struct client *c)
+{
+	int pollout = 0;
+	int paused = c->rxpaused;
+	ssize_t n;
+
+	while (c->outoff < c->outlen) {
+		n = send(c->sa, c->out + c->outoff, c->outlen - c->outoff, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				pollout = 1;
 				break;
+			}
+			close_client(c);
+			return -1;
+		}
+		c->outoff += n;
+	}
+
+	if (c->outoff == c->outlen)
+		c->outoff = c->outlen = 0;
+
+	/* read the BCM socket again when there is room for a batch */
+	c->rxpaused = (OUTSIZE - c->outlen < MAXBATCH * MAXRXMSG);
+
+	if (pollout != c->pollout || paused != c->rxpaused) {
+		c->pollout = pollout;
+		set_events(c);
+	}
+
+	return 0;
+}
+
+/* '< interface can_id can_dlc [data]* >' */
+static int format_rxmsg(char *buf, const char *ifname, struct bcm_msg *msg)
+{
+	char *p = buf;
+	canid_t id = msg->msg_head.can_id;
+	int i, digits;
+
+	*p++ = '<';
+	*p++ = ' ';
+	while (*ifname)
+		*p++ = *ifname++;
+	*p++ = ' ';
+
+	/* %03X */
+	for (digits = 3; digits < 8 && (id >> (4 * digits)); digits++)
+		;
+	for (i = digits - 1; i >= 0; i--)
+		*p++ = hex[(id >> (4 * i)) & 0xF];
+	*p++ = ' ';
+
+	p += sprintf(p, "%d ", msg->frame[0].can_dlc);
+
+	for (i = 0; i < msg->frame[0].can_dlc && i < 8; i++) {
+		*p++ = hex[msg->frame[0].data[i] >> 4];
+		*p++ = hex[msg->frame[0].data[i] & 0xF];
+		*p++ = ' ';
+	}
+
+	/* delimiter '\0' for Adobe(TM) Flash(TM) XML sockets */
+	*p++ = '>';
+	*p++ = 0;
+
+	return p - buf;
+}
+
+/*
+ * forward the messages received by the BCM socket to the client
+ * returns -1 when the client has been closed
+ */
+static int client_rx(struct client *c)
+{
+	static struct bcm_msg msg[MAXBATCH];
+	struct sockaddr_can caddr[MAXBATCH];
+	struct mmsghdr mmsg[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	int n, i, room;
+
+	room = (OUTSIZE - c->outlen) / MAXRXMSG;
+	if (room > MAXBATCH)
+		room = MAXBATCH;
+	if (!room)
+		return flush_out(c);
+
+	memset(mmsg, 0, sizeof(mmsg));
+	for (i = 0; i < room; i++) {
+		iov[i].iov_base = &msg[i];
+		iov[i].iov_len = sizeof(msg[i]);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_name = &caddr[i];
+		mmsg[i].msg_hdr.msg_namelen = sizeof(caddr[i]);
+		caddr[i].can_ifindex = 0;
+	}
+
+	n = recvmmsg(c->sc, mmsg, room, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		close_client(c);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		c->outlen += format_rxmsg(c->out + c->outlen,
+					  cache_ifname(c->sc, caddr[i].can_ifindex),
+					  &msg[i]);
+
+	return flush_out(c);
+}
+
+/* '< error interface can_id errno >' for a command the BCM rejected */
+static void report_error(struct client *c, const char *ifname,
+			 struct bcm_msg *msg, int err)
+{
+	if (OUTSIZE - c->outlen < MAXRXMSG)
+		return; /* client does not read - drop it like CAN messages */
+
+	c->outlen += snprintf(c->out + c->outlen, MAXRXMSG, "< error %s %03X %d >",
+			      ifname, msg->msg_head.can_id, err) + 1;
+}
+
+/*
+ * A TX_SETUP / RX_SETUP for an existing job must not have more frames than
+ * the first setup (E2BIG). Delete the job to set it up from scratch.
+ * Returns 0 when the job has been deleted.
+ */
+static int delete_job(struct client *c, struct bcm_msg *msg,
+		      struct sockaddr_can *caddr)
+{
+	struct bcm_msg_head head;
+
+	memset(&head, 0, sizeof(head));
+	head.opcode = (msg->msg_head.opcode == TX_SETUP) ? TX_DELETE : RX_DELETE;
+	head.can_id = msg->msg_head.can_id;
+
+	return (sendto(c->sc, &head, sizeof(head), 0,
+		       (struct sockaddr *)caddr, sizeof(*caddr)) < 0) ? -1 : 0;
+}
+
+/* hand the batch of commands to the BCM */
+static void send_cmds(struct client *c, struct mmsghdr *mmsg,
+		      struct sockaddr_can *caddr, char (*ifname)[IFNAMSIZ], int n)
+{
+	struct bcm_msg *msg;
+	int i = 0, ret, ifindex, retried = -1;
+
+	while (i < n) {
+		ret = sendmmsg(c->sc, &mmsg[i], n - i, 0);
+		if (ret > 0) {
+			i += ret;
+			continue;
 		}
-		else {
-			if (errno != EINTR) {
-				/*
-				 * If the cause for the error was NOT the
-				 * signal from a dying child => give an error
-				 */
-				perror("accept");
-				exit(1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		msg = mmsg[i].msg_hdr.msg_iov->iov_base;
+
+		if (ret < 0 && errno == ENODEV) {
+			/* interface re-created - update the cached index */
+			cache_drop(caddr[i].can_ifindex);
+			ifindex = cache_ifindex(c->sc, ifname[i]);
+			if (ifindex && ifindex != caddr[i].can_ifindex) {
+				caddr[i].can_ifindex = ifindex;
+				continue;
 			}
 		}
+
+		if (ret < 0 && errno == E2BIG && retried != i &&
+		    (msg->msg_head.opcode == TX_SETUP ||
+		     msg->msg_head.opcode == RX_SETUP) &&
+		    !delete_job(c, msg, &caddr[i])) {
+			retried = i; /* once - then report the error */
+			continue;
+		}
+
+		report_error(c, ifname[i], msg, (ret < 0) ? errno : EIO);
+		i++; /* skip the failing command */
+	}
+}
+
+/*
+ * process all complete commands received from the client
+ * returns -1 when the client has been closed
+ */
+static int client_cmds(struct client *c)
+{
+	static struct bcm_msg msg[MAXBATCH];
+	static struct sockaddr_can caddr[MAXBATCH];
+	static char ifname[MAXBATCH][IFNAMSIZ];
+	struct mmsghdr mmsg[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	char buf[MAXLEN];
+	char *p, *end, *start, *stop;
+	int n, len, cmd, err = 0;
+
+	len = read(c->sa, c->in + c->inlen, INSIZE - c->inlen);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (len <= 0) {
+		close_client(c);
+		return -1;
+	}
+
+	c->inlen += len;
+	p = c->in;
+	end = c->in + c->inlen;
+	n = 0;
+
+	while (p < end) {
+
+		start = memchr(p, '<', end - p);
+		if (!start) {
+			p = end;
+			break;
+		}
+
+		stop = memchr(start, '>', end - start);
+		len = (stop) ? stop - start : end - start;
+
+		if (len > MAXLEN - 2) {
+			/* too long - skip it */
+			p = start + MAXLEN - 1;
+			continue;
+		}
+
+		if (!stop) {
+			/* wait for the rest */
+			p = start;
+			break;
+		}
+
+		memcpy(buf, start, len + 1);
+		buf[len + 1] = 0;
+		p = stop + 1;
+
+		/* prepare bcm message settings - the frames are set by the parser */
+		memset(&msg[n].msg_head, 0, sizeof(msg[n].msg_head));
+		msg[n].msg_head.nframes = 1;
+
+		cmd = parse_cmd(buf, ifname[n], &msg[n]);
+
+		switch (cmd) {
+		case 'S':
+			msg[n].msg_head.opcode = TX_SEND;
+			break;
+		case 'A':
+			msg[n].msg_head.opcode = TX_SETUP;
+			msg[n].msg_head.flags |= SETTIMER | STARTTIMER;
+			break;
+		case 'U':
+			msg[n].msg_head.opcode = TX_SETUP;
+			msg[n].msg_head.flags  = 0;
+			break;
+		case 'M':
+			msg[n].msg_head.opcode = TX_SETUP;
+			msg[n].msg_head.flags |= SETTIMER | STARTTIMER;
+			break;
+		case 'D':
+			msg[n].msg_head.opcode = TX_DELETE;
+			break;
+
+		case 'R':
+			msg[n].msg_head.opcode = RX_SETUP;
+			msg[n].msg_head.flags  = SETTIMER;
+			break;
+		case 'F':
+			msg[n].msg_head.opcode = RX_SETUP;
+			msg[n].msg_head.flags  = RX_FILTER_ID | SETTIMER;
+			break;
+		case 'P':
+			msg[n].msg_head.opcode = RX_SETUP;
+			msg[n].msg_head.flags  = SETTIMER;
+			break;
+		case 'X':
+			msg[n].msg_head.opcode = RX_DELETE;
+			break;
+		case 0:
+			err = 1;
+			break;
+		default:
+			printf("unknown command '%c'.\n", cmd);
+			err = 1;
+		}
+
+		if (err)
+			break;
+
+		memset(&caddr[n], 0, sizeof(caddr[n]));
+		caddr[n].can_family = PF_CAN;
+		caddr[n].can_ifindex = cache_ifindex(c->sc, ifname[n]);
+		if (!caddr[n].can_ifindex) {
+			report_error(c, ifname[n], &msg[n], ENODEV);
+			continue;
+		}
+
+		iov[n].iov_base = &msg[n];
+		iov[n].iov_len = sizeof(msg[n].msg_head) +
+			msg[n].msg_head.nframes * sizeof(struct can_frame);
+		memset(&mmsg[n], 0, sizeof(mmsg[n]));
+		mmsg[n].msg_hdr.msg_name = &caddr[n];
+		mmsg[n].msg_hdr.msg_namelen = sizeof(caddr[n]);
+		mmsg[n].msg_hdr.msg_iov = &iov[n];
+		mmsg[n].msg_hdr.msg_iovlen = 1;
+
+		if (++n == MAXBATCH) {
+			send_cmds(c, mmsg, caddr, ifname, n);
+			n = 0;
+		}
+	}
+
+	if (n)
+		send_cmds(c, mmsg, caddr, ifname, n);
+
+	if (err) {
+		/* malformed command terminates the connection */
+		close_client(c);
+		return -1;
+	}
+
+	c->inlen = end - p;
+	memmove(c->in, p, c->inlen);
+
+	/* error reports */
+	if (c->outlen > c->outoff && !c->pollout)
+		return flush_out(c);
+
+	return 0;
+}
+
+static void accept_client(int sl)
+{
+	struct sockaddr_in clientaddr;
+	socklen_t sin_size = sizeof(clientaddr);
+	struct sockaddr_can caddr;
+	struct epoll_event ev;
+	struct client *c;
+	int sa, sc, i;
+
+	sa = accept(sl, (struct sockaddr *)&clientaddr, &sin_size);
+	if (sa < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			perror("accept");
+		return;
+	}
+
+	for (i = 0; i < MAXCLIENTS && client[i].sa >= 0; i++)
+		;
+
+	if (i == MAXCLIENTS) {
+		fprintf(stderr, "more than %d clients!\n", MAXCLIENTS);
+		close(sa);
+		return;
 	}
 
 	/* open BCM socket */
 
 	if ((sc = socket(PF_CAN, SOCK_DGRAM, CAN_BCM)) < 0) {
 		perror("bcmsocket");
-		return 1;
+		close(sa);
+		return;
 	}
 
 	memset(&caddr, 0, sizeof(caddr));
@@ -219,142 +742,107 @@ int main(int argc, char **argv)
 
 	if (connect(sc, (struct sockaddr *)&caddr, sizeof(caddr)) < 0) {
 		perror("connect");
-		return 1;
+		close(sc);
+		close(sa);
+		return;
 	}
 
-	while (1) {
+	fcntl(sa, F_SETFL, fcntl(sa, F_GETFL) | O_NONBLOCK);
 
-		FD_ZERO(&readfds);
-		FD_SET(sc, &readfds);
-		FD_SET(sa, &readfds);
+	c = &client[i];
+	c->sa = sa;
+	c->sc = sc;
+	c->inlen = c->outlen = c->outoff = 0;
+	c->rxpaused = c->pollout = 0;
 
-		ret = select((sc > sa)?sc+1:sa+1, &readfds, NULL, NULL, NULL);
+	ev.events = EPOLLIN;
+	ev.data.u32 = TAG_TCP + i;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sa, &ev);
+	ev.data.u32 = TAG_BCM + i;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sc, &ev);
+}
 
-		if (FD_ISSET(sc, &readfds)) {
+int main(int argc, char **argv)
+{
+	int sl, i, n;
+	struct sockaddr_in saddr;
+	struct epoll_event ev, events[2 * MAXCLIENTS + 1];
+	struct client *c;
 
-			ret = recvfrom(sc, &msg, sizeof(msg), 0,
-				       (struct sockaddr*)&caddr, &caddrlen);
+	signal(SIGPIPE, SIG_IGN); /* send errors close the client */
 
-			ifr.ifr_ifindex = caddr.can_ifindex;
-			ioctl(sc, SIOCGIFNAME, &ifr);
+	for (i = 0; i < MAXCLIENTS; i++)
+		client[i].sa = -1;
 
-			sprintf(rxmsg, "< %s %03X %d ", ifr.ifr_name,
-				msg.msg_head.can_id, msg.frame.can_dlc);
+	if((sl = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("inetsocket");
+		exit(1);
+	}
 
-			for ( i = 0; i < msg.frame.can_dlc; i++)
-				sprintf(rxmsg + strlen(rxmsg), "%02X ",
-					msg.frame.data[i]);
+	saddr.sin_family = AF_INET;
+	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	saddr.sin_port = htons(PORT);
 
-			/* delimiter '\0' for Adobe(TM) Flash(TM) XML sockets */
-			strcat(rxmsg, ">\0");
+	while(bind(sl,(struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+		printf(".");fflush(NULL);
+		usleep(100000);
+	}
 
-			send(sa, rxmsg, strlen(rxmsg) + 1, 0);
-		}
+	if (listen(sl, 16) != 0) {
+		perror("listen");
+		exit(1);
+	}
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
 
+	ev.events = EPOLLIN;
+	ev.data.u32 = TAG_LISTEN;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sl, &ev) < 0) {
+		perror("epoll_ctl");
+		exit(1);
+	}
 
-		if (FD_ISSET(sa, &readfds)) {
+	while (1) {
 
-			char cmd;
-			int items;
+		n = epoll_wait(epfd, events, 2 * MAXCLIENTS + 1, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
 
-			if (read(sa, buf+idx, 1) < 1)
-				exit(1);
+		for (i = 0; i < n; i++) {
 
-			if (!idx) {
-				if (buf[0] == '<')
-					idx = 1;
+			unsigned int tag = events[i].data.u32;
 
+			if (tag == TAG_LISTEN) {
+				accept_client(sl);
 				continue;
 			}
 
-			if (idx > MAXLEN-2) {
-				idx = 0;
-				continue;
-			}
+			c = &client[(tag & 0xFFFF)];
+			if (c->sa < 0)
+				continue; /* closed in this round */
 
-			if (buf[idx] != '>') {
-				idx++;
+			if (tag >= TAG_BCM) {
+				client_rx(c);
 				continue;
 			}
 
-			buf[idx+1] = 0;
-			idx = 0;
-
-			//printf("read '%s'\n", buf);
-
-			/* prepare bcm message settings */
-			memset(&msg, 0, sizeof(msg));
-			msg.msg_head.nframes = 1;
-
-			items = sscanf(buf, "< %6s %c %lu %lu %x %hhu "
-				       "%hhx %hhx %hhx %hhx %hhx %hhx "
-				       "%hhx %hhx >",
-				       ifr.ifr_name,
-				       &cmd, 
-				       &msg.msg_head.ival2.tv_sec,
-				       &msg.msg_head.ival2.tv_usec,
-				       &msg.msg_head.can_id,
-				       &msg.frame.can_dlc,
-				       &msg.frame.data[0],
-				       &msg.frame.data[1],
-				       &msg.frame.data[2],
-				       &msg.frame.data[3],
-				       &msg.frame.data[4],
-				       &msg.frame.data[5],
-				       &msg.frame.data[6],
-				       &msg.frame.data[7]);
-
-			if (items < 6)
-				break;
-			if (msg.frame.can_dlc > 8)
-				break;
-			if (items != 6 + msg.frame.can_dlc)
-				break;
-
-			msg.frame.can_id = msg.msg_head.can_id;
-
-			switch (cmd) {
-			case 'S':
-				msg.msg_head.opcode = TX_SEND;
-				break;
-			case 'A':
-				msg.msg_head.opcode = TX_SETUP;
-				msg.msg_head.flags |= SETTIMER | STARTTIMER;
-				break;
-			case 'U':
-				msg.msg_head.opcode = TX_SETUP;
-				msg.msg_head.flags  = 0;
-				break;
-			case 'D':
-				msg.msg_head.opcode = TX_DELETE;
-				break;
-
-			case 'R':
-				msg.msg_head.opcode = RX_SETUP;
-				msg.msg_head.flags  = SETTIMER;
-				break;
-			case 'F':
-				msg.msg_head.opcode = RX_SETUP;
-				msg.msg_head.flags  = RX_FILTER_ID | SETTIMER;
-				break;
-			case 'X':
-				msg.msg_head.opcode = RX_DELETE;
-				break;
-			default:
-				printf("unknown command '%c'.\n", cmd);
-				exit(1);
-			}
+			if ((events[i].events & EPOLLOUT) && flush_out(c) < 0)
+				continue;
 
-			if (!ioctl(sc, SIOCGIFINDEX, &ifr)) {
-				caddr.can_ifindex = ifr.ifr_ifindex;
-				sendto(sc, &msg, sizeof(msg), 0,
-				       (struct sockaddr*)&caddr, sizeof(caddr));
-			}
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				client_cmds(c);
 		}
 	}
 
-	close(sc);
-	close(sa);
+	close(sl);
 
 	return 0;
 }
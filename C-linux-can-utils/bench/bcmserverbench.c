@@ -0,0 +1,421 @@
+/*
+ * bcmserverbench.c - command and receive throughput of bcmserver
+ *
+ * Runs bcmserver.c with the BCM socket replaced by a datagram socketpair
+ * whose other end (a thread in the server process) plays the BCM, so the
+ * TCP command parser and the message formatting can be measured without
+ * CAN hardware or vcan support:
+ *
+ * -c <n>  sends n 'S' commands with one write and measures the commands/s
+ *         arriving at the BCM side
+ * -r <n>  sets up an 'F' filter and lets the BCM side deliver n RX_CHANGED
+ *         messages as fast as possible - measured are the messages/s the
+ *         TCP client receives
+ *
+ * Another bcmserver revision can be measured with
+ * make BCMSERVER=/path/to/bcmserver.c bcmserverbench
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#define _GNU_SOURCE /* sendmmsg(), recvmmsg() */
+
+#include <pthread.h>
+#include <time.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+
+#ifndef BCMSERVER
+#define BCMSERVER "../bcmserver.c"
+#endif
+
+#define BATCH 64
+#define BCM_PORT 28600
+
+struct result {
+	double secs;
+	long msgs;
+	long ioctls;
+};
+
+static long nmsgs;
+static int rxmode;
+static int result_fd;  /* pipe from the server process */
+static long nioctl;    /* in the server process */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the BCM side of the socketpair - runs as a thread in the server */
+static void *bcm_thread(void *arg)
+{
+	int fd = (long)arg;
+	static struct {
+		struct bcm_msg_head head;
+		struct can_frame frame;
+	} msg[BATCH];
+	struct mmsghdr mmsg[BATCH];
+	struct iovec iov[BATCH];
+	struct result res;
+	double start = 0;
+	long cnt = 0;
+	int i, n;
+
+	memset(msg, 0, sizeof(msg));
+	memset(mmsg, 0, sizeof(mmsg));
+	for (i = 0; i < BATCH; i++) {
+		iov[i].iov_base = &msg[i];
+		iov[i].iov_len = sizeof(msg[i]);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (rxmode) {
+		/* wait for the RX_SETUP of the client */
+		while (recv(fd, &msg[0], sizeof(msg[0]), 0) < 0)
+			;
+
+		memset(&msg[0], 0, sizeof(msg[0]));
+		msg[0].head.opcode = RX_CHANGED;
+		msg[0].head.can_id = 0x123;
+		msg[0].head.nframes = 1;
+		msg[0].frame.can_id = 0x123;
+		msg[0].frame.can_dlc = 8;
+		memset(msg[0].frame.data, 0x5A, 8);
+
+		for (cnt = 0; cnt < nmsgs; cnt++) {
+			msg[0].frame.data[0] = cnt;
+			while (send(fd, &msg[0], sizeof(msg[0]), 0) < 0)
+				;
+		}
+		return NULL;
+	}
+
+	while (cnt < nmsgs) {
+		n = recvmmsg(fd, mmsg, BATCH, 0, NULL);
+		if (n <= 0)
+			continue;
+		if (!cnt)
+			start = now();
+		cnt += n;
+	}
+
+	res.secs = now() - start;
+	res.msgs = cnt;
+	res.ioctls = nioctl;
+	if (write(result_fd, &res, sizeof(res)) != sizeof(res))
+		perror("result");
+
+	return NULL;
+}
+
+static int fake_socket(int domain, int type, int protocol)
+{
+	pthread_t thread;
+	int sv[2], size = 1 << 20;
+
+	if (domain != PF_CAN)
+		return socket(domain, type, protocol);
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+		return -1;
+
+	setsockopt(sv[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	pthread_create(&thread, NULL, bcm_thread, (void *)(long)sv[1]);
+
+	return sv[0];
+}
+
+static int fake_connect(int sock, const struct sockaddr *addr, socklen_t len)
+{
+	if (addr->sa_family == PF_CAN)
+		return 0; /* the socketpair is connected */
+
+	return connect(sock, addr, len);
+}
+
+static int fake_ioctl(int sock, unsigned long req, void *arg)
+{
+	struct ifreq *ifr = arg;
+
+	nioctl++;
+	if (req == SIOCGIFINDEX)
+		ifr->ifr_ifindex = 1;
+	else
+		strcpy(ifr->ifr_name, "vcan0");
+
+	return 0;
+}
+
+static ssize_t fake_sendto(int sock, const void *buf, size_t len, int flags,
+			   const struct sockaddr *addr, socklen_t alen)
+{
+	return send(sock, buf, len, flags);
+}
+
+static int fake_sendmmsg(int sock, struct mmsghdr *mmsg, unsigned int n,
+			 int flags)
+{
+	unsigned int i;
+
+	/* no CAN addresses on the socketpair */
+	for (i = 0; i < n; i++) {
+		mmsg[i].msg_hdr.msg_name = NULL;
+		mmsg[i].msg_hdr.msg_namelen = 0;
+	}
+
+	return sendmmsg(sock, mmsg, n, flags);
+}
+
+#define socket fake_socket
+#define connect fake_connect
+#define ioctl fake_ioctl
+#define sendto fake_sendto
+#define sendmmsg fake_sendmmsg
+#define main bcmserver_main
+#include BCMSERVER
+#undef main
+#undef socket
+#undef connect
+#undef ioctl
+#undef sendto
+#undef sendmmsg
+
+static int connect_server(void)
+{
+	struct sockaddr_in addr;
+	int s, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(BCM_PORT);
+
+	/* the server needs some time to bind */
+	for (i = 0; i < 100; i++) {
+		s = socket(PF_INET, SOCK_STREAM, 0);
+		if (s < 0)
+			break;
+		if (!connect(s, (struct sockaddr *)&addr, sizeof(addr)))
+			return s;
+		close(s);
+		usleep(50000);
+	}
+
+	perror("connect bcmserver");
+	return -1;
+}
+
+static int send_all(int s, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(s, buf, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("send");
+			return 1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int bench_cmds(int s, int rfd)
+{
+	static const char cmd[] = "< vcan0 S 0 0 123 8 11 22 33 44 55 66 77 88 >";
+	struct result res;
+	char *buf;
+	long i;
+
+	buf = malloc(nmsgs * (sizeof(cmd) - 1));
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (i = 0; i < nmsgs; i++)
+		memcpy(buf + i * (sizeof(cmd) - 1), cmd, sizeof(cmd) - 1);
+
+	if (send_all(s, buf, nmsgs * (sizeof(cmd) - 1)))
+		return 1;
+	free(buf);
+
+	if (read(rfd, &res, sizeof(res)) != sizeof(res)) {
+		fprintf(stderr, "no result from the server\n");
+		return 1;
+	}
+
+	printf("%ld commands in %.3f s = %.0f commands/s, %ld ioctls\n",
+	       res.msgs, res.secs, res.msgs / res.secs, res.ioctls);
+
+	return 0;
+}
+
+static int bench_rx(int s)
+{
+	static const char cmd[] = "< vcan0 F 0 0 123 0 >";
+	static char buf[1 << 16];
+	double start = 0, secs;
+	long got = 0;
+	ssize_t n, i;
+
+	if (send_all(s, cmd, sizeof(cmd) - 1))
+		return 1;
+
+	while (got < nmsgs) {
+		n = recv(s, buf, sizeof(buf), 0);
+		if (n <= 0) {
+			perror("recv");
+			return 1;
+		}
+		if (!got && !start)
+			start = now();
+		/* every message ends with '\0' */
+		for (i = 0; i < n; i++)
+			got += !buf[i];
+	}
+
+	secs = now() - start;
+	printf("%ld messages in %.3f s = %.0f messages/s\n",
+	       got, secs, got / secs);
+
+	return 0;
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "\nUsage: %s -c <n> | -r <n>\n", prg);
+	fprintf(stderr, "Options: -c <n>  (send n commands to the BCM)\n");
+	fprintf(stderr, "         -r <n>  (receive n CAN messages from the BCM)\n");
+	fprintf(stderr, "\nbcmserver listens on port %d - it must be free.\n\n",
+		BCM_PORT);
+}
+
+int main(int argc, char **argv)
+{
+	char *srv_argv[] = { "bcmserver", NULL };
+	int opt, s, ret, pfd[2];
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "c:r:?")) != -1) {
+		switch (opt) {
+		case 'c':
+			rxmode = 0;
+			nmsgs = strtol(optarg, NULL, 10);
+			break;
+
+		case 'r':
+			rxmode = 1;
+			nmsgs = strtol(optarg, NULL, 10);
+			break;
+
+		default:
+			print_usage(basename(argv[0]));
+			exit(1);
+		}
+	}
+
+	if (nmsgs <= 0) {
+		print_usage(basename(argv[0]));
+		exit(1);
+	}
+
+	if (pipe(pfd) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+
+	if (!pid) {
+		/* own process group - older revisions fork per client */
+		setpgid(0, 0);
+		close(pfd[0]);
+		result_fd = pfd[1];
+		exit(bcmserver_main(1, srv_argv));
+	}
+
+	close(pfd[1]);
+
+	s = connect_server();
+	if (s < 0)
+		ret = 1;
+	else if (rxmode)
+		ret = bench_rx(s);
+	else
+		ret = bench_cmds(s, pfd[0]);
+
+	if (s >= 0)
+		close(s);
+	kill(-pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	return ret;
+}
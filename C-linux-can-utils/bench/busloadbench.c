@@ -0,0 +1,217 @@
+/*
+ * busloadbench.c - accuracy and cost of the canbusload bit calculation modes
+ *
+ * Runs frame_bits() of canbusload.c in the three modes (Tindell estimation,
+ * -i without stuff bits, -e exact) over sets of test frames and compares
+ * the results with a straightforward bit-by-bit serialization of the frame
+ * which is used as reference.
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+/* canbusload.c is included to get access to its static functions */
+#define main canbusload_main
+#include "../canbusload.c"
+#undef main
+
+#include <time.h>
+
+#define NFRAMES 4096
+#define MAXBITS 160
+
+static struct can_frame frame[NFRAMES];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int addbits(unsigned char *bit, int pos, unsigned int val, int n)
+{
+	while (n--)
+		bit[pos++] = (val >> n) & 1;
+	return pos;
+}
+
+/* bit-by-bit reference of the wire bits incl. stuffing */
+static unsigned int reference_bits(struct can_frame *cf)
+{
+	unsigned char bit[MAXBITS];
+	int rtr = !!(cf->can_id & CAN_RTR_FLAG);
+	int dlc = (cf->can_dlc > 8) ? 8 : cf->can_dlc;
+	int pos = 0, i, run = 0, last = -1, stuffed = 0;
+	unsigned int crc = 0, nxt;
+
+	pos = addbits(bit, pos, 0, 1); /* SOF */
+	if (cf->can_id & CAN_EFF_FLAG) {
+		pos = addbits(bit, pos, (cf->can_id & CAN_EFF_MASK) >> 18, 11);
+		pos = addbits(bit, pos, 3, 2); /* SRR, IDE */
+		pos = addbits(bit, pos, cf->can_id & 0x3FFFF, 18);
+		pos = addbits(bit, pos, rtr << 2, 3); /* RTR, r1, r0 */
+	} else {
+		pos = addbits(bit, pos, cf->can_id & CAN_SFF_MASK, 11);
+		pos = addbits(bit, pos, rtr << 2, 3); /* RTR, IDE, r0 */
+	}
+	pos = addbits(bit, pos, dlc, 4);
+	for (i = 0; !rtr && i < dlc; i++)
+		pos = addbits(bit, pos, cf->data[i], 8);
+
+	for (i = 0; i < pos; i++) {
+		nxt = bit[i] ^ (crc >> 14);
+		crc = (crc << 1) & 0x7FFF;
+		if (nxt & 1)
+			crc ^= CRC15POLY;
+	}
+	pos = addbits(bit, pos, crc, 15);
+
+	for (i = 0; i < pos; i++) {
+		if (bit[i] == last)
+			run++;
+		else {
+			last = bit[i];
+			run = 1;
+		}
+		if (run == 5) {
+			stuffed++;
+			last = !bit[i];
+			run = 1;
+		}
+	}
+
+	return pos + stuffed + UNSTUFFED;
+}
+
+static void make_frames(int set)
+{
+	unsigned int x = 2463534242U;
+	int i, j;
+
+	for (i = 0; i < NFRAMES; i++) {
+		memset(&frame[i], 0, sizeof(frame[i]));
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		switch (set) {
+		case 0: /* SFF, random DLC and data */
+			frame[i].can_id = x & CAN_SFF_MASK;
+			frame[i].can_dlc = x % 9;
+			break;
+		case 1: /* EFF, mostly zero data */
+			frame[i].can_id = 0x0C000000 | (x % 0x1000) | CAN_EFF_FLAG;
+			frame[i].can_dlc = 8;
+			break;
+		default: /* SFF/EFF data and RTR frames */
+			frame[i].can_id = x & ((x & 1) ? CAN_EFF_MASK : CAN_SFF_MASK);
+			if (x & 1)
+				frame[i].can_id |= CAN_EFF_FLAG;
+			if (!(x % 5))
+				frame[i].can_id |= CAN_RTR_FLAG;
+			frame[i].can_dlc = (x >> 8) % 9;
+			break;
+		}
+		for (j = 0; j < frame[i].can_dlc; j++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			frame[i].data[j] = (set == 1 && j >= 2) ? 0 : x;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const char *setname[] = {
+		"SFF random DLC/data", "EFF mostly zero data", "mixed incl. RTR",
+	};
+	static const char *modename[] = { "estimate", "ignore (-i)", "exact (-e)" };
+	unsigned long long ref, sum;
+	unsigned int rounds = 500, k, r, mismatch;
+	int set, mode;
+	double t;
+
+	if (argc > 1)
+		rounds = strtoul(argv[1], NULL, 10);
+	if (!rounds)
+		rounds = 1;
+
+	init_exact();
+
+	for (set = 0; set < 3; set++) {
+		make_frames(set);
+
+		ref = 0;
+		mismatch = 0;
+		for (k = 0; k < NFRAMES; k++)
+			ref += reference_bits(&frame[k]);
+
+		printf("%s: reference %.2f bits/frame\n", setname[set],
+		       (double)ref / NFRAMES);
+
+		for (mode = 0; mode < 3; mode++) {
+			ignore_bitstuffing = (mode == 1);
+			exact_bitstuffing = (mode == 2);
+
+			sum = 0;
+			t = now();
+			for (r = 0; r < rounds; r++)
+				for (k = 0; k < NFRAMES; k++)
+					sum += frame_bits(&frame[k]);
+			t = now() - t;
+
+			if (exact_bitstuffing)
+				for (k = 0; k < NFRAMES; k++)
+					if (frame_bits(&frame[k]) != reference_bits(&frame[k]))
+						mismatch++;
+
+			printf("  %-12s %7.2f bits/frame %+6.1f%% %8.1f ns/frame",
+			       modename[mode], (double)sum / rounds / NFRAMES,
+			       100.0 * ((double)sum / rounds - ref) / ref,
+			       t * 1e9 / rounds / NFRAMES);
+			if (exact_bitstuffing)
+				printf("  %u mismatches", mismatch);
+			printf("\n");
+		}
+	}
+
+	return 0;
+}
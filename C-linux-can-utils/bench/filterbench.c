@@ -0,0 +1,284 @@
+/*
+ * filterbench.c - cost of compiled filter expressions and kernel filter sets
+ *
+ * Measures the frames/s of a compiled candump '-X' expression (an OR of
+ * N rules 'id == <id> && data[1] != 0') evaluated over batches of 32
+ * frames like in candump, for N = 1 .. 128.
+ *
+ * With -k <CAN interface> (e.g. a vcan) the kernel side CAN_RAW_FILTER cost
+ * is measured: a receiving socket gets N filters '<id>:7FF' for adjacent
+ * IDs - once as given and once reduced by cfx_minimize() - while a second
+ * socket sends frames with random SFF IDs as fast as possible.
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <time.h>
+
+#include <errno.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "canfilter.h"
+
+#define BATCH 32      /* frames per recvmmsg() in candump */
+#define NFRAMES 4096  /* different test frames */
+#define MAXRULES 128
+#define MAXKFILTER 512 /* filters per socket in the kernel bench */
+
+static struct can_frame frame[NFRAMES];
+static unsigned char res[NFRAMES];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_frames(void)
+{
+	unsigned int x = 2463534242U;
+	int i, j;
+
+	for (i = 0; i < NFRAMES; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		frame[i].can_id = 0x100 + x % (2 * MAXRULES);
+		frame[i].can_dlc = 8;
+		for (j = 0; j < 8; j++)
+			frame[i].data[j] = (x >> (j * 3)) & 1;
+	}
+}
+
+static void bench_expr(unsigned long nframes)
+{
+	static struct cfx_prog prog;
+	struct can_filter kf[CFX_MAXKF];
+	char expr[MAXRULES * 40];
+	unsigned long done, matched;
+	int rules, i, len, nkf;
+	double t;
+
+	printf("%6s %6s %8s %14s %10s\n", "rules", "insns", "kfilter",
+	       "frames/s", "accepted");
+
+	for (rules = 1; rules <= MAXRULES; rules *= 2) {
+		len = 0;
+		for (i = 0; i < rules; i++)
+			len += sprintf(expr + len, "%s(id == 0x%X && data[1] != 0)",
+				       (i) ? " || " : "", 0x100 + 2 * i);
+
+		if (cfx_compile(expr, &prog, kf, &nkf))
+			exit(1);
+
+		matched = 0;
+		t = now();
+		for (done = 0; done < nframes; done += BATCH)
+			matched += cfx_run(&prog, &frame[done % NFRAMES], BATCH, res);
+		t = now() - t;
+
+		printf("%6d %6d %8d %14.0f %9.1f%%\n", rules, prog.len, nkf,
+		       done / t, 100.0 * matched / done);
+	}
+}
+
+static int open_raw(int ifindex)
+{
+	struct sockaddr_can addr;
+	int s;
+
+	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	return s;
+}
+
+/* returns the number of frames sent per second */
+static double kernel_run(int ifindex, struct can_filter *filter, int nfilter,
+			 unsigned long nframes, unsigned long *received)
+{
+	struct can_frame rx;
+	unsigned long done, n = 0;
+	int tx, rs, i;
+	double t;
+
+	tx = open_raw(ifindex);
+	rs = open_raw(ifindex);
+
+	/* the sender does not receive anything */
+	setsockopt(tx, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+
+	if (setsockopt(rs, SOL_CAN_RAW, CAN_RAW_FILTER, filter,
+		       nfilter * sizeof(struct can_filter)) < 0) {
+		perror("setsockopt CAN_RAW_FILTER");
+		exit(1);
+	}
+
+	t = now();
+	for (done = 0; done < nframes; done += BATCH) {
+		for (i = 0; i < BATCH; i++) {
+			while (write(tx, &frame[(done + i) % NFRAMES],
+				     sizeof(struct can_frame)) < 0) {
+				if (errno != ENOBUFS) {
+					perror("write");
+					exit(1);
+				}
+				usleep(10); /* tx queue full */
+			}
+		}
+		while (recv(rs, &rx, sizeof(rx), MSG_DONTWAIT) > 0)
+			n++;
+	}
+	t = now() - t;
+
+	close(tx);
+	close(rs);
+
+	*received = n;
+	return done / t;
+}
+
+static void bench_kernel(const char *ifname, unsigned long nframes)
+{
+	static struct can_filter filter[MAXKFILTER], minimized[MAXKFILTER];
+	unsigned long rxa, rxb;
+	struct ifreq ifr;
+	double a, b;
+	int s, n, i, m;
+
+	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror("SIOCGIFINDEX");
+		exit(1);
+	}
+	close(s);
+
+	/* random SFF IDs over the whole range */
+	for (i = 0; i < NFRAMES; i++)
+		frame[i].can_id = (frame[i].can_id * 2654435761U >> 8) & CAN_SFF_MASK;
+
+	printf("\n%8s %14s %10s %9s %14s %10s\n", "filters", "frames/s", "received",
+	       "minimized", "frames/s", "received");
+
+	for (n = 1; n <= MAXKFILTER; n *= 2) {
+		for (i = 0; i < n; i++) {
+			filter[i].can_id = 0x100 + i;
+			filter[i].can_mask = CAN_SFF_MASK;
+		}
+		memcpy(minimized, filter, n * sizeof(struct can_filter));
+		m = cfx_minimize(minimized, n, 0);
+
+		a = kernel_run(ifr.ifr_ifindex, filter, n, nframes, &rxa);
+		b = kernel_run(ifr.ifr_ifindex, minimized, m, nframes, &rxb);
+
+		printf("%8d %14.0f %10lu %9d %14.0f %10lu\n", n, a, rxa, m, b, rxb);
+	}
+}
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "\nUsage: %s [options]\n", prg);
+	fprintf(stderr, "Options: -n <frames>  (frames per measurement. Default: 50000000)\n");
+	fprintf(stderr, "         -k <ifname>  (measure kernel filters on this CAN interface\n");
+	fprintf(stderr, "                       with -n frames per run. e.g. -n 1000000 -k vcan0)\n");
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long nframes = 50000000;
+	char *ifname = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:k:?")) != -1) {
+		switch (opt) {
+		case 'n':
+			nframes = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'k':
+			ifname = optarg;
+			break;
+
+		default:
+			print_usage(basename(argv[0]));
+			exit(1);
+		}
+	}
+
+	/* whole batches out of the test frame array */
+	nframes -= nframes % BATCH;
+	if (!nframes)
+		nframes = BATCH;
+
+	make_frames();
+	bench_expr(nframes);
+
+	if (ifname)
+		bench_kernel(ifname, nframes);
+
+	return 0;
+}
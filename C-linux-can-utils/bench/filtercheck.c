@@ -0,0 +1,184 @@
+/*
+ * filtercheck.c - cfx_minimize() / cfx_match_filterset() vs. kernel semantics
+ *
+ * Compares random CAN_RAW filter sets (OR and CAN_RAW_JOIN_FILTERS AND
+ * semantic, inverted filters, SFF only filters with ID bits above
+ * CAN_SFF_MASK) before and after cfx_minimize() against a model of the
+ * kernel filter reduction (can_rcv_list_find()) and match, and checks
+ * cfx_match_filterset() against the same model.
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "canfilter.h"
+
+#define RUNS 3000
+#define MAXFILTER 40
+
+/* can_rcv_list_find() and the receive path of net/can/af_can.c */
+static int kernel_match(const struct can_filter *f, canid_t can_id)
+{
+	canid_t id = f->can_id, mask = f->can_mask;
+	int inv = (id & CAN_INV_FILTER) ? 1 : 0;
+
+	if ((mask & CAN_EFF_FLAG) && !(id & CAN_EFF_FLAG))
+		mask &= (CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG);
+	id &= mask;
+
+	return ((can_id & mask) == id) ^ inv;
+}
+
+static int kernel_match_set(const struct can_filter *f, int n, int join,
+			    canid_t can_id)
+{
+	int i, m;
+
+	for (i = 0; i < n; i++) {
+		m = kernel_match(&f[i], can_id);
+		if (m != join)
+			return m;
+	}
+
+	return join;
+}
+
+static void random_filter(struct can_filter *f)
+{
+	f->can_id = 0x100 + rand() % 16;
+	f->can_mask = (rand() % 3) ? 0x7FF : (rand() % 2) ? 0x7F0 : 0x7FE;
+
+	if (!(rand() % 6))
+		f->can_mask |= CAN_EFF_FLAG;
+	if (!(rand() % 5))
+		f->can_mask |= CAN_EFF_FLAG |
+			((rand() % 2) ? 0x1FFFF800 : 0x00800000);
+	/* SFF only filters with ID bits above CAN_SFF_MASK */
+	if (!(rand() % 8))
+		f->can_id |= 0x00800000;
+	if (!(rand() % 10))
+		f->can_id |= CAN_INV_FILTER;
+	if (!(rand() % 10))
+		f->can_mask |= CAN_RTR_FLAG;
+	if (!(rand() % 30))
+		f->can_mask = 0;
+}
+
+/* SFF, EFF with the same low bits, EFF with bit 23 and remote frames */
+static canid_t test_id(unsigned int k)
+{
+	canid_t id = k & CAN_SFF_MASK;
+
+	switch ((k >> 11) & 3) {
+	case 1:
+		id |= CAN_EFF_FLAG;
+		break;
+	case 2:
+		id |= CAN_EFF_FLAG | 0x00800000;
+		break;
+	}
+
+	if (k & 0x2000)
+		id |= CAN_RTR_FLAG;
+
+	return id;
+}
+
+int main(int argc, char **argv)
+{
+	/* '12345:DFFFFFFF' matches SFF 0x345 in the kernel */
+	static struct can_filter sff = { 0x12345, 0xDFFFFFFF };
+	struct can_filter orig[MAXFILTER], f[MAXFILTER];
+	struct cfx_filterset fs;
+	unsigned long filters = 0, minimized = 0, errors = 0;
+	unsigned int run, k;
+	int n, m, join;
+
+	srand(getpid());
+
+	for (run = 0; run <= RUNS; run++) {
+		if (run == RUNS) {
+			/* the fixed case last */
+			n = 1;
+			join = 0;
+			orig[0] = sff;
+		} else {
+			n = 1 + rand() % MAXFILTER;
+			join = !(rand() % 4);
+			for (k = 0; k < (unsigned int)n; k++)
+				random_filter(&orig[k]);
+		}
+
+		memcpy(f, orig, n * sizeof(*f));
+		m = cfx_minimize(f, n, join);
+		filters += n;
+		minimized += m;
+
+		fs.filter = orig;
+		fs.nfilter = n;
+		fs.err_mask = 0;
+		fs.join = join;
+
+		for (k = 0; k < 0x4000; k++) {
+			canid_t id = test_id(k);
+			int want = kernel_match_set(orig, n, join, id);
+
+			if (kernel_match_set(f, m, join, id) != want ||
+			    cfx_match_filterset(&fs, id) != want) {
+				if (errors++ < 10)
+					printf("run %u: mismatch for can_id %X\n",
+					       run, id);
+			}
+		}
+	}
+
+	if (!kernel_match_set(&sff, 1, 0, 0x345))
+		errors++;
+
+	printf("%u runs, %lu filters minimized to %lu, %lu errors\n",
+	       RUNS + 1, filters, minimized, errors);
+
+	return (errors) ? 1 : 0;
+}
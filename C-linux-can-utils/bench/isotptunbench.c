@@ -0,0 +1,438 @@
+/*
+ * isotptunbench.c - iperf like goodput / RTT test of isotptun channels
+ *
+ * Runs isotptun.c with the tun device and the ISO-TP sockets replaced by
+ * AF_UNIX datagram sockets. Each ISO-TP socket gets a peer thread which
+ * plays the bus: a PDU takes one frame time per CAN frame (first frame,
+ * consecutive frames and one flow control frame) on a bus lock shared by
+ * all channels plus STmin between the consecutive frames, and is then
+ * looped back. Like a real ISO-TP socket only one PDU can be in flight.
+ *
+ * A generator writes FLOWS UDP flows into the tun side with a window of
+ * outstanding packets per flow and counts goodput, RTT and the packets
+ * that arrive out of order within a flow.
+ *
+ * The ISO-TP emulation sets /proc/sys/net/unix/max_dgram_qlen (root) and
+ * restores it at exit. Without delays (-f 0 -s 0) the packet rate of the
+ * event loop itself is measured.
+ *
+ * e.g. 4 channels at 500 kbit/s with 1 ms STmin
+ * isotptunbench -t 10 -- -s 100 -d 200 -c 101:201 -c 102:202 -c 103:203 can0
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FLOWS 8
+#define QLEN_FILE "/proc/sys/net/unix/max_dgram_qlen"
+
+static long frame_ns = 260000; /* 8 byte frame at 500 kbit/s */
+static long stmin_ns = 1000000;
+static pthread_mutex_t bus = PTHREAD_MUTEX_INITIALIZER;
+static int nsock;
+static int tunpeer;            /* the 'kernel' side of the tun device */
+static int qlen_saved = -1;
+
+/* unix datagram sockets bound to abstract addresses */
+struct link {
+	int s;
+	struct sockaddr_un addr;   /* isotptun side */
+};
+
+static void set_qlen(int qlen)
+{
+	FILE *f = fopen(QLEN_FILE, "w");
+
+	if (!f) {
+		perror(QLEN_FILE);
+		exit(1);
+	}
+	fprintf(f, "%d\n", qlen);
+	fclose(f);
+}
+
+static void restore_qlen(void)
+{
+	if (qlen_saved >= 0)
+		set_qlen(qlen_saved);
+}
+
+static void sleep_ns(long ns)
+{
+	struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+
+	if (ns)
+		nanosleep(&ts, NULL);
+}
+
+static struct sockaddr_un link_addr(char side, int n)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	/* abstract namespace: sun_path[0] = 0 */
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+		 "isotptunbench-%c%d.%d", side, n, getpid());
+
+	return addr;
+}
+
+/* the bus and the remote ISO-TP node of one channel */
+static void *link_thread(void *arg)
+{
+	struct link *l = arg;
+	static __thread unsigned char buf[5000];
+	int n, frames, i;
+
+	while (1) {
+		/* the PDU stays queued (and blocks the sender) until sent */
+		n = recv(l->s, buf, sizeof(buf), MSG_PEEK);
+		if (n <= 0)
+			return NULL;
+
+		/* SF or FF + CFs + one FC */
+		frames = (n <= 7) ? 1 : 2 + (n - 6 + 6) / 7;
+
+		for (i = 0; i < frames; i++) {
+			if (frame_ns) {
+				pthread_mutex_lock(&bus);
+				sleep_ns(frame_ns);
+				pthread_mutex_unlock(&bus);
+			}
+			if (i >= 2)
+				sleep_ns(stmin_ns);
+		}
+
+		recv(l->s, buf, sizeof(buf), 0);
+		sendto(l->s, buf, n, 0, (struct sockaddr *)&l->addr,
+		       sizeof(l->addr));
+	}
+}
+
+/*
+ * ISO-TP socket: a unix datagram socket connected to a peer which is not
+ * connected back. With max_dgram_qlen 0 the sender gets EAGAIN while the
+ * peer has not yet taken the PDU - one PDU in flight.
+ */
+static int fake_socket(int domain, int type, int protocol)
+{
+	struct sockaddr_un peer;
+	struct link *l;
+	pthread_t thread;
+	int s, n = nsock++;
+
+	set_qlen(0);
+
+	l = malloc(sizeof(*l));
+	if (!l)
+		return -1;
+
+	s = socket(AF_UNIX, SOCK_DGRAM, 0);
+	l->s = socket(AF_UNIX, SOCK_DGRAM, 0);
+	l->addr = link_addr('A', n);
+	peer = link_addr('B', n);
+
+	if (s < 0 || l->s < 0 ||
+	    bind(s, (struct sockaddr *)&l->addr, sizeof(l->addr)) < 0 ||
+	    bind(l->s, (struct sockaddr *)&peer, sizeof(peer)) < 0 ||
+	    connect(s, (struct sockaddr *)&peer, sizeof(peer)) < 0)
+		return -1;
+
+	pthread_create(&thread, NULL, link_thread, l);
+
+	return s;
+}
+
+static int fake_setsockopt(int s, int level, int opt, const void *val,
+			   socklen_t len)
+{
+	return 0;
+}
+
+static int fake_bind(int s, const struct sockaddr *addr, socklen_t len)
+{
+	return 0;
+}
+
+/* the tun device */
+static int fake_open(const char *path, int flags, ...)
+{
+	int sv[2];
+
+	set_qlen(1024);
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+		return -1;
+
+	fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+	tunpeer = sv[1];
+
+	return sv[0];
+}
+
+static int fake_ioctl(int fd, unsigned long req, ...)
+{
+	return 0;
+}
+
+#define socket fake_socket
+#define setsockopt fake_setsockopt
+#define bind fake_bind
+#define open fake_open
+#define ioctl fake_ioctl
+#define main isotptun_main
+#include "../isotptun.c"
+#undef main
+#undef socket
+#undef setsockopt
+#undef bind
+#undef open
+#undef ioctl
+
+static int window = 2;
+static int pktlen = 500;
+static volatile int stop;
+static volatile int outstanding[FLOWS];
+static unsigned long rxpkts, rxbytes, reordered, lost;
+static double rttsum, rttmax;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* UDP packets 10.0.0.1:<0x3000 + flow> -> 10.0.0.2:5001 */
+static void *gen_thread(void *arg)
+{
+	unsigned char pkt[4096];
+	unsigned int seq[FLOWS] = { 0 };
+	double stamp;
+	int flow, sent;
+
+	while (!stop) {
+		sent = 0;
+		for (flow = 0; flow < FLOWS; flow++) {
+			if (outstanding[flow] >= window)
+				continue;
+
+			memset(pkt, 0, pktlen);
+			pkt[0] = 0x45;
+			pkt[9] = 17;
+			pkt[12] = 10;
+			pkt[15] = 1;
+			pkt[16] = 10;
+			pkt[19] = 2;
+			pkt[20] = 0x30;
+			pkt[21] = flow;
+			pkt[22] = 0x13;
+			pkt[23] = 0x89;
+
+			seq[flow]++;
+			stamp = now();
+			memcpy(pkt + 28, &flow, sizeof(flow));
+			memcpy(pkt + 32, &seq[flow], sizeof(seq[flow]));
+			memcpy(pkt + 36, &stamp, sizeof(stamp));
+
+			__atomic_fetch_add(&outstanding[flow], 1, __ATOMIC_RELAXED);
+			send(tunpeer, pkt, pktlen, 0);
+			sent = 1;
+		}
+		if (!sent)
+			usleep(200);
+	}
+
+	return NULL;
+}
+
+static void *rcv_thread(void *arg)
+{
+	unsigned char pkt[4096];
+	unsigned int seq, lastseq[FLOWS] = { 0 };
+	double stamp, rtt;
+	int n, flow;
+
+	while (1) {
+		n = recv(tunpeer, pkt, sizeof(pkt), 0);
+		if (n <= 0)
+			return NULL;
+
+		memcpy(&flow, pkt + 28, sizeof(flow));
+		memcpy(&seq, pkt + 32, sizeof(seq));
+		memcpy(&stamp, pkt + 36, sizeof(stamp));
+		if (flow < 0 || flow >= FLOWS)
+			continue;
+
+		if (seq <= lastseq[flow])
+			reordered++;
+		else
+			lost += seq - lastseq[flow] - 1;
+		lastseq[flow] = seq;
+
+		rtt = now() - stamp;
+		rttsum += rtt;
+		if (rtt > rttmax)
+			rttmax = rtt;
+		rxpkts++;
+		rxbytes += n;
+		__atomic_fetch_sub(&outstanding[flow], 1, __ATOMIC_RELAXED);
+	}
+}
+
+struct tun_args {
+	int argc;
+	char **argv;
+};
+
+static void *tun_thread(void *arg)
+{
+	struct tun_args *ta = arg;
+
+	isotptun_main(ta->argc, ta->argv);
+
+	return NULL;
+}
+
+void print_bench_usage(char *prg)
+{
+	fprintf(stderr, "\nUsage: %s [options] -- <isotptun options> <CAN interface>\n", prg);
+	fprintf(stderr, "Options: -t <secs>  (duration. Default: 10)\n");
+	fprintf(stderr, "         -l <len>   (packet length. Default: 500)\n");
+	fprintf(stderr, "         -w <num>   (outstanding packets per flow. Default: 2)\n");
+	fprintf(stderr, "         -f <ns>    (CAN frame time. Default: 260000)\n");
+	fprintf(stderr, "         -s <ns>    (STmin. Default: 1000000)\n");
+	fprintf(stderr, "\n%d UDP flows are sent. Needs write access to %s\n\n",
+		FLOWS, QLEN_FILE);
+}
+
+int main(int argc, char **argv)
+{
+	struct tun_args ta;
+	pthread_t tun, gen, rcv;
+	double start, secs;
+	int opt, duration = 10;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "t:l:w:f:s:?")) != -1) {
+		switch (opt) {
+		case 't':
+			duration = atoi(optarg);
+			break;
+
+		case 'l':
+			pktlen = atoi(optarg);
+			break;
+
+		case 'w':
+			window = atoi(optarg);
+			break;
+
+		case 'f':
+			frame_ns = atol(optarg);
+			break;
+
+		case 's':
+			stmin_ns = atol(optarg);
+			break;
+
+		default:
+			print_bench_usage(basename(argv[0]));
+			exit(1);
+		}
+	}
+
+	if (optind == argc || duration <= 0 || window <= 0 ||
+	    pktlen < 44 || pktlen > 4095) {
+		print_bench_usage(basename(argv[0]));
+		exit(1);
+	}
+
+	f = fopen(QLEN_FILE, "r");
+	if (!f || fscanf(f, "%d", &qlen_saved) != 1) {
+		perror(QLEN_FILE);
+		exit(1);
+	}
+	fclose(f);
+	atexit(restore_qlen);
+
+	/* isotptun gets the arguments behind '--' */
+	ta.argc = argc - optind + 1;
+	ta.argv = &argv[optind - 1];
+	ta.argv[0] = "isotptun";
+	optind = 1;
+
+	pthread_create(&tun, NULL, tun_thread, &ta);
+	usleep(100000);
+
+	pthread_create(&rcv, NULL, rcv_thread, NULL);
+	pthread_create(&gen, NULL, gen_thread, NULL);
+
+	start = now();
+	sleep(duration);
+	stop = 1;
+	secs = now() - start;
+
+	pthread_kill(tun, SIGTERM);
+	pthread_join(tun, NULL);
+
+	printf("%d channels: %lu packets %.0f bytes/s (%.1f packets/s) "
+	       "RTT avg %.1f ms max %.1f ms, reordered %lu lost %lu\n",
+	       channels, rxpkts, rxbytes / secs, rxpkts / secs,
+	       (rxpkts) ? rttsum / rxpkts * 1e3 : 0, rttmax * 1e3,
+	       reordered, lost);
+
+	return 0;
+}
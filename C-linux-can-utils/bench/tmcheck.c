@@ -0,0 +1,136 @@
+/*
+ * tmcheck.c - round trip check of the traffic model file format
+ *
+ * Writes random traffic models (SFF/EFF, data and remote frames) with
+ * tm_write() and reads them back with tm_read(). Every CAN ID entry has
+ * to come back unchanged.
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trafficmodel.h"
+
+#define RUNS 100
+#define MAXIDS 512
+
+static void random_id(struct tm_id *t)
+{
+	unsigned int i;
+
+	memset(t, 0, sizeof(*t));
+
+	if (rand() & 1)
+		t->can_id = (rand() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	else
+		t->can_id = rand() & CAN_SFF_MASK;
+
+	if (!(rand() & 3))
+		t->can_id |= CAN_RTR_FLAG;
+
+	t->dlc = rand() % 9;
+	t->frames = rand();
+
+	for (i = 0; i < 8; i++) {
+		t->data[i] = rand();
+		t->change[i] = rand() % 1001;
+	}
+
+	for (i = 0; i < TM_QUANTILES; i++)
+		t->period[i] = ((i) ? t->period[i - 1] : 0) + rand() % 100000;
+}
+
+int main(int argc, char **argv)
+{
+	static struct tm_id id[MAXIDS];
+	struct trafficmodel tm, rd;
+	unsigned int run, i, errors = 0;
+	unsigned long ids = 0;
+	FILE *f;
+
+	srand(getpid());
+
+	for (run = 0; run < RUNS; run++) {
+		tm.id = id;
+		tm.ids = rand() % MAXIDS;
+
+		for (i = 0; i < tm.ids; i++)
+			random_id(&id[i]);
+
+		f = tmpfile();
+		if (!f) {
+			perror("tmpfile");
+			return 1;
+		}
+
+		tm_write(f, &tm);
+		rewind(f);
+
+		if (tm_read(f, &rd))
+			return 1;
+		fclose(f);
+
+		if (rd.ids != tm.ids) {
+			printf("run %u: wrote %u CAN IDs, read %u\n",
+			       run, tm.ids, rd.ids);
+			errors++;
+		}
+
+		for (i = 0; i < tm.ids && i < rd.ids; i++) {
+			if (memcmp(&id[i], &rd.id[i], sizeof(id[i]))) {
+				printf("run %u: CAN ID %X read back as %X\n",
+				       run, id[i].can_id, rd.id[i].can_id);
+				errors++;
+			}
+		}
+
+		ids += tm.ids;
+		tm_free(&rd);
+	}
+
+	printf("%u runs, %lu CAN IDs, %u errors\n", RUNS, ids, errors);
+
+	return (errors) ? 1 : 0;
+}
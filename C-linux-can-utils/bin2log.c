@@ -0,0 +1,157 @@
+/*
+ * bin2log.c - convert binary log format to compact CAN frame logfile
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "lib.h"
+#include "binlog.h"
+
+extern int optind, opterr, optopt;
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prg);
+	fprintf(stderr, "Options: -I <infile>  (default stdin)\n");
+	fprintf(stderr, "         -O <outfile> (default stdout)\n");
+	fprintf(stderr, "         -N           (nanosecond timestamps - default microseconds)\n");
+	fprintf(stderr, "         -v           (print read statistics on stderr)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct binlog_reader br;
+	static struct binlog_rec rec;
+	char ascframe[sizeof("12345678#0011223344556677")];
+	struct timespec start, end;
+	FILE *infile = stdin;
+	FILE *outfile = stdout;
+	unsigned long frames = 0;
+	int tsdigits = 6;
+	int verbose = 0;
+	int opt, ret;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "I:O:Nv?")) != -1) {
+		switch (opt) {
+		case 'I':
+			infile = fopen(optarg, "r");
+			if (!infile) {
+				perror("infile");
+				return 1;
+			}
+			break;
+
+		case 'O':
+			outfile = fopen(optarg, "w");
+			if (!outfile) {
+				perror("outfile");
+				return 1;
+			}
+			break;
+
+		case 'N':
+			tsdigits = 9;
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		case '?':
+			print_usage(basename(argv[0]));
+			return 0;
+			break;
+
+		default:
+			fprintf(stderr, "Unknown option %c\n", opt);
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	if (binlog_open(&br, infile)) {
+		fprintf(stderr, "no binary CAN log file format\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((ret = binlog_read(&br, &rec)) > 0) {
+
+		if (ret == BINLOG_REC_TEXT) {
+			fprintf(outfile, "%s\n", rec.text);
+			continue;
+		}
+
+		sprint_canframe(ascframe, &rec.frame, 0);
+		fprintf(outfile, "(%ld.%0*ld) %s %s\n", rec.ts.tv_sec, tsdigits,
+			(tsdigits == 9) ? rec.ts.tv_nsec : rec.ts.tv_nsec / 1000,
+			rec.ifname, ascframe);
+		frames++;
+	}
+
+	fflush(outfile);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	binlog_close(&br);
+
+	if (ret < 0) {
+		fprintf(stderr, "corrupt binary log file\n");
+		return 1;
+	}
+
+	if (verbose) {
+		secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "%lu frames in %.3fs (%.0f frames/s)\n",
+			frames, secs, (secs > 0) ? frames / secs : 0.0);
+	}
+
+	return 0;
+}
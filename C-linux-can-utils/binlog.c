@@ -0,0 +1,383 @@
+/*
+ * binlog.c - compact binary CAN log file format
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "binlog.h"
+
+#define STREAMBUFSZ 65536 /* read buffer for non-seekable input */
+#define MAXRECSZ    (2 + BINLOG_MAXTEXT) /* longest record (TEXT) */
+#define FRAMESZ     16
+
+static const unsigned char magic[8] = {0x89, 'C', 'B', 'L', '\r', '\n', 0x1A, '\n'};
+
+static inline void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t ts2ns(struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+int binlog_header(unsigned char *buf)
+{
+	memset(buf, 0, BINLOG_HDRSZ);
+	memcpy(buf, magic, sizeof(magic));
+	buf[sizeof(magic)] = BINLOG_VERSION;
+
+	return BINLOG_HDRSZ;
+}
+
+int binlog_is_binary(FILE *f)
+{
+	int c = getc(f);
+
+	if (c == EOF)
+		return 0;
+
+	ungetc(c, f);
+
+	return c == magic[0];
+}
+
+/* --- writer --- */
+
+void binlog_writer_init(struct binlog_writer *bw, FILE *f)
+{
+	memset(bw, 0, sizeof(*bw));
+	bw->file = f;
+}
+
+static int iface_rec(struct binlog_writer *bw, int dev, unsigned char *p)
+{
+	int len = strlen(bw->ifname[dev]);
+
+	p[0] = BINLOG_TAG_IFACE;
+	p[1] = dev;
+	p[2] = len;
+	memcpy(p + 3, bw->ifname[dev], len);
+
+	return len + 3;
+}
+
+static int find_dev(struct binlog_writer *bw, const char *ifname, int *added)
+{
+	int i;
+
+	for (i = 0; i < bw->ndev; i++)
+		if (!strcmp(bw->ifname[i], ifname))
+			return i;
+
+	if (bw->ndev == BINLOG_MAXDEV || strlen(ifname) >= IFNAMSIZ)
+		return -1;
+
+	strcpy(bw->ifname[i], ifname);
+	bw->ndev++;
+	*added = 1;
+
+	return i;
+}
+
+int binlog_write_frame(struct binlog_writer *bw, struct timespec *ts,
+		       const char *ifname, struct can_frame *cf)
+{
+	unsigned char rec[9 + BINLOG_MAXDEV * (3 + IFNAMSIZ)];
+	uint64_t ns = ts2ns(ts);
+	uint64_t delta;
+	int dev, i, n = 0, added = 0;
+
+	dev = find_dev(bw, ifname, &added);
+	if (dev < 0)
+		return -1;
+
+	if (!bw->block || ns < bw->last_ns || bw->block >= BINLOG_BLOCK) {
+		/* new block: absolute time + complete interface dictionary */
+		rec[n++] = BINLOG_TAG_SYNC;
+		for (i = 0; i < 8; i++)
+			rec[n++] = ns >> (8 * i);
+		for (i = 0; i < bw->ndev; i++)
+			n += iface_rec(bw, i, rec + n);
+		bw->last_ns = ns;
+		bw->block = 0;
+	} else if (added)
+		n += iface_rec(bw, dev, rec + n);
+
+	if (n && fwrite(rec, 1, n, bw->file) != n)
+		return -1;
+
+	delta = ns - bw->last_ns;
+	bw->last_ns = ns;
+	bw->block++;
+
+	i = 0;
+	rec[i++] = BINLOG_TAG_FRAME | dev;
+	while (delta >= 0x80) {
+		rec[i++] = (delta & 0x7F) | 0x80;
+		delta >>= 7;
+	}
+	rec[i++] = delta;
+
+	put_le32(rec + i, cf->can_id);
+	rec[i + 4] = cf->can_dlc;
+	rec[i + 5] = rec[i + 6] = rec[i + 7] = 0;
+	memcpy(rec + i + 8, cf->data, 8);
+	i += FRAMESZ;
+
+	if (fwrite(rec, 1, i, bw->file) != i)
+		return -1;
+
+	return n + i;
+}
+
+int binlog_write_text(struct binlog_writer *bw, const char *text)
+{
+	unsigned char rec[MAXRECSZ];
+	int len = strlen(text);
+
+	if (len && text[len - 1] == '\n')
+		len--;
+	if (len > BINLOG_MAXTEXT)
+		len = BINLOG_MAXTEXT;
+
+	rec[0] = BINLOG_TAG_TEXT;
+	rec[1] = len;
+	memcpy(rec + 2, text, len);
+
+	if (fwrite(rec, 1, len + 2, bw->file) != len + 2)
+		return -1;
+
+	return len + 2;
+}
+
+/* --- reader --- */
+
+static int fill(struct binlog_reader *br, size_t need)
+{
+	size_t n;
+
+	if (br->len - br->pos >= need || br->mapped || br->eof)
+		return br->len - br->pos >= need;
+
+	memmove(br->buf, br->buf + br->pos, br->len - br->pos);
+	br->base += br->pos;
+	br->len -= br->pos;
+	br->pos = 0;
+
+	while (br->len < STREAMBUFSZ && !br->eof) {
+		n = fread(br->buf + br->len, 1, STREAMBUFSZ - br->len, br->file);
+		if (!n)
+			br->eof = 1;
+		br->len += n;
+	}
+
+	return br->len - br->pos >= need;
+}
+
+int binlog_open(struct binlog_reader *br, FILE *f)
+{
+	struct stat st;
+	void *map;
+
+	memset(br, 0, sizeof(*br));
+	br->file = f;
+
+	if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode) &&
+	    st.st_size >= BINLOG_HDRSZ && ftello(f) == 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			br->buf = map;
+			br->len = st.st_size;
+			br->mapped = 1;
+		}
+	}
+
+	if (!br->mapped) {
+		br->buf = malloc(STREAMBUFSZ);
+		if (!br->buf)
+			return -1;
+	}
+
+	if (!fill(br, BINLOG_HDRSZ) ||
+	    memcmp(br->buf, magic, sizeof(magic)) ||
+	    br->buf[sizeof(magic)] != BINLOG_VERSION) {
+		binlog_close(br);
+		return -1;
+	}
+
+	br->pos = BINLOG_HDRSZ;
+
+	return 0;
+}
+
+int binlog_read(struct binlog_reader *br, struct binlog_rec *rec)
+{
+	unsigned char *p;
+	uint64_t delta;
+	size_t avail;
+	int tag, i, shift;
+
+	while (1) {
+
+		fill(br, MAXRECSZ);
+		avail = br->len - br->pos;
+		if (!avail)
+			return 0;
+
+		p = br->buf + br->pos;
+		tag = p[0];
+		rec->offset = br->base + br->pos;
+
+		if (tag & BINLOG_TAG_FRAME) {
+
+			delta = 0;
+			for (i = 1, shift = 0; i < avail && i < 11; i++, shift += 7) {
+				delta |= (uint64_t)(p[i] & 0x7F) << shift;
+				if (!(p[i] & 0x80))
+					break;
+			}
+			if (i >= avail || i == 11)
+				return -1;
+			i++;
+			if (i + FRAMESZ > avail || !br->ifname[tag & 0x7F][0] ||
+			    p[i + 4] > 8)
+				return -1;
+
+			br->ts_ns += delta;
+			rec->type = BINLOG_REC_FRAME;
+			rec->ts.tv_sec = br->ts_ns / 1000000000ULL;
+			rec->ts.tv_nsec = br->ts_ns % 1000000000ULL;
+			rec->ifname = br->ifname[tag & 0x7F];
+			rec->frame.can_id = get_le32(p + i);
+			rec->frame.can_dlc = p[i + 4];
+			memcpy(rec->frame.data, p + i + 8, 8);
+			br->pos += i + FRAMESZ;
+
+			return BINLOG_REC_FRAME;
+		}
+
+		switch (tag) {
+
+		case BINLOG_TAG_IFACE:
+			if (avail < 3 || avail < 3 + p[2] ||
+			    p[1] >= BINLOG_MAXDEV || p[2] >= IFNAMSIZ)
+				return -1;
+			memcpy(br->ifname[p[1]], p + 3, p[2]);
+			br->ifname[p[1]][p[2]] = 0;
+			br->pos += 3 + p[2];
+			break;
+
+		case BINLOG_TAG_SYNC:
+			if (avail < 9)
+				return -1;
+			br->sync = rec->offset;
+			br->ts_ns = 0;
+			for (i = 0; i < 8; i++)
+				br->ts_ns |= (uint64_t)p[1 + i] << (8 * i);
+			br->pos += 9;
+			break;
+
+		case BINLOG_TAG_TEXT:
+			if (avail < 2 || avail < 2 + p[1])
+				return -1;
+			rec->type = BINLOG_REC_TEXT;
+			rec->ts.tv_sec = br->ts_ns / 1000000000ULL;
+			rec->ts.tv_nsec = br->ts_ns % 1000000000ULL;
+			rec->ifname = NULL;
+			memcpy(rec->text, p + 2, p[1]);
+			rec->text[p[1]] = 0;
+			br->pos += 2 + p[1];
+			return BINLOG_REC_TEXT;
+
+		default:
+			return -1;
+		}
+	}
+}
+
+int binlog_seek(struct binlog_reader *br, off_t offset)
+{
+	if (br->mapped) {
+		if (offset < BINLOG_HDRSZ || offset > br->len)
+			return -1;
+		br->pos = offset;
+		return 0;
+	}
+
+	if (fseeko(br->file, offset, SEEK_SET))
+		return -1;
+
+	br->base = offset;
+	br->len = br->pos = 0;
+	br->eof = 0;
+
+	return 0;
+}
+
+void binlog_close(struct binlog_reader *br)
+{
+	if (br->mapped)
+		munmap(br->buf, br->len);
+	else
+		free(br->buf);
+
+	br->buf = NULL;
+	br->len = br->pos = 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * binlog.h - compact binary CAN log file format
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+/*
+ * File layout (all multi-byte values little endian):
+ *
+ * header  : 8 bytes magic "\x89CBL\r\n\x1a\n", 1 byte version, 7 bytes 0
+ *
+ * records : 0x01 IFACE  <dev> <len> <name[len]>
+ *           0x02 SYNC   <u64 absolute timestamp in ns>
+ *           0x03 TEXT   <len> <text[len]>  (e.g. candump DROPCOUNT lines)
+ *           0x80|dev    <varint delta ns> <16 byte CAN frame>
+ *
+ * The 16 byte CAN frame is the struct can_frame layout: u32 can_id,
+ * u8 can_dlc, 3 bytes padding, 8 bytes data.
+ * Frame timestamps are coded as LEB128 varint delta to the previous
+ * record timestamp. A SYNC record with the absolute time starts every
+ * block of BINLOG_BLOCK frames and is followed by the complete interface
+ * dictionary, so reading can start at any SYNC record offset.
+ * A typical frame record needs ~20 bytes instead of ~40 bytes in the
+ * ASCII log format.
+ */
+
+#define BINLOG_VERSION 1
+#define BINLOG_HDRSZ 16
+#define BINLOG_MAXDEV 128  /* device numbers 0..127 in the frame tag */
+#define BINLOG_BLOCK 1024  /* frames between SYNC records */
+#define BINLOG_MAXTEXT 255
+
+#define BINLOG_TAG_IFACE 0x01
+#define BINLOG_TAG_SYNC  0x02
+#define BINLOG_TAG_TEXT  0x03
+#define BINLOG_TAG_FRAME 0x80
+
+#define BINLOG_REC_FRAME 1
+#define BINLOG_REC_TEXT  2
+
+struct binlog_writer {
+	FILE *file;
+	int ndev;
+	char ifname[BINLOG_MAXDEV][IFNAMSIZ];
+	uint64_t last_ns;
+	unsigned int block;             /* frames since the last SYNC */
+};
+
+struct binlog_rec {
+	int type;                       /* BINLOG_REC_FRAME / BINLOG_REC_TEXT */
+	off_t offset;                   /* file offset of the record */
+	struct timespec ts;
+	const char *ifname;
+	struct can_frame frame;
+	char text[BINLOG_MAXTEXT + 1];
+};
+
+struct binlog_reader {
+	FILE *file;
+	int mapped;                     /* buf is the mmap()ed file */
+	unsigned char *buf;
+	size_t len;                     /* valid bytes in buf */
+	size_t pos;                     /* read position in buf */
+	off_t base;                     /* file offset of buf[0] */
+	int eof;
+	off_t sync;                     /* file offset of the last SYNC */
+	char ifname[BINLOG_MAXDEV][IFNAMSIZ];
+	uint64_t ts_ns;
+};
+
+int binlog_header(unsigned char *buf);
+/*
+ * Writes the BINLOG_HDRSZ bytes file header into buf.
+ * Returns BINLOG_HDRSZ.
+ */
+
+int binlog_is_binary(FILE *f);
+/*
+ * Checks (without consuming input) whether the stream starts with the
+ * binary log file magic. Returns 1 for binary logs, 0 otherwise.
+ */
+
+void binlog_writer_init(struct binlog_writer *bw, FILE *f);
+/*
+ * Initializes the writer state for the stream f. The file header has to
+ * be written separately (see binlog_header()).
+ */
+
+int binlog_write_frame(struct binlog_writer *bw, struct timespec *ts,
+		       const char *ifname, struct can_frame *cf);
+/*
+ * Appends a CAN frame record received on interface 'ifname' at time ts.
+ * Returns the number of bytes written or -1 on error.
+ */
+
+int binlog_write_text(struct binlog_writer *bw, const char *text);
+/*
+ * Appends a text record (up to BINLOG_MAXTEXT chars, a trailing newline
+ * is stripped). Returns the number of bytes written or -1 on error.
+ */
+
+int binlog_open(struct binlog_reader *br, FILE *f);
+/*
+ * Opens a binary log for reading. Regular files are mmap()ed, other
+ * streams (e.g. stdin) are read through an internal buffer.
+ * The stream has to be positioned at the file header.
+ * Returns 0 on success, -1 on error (bad magic/version or I/O error).
+ */
+
+int binlog_read(struct binlog_reader *br, struct binlog_rec *rec);
+/*
+ * Reads the next frame or text record.
+ * Returns BINLOG_REC_FRAME or BINLOG_REC_TEXT, 0 at end of file and
+ * -1 on corrupt input.
+ */
+
+int binlog_seek(struct binlog_reader *br, off_t offset);
+/*
+ * Continues reading at file offset 'offset', which has to point to a SYNC
+ * record (or directly behind the file header).
+ * Returns 0 on success, -1 on error.
+ */
+
+void binlog_close(struct binlog_reader *br);
+/*
+ * Releases the reader resources. The stream itself is not closed.
+ */
+
+#endif
@@ -45,6 +45,8 @@
  *
  */
 
+#define _GNU_SOURCE /* recvmmsg() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -53,34 +55,71 @@
 #include <ctype.h>
 #include <libgen.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/timerfd.h>
 #include <net/if.h>
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
 #include "terminal.h"
+#include "metrics.h"
 
 #define MAXSOCK 16    /* max. number of CAN interfaces given on the cmdline */
+#define MAXBATCH 32   /* max. number of CAN frames fetched with one recvmmsg() */
 
 #define PERCENTRES 5 /* resolution in percent for bargraph */
 #define NUMBAR (100/PERCENTRES) /* number of bargraph elements */
 
+#define PERIOD_MS 1000 /* output period */
+#define MINWINDOW 10   /* min. load window in ms */
+#define HISTSIZE 2001  /* window load histogram 0 .. 200.0% in permille */
+#define IDTAB 4096     /* per interface CAN-ID table (power of 2) */
+#define MAXTOP 32      /* max. number of top talkers per interface */
+
+#define CRC15POLY 0x4599 /* CAN CRC x^15+x^14+x^10+x^8+x^7+x^4+x^3+1 */
+#define UNSTUFFED 13     /* CRC delimiter, ACK slot/delimiter, EOF, IFS */
+
 extern int optind, opterr, optopt;
 
+struct idstat {
+	canid_t id;
+	unsigned int frames; /* 0 = unused entry */
+	unsigned int bits_total;
+	unsigned int bits_payload;
+};
+
 static struct {
 	char devname[IFNAMSIZ+1];
 	unsigned int bitrate;
 	unsigned int recv_frames;
 	unsigned int recv_bits_total;
 	unsigned int recv_bits_payload;
+	unsigned int window_bits;     /* bits in the current load window */
+	unsigned int peak;            /* max. window load in permille */
+	unsigned int hist[HISTSIZE];  /* window loads of the current period */
+	struct idstat *ids;           /* per CAN-ID load (with -n) */
+	struct idstat other;          /* CAN-IDs not fitting into ids[] */
+	struct metric *m_frames;      /* exported with -M - NULL when disabled */
+	struct metric *m_bits;
+	struct metric *m_payload;
+	struct metric *m_load;
+	struct metric *m_windows;
+	struct metric *m_batch;
 } stat[MAXSOCK+1];
 
+static const unsigned long long loadbounds[] = {
+	100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1200, 1500, 2000
+};
+static const unsigned long long batchbounds[] = { 1, 2, 4, 8, 16, MAXBATCH };
+
 static int  max_devname_len; /* to prevent frazzled device name output */ 
 static int  max_bitrate_len;
 static int  currmax;
@@ -89,6 +128,13 @@ static unsigned char timestamp;
 static unsigned char color;
 static unsigned char bargraph;
 static unsigned char ignore_bitstuffing;
+static unsigned char exact_bitstuffing;
+static unsigned short crc15tab[256];
+static unsigned char stufftab[16][256]; /* (stuff bits << 4) | new state */
+static unsigned int window = PERIOD_MS; /* load window in ms */
+static unsigned int windows;            /* elapsed windows in this period */
+static unsigned int percentile = 99;
+static int topn;
 static char *prg;
 
 void print_usage(char *prg)
@@ -100,14 +146,26 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -b (show bargraph in %d%% resolution)\n", PERCENTRES);
 	fprintf(stderr, "         -r (redraw the terminal - similar to top)\n");
 	fprintf(stderr, "         -i (ignore bitstuffing estimation in bandwith calculation)\n");
+	fprintf(stderr, "         -e (exact bitstuffing calculation from the frame content incl. CRC. Not with -i)\n");
+	fprintf(stderr, "         -w <ms> (load window in ms - a divider of %d, min. %d. Default: %d)\n",
+		PERIOD_MS, MINWINDOW, PERIOD_MS);
+	fprintf(stderr, "         -p <n>  (show the n-th percentile of the window loads. Default: 99)\n");
+	fprintf(stderr, "         -n <n>  (show the n CAN-IDs with the highest load - max. %d)\n", MAXTOP);
+	fprintf(stderr, "         -M <addr> (export metrics in Prometheus format on unix:<path> or [<host>:]<port>)\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Up to %d CAN interfaces with mandatory bitrate can be specified on the \n", MAXSOCK);
 	fprintf(stderr, "commandline in the form: <ifname>@<bitrate>\n\n");
 	fprintf(stderr, "The bitrate is mandatory as it is needed to know the CAN bus bitrate to\n");
 	fprintf(stderr, "calcultate the bus load percentage based on the received CAN frames.\n");
 	fprintf(stderr, "Due to the bitstuffing estimation the calculated busload may exceed 100%%.\n");
+	fprintf(stderr, "The worst case estimation can be replaced by the stuff bits actually\n");
+	fprintf(stderr, "inserted on the wire with -e (exact calculation - more CPU load).\n");
 	fprintf(stderr, "For each given interface the data is presented in one line which contains:\n\n");
 	fprintf(stderr, "(interface) (received CAN frames) (used bits total) (used bits for payload)\n");
+	fprintf(stderr, "\nWith a load window shorter than %dms the peak and the percentile of the\n", PERIOD_MS);
+	fprintf(stderr, "window loads within the last %dms are appended to the line.\n", PERIOD_MS);
+	fprintf(stderr, "With -n the top talkers follow the interface line as (CAN-ID) (frames)\n");
+	fprintf(stderr, "(used bits total) (used bits for payload) (load contribution).\n");
 	fprintf(stderr, "\nExample:\n");
 	fprintf(stderr, "\nuser$> canbusload can0@100000 can1@500000 can2@500000 can3@500000 -r -t -b -c\n\n");
 	fprintf(stderr, "%s 2008-05-27 15:18:49\n", prg);
@@ -123,7 +181,278 @@ void sigterm(int signo)
 	exit(0);
 }
 
-void printstats(int signo)
+/*
+ * Bit stuffing state: (value of the last bit << 3) | number of equal bits
+ * in a row (0 = start of frame). Returns 1 when a stuff bit is inserted.
+ */
+static int stuff_step(int *state, int bit)
+{
+	int last = *state >> 3;
+	int run = *state & 7;
+
+	if (run && bit == last)
+		run++;
+	else {
+		last = bit;
+		run = 1;
+	}
+
+	if (run == 5) {
+		/* complementary stuff bit starts the next sequence */
+		*state = (!last << 3) | 1;
+		return 1;
+	}
+
+	*state = (last << 3) | run;
+	return 0;
+}
+
+static unsigned int crc15_bits(unsigned int crc, unsigned int val, int n)
+{
+	while (n--) {
+		if (((val >> n) ^ (crc >> 14)) & 1)
+			crc = (crc << 1) ^ CRC15POLY;
+		else
+			crc <<= 1;
+	}
+
+	return crc & 0x7FFF;
+}
+
+static void init_exact(void)
+{
+	int i, j, state, stuffed;
+
+	for (i = 0; i < 256; i++)
+		crc15tab[i] = crc15_bits(i << 7, 0, 8);
+
+	for (state = 0; state < 16; state++) {
+		if ((state & 7) > 4)
+			continue; /* not reached */
+		for (i = 0; i < 256; i++) {
+			int s = state;
+
+			stuffed = 0;
+			for (j = 7; j >= 0; j--)
+				stuffed += stuff_step(&s, (i >> j) & 1);
+			stufftab[state][i] = (stuffed << 4) | s;
+		}
+	}
+}
+
+static void putbits(unsigned char *buf, unsigned int *pos,
+		    unsigned int val, int n)
+{
+	/* n <= 24 - writes up to 4 bytes starting at the current byte */
+	unsigned char *p = &buf[*pos >> 3];
+	unsigned int v = (val & ((1U << n) - 1)) << (32 - n - (*pos & 7));
+
+	p[0] |= v >> 24;
+	p[1] |= v >> 16;
+	p[2] |= v >> 8;
+	p[3] |= v;
+	*pos += n;
+}
+
+static unsigned int frame_bits_exact(struct can_frame *cf)
+{
+	unsigned char buf[16 + 3] = {0}; /* SOF .. CRC - max. 118 bits */
+	unsigned int pos = 0;
+	unsigned int crc = 0;
+	unsigned int i;
+	int dlc = (cf->can_dlc > 8) ? 8 : cf->can_dlc;
+	int rtr = !!(cf->can_id & CAN_RTR_FLAG);
+	int ndata = (rtr) ? 0 : dlc;
+	int state = 0;
+	int stuffed = 0;
+
+	/* SOF, arbitration and control field */
+	if (cf->can_id & CAN_EFF_FLAG) {
+		putbits(buf, &pos, (cf->can_id & CAN_EFF_MASK) >> 18, 1 + 11);
+		putbits(buf, &pos, 3, 2); /* SRR, IDE */
+		putbits(buf, &pos, cf->can_id & 0x3FFFF, 18);
+		putbits(buf, &pos, (rtr << 6) | dlc, 1 + 2 + 4); /* r1, r0 */
+	} else {
+		putbits(buf, &pos, cf->can_id & CAN_SFF_MASK, 1 + 11);
+		putbits(buf, &pos, (rtr << 6) | dlc, 1 + 2 + 4); /* IDE, r0 */
+	}
+
+	for (i = 0; i < ndata; i++)
+		putbits(buf, &pos, cf->data[i], 8);
+
+	/* CRC bytewise - the remaining bits one by one */
+	for (i = 0; i < pos / 8; i++)
+		crc = ((crc << 8) ^ crc15tab[((crc >> 7) ^ buf[i]) & 0xFF]) & 0x7FFF;
+	crc = crc15_bits(crc, buf[i] >> (8 - (pos & 7)), pos & 7);
+
+	putbits(buf, &pos, crc, 15);
+
+	/* same for the stuff bits */
+	for (i = 0; i < pos / 8; i++) {
+		stuffed += stufftab[state][buf[i]] >> 4;
+		state = stufftab[state][buf[i]] & 0xF;
+	}
+	for (i = pos & ~7; i < pos; i++)
+		stuffed += stuff_step(&state, (buf[i >> 3] >> (7 - (i & 7))) & 1);
+
+	return pos + stuffed + UNSTUFFED;
+}
+
+static unsigned int frame_bits(struct can_frame *cf)
+{
+	if (exact_bitstuffing)
+		return frame_bits_exact(cf);
+
+	/*
+	 * Following Ken Tindells *worst* case calculation for stuff-bits
+	 * (see "Guaranteeing Message Latencies on Controller Area Network" 1st ICC'94)
+	 * the needed bits on the wire can be calculated as:
+	 *
+	 * (34 + 8n)/5 + 47 + 8n for SFF frames (11 bit CAN-ID) => (269 + 48n)/5 
+	 * (54 + 8n)/5 + 67 + 8n for EFF frames (29 bit CAN-ID) => (389 + 48n)/5 
+	 *
+	 * while 'n' is the data length code (number of payload bytes)
+	 *
+	 */
+
+	if (ignore_bitstuffing) {
+		/* calculation without bitstuffing */
+		if (cf->can_id & CAN_EFF_FLAG)
+			return 67 + cf->can_dlc*8;
+		else
+			return 47 + cf->can_dlc*8;
+	}
+
+	/* needed bits including estimated worst case stuff bits */
+	if (cf->can_id & CAN_EFF_FLAG)
+		return (389 + cf->can_dlc*48)/5;
+	else
+		return (269 + cf->can_dlc*48)/5;
+}
+
+static struct idstat *idstat_get(int i, canid_t id)
+{
+	unsigned int h = (id * 0x9E3779B1U) >> 20; /* 12 bit for IDTAB */
+	int n;
+
+	for (n = 0; n < IDTAB; n++, h = (h + 1) & (IDTAB - 1)) {
+		if (!stat[i].ids[h].frames) {
+			stat[i].ids[h].id = id;
+			return &stat[i].ids[h];
+		}
+		if (stat[i].ids[h].id == id)
+			return &stat[i].ids[h];
+		if (n == IDTAB / 2)
+			break; /* keep probing short - count the rest as 'other' */
+	}
+
+	return &stat[i].other;
+}
+
+static void account_frame(int i, struct can_frame *cf)
+{
+	unsigned int bits = frame_bits(cf);
+	struct idstat *ids;
+
+	stat[i].recv_frames++;
+	stat[i].recv_bits_total += bits;
+	stat[i].recv_bits_payload += cf->can_dlc*8;
+	stat[i].window_bits += bits;
+
+	if (stat[i].ids) {
+		ids = idstat_get(i, cf->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+		ids->frames++;
+		ids->bits_total += bits;
+		ids->bits_payload += cf->can_dlc*8;
+	}
+}
+
+static void close_window(void)
+{
+	unsigned int i, load;
+
+	for (i=0; i<currmax; i++) {
+		/* window load in permille of the bitrate */
+		load = (uint64_t)stat[i].window_bits * 1000 * 1000 /
+			((uint64_t)stat[i].bitrate * window);
+		if (load >= HISTSIZE)
+			load = HISTSIZE - 1;
+
+		stat[i].hist[load]++;
+		metric_observe(stat[i].m_windows, load);
+		if (load > stat[i].peak)
+			stat[i].peak = load;
+		stat[i].window_bits = 0;
+	}
+
+	windows++;
+}
+
+static unsigned int window_percentile(int i)
+{
+	unsigned int rank = (windows * percentile + 99) / 100;
+	unsigned int sum = 0;
+	unsigned int load;
+
+	for (load = 0; load < HISTSIZE; load++) {
+		sum += stat[i].hist[load];
+		if (sum >= rank)
+			break;
+	}
+
+	return load;
+}
+
+static void printtop(int i)
+{
+	struct idstat *top[MAXTOP];
+	struct idstat *ids;
+	char idstr[16];
+	int ntop = 0;
+	int j, n;
+
+	/* keep the topn entries with the most bits sorted in top[] */
+	for (j=0; j<IDTAB; j++) {
+		ids = &stat[i].ids[j];
+		if (!ids->frames)
+			continue;
+		for (n = ntop; n > 0 && top[n-1]->bits_total < ids->bits_total; n--)
+			if (n < topn)
+				top[n] = top[n-1];
+		if (n < topn) {
+			top[n] = ids;
+			if (ntop < topn)
+				ntop++;
+		}
+	}
+
+	for (n=0; n<topn; n++) {
+		if (n < ntop) {
+			if (top[n]->id & CAN_EFF_FLAG)
+				sprintf(idstr, "%08X", top[n]->id & CAN_EFF_MASK);
+			else
+				sprintf(idstr, "%03X", top[n]->id);
+			printf(" %*s %4d %6d %6d %3d%%\n",
+			       max_devname_len + max_bitrate_len + 1, idstr,
+			       top[n]->frames, top[n]->bits_total,
+			       top[n]->bits_payload,
+			       (top[n]->bits_total*100)/stat[i].bitrate);
+		} else /* keep the screen layout for redraw */
+			printf("%*s\n", max_devname_len + max_bitrate_len + 26, "");
+	}
+
+	/* always printed to keep the screen layout for redraw */
+	printf(" %*s %4d %6d %6d %3d%%\n",
+	       max_devname_len + max_bitrate_len + 1, "other",
+	       stat[i].other.frames, stat[i].other.bits_total,
+	       stat[i].other.bits_payload,
+	       (stat[i].other.bits_total*100)/stat[i].bitrate);
+
+	memset(stat[i].ids, 0, IDTAB * sizeof(struct idstat));
+	memset(&stat[i].other, 0, sizeof(stat[i].other));
+}
+
+void printstats(void)
 {
 	int i, j, percent;
 
@@ -165,6 +494,9 @@ void printstats(int signo)
 		else
 			percent = 0;
 
+		metric_set(stat[i].m_load, ((unsigned long long)stat[i].recv_bits_total * 1000) /
+			   stat[i].bitrate);
+
 		printf(" %*s@%-*d %4d %6d %6d %3d%%",
 		       max_devname_len, stat[i].devname,
 		       max_bitrate_len, stat[i].bitrate,
@@ -189,45 +521,63 @@ void printstats(int signo)
 	    
 			printf("|");
 		}
+
+		if (window < PERIOD_MS) {
+			/* the bursts hidden by the average */
+			j = window_percentile(i);
+			printf("  peak %3d.%d%%  p%d %3d.%d%%",
+			       stat[i].peak / 10, stat[i].peak % 10,
+			       percentile, j / 10, j % 10);
+		}
 	
 		if (color)
 			printf("%s", ATTRESET);
 
 		printf("\n");
 
+		if (topn)
+			printtop(i);
+
 		stat[i].recv_frames = 0;
 		stat[i].recv_bits_total = 0;
 		stat[i].recv_bits_payload = 0;
+		stat[i].peak = 0;
+		memset(stat[i].hist, 0, sizeof(stat[i].hist));
 	}
 
 	printf("\n");
 	fflush(stdout);
 
-	alarm(1);
+	windows = 0;
 }
 
 int main(int argc, char **argv)
 {
 	fd_set rdfs;
 	int s[MAXSOCK];
+	int tfd, maxfd;
 
 	int opt;
 	char *ptr, *nptr;
 	struct sockaddr_can addr;
-	struct can_frame frame;
-	int nbytes, i;
+	struct can_frame frame[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	struct mmsghdr mmsg[MAXBATCH];
+	struct itimerspec its;
+	uint64_t expired;
+	int nbytes, i, j, n;
+	unsigned int bits, payload;
 	struct ifreq ifr;
-	sigset_t sigmask, savesigmask;
+	char labels[2 * IFNAMSIZ + 40];
+	char bitrate[16];
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
 
-	signal(SIGALRM, printstats);
-
 	prg = basename(argv[0]);
 
-	while ((opt = getopt(argc, argv, "rtbcih?")) != -1) {
+	while ((opt = getopt(argc, argv, "rtbciew:p:n:M:h?")) != -1) {
 		switch (opt) {
 		case 'r':
 			redraw = 1;
@@ -249,6 +599,41 @@ int main(int argc, char **argv)
 			ignore_bitstuffing = 1;
 			break;
 
+		case 'e':
+			exact_bitstuffing = 1;
+			init_exact();
+			break;
+
+		case 'w':
+			window = atoi(optarg);
+			if (window < MINWINDOW || window > PERIOD_MS ||
+			    PERIOD_MS % window) {
+				printf("invalid load window %sms!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'p':
+			percentile = atoi(optarg);
+			if (!percentile || percentile > 100) {
+				printf("invalid percentile %s!\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'M':
+			if (metrics_open(optarg))
+				return 1;
+			break;
+
+		case 'n':
+			topn = atoi(optarg);
+			if (topn < 0 || topn > MAXTOP) {
+				printf("invalid number of top talkers %s!\n", optarg);
+				return 1;
+			}
+			break;
+
 		default:
 			print_usage(prg);
 			exit(1);
@@ -256,6 +641,11 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (ignore_bitstuffing && exact_bitstuffing) {
+		printf("options -i and -e can not be combined!\n");
+		return 1;
+	}
+
 	if (optind == argc) {
 		print_usage(prg);
 		exit(0);
@@ -320,6 +710,32 @@ int main(int argc, char **argv)
 		if (nbytes > max_bitrate_len)
 			max_bitrate_len = nbytes; /* for nice printing */
 
+		labels[0] = 0;
+		metric_label(labels, sizeof(labels), "interface", stat[i].devname, IFNAMSIZ);
+		snprintf(bitrate, sizeof(bitrate), "%d", stat[i].bitrate);
+		metric_label(labels, sizeof(labels), "bitrate", bitrate, -1);
+		stat[i].m_frames = metric_counter("canbusload_frames_total",
+						  "Received CAN frames", labels);
+		stat[i].m_bits = metric_counter("canbusload_bits_total",
+						"CAN bus bits used by the received frames", labels);
+		stat[i].m_payload = metric_counter("canbusload_payload_bits_total",
+						   "CAN payload bits of the received frames", labels);
+		stat[i].m_load = metric_gauge("canbusload_load_permille",
+					      "CAN bus load of the last second in permille", labels);
+		stat[i].m_windows = metric_histogram("canbusload_window_load_permille",
+						     "CAN bus load per load window in permille", labels,
+						     loadbounds, sizeof(loadbounds) / sizeof(loadbounds[0]));
+		stat[i].m_batch = metric_histogram("canbusload_rx_batch_frames",
+						   "CAN frames fetched with one recvmmsg() call", labels,
+						   batchbounds, sizeof(batchbounds) / sizeof(batchbounds[0]));
+
+		if (topn) {
+			stat[i].ids = calloc(IDTAB, sizeof(struct idstat));
+			if (!stat[i].ids) {
+				perror("calloc");
+				return 1;
+			}
+		}
 
 #ifdef DEBUG
 		printf("using interface name '%s'.\n", ifr.ifr_name);
@@ -339,7 +755,35 @@ int main(int argc, char **argv)
 		}
 	}
 
-	alarm(1);
+	/* the load windows are clocked by a periodic timer */
+	tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (tfd < 0) {
+		perror("timerfd_create");
+		return 1;
+	}
+
+	its.it_value.tv_sec = window / 1000;
+	its.it_value.tv_nsec = (window % 1000) * 1000000;
+	its.it_interval = its.it_value;
+
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		perror("timerfd_settime");
+		return 1;
+	}
+
+	/* these settings are static and can be held out of the hot path */
+	memset(mmsg, 0, sizeof(mmsg));
+	for (j=0; j<MAXBATCH; j++) {
+		iov[j].iov_base = &frame[j];
+		iov[j].iov_len = sizeof(frame[j]);
+		mmsg[j].msg_hdr.msg_iov = &iov[j];
+		mmsg[j].msg_hdr.msg_iovlen = 1;
+	}
+
+	maxfd = tfd;
+	for (i=0; i<currmax; i++)
+		if (s[i] > maxfd)
+			maxfd = s[i];
 
 	if (redraw)
 		printf("%s", CLR_SCREEN);
@@ -347,61 +791,66 @@ int main(int argc, char **argv)
 	while (1) {
 
 		FD_ZERO(&rdfs);
+		FD_SET(tfd, &rdfs);
 		for (i=0; i<currmax; i++)
 			FD_SET(s[i], &rdfs);
 
-		savesigmask = sigmask;
-
-		if (pselect(s[currmax-1]+1, &rdfs, NULL, NULL, NULL, &sigmask) < 0) {
-			//perror("pselect");
-			sigmask = savesigmask;
-			continue;
+		if (select(maxfd+1, &rdfs, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("select");
+			return 1;
 		}
 
 		for (i=0; i<currmax; i++) {  /* check all CAN RAW sockets */
 
-			if (FD_ISSET(s[i], &rdfs)) {
-
-				nbytes = read(s[i], &frame, sizeof(struct can_frame));
+			/* fetch the pending frames before a load window closes */
+			if (!FD_ISSET(s[i], &rdfs) && !FD_ISSET(tfd, &rdfs))
+				continue;
 
-				if (nbytes < 0) {
+			do {
+				n = recvmmsg(s[i], mmsg, MAXBATCH, MSG_DONTWAIT, NULL);
+				if (n < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						break;
 					perror("read");
 					return 1;
 				}
 
-				if (nbytes < sizeof(struct can_frame)) {
-					fprintf(stderr, "read: incomplete CAN frame\n");
-					return 1;
+				bits = stat[i].recv_bits_total;
+				payload = stat[i].recv_bits_payload;
+
+				for (j=0; j<n; j++) {
+					if (mmsg[j].msg_len < sizeof(struct can_frame)) {
+						fprintf(stderr, "read: incomplete CAN frame\n");
+						return 1;
+					}
+					account_frame(i, &frame[j]);
 				}
 
-				stat[i].recv_frames++;
-				stat[i].recv_bits_payload += frame.can_dlc*8;
-
-				/*
-				 * Following Ken Tindells *worst* case calculation for stuff-bits
-				 * (see "Guaranteeing Message Latencies on Controller Area Network" 1st ICC'94)
-				 * the needed bits on the wire can be calculated as:
-				 *
-				 * (34 + 8n)/5 + 47 + 8n for SFF frames (11 bit CAN-ID) => (269 + 48n)/5 
-				 * (54 + 8n)/5 + 67 + 8n for EFF frames (29 bit CAN-ID) => (389 + 48n)/5 
-				 *
-				 * while 'n' is the data length code (number of payload bytes)
-				 *
-				 */
-
-				if (ignore_bitstuffing) {
-					/* calculation without bitstuffing */
-					if (frame.can_id & CAN_EFF_FLAG)
-						stat[i].recv_bits_total += 67 + frame.can_dlc*8;
-					else
-						stat[i].recv_bits_total += 47 + frame.can_dlc*8;
-				} else {
-					/* needed bits including estimated worst case stuff bits */
-					if (frame.can_id & CAN_EFF_FLAG)
-						stat[i].recv_bits_total += (389 + frame.can_dlc*48)/5;
-					else
-						stat[i].recv_bits_total += (269 + frame.can_dlc*48)/5;
+				/* one update per batch */
+				if (n) {
+					metric_add(stat[i].m_frames, n);
+					metric_add(stat[i].m_bits, stat[i].recv_bits_total - bits);
+					metric_add(stat[i].m_payload, stat[i].recv_bits_payload - payload);
+					metric_observe(stat[i].m_batch, n);
 				}
+			} while (n == MAXBATCH);
+		}
+
+		if (FD_ISSET(tfd, &rdfs)) {
+
+			if (read(tfd, &expired, sizeof(expired)) != sizeof(expired))
+				continue;
+
+			/*
+			 * When we were late the frames are accounted to the
+			 * current window. The missed windows count as empty.
+			 */
+			while (expired--) {
+				close_window();
+				if (windows == PERIOD_MS / window)
+					printstats();
 			}
 		}
 	}
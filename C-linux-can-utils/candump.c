@@ -45,6 +45,8 @@
  *
  */
 
+#define _GNU_SOURCE /* recvmmsg() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -59,19 +61,46 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/timerfd.h>
 #include <net/if.h>
+#include <poll.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
 #include "terminal.h"
 #include "lib.h"
+#include "logrotate.h"
+#include "binlog.h"
+#include "canfilter.h"
+#include "spscring.h"
+#include "timerwheel.h"
+#include "metrics.h"
 
 #define MAXSOCK 16    /* max. number of CAN interfaces given on the cmdline */
 #define MAXIFNAMES 30 /* size of receive name index to omit ioctls */
 #define MAXCOL 6      /* number of different colors for colorized output */
 #define ANYDEV "any"  /* name of interface to receive from any CAN interface */
 #define ANL "\r\n"    /* newline in ASC mode */
+#define MAXBATCH 32   /* max. number of CAN frames fetched with one recvmmsg() */
+#define MAXLOGLINE 100 /* "(1160000000.123456789) <ifname> 12345678#0011223344556677\n" */
+#define MAXCPUS 64    /* max. number of CPUs given for the pipeline threads */
+
+#define BRIDGE_QLEN    16384      /* max. number of frames in flight on the bridge */
+#define BRIDGE_SLOTS   1024       /* timer wheel slots for the bridge delay */
+#define BRIDGE_TICK_NS 100000     /* timer wheel resolution (100us) */
+#define BRIDGE_LATE_NS 1000000ULL /* frames sent later than this are 'late' (1ms) */
+
+#define PIPE_CAPRING  4096       /* frames in the ring of each capture thread */
+#define PIPE_OUTRING  8192       /* frames in the ring to the output thread */
+#define PIPE_POLL_MS  10         /* watermark update interval of idle sockets */
+#define PIPE_GUARD_NS 1000000ULL /* max. lag of the kernel timestamp (1ms) */
+#define PIPE_MERGE_NS 50000000ULL /* max. wait for idle sockets when merging (50ms) */
+#define PIPE_IDLE_US  100        /* back-off of idle pipeline stages */
 
 #define SILENT_INI 42 /* detect user setting on commandline */
 #define SILENT_OFF 0  /* no silent mode */
@@ -92,9 +121,99 @@ const char col_off [] = ATTRESET;
 static char *cmdlinename[MAXSOCK];
 static __u32 dropcnt[MAXSOCK];
 static __u32 last_dropcnt[MAXSOCK];
+
+/* exported with -M - NULL when disabled */
+static struct {
+	struct metric *frames;
+	struct metric *errors;
+	struct metric *drops;
+	struct metric *batch;
+} metrics[MAXSOCK];
+static struct metric *m_forwarded, *m_brdropped;
+static const unsigned long long batchbounds[] = { 1, 2, 4, 8, 16, MAXBATCH };
 static char devname[MAXIFNAMES][IFNAMSIZ+1];
 static int  dindex[MAXIFNAMES];
 static int  max_devname_len; /* to prevent frazzled device name output */ 
+static int  tsdigits = 6;    /* timestamp resolution: 6 (usecs) or 9 (nsecs) */
+
+/* output settings - only used by the output path (main or output thread) */
+static unsigned char timestamp;
+static unsigned char silent = SILENT_INI;
+static unsigned char silentani;
+static unsigned char color;
+static unsigned char view;
+static unsigned char logging;
+static unsigned char logfrmt;
+static unsigned char binfrmt;
+static int count;         /* terminate after this number of frames (0 = off) */
+static int limit_reached; /* count has expired */
+static struct timespec last_ts;
+static struct logrot *logrot;
+static struct binlog_writer binlog;
+static struct cfx_prog *expr;
+
+/* receive buffers for one batch of CAN frames */
+struct rxbatch {
+	struct mmsghdr mmsg[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	struct sockaddr_can addr[MAXBATCH];
+	char ctrlmsg[MAXBATCH][CMSG_SPACE(CANLIB_CMSG_TSTAMP_SPACE) + CMSG_SPACE(sizeof(__u32))];
+	struct can_frame frame[MAXBATCH];
+	struct timespec ts[MAXBATCH];
+	unsigned char match[MAXBATCH];
+};
+
+/* CAN frame passed through the pipeline */
+struct rxframe {
+	struct can_frame frame;
+	struct timespec ts;
+	int ifindex;
+	int sock;      /* index of the receiving socket */
+	__u32 dropcnt; /* SO_RXQ_OVFL counter of the socket */
+};
+
+struct capture {
+	pthread_t thread;
+	int fd;
+	int sock;
+	struct spsc_ring ring;
+	unsigned long long watermark; /* no frame older than this will follow */
+	int done;
+};
+
+/* CAN frame waiting for its forwarding time */
+struct bridge_frame {
+	struct tw_timer timer; /* must be first */
+	struct can_frame frame;
+};
+
+static struct bridge {
+	int fd;
+	int tfd;                      /* timerfd driving the timer wheel */
+	int timer_on;
+	int blocked;                  /* socket buffer full - wait for POLLOUT */
+	unsigned long long delay;     /* ns */
+	struct timerwheel tw;
+	struct bridge_frame *pool;
+	struct tw_timer *freelist;
+	struct tw_timer *backlog;     /* due frames not sent yet */
+	struct tw_timer **backlog_tail;
+	unsigned long inflight;
+	unsigned long forwarded;
+	unsigned long dropped;
+	unsigned long late;
+} br;
+
+static struct pipeline {
+	pthread_t merge;
+	pthread_t output;
+	struct spsc_ring out;
+	int merge_done;
+	unsigned long merge_waits;
+	unsigned long merge_timeouts;
+	int ncap;
+	struct capture cap[MAXSOCK];
+} pipeline;
 
 #define MAXANI 4
 const char anichar[MAXANI] = {'|', '/', '-', '\\'};
@@ -108,6 +227,8 @@ void print_usage(char *prg)
 	fprintf(stderr, "\nUsage: %s [options] <CAN interface>+\n", prg);
 	fprintf(stderr, "  (use CTRL-C to terminate %s)\n\n", prg);
 	fprintf(stderr, "Options: -t <type>   (timestamp: (a)bsolute/(d)elta/(z)ero/(A)bsolute w date)\n");
+	fprintf(stderr, "         -N          (nanosecond resolution for timestamps and log files)\n");
+	fprintf(stderr, "         -H          (use hardware timestamps of the CAN controller if available)\n");
 	fprintf(stderr, "         -c          (increment color mode level)\n");
 	fprintf(stderr, "         -i          (binary output - may exceed 80 chars/line)\n");
 	fprintf(stderr, "         -a          (enable additional ASCII output)\n");
@@ -117,11 +238,18 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -B <can>    (bridge mode - like '-b' with disabled loopback)\n");
 	fprintf(stderr, "         -u <usecs>  (delay bridge forwarding by <usecs> microseconds)\n");
 	fprintf(stderr, "         -l          (log CAN-frames into file. Sets '-s %d' by default)\n", SILENT_ON);
+	fprintf(stderr, "         -F          (write log file in compact binary format '.cbl')\n");
+	fprintf(stderr, "         -C <size>   (rotate log file after <size> bytes - k/M/G suffix allowed)\n");
+	fprintf(stderr, "         -G <secs>   (rotate log file every <secs> seconds)\n");
 	fprintf(stderr, "         -L          (use log file format on stdout)\n");
 	fprintf(stderr, "         -n <count>  (terminate after receiption of <count> CAN frames)\n");
 	fprintf(stderr, "         -r <size>   (set socket receive buffer to <size>)\n");
 	fprintf(stderr, "         -d          (monitor dropped CAN frames)\n");
 	fprintf(stderr, "         -e          (dump CAN error frames in human-readable format)\n");
+	fprintf(stderr, "         -X <expr>   (only process CAN frames matching the filter expression <expr>)\n");
+	fprintf(stderr, "         -P          (pipeline mode - capture threads per interface, merged by timestamp)\n");
+	fprintf(stderr, "         -A <cpus>   (bind pipeline threads to the comma separated list of CPUs)\n");
+	fprintf(stderr, "         -M <addr>   (export metrics in Prometheus format on unix:<path> or [<host>:]<port>)\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Up to %d CAN interfaces with optional filter sets can be specified\n", MAXSOCK);
 	fprintf(stderr, "on the commandline in the form: <ifname>[,filter]*\n");
@@ -129,9 +257,16 @@ void print_usage(char *prg)
 	fprintf(stderr, " <can_id>:<can_mask> (matches when <received_can_id> & mask == can_id & mask)\n");
 	fprintf(stderr, " <can_id>~<can_mask> (matches when <received_can_id> & mask != can_id & mask)\n");
 	fprintf(stderr, " #<error_mask>       (set error frame filter, see include/linux/can/error.h)\n");
+	fprintf(stderr, " [j|J]               (join the given CAN filters - logical AND semantic)\n");
 	fprintf(stderr, "\nCAN IDs, masks and data content are given and expected in hexadecimal values.\n");
 	fprintf(stderr, "When can_id and can_mask are both 8 digits, they are assumed to be 29 bit EFF.\n");
 	fprintf(stderr, "Without any given filter all data frames are received ('0:0' default filter).\n");
+	fprintf(stderr, "Overlapping filters are merged into a minimal filter set for the kernel.\n");
+	fprintf(stderr, "\nThe filter expression of option '-X' is checked in user space and may test\n");
+	fprintf(stderr, "the fields id, dlc, data[0..7], eff, rtr and err with ==, !=, <, <=, >, >=\n");
+	fprintf(stderr, "or <value>/<mask> combined with &&, ||, ! (and, or, not) and parentheses.\n");
+	fprintf(stderr, "Values are given in C notation (e.g. 0x123). Where possible the ID part of\n");
+	fprintf(stderr, "the expression is set as kernel filter for interfaces without filter sets.\n");
 	fprintf(stderr, "\nUse interface name '%s' to receive from all CAN interfaces.\n", ANYDEV);
 	fprintf(stderr, "\nExamples:\n");
 	fprintf(stderr, "%s -c -c -ta can0,123:7FF,400:700,#000000FF can2,400~7F0 can3 can8\n", prg);
@@ -140,6 +275,7 @@ void print_usage(char *prg)
 	fprintf(stderr, "%s vcan2,92345678:DFFFFFFF (match only for extended CAN ID 12345678)\n", prg);
 	fprintf(stderr, "%s vcan2,123:7FF (matches CAN ID 123 - including EFF and RTR frames)\n", prg);
 	fprintf(stderr, "%s vcan2,123:C00007FF (matches CAN ID 123 - only SFF and non-RTR frames)\n", prg);
+	fprintf(stderr, "%s -X 'id 0x02000000/0x1FF00000 and data[1] != 0' can0\n", prg);
 	fprintf(stderr, "\n");
 }
 
@@ -148,6 +284,12 @@ void sigterm(int signo)
 	running = 0;
 }
 
+static inline long tsfrac(struct timespec *ts)
+{
+	/* fractional part of the timestamp in the selected resolution */
+	return (tsdigits == 9) ? ts->tv_nsec : ts->tv_nsec / 1000;
+}
+
 int idx2dindex(int ifidx, int socket) {
 
 	int i;
@@ -197,46 +339,704 @@ int idx2dindex(int ifidx, int socket) {
 	return i;
 }
 
+static void rxbatch_init(struct rxbatch *b)
+{
+	int i;
+
+	/* these settings are static and can be held out of the hot path */
+	memset(b, 0, sizeof(*b));
+	for (i = 0; i < MAXBATCH; i++) {
+		b->iov[i].iov_base = &b->frame[i];
+		b->iov[i].iov_len = sizeof(b->frame[i]);
+		b->mmsg[i].msg_hdr.msg_name = &b->addr[i];
+		b->mmsg[i].msg_hdr.msg_iov = &b->iov[i];
+		b->mmsg[i].msg_hdr.msg_iovlen = 1;
+		b->mmsg[i].msg_hdr.msg_control = &b->ctrlmsg[i];
+	}
+}
+
+static int rxbatch_recv(int sock, struct rxbatch *b, __u32 *drops)
+{
+	struct cmsghdr *cmsg;
+	struct msghdr *msg;
+	int nframes, j;
+
+	/* these settings may be modified by recvmmsg() */
+	for (j = 0; j < MAXBATCH; j++) {
+		b->mmsg[j].msg_hdr.msg_namelen = sizeof(b->addr[j]);
+		b->mmsg[j].msg_hdr.msg_controllen = sizeof(b->ctrlmsg[j]);
+		b->mmsg[j].msg_hdr.msg_flags = 0;
+	}
+
+	/* fetch all pending frames of this socket at once */
+	nframes = recvmmsg(sock, b->mmsg, MAXBATCH, MSG_DONTWAIT, NULL);
+	if (nframes < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	for (j = 0; j < nframes; j++) {
+		if (b->mmsg[j].msg_len < sizeof(struct can_frame)) {
+			fprintf(stderr, "read: incomplete CAN frame\n");
+			errno = EPROTO;
+			return -1;
+		}
+	}
+
+	/* evaluate the filter expression for the whole batch */
+	if (expr)
+		cfx_run(expr, b->frame, nframes, b->match);
+	else
+		memset(b->match, 1, nframes);
+
+	/*
+	 * Rejected frames are skipped completely. The SO_RXQ_OVFL drop
+	 * counter is cumulative and is picked up with the next accepted frame.
+	 */
+	for (j = 0; j < nframes; j++) {
+		if (!b->match[j])
+			continue;
+
+		msg = &b->mmsg[j].msg_hdr;
+		for (cmsg = CMSG_FIRSTHDR(msg);
+		     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
+		     cmsg = CMSG_NXTHDR(msg,cmsg)) {
+			if (cmsg->cmsg_type == SO_RXQ_OVFL)
+				*drops = *(__u32 *)CMSG_DATA(cmsg);
+			else
+				cmsg_rx_timestamp(cmsg, &b->ts[j]);
+		}
+	}
+
+	return nframes;
+}
+
+static void output_frame(int i, int sock, struct can_frame *cf,
+			 struct timespec *ts, int ifindex)
+{
+	FILE *logfile;
+	int idx, nbytes;
+
+	if (count && (--count == 0)) {
+		limit_reached = 1;
+		running = 0;
+	}
+
+	/* check for (unlikely) dropped frames on this specific socket */
+	if (dropcnt[i] != last_dropcnt[i]) {
+
+		__u32 frames;
+
+		if (dropcnt[i] > last_dropcnt[i])
+			frames = dropcnt[i] - last_dropcnt[i];
+		else
+			frames = 4294967295U - last_dropcnt[i] + dropcnt[i]; /* 4294967295U == UINT32_MAX */
+
+		metric_add(metrics[i].drops, frames);
+
+		if (silent != SILENT_ON)
+			printf("DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
+			       frames, (frames > 1)?"s":"", cmdlinename[i], dropcnt[i]);
+
+		if (logging) {
+			char buf[BINLOG_MAXTEXT + 1];
+
+			snprintf(buf, sizeof(buf), "DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
+				 frames, (frames > 1)?"s":"", cmdlinename[i], dropcnt[i]);
+
+			logfile = logrot_file(logrot, NULL);
+			if (binfrmt) {
+				if (logfile != binlog.file)
+					binlog_writer_init(&binlog, logfile);
+				nbytes = binlog_write_text(&binlog, buf);
+			} else
+				nbytes = fputs(buf, logfile) < 0 ? -1 : strlen(buf);
+			if (nbytes > 0)
+				logrot_account(logrot, NULL, nbytes);
+		}
+
+		last_dropcnt[i] = dropcnt[i];
+	}
+
+	metric_add(metrics[i].frames, 1);
+	if (cf->can_id & CAN_ERR_FLAG)
+		metric_add(metrics[i].errors, 1);
+
+	idx = idx2dindex(ifindex, sock);
+
+	if (logging && binfrmt) {
+		/* compact binary record with nanosecond timestamp */
+		logfile = logrot_file(logrot, ts);
+		if (logfile != binlog.file)
+			binlog_writer_init(&binlog, logfile);
+		nbytes = binlog_write_frame(&binlog, ts, devname[idx], cf);
+		if (nbytes > 0)
+			logrot_account(logrot, ts, nbytes);
+	} else if (logging) {
+		char buf[MAXLOGLINE];
+
+		/* log CAN frame with absolute timestamp & device */
+		nbytes = sprintf(buf, "(%ld.%0*ld) %*s ", ts->tv_sec,
+				 tsdigits, tsfrac(ts),
+				 max_devname_len, devname[idx]);
+		/* without seperator as logfile use-case is parsing */
+		sprint_canframe(buf+nbytes, cf, 0);
+		nbytes += strlen(buf+nbytes);
+		buf[nbytes++] = '\n';
+		buf[nbytes] = 0;
+
+		logfile = logrot_file(logrot, ts);
+		fputs(buf, logfile);
+		logrot_account(logrot, ts, nbytes);
+	}
+
+	if (logfrmt) {
+		/* print CAN frame in log file style to stdout */
+		printf("(%ld.%0*ld) ", ts->tv_sec, tsdigits, tsfrac(ts));
+		printf("%*s ", max_devname_len, devname[idx]);
+		fprint_canframe(stdout, cf, "\n", 0);
+		return; /* no other output to stdout */
+	}
+
+	if (silent != SILENT_OFF){
+		if (silent == SILENT_ANI) {
+			printf("%c\b", anichar[silentani%=MAXANI]);
+			silentani++;
+		}
+		return; /* no other output to stdout */
+	}
+
+	printf(" %s", (color>2)?col_on[idx%MAXCOL]:"");
+
+	switch (timestamp) {
+
+	case 'a': /* absolute with timestamp */
+		printf("(%ld.%0*ld) ", ts->tv_sec, tsdigits, tsfrac(ts));
+		break;
+
+	case 'A': /* absolute with date */
+	{
+		struct tm tm;
+		char timestring[25];
+
+		tm = *localtime(&ts->tv_sec);
+		strftime(timestring, 24, "%Y-%m-%d %H:%M:%S", &tm);
+		printf("(%s.%0*ld) ", timestring, tsdigits, tsfrac(ts));
+	}
+	break;
+
+	case 'd': /* delta */
+	case 'z': /* starting with zero */
+	{
+		struct timespec diff;
+
+		if (last_ts.tv_sec == 0)   /* first init */
+			last_ts = *ts;
+		diff.tv_sec  = ts->tv_sec  - last_ts.tv_sec;
+		diff.tv_nsec = ts->tv_nsec - last_ts.tv_nsec;
+		if (diff.tv_nsec < 0)
+			diff.tv_sec--, diff.tv_nsec += 1000000000;
+		if (diff.tv_sec < 0)
+			diff.tv_sec = diff.tv_nsec = 0;
+		printf("(%03ld.%0*ld) ", diff.tv_sec, tsdigits, tsfrac(&diff));
+
+		if (timestamp == 'd')
+			last_ts = *ts; /* update for delta calculation */
+	}
+	break;
+
+	default: /* no timestamp output */
+		break;
+	}
+
+	printf(" %s", (color && (color<3))?col_on[idx%MAXCOL]:"");
+	printf("%*s", max_devname_len, devname[idx]);
+	printf("%s  ", (color==1)?col_off:"");
+
+	fprint_long_canframe(stdout, cf, NULL, view);
+
+	printf("%s", (color>1)?col_off:"");
+	printf("\n");
+}
+
+static inline unsigned long long ts_ns(struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static unsigned long long now_ns(clockid_t clk)
+{
+	struct timespec now;
+
+	clock_gettime(clk, &now);
+	return ts_ns(&now);
+}
+
+/*
+ * Bridge mode (-b/-B): received frames are queued with their due time in
+ * a timer wheel driven by a periodic timerfd while frames are in flight,
+ * so a forwarding delay (-u) never blocks the reception. Due frames are
+ * sent with sendmmsg(). When the socket buffer is full (EAGAIN) sending
+ * continues when the socket becomes writable, when the device queue is
+ * full (ENOBUFS) with the next timer tick.
+ */
+
+static int bridge_timer(int on)
+{
+	struct itimerspec its;
+
+	if (br.timer_on == on)
+		return 0;
+
+	memset(&its, 0, sizeof(its));
+	if (on) {
+		its.it_value.tv_nsec = BRIDGE_TICK_NS;
+		its.it_interval.tv_nsec = BRIDGE_TICK_NS;
+	}
+
+	br.timer_on = on;
+	return timerfd_settime(br.tfd, 0, &its, NULL);
+}
+
+static int bridge_init(int fd, useconds_t delay)
+{
+	int i;
+
+	br.fd = fd;
+	br.delay = delay * 1000ULL;
+	br.backlog_tail = &br.backlog;
+
+	br.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (br.tfd < 0) {
+		perror("bridge timerfd");
+		return -1;
+	}
+
+	br.pool = calloc(BRIDGE_QLEN, sizeof(struct bridge_frame));
+	if (!br.pool ||
+	    tw_init(&br.tw, BRIDGE_SLOTS, BRIDGE_TICK_NS, now_ns(CLOCK_MONOTONIC))) {
+		perror("bridge queue");
+		return -1;
+	}
+
+	for (i = 0; i < BRIDGE_QLEN; i++) {
+		br.pool[i].timer.next = br.freelist;
+		br.freelist = &br.pool[i].timer;
+	}
+
+	return 0;
+}
+
+static void bridge_queue(struct can_frame *cf, unsigned long long now)
+{
+	struct tw_timer *t = br.freelist;
+
+	if (!t) {
+		br.dropped++; /* too many frames in flight */
+		metric_add(m_brdropped, 1);
+		return;
+	}
+
+	br.freelist = t->next;
+	br.inflight++;
+	((struct bridge_frame *)t)->frame = *cf;
+
+	if (!br.delay) {
+		/* send with the next flush */
+		t->expires = now;
+		t->next = NULL;
+		*br.backlog_tail = t;
+		br.backlog_tail = &t->next;
+		return;
+	}
+
+	tw_add(&br.tw, t, now + br.delay);
+}
+
+static int bridge_flush(void)
+{
+	struct mmsghdr mmsg[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	struct tw_timer *t;
+	unsigned long long now = now_ns(CLOCK_MONOTONIC);
+	int n, sent;
+
+	br.blocked = 0;
+
+	while (br.backlog) {
+
+		memset(mmsg, 0, sizeof(mmsg));
+		for (n = 0, t = br.backlog; t && n < MAXBATCH; t = t->next, n++) {
+			iov[n].iov_base = &((struct bridge_frame *)t)->frame;
+			iov[n].iov_len = sizeof(struct can_frame);
+			mmsg[n].msg_hdr.msg_iov = &iov[n];
+			mmsg[n].msg_hdr.msg_iovlen = 1;
+		}
+
+		sent = sendmmsg(br.fd, mmsg, n, MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				br.blocked = 1; /* wait for POLLOUT */
+				return 0;
+			}
+			if (errno == ENOBUFS)
+				return 0; /* retry with the next timer tick */
+			perror("bridge write");
+			return -1;
+		}
+
+		while (sent--) {
+			t = br.backlog;
+			br.backlog = t->next;
+			if (now > t->expires + BRIDGE_LATE_NS)
+				br.late++;
+			br.forwarded++;
+			br.inflight--;
+			metric_add(m_forwarded, 1);
+			t->next = br.freelist;
+			br.freelist = t;
+		}
+
+		if (!br.backlog)
+			br.backlog_tail = &br.backlog;
+	}
+
+	return 0;
+}
+
+static int bridge_tick(void)
+{
+	struct tw_timer *t;
+	uint64_t expirations;
+
+	if (read(br.tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+		perror("bridge timerfd");
+		return -1;
+	}
+
+	t = tw_expire(&br.tw, now_ns(CLOCK_MONOTONIC));
+	if (t) {
+		*br.backlog_tail = t;
+		while (t->next)
+			t = t->next;
+		br.backlog_tail = &t->next;
+	}
+
+	if (!br.blocked && bridge_flush())
+		return -1;
+
+	return 0;
+}
+
+/* run the timer only while frames are in flight */
+static int bridge_update_timer(void)
+{
+	if (bridge_timer(br.tw.pending || (br.backlog && !br.blocked)) < 0) {
+		perror("bridge timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Pipeline mode (-P): one capture thread per CAN socket, a merge thread
+ * ordering the frames of all sockets by their timestamps and an output
+ * thread doing the formatting and (log file) writing. The stages are
+ * connected by lock-free single producer/single consumer rings.
+ */
+
+static void set_affinity(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(thread, sizeof(set), &set))
+		fprintf(stderr, "Failed to bind thread to CPU %d\n", cpu);
+}
+
+static void *capture_thread(void *arg)
+{
+	struct capture *cap = arg;
+	struct rxbatch *b;
+	struct pollfd pfd;
+	struct rxframe *e;
+	__u32 drops = 0;
+	int nframes, j;
+
+	b = malloc(sizeof(*b));
+	if (!b) {
+		perror("capture buffer");
+		running = 0;
+		goto out;
+	}
+	rxbatch_init(b);
+
+	pfd.fd = cap->fd;
+	pfd.events = POLLIN;
+
+	while (running) {
+
+		if (poll(&pfd, 1, PIPE_POLL_MS) <= 0) {
+			/* socket queue empty - no older frame can show up */
+			__atomic_store_n(&cap->watermark,
+					 now_ns(CLOCK_REALTIME) - PIPE_GUARD_NS,
+					 __ATOMIC_RELEASE);
+			continue;
+		}
+
+		nframes = rxbatch_recv(cap->fd, b, &drops);
+		if (nframes < 0) {
+			perror("read");
+			running = 0;
+			break;
+		}
+		if (nframes)
+			metric_observe(metrics[cap->sock].batch, nframes);
+
+		for (j = 0; j < nframes; j++) {
+			if (!b->match[j])
+				continue;
+
+			e = spsc_write_slot(&cap->ring);
+			if (!e)
+				continue; /* merge stage is behind - counted in ring */
+
+			e->frame = b->frame[j];
+			e->ts = b->ts[j];
+			e->ifindex = b->addr[j].can_ifindex;
+			e->sock = cap->sock;
+			e->dropcnt = drops;
+			spsc_write_commit(&cap->ring);
+		}
+
+		/* the socket queue has been drained */
+		if (nframes < MAXBATCH)
+			__atomic_store_n(&cap->watermark,
+					 now_ns(CLOCK_REALTIME) - PIPE_GUARD_NS,
+					 __ATOMIC_RELEASE);
+	}
+
+	free(b);
+out:
+	__atomic_store_n(&cap->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *merge_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct capture *cap;
+	struct rxframe *e, *min;
+	unsigned long long lowmark, waiting = 0;
+	int i, mini = 0, live;
+
+	while (1) {
+
+		min = NULL;
+		live = 0;
+		lowmark = ~0ULL;
+
+		for (i = 0; i < pl->ncap; i++) {
+			cap = &pl->cap[i];
+
+			/* load the watermark before looking into the ring */
+			unsigned long long wm = __atomic_load_n(&cap->watermark, __ATOMIC_ACQUIRE);
+			int done = __atomic_load_n(&cap->done, __ATOMIC_ACQUIRE);
+
+			e = spsc_read_slot(&cap->ring);
+			if (!e) {
+				if (!done) {
+					live++;
+					if (wm < lowmark)
+						lowmark = wm;
+				}
+				continue;
+			}
+
+			live++;
+			if (!min || ts_ns(&e->ts) < ts_ns(&min->ts)) {
+				min = e;
+				mini = i;
+			}
+		}
+
+		if (!min) {
+			if (!live)
+				break; /* all capture threads finished */
+			waiting = 0;
+			usleep(PIPE_IDLE_US);
+			continue;
+		}
+
+		if (ts_ns(&min->ts) > lowmark) {
+			/*
+			 * An idle socket may still deliver an older frame.
+			 * Wait until its watermark passes or the timeout hits
+			 * (e.g. hardware timestamps from a different clock).
+			 */
+			if (!waiting) {
+				waiting = now_ns(CLOCK_MONOTONIC);
+				pl->merge_waits++;
+			}
+			if (now_ns(CLOCK_MONOTONIC) - waiting < PIPE_MERGE_NS) {
+				usleep(PIPE_IDLE_US);
+				continue;
+			}
+			pl->merge_timeouts++;
+		} else
+			waiting = 0;
+
+		while (!(e = spsc_write_slot(&pl->out)))
+			usleep(PIPE_IDLE_US); /* back pressure from the output stage */
+
+		*e = *min;
+		spsc_write_commit(&pl->out);
+		spsc_read_commit(&pl->cap[mini].ring);
+	}
+
+	__atomic_store_n(&pl->merge_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *output_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct rxframe *e;
+	int done;
+
+	while (1) {
+
+		done = __atomic_load_n(&pl->merge_done, __ATOMIC_ACQUIRE);
+
+		e = spsc_read_slot(&pl->out);
+		if (!e) {
+			fflush(stdout);
+			if (done)
+				break;
+			usleep(PIPE_IDLE_US);
+			continue;
+		}
+
+		/* frames behind the '-n' limit are discarded */
+		if (!limit_reached) {
+			dropcnt[e->sock] = e->dropcnt;
+			output_frame(e->sock, pl->cap[e->sock].fd, &e->frame,
+				     &e->ts, e->ifindex);
+		}
+
+		spsc_read_commit(&pl->out);
+	}
+
+	return NULL;
+}
+
+static void print_ring_stats(const char *name, struct spsc_ring *r,
+			     const char *fullname)
+{
+	fprintf(stderr, "  %-14s size %5u  max depth %5u  avg depth %7.1f  %s %lu\n",
+		name, spsc_size(r), r->maxdepth,
+		(r->reads) ? (double)r->depthsum / r->reads : 0.0,
+		fullname, r->full);
+}
+
+static int run_pipeline(int *s, int currmax, int *cpus, int ncpus)
+{
+	struct pipeline *pl = &pipeline;
+	char name[IFNAMSIZ];
+	int i, cpu = 0;
+
+	pl->ncap = currmax;
+
+	if (spsc_init(&pl->out, PIPE_OUTRING, sizeof(struct rxframe))) {
+		perror("pipeline ring");
+		return 1;
+	}
+
+	for (i = 0; i < currmax; i++) {
+		pl->cap[i].fd = s[i];
+		pl->cap[i].sock = i;
+		if (spsc_init(&pl->cap[i].ring, PIPE_CAPRING, sizeof(struct rxframe))) {
+			perror("pipeline ring");
+			return 1;
+		}
+	}
+
+	/* start from the end of the pipeline */
+	if (pthread_create(&pl->output, NULL, output_thread, pl) ||
+	    pthread_create(&pl->merge, NULL, merge_thread, pl)) {
+		perror("pipeline thread");
+		return 1;
+	}
+
+	for (i = 0; i < currmax; i++) {
+		if (pthread_create(&pl->cap[i].thread, NULL, capture_thread, &pl->cap[i])) {
+			perror("capture thread");
+			return 1;
+		}
+		if (ncpus)
+			set_affinity(pl->cap[i].thread, cpus[cpu++ % ncpus]);
+	}
+
+	if (ncpus) {
+		set_affinity(pl->merge, cpus[cpu++ % ncpus]);
+		set_affinity(pl->output, cpus[cpu++ % ncpus]);
+	}
+
+	for (i = 0; i < currmax; i++)
+		pthread_join(pl->cap[i].thread, NULL);
+	pthread_join(pl->merge, NULL);
+	pthread_join(pl->output, NULL);
+
+	fprintf(stderr, "\nPipeline queue statistics:\n");
+	for (i = 0; i < currmax; i++) {
+		snprintf(name, sizeof(name), "%.*s",
+			 (int)strcspn(cmdlinename[i], ","), cmdlinename[i]);
+		print_ring_stats(name, &pl->cap[i].ring, "dropped");
+		spsc_free(&pl->cap[i].ring);
+	}
+	print_ring_stats("merge->output", &pl->out, "stalls");
+	fprintf(stderr, "  merge stage waited %lu times for idle sockets (%lu timeouts)\n",
+		pl->merge_waits, pl->merge_timeouts);
+	spsc_free(&pl->out);
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	fd_set rdfs;
+	fd_set rdfs, wrfs;
+	int maxfd;
+	unsigned long long now = 0;
 	int s[MAXSOCK];
 	int bridge = 0;
 	useconds_t bridge_delay = 0;
-	unsigned char timestamp = 0;
+	unsigned char hwstamp = 0;
 	unsigned char dropmonitor = 0;
-	unsigned char silent = SILENT_INI;
-	unsigned char silentani = 0;
-	unsigned char color = 0;
-	unsigned char view = 0;
-	unsigned char log = 0;
-	unsigned char logfrmt = 0;
-	int count = 0;
+	unsigned char pipelined = 0;
+	unsigned long long rotate_size = 0;
+	unsigned int rotate_secs = 0;
+	int cpus[MAXCPUS];
+	int ncpus = 0;
 	int rcvbuf_size = 0;
 	int opt, ret;
 	int currmax, numfilter;
 	char *ptr, *nptr;
 	struct sockaddr_can addr;
-	char ctrlmsg[CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(__u32))];
-	struct iovec iov;
-	struct msghdr msg;
-	struct cmsghdr *cmsg;
-	struct can_filter *rfilter;
-	can_err_mask_t err_mask;
-	struct can_frame frame;
-	int nbytes, i;
+	struct rxbatch rx;
+	struct can_filter exprfilter[CFX_MAXKF];
+	int nexprfilter = -1;
+	int nbytes, nframes, i;
 	struct ifreq ifr;
-	struct timeval tv, last_tv;
-	FILE *logfile = NULL;
+	char labels[2 * IFNAMSIZ + 16];
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
 
-	last_tv.tv_sec  = 0;
-	last_tv.tv_usec = 0;
-
-	while ((opt = getopt(argc, argv, "t:ciaSs:b:B:u:ldLn:r:he?")) != -1) {
+	while ((opt = getopt(argc, argv, "t:NHciaSs:b:B:u:lFC:G:dLn:r:X:PA:M:he?")) != -1) {
 		switch (opt) {
 		case 't':
 			timestamp = optarg[0];
@@ -248,6 +1048,14 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'N':
+			tsdigits = 9;
+			break;
+
+		case 'H':
+			hwstamp = 1;
+			break;
+
 		case 'c':
 			color++;
 			break;
@@ -320,7 +1128,27 @@ int main(int argc, char **argv)
 			break;
 
 		case 'l':
-			log = 1;
+			logging = 1;
+			break;
+
+		case 'F':
+			binfrmt = 1;
+			break;
+
+		case 'C':
+			rotate_size = logrot_parse_size(optarg);
+			if (!rotate_size) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case 'G':
+			rotate_secs = strtoul(optarg, NULL, 10);
+			if (!rotate_secs) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
 			break;
 
 		case 'd':
@@ -347,6 +1175,41 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'X':
+			expr = malloc(sizeof(*expr));
+			if (!expr) {
+				perror("filter expression");
+				return 1;
+			}
+			if (cfx_compile(optarg, expr, exprfilter, &nexprfilter))
+				return 1;
+			break;
+
+		case 'P':
+			pipelined = 1;
+			break;
+
+		case 'M':
+			if (metrics_open(optarg))
+				return 1;
+			break;
+
+		case 'A':
+			ptr = optarg;
+			while (*ptr) {
+				if (ncpus == MAXCPUS) {
+					fprintf(stderr, "More than %d CPUs given!\n", MAXCPUS);
+					return 1;
+				}
+				cpus[ncpus++] = strtoul(ptr, &nptr, 10);
+				if (nptr == ptr || (*nptr && *nptr != ',')) {
+					print_usage(basename(argv[0]));
+					exit(1);
+				}
+				ptr = (*nptr) ? nptr + 1 : nptr;
+			}
+			break;
+
 		default:
 			print_usage(basename(argv[0]));
 			exit(1);
@@ -364,8 +1227,23 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
+	if ((rotate_size || rotate_secs || binfrmt) && !logging) {
+		fprintf(stderr, "Log file rotation/format needs logging to file (option -l)!\n");
+		exit(1);
+	}
+
+	if (pipelined && bridge) {
+		fprintf(stderr, "Bridge mode is not supported in pipeline mode!\n");
+		exit(1);
+	}
+
+	if (ncpus && !pipelined) {
+		fprintf(stderr, "CPU affinity needs the pipeline mode (option -P)!\n");
+		exit(1);
+	}
+
 	if (silent == SILENT_INI) {
-		if (log) {
+		if (logging) {
 			fprintf(stderr, "Disabled standard output while logging.\n");
 			silent = SILENT_ON; /* disable output on stdout */
 		} else
@@ -409,6 +1287,18 @@ int main(int argc, char **argv)
 		if (nbytes > max_devname_len)
 			max_devname_len = nbytes; /* for nice printing */
 
+		labels[0] = 0;
+		metric_label(labels, sizeof(labels), "interface", ptr, nbytes);
+		metrics[i].frames = metric_counter("candump_rx_frames_total",
+						   "Received CAN frames passing the filters", labels);
+		metrics[i].errors = metric_counter("candump_rx_error_frames_total",
+						   "Received CAN error frames", labels);
+		metrics[i].drops = metric_counter("candump_rx_dropped_frames_total",
+						  "CAN frames dropped by the socket (needs -d)", labels);
+		metrics[i].batch = metric_histogram("candump_rx_batch_frames",
+						    "CAN frames fetched with one recvmmsg() call", labels,
+						    batchbounds, sizeof(batchbounds) / sizeof(batchbounds[0]));
+
 		addr.can_family = AF_CAN;
 
 		memset(&ifr.ifr_name, 0, sizeof(ifr.ifr_name));
@@ -427,61 +1317,44 @@ int main(int argc, char **argv)
 		} else
 			addr.can_ifindex = 0; /* any can interface */
 
+		numfilter = 0;
+
 		if (nptr) {
 
 			/* found a ',' after the interface name => check for filters */
+			struct cfx_filterset fs;
 
-			/* determine number of filters to alloc the filter space */
-			numfilter = 0;
-			ptr = nptr;
-			while (ptr) {
-				numfilter++;
-				ptr++; /* hop behind the ',' */
-				ptr = strchr(ptr, ','); /* exit condition */
-			}
-
-			rfilter = malloc(sizeof(struct can_filter) * numfilter);
-			if (!rfilter) {
-				fprintf(stderr, "Failed to create filter space!\n");
+			if (cfx_parse_filterset(nptr+1, &fs))
 				return 1;
-			}
 
-			numfilter = 0;
-			err_mask = 0;
-
-			while (nptr) {
-
-				ptr = nptr+1; /* hop behind the ',' */
-				nptr = strchr(ptr, ','); /* update exit condition */
-
-				if (sscanf(ptr, "%x:%x",
-					   &rfilter[numfilter].can_id, 
-					   &rfilter[numfilter].can_mask) == 2) {
- 					rfilter[numfilter].can_mask &= ~CAN_ERR_FLAG;
-					numfilter++;
-				} else if (sscanf(ptr, "%x~%x",
-						  &rfilter[numfilter].can_id, 
-						  &rfilter[numfilter].can_mask) == 2) {
- 					rfilter[numfilter].can_id |= CAN_INV_FILTER;
- 					rfilter[numfilter].can_mask &= ~CAN_ERR_FLAG;
-					numfilter++;
-				} else if (sscanf(ptr, "#%x", &err_mask) != 1) { 
-					fprintf(stderr, "Error in filter option parsing: '%s'\n", ptr);
-					return 1;
-				}
+			numfilter = fs.nfilter;
+
+			/* overlapping/adjacent filters are merged into a minimal set */
+			if (cfx_apply_filterset(s[i], &fs) < 0) {
+				if (fs.join && errno == ENOPROTOOPT)
+					fprintf(stderr, "CAN_RAW_JOIN_FILTERS not supported by your Linux Kernel\n");
+				else
+					perror("setsockopt CAN_RAW_FILTER");
+				return 1;
 			}
 
-			if (err_mask)
-				setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
-					   &err_mask, sizeof(err_mask));
+#ifdef DEBUG
+			printf("%d filter(s) reduced to %d.\n", numfilter, fs.nfilter);
+#endif
+			cfx_free_filterset(&fs);
 
-			if (numfilter)
-				setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_FILTER,
-					   rfilter, numfilter * sizeof(struct can_filter));
+		} /* if (nptr) */
 
-			free(rfilter);
+		/* push the ID/mask part of the filter expression into the kernel */
+		if (!numfilter && nexprfilter >= 0 &&
+		    setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_FILTER,
+			       exprfilter, nexprfilter * sizeof(struct can_filter)) < 0) {
+			struct can_filter all = { 0, 0 };
 
-		} /* if (nptr) */
+			/* the expression is checked in user space anyway */
+			perror("setsockopt CAN_RAW_FILTER");
+			setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_FILTER, &all, sizeof(all));
+		}
 
 		if (rcvbuf_size) {
 
@@ -514,13 +1387,11 @@ int main(int argc, char **argv)
 			}
 		}
 
-		if (timestamp || log || logfrmt) {
+		/* the pipeline merges the frames by their timestamps */
+		if (timestamp || logging || logfrmt || pipelined) {
 
-			const int timestamp_on = 1;
-
-			if (setsockopt(s[i], SOL_SOCKET, SO_TIMESTAMP,
-				       &timestamp_on, sizeof(timestamp_on)) < 0) {
-				perror("setsockopt SO_TIMESTAMP");
+			if (set_rx_timestamping(s[i], hwstamp) < 0) {
+				perror("setsockopt SO_TIMESTAMPING");
 				return 1;
 			}
 		}
@@ -542,10 +1413,12 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (log) {
+	if (logging) {
 		time_t currtime;
 		struct tm now;
-		char fname[sizeof("candump-2006-11-20_202026.log")+1];
+		char fname[sizeof("candump-2006-11-20_202026")+1];
+		const char *ext = (binfrmt) ? ".cbl" : ".log";
+		unsigned char hdr[BINLOG_HDRSZ];
 
 		if (time(&currtime) == (time_t)-1) {
 			perror("time");
@@ -554,207 +1427,144 @@ int main(int argc, char **argv)
 
 		localtime_r(&currtime, &now);
 
-		sprintf(fname, "candump-%04d-%02d-%02d_%02d%02d%02d.log",
-			now.tm_year + 1900,
-			now.tm_mon + 1,
-			now.tm_mday,
-			now.tm_hour,
-			now.tm_min,
-			now.tm_sec);
+		if (snprintf(fname, sizeof(fname), "candump-%04d-%02d-%02d_%02d%02d%02d",
+			     now.tm_year + 1900,
+			     now.tm_mon + 1,
+			     now.tm_mday,
+			     now.tm_hour,
+			     now.tm_min,
+			     now.tm_sec) >= (int)sizeof(fname)) {
+			fprintf(stderr, "logfile name too long\n");
+			return 1;
+		}
 
 		if (silent != SILENT_ON)
 			printf("\nWarning: console output active while logging!");
 
-		fprintf(stderr, "\nEnabling Logfile '%s'\n\n", fname);
+		if (rotate_size || rotate_secs)
+			fprintf(stderr, "\nEnabling Logfile segments '%s-NNN%s' (see '%s.manifest')\n\n",
+				fname, ext, fname);
+		else
+			fprintf(stderr, "\nEnabling Logfile '%s%s'\n\n", fname, ext);
 
-		logfile = fopen(fname, "w");
-		if (!logfile) {
-			perror("logfile");
+		logrot = logrot_open(fname, ext, hdr, (binfrmt) ? binlog_header(hdr) : 0,
+				     rotate_size, rotate_secs);
+		if (!logrot)
 			return 1;
-		}
+
+		binlog_writer_init(&binlog, NULL);
 	}
 
-	/* these settings are static and can be held out of the hot path */
-	iov.iov_base = &frame;
-	msg.msg_name = &addr;
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = &ctrlmsg;
+	if (bridge && bridge_init(bridge, bridge_delay))
+		return 1;
+
+	if (bridge) {
+		m_forwarded = metric_counter("candump_bridge_forwarded_frames_total",
+					     "CAN frames sent to the bridge interface", NULL);
+		m_brdropped = metric_counter("candump_bridge_dropped_frames_total",
+					     "CAN frames dropped by the bridge (queue full)", NULL);
+	}
+
+	if (pipelined) {
+		if (run_pipeline(s, currmax, cpus, ncpus))
+			return 1;
+		running = 0;
+	} else
+		rxbatch_init(&rx);
 
 	while (running) {
 
 		FD_ZERO(&rdfs);
-		for (i=0; i<currmax; i++)
+		FD_ZERO(&wrfs);
+		maxfd = 0;
+		for (i=0; i<currmax; i++) {
 			FD_SET(s[i], &rdfs);
+			if (s[i] > maxfd)
+				maxfd = s[i];
+		}
+
+		if (bridge) {
+			FD_SET(br.tfd, &rdfs);
+			if (br.tfd > maxfd)
+				maxfd = br.tfd;
+			if (br.blocked)
+				FD_SET(bridge, &wrfs);
+			if (bridge > maxfd)
+				maxfd = bridge;
+		}
 
-		if ((ret = select(s[currmax-1]+1, &rdfs, NULL, NULL, NULL)) < 0) {
+		if ((ret = select(maxfd+1, &rdfs, &wrfs, NULL, NULL)) < 0) {
 			//perror("select");
 			running = 0;
 			continue;
 		}
 
+		if (bridge) {
+			if (FD_ISSET(br.tfd, &rdfs) && bridge_tick())
+				return 1;
+			if (FD_ISSET(bridge, &wrfs) && bridge_flush())
+				return 1;
+		}
+
 		for (i=0; i<currmax; i++) {  /* check all CAN RAW sockets */
 
 			if (FD_ISSET(s[i], &rdfs)) {
 
-				int idx;
-
-				/* these settings may be modified by recvmsg() */
-				iov.iov_len = sizeof(frame);
-				msg.msg_namelen = sizeof(addr);
-				msg.msg_controllen = sizeof(ctrlmsg);  
-				msg.msg_flags = 0;
+				int j;
 
-				nbytes = recvmsg(s[i], &msg, 0);
-				if (nbytes < 0) {
+				nframes = rxbatch_recv(s[i], &rx, &dropcnt[i]);
+				if (nframes < 0) {
 					perror("read");
 					return 1;
 				}
+				if (nframes)
+					metric_observe(metrics[i].batch, nframes);
 
-				if (nbytes < sizeof(struct can_frame)) {
-					fprintf(stderr, "read: incomplete CAN frame\n");
-					return 1;
-				}
-
-				if (count && (--count == 0))
-					running = 0;
-
-				if (bridge) {
-					if (bridge_delay)
-						usleep(bridge_delay);
-
-					nbytes = write(bridge, &frame, sizeof(struct can_frame));
-					if (nbytes < 0) {
-						perror("bridge write");
-						return 1;
-					} else if (nbytes < sizeof(struct can_frame)) {
-						fprintf(stderr,"bridge write: incomplete CAN frame\n");
-						return 1;
-					}
-				}
-		    
-				for (cmsg = CMSG_FIRSTHDR(&msg);
-				     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
-				     cmsg = CMSG_NXTHDR(&msg,cmsg)) {
-					if (cmsg->cmsg_type == SO_TIMESTAMP)
-						tv = *(struct timeval *)CMSG_DATA(cmsg);
-					else if (cmsg->cmsg_type == SO_RXQ_OVFL)
-						dropcnt[i] = *(__u32 *)CMSG_DATA(cmsg);
-				}
-
-				/* check for (unlikely) dropped frames on this specific socket */
-				if (dropcnt[i] != last_dropcnt[i]) {
-
-					__u32 frames;
-
-					if (dropcnt[i] > last_dropcnt[i])
-						frames = dropcnt[i] - last_dropcnt[i];
-					else
-						frames = 4294967295U - last_dropcnt[i] + dropcnt[i]; /* 4294967295U == UINT32_MAX */
-
-					if (silent != SILENT_ON)
-						printf("DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
-						       frames, (frames > 1)?"s":"", cmdlinename[i], dropcnt[i]);
-
-					if (log)
-						fprintf(logfile, "DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
-							frames, (frames > 1)?"s":"", cmdlinename[i], dropcnt[i]);
-
-					last_dropcnt[i] = dropcnt[i];
-				}
-
-				idx = idx2dindex(addr.can_ifindex, s[i]);
-
-				if (log) {
-					/* log CAN frame with absolute timestamp & device */
-					fprintf(logfile, "(%ld.%06ld) ", tv.tv_sec, tv.tv_usec);
-					fprintf(logfile, "%*s ", max_devname_len, devname[idx]);
-					/* without seperator as logfile use-case is parsing */
-					fprint_canframe(logfile, &frame, "\n", 0);
-				}
-
-				if (logfrmt) {
-					/* print CAN frame in log file style to stdout */
-					printf("(%ld.%06ld) ", tv.tv_sec, tv.tv_usec);
-					printf("%*s ", max_devname_len, devname[idx]);
-					fprint_canframe(stdout, &frame, "\n", 0);
-					goto out_fflush; /* no other output to stdout */
-				}
-
-				if (silent != SILENT_OFF){
-					if (silent == SILENT_ANI) {
-						printf("%c\b", anichar[silentani%=MAXANI]);
-						silentani++;
-					}
-					goto out_fflush; /* no other output to stdout */
-				}
-		      
-				printf(" %s", (color>2)?col_on[idx%MAXCOL]:"");
-
-				switch (timestamp) {
+				if (bridge)
+					now = now_ns(CLOCK_MONOTONIC);
 
-				case 'a': /* absolute with timestamp */
-					printf("(%ld.%06ld) ", tv.tv_sec, tv.tv_usec);
-					break;
+				for (j = 0; j < nframes && running; j++) {
 
-				case 'A': /* absolute with date */
-				{
-					struct tm tm;
-					char timestring[25];
-
-					tm = *localtime(&tv.tv_sec);
-					strftime(timestring, 24, "%Y-%m-%d %H:%M:%S", &tm);
-					printf("(%s.%06ld) ", timestring, tv.tv_usec);
-				}
-				break;
+					if (!rx.match[j])
+						continue;
 
-				case 'd': /* delta */
-				case 'z': /* starting with zero */
-				{
-					struct timeval diff;
-
-					if (last_tv.tv_sec == 0)   /* first init */
-						last_tv = tv;
-					diff.tv_sec  = tv.tv_sec  - last_tv.tv_sec;
-					diff.tv_usec = tv.tv_usec - last_tv.tv_usec;
-					if (diff.tv_usec < 0)
-						diff.tv_sec--, diff.tv_usec += 1000000;
-					if (diff.tv_sec < 0)
-						diff.tv_sec = diff.tv_usec = 0;
-					printf("(%03ld.%06ld) ", diff.tv_sec, diff.tv_usec);
-				
-					if (timestamp == 'd')
-						last_tv = tv; /* update for delta calculation */
-				}
-				break;
+					if (bridge)
+						bridge_queue(&rx.frame[j], now);
 
-				default: /* no timestamp output */
-					break;
+					output_frame(i, s[i], &rx.frame[j], &rx.ts[j],
+						     rx.addr[j].can_ifindex);
 				}
 
-				printf(" %s", (color && (color<3))?col_on[idx%MAXCOL]:"");
-				printf("%*s", max_devname_len, devname[idx]);
-				printf("%s  ", (color==1)?col_off:"");
-
-				fprint_long_canframe(stdout, &frame, NULL, view);
-
-				printf("%s", (color>1)?col_off:"");
-				printf("\n");
+				/* undelayed frames are forwarded batch by batch */
+				if (bridge && !br.blocked && bridge_flush())
+					return 1;
 			}
 
-		out_fflush:
 			fflush(stdout);
 		}
+
+		if (bridge && bridge_update_timer())
+			return 1;
 	}
 
 	for (i=0; i<currmax; i++)
 		close(s[i]);
 
-	if (bridge)
+	if (bridge) {
+		/* frames still in flight are not forwarded anymore */
+		fprintf(stderr, "bridge: %lu frames forwarded, %lu dropped, %lu late (> %llums)\n",
+			br.forwarded, br.dropped + br.inflight,
+			br.late, BRIDGE_LATE_NS / 1000000);
+		close(br.tfd);
 		close(bridge);
+	}
 
-	if (log)
-		fclose(logfile);
+	if (logging) {
+		if (logrot_late(logrot))
+			fprintf(stderr, "%lu log file rotation(s) deferred.\n",
+				logrot_late(logrot));
+		logrot_close(logrot);
+	}
 
 	return 0;
 }
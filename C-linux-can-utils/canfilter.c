@@ -0,0 +1,842 @@
+/*
+ * canfilter.c - compiled CAN frame filter expressions
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "canfilter.h"
+
+#define MAXNODES (2 * CFX_MAXINSN) /* max. number of syntax tree nodes */
+#define MAXDEPTH 64                /* max. nesting of '(' and '!' */
+
+enum { N_CMP, N_AND, N_OR, N_NOT };
+
+struct node {
+	int type;
+	int l, r; /* operand nodes */
+	struct cfx_insn cmp;
+};
+
+struct parser {
+	const char *expr;
+	const char *p;
+	int depth;
+	int nnodes;
+	struct node node[MAXNODES];
+};
+
+/* set of kernel filters matching (a superset of) a sub expression */
+struct kset {
+	int all;   /* no ID/mask restriction possible */
+	int exact; /* filters match exactly the sub expression */
+	int n;
+	struct can_filter f[CFX_MAXKF];
+};
+
+static const struct {
+	const char *name;
+	int field;
+	__u32 mask;
+} fields[] = {
+	{ "id",   CFX_F_ID,   CAN_EFF_MASK },
+	{ "dlc",  CFX_F_DLC,  0xF },
+	{ "eff",  CFX_F_EFF,  1 },
+	{ "rtr",  CFX_F_RTR,  1 },
+	{ "err",  CFX_F_ERR,  1 },
+	{ "data", CFX_F_DATA, 0xFF },
+};
+
+static const struct {
+	const char *tok;
+	int op;
+} ops[] = {
+	/* longest tokens first */
+	{ "==", CFX_EQ }, { "!=", CFX_NE }, { "<=", CFX_LE }, { ">=", CFX_GE },
+	{ "<",  CFX_LT }, { ">",  CFX_GT },
+};
+
+static int error(struct parser *ps, const char *what)
+{
+	fprintf(stderr, "filter expression: %s at position %d ('%s')\n",
+		what, (int)(ps->p - ps->expr) + 1, ps->p);
+	return -1;
+}
+
+static void skip_space(struct parser *ps)
+{
+	while (isspace((unsigned char)*ps->p))
+		ps->p++;
+}
+
+static int accept_tok(struct parser *ps, const char *tok)
+{
+	size_t len = strlen(tok);
+
+	skip_space(ps);
+
+	if (isalpha((unsigned char)tok[0])) {
+		/* keywords are case insensitive and end at a word boundary */
+		if (strncasecmp(ps->p, tok, len) ||
+		    isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_')
+			return 0;
+	} else if (strncmp(ps->p, tok, len))
+		return 0;
+
+	ps->p += len;
+	return 1;
+}
+
+static int number(struct parser *ps, __u32 *val)
+{
+	unsigned long v;
+	char *end;
+
+	skip_space(ps);
+
+	if (!isdigit((unsigned char)*ps->p))
+		return error(ps, "value expected");
+
+	errno = 0;
+	v = strtoul(ps->p, &end, 0);
+	if (errno || v > 0xFFFFFFFFUL)
+		return error(ps, "value out of range");
+
+	ps->p = end;
+	*val = v;
+	return 0;
+}
+
+static int new_node(struct parser *ps, int type, int l, int r)
+{
+	struct node *n;
+
+	if (ps->nnodes == MAXNODES)
+		return error(ps, "expression too complex");
+
+	n = &ps->node[ps->nnodes];
+	n->type = type;
+	n->l = l;
+	n->r = r;
+
+	return ps->nnodes++;
+}
+
+static int parse_expr(struct parser *ps);
+
+static int parse_cmp(struct parser *ps)
+{
+	struct cfx_insn in;
+	__u32 val;
+	int i, n;
+
+	memset(&in, 0, sizeof(in));
+
+	for (i = 0; i < sizeof(fields)/sizeof(fields[0]); i++)
+		if (accept_tok(ps, fields[i].name))
+			break;
+
+	if (i == sizeof(fields)/sizeof(fields[0]))
+		return error(ps, "field expected");
+
+	in.field = fields[i].field;
+	in.mask = fields[i].mask;
+
+	if (in.field == CFX_F_DATA) {
+		if (!accept_tok(ps, "["))
+			return error(ps, "'[' expected");
+		if (number(ps, &val))
+			return -1;
+		if (val >= 8)
+			return error(ps, "data index out of range");
+		if (!accept_tok(ps, "]"))
+			return error(ps, "']' expected");
+		in.field += val;
+	}
+
+	/* optional '&' <mask> - but not the '&&' operator */
+	skip_space(ps);
+	if (ps->p[0] == '&' && ps->p[1] != '&') {
+		ps->p++;
+		if (number(ps, &val))
+			return -1;
+		in.mask &= val;
+	}
+
+	for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++)
+		if (accept_tok(ps, ops[i].tok))
+			break;
+
+	skip_space(ps);
+
+	if (i < sizeof(ops)/sizeof(ops[0]) || isdigit((unsigned char)*ps->p)) {
+		in.op = (i < sizeof(ops)/sizeof(ops[0])) ? ops[i].op : CFX_EQ;
+		if (number(ps, &in.k))
+			return -1;
+		/* <value>/<mask> compares the value under the given mask */
+		if (accept_tok(ps, "/")) {
+			if (number(ps, &val))
+				return -1;
+			in.mask &= val;
+			in.k &= in.mask;
+		}
+	} else {
+		/* plain field is true when not zero */
+		in.op = CFX_NE;
+		in.k = 0;
+	}
+
+	if ((in.op == CFX_EQ || in.op == CFX_NE) && (in.k & ~in.mask)) {
+		/*
+		 * e.g. 'id&0x40 == 0x400' can never be true. Fold it into the
+		 * constant 0 != 0 (false) or 0 == 0 (true) which kleaf() turns
+		 * into an accept-none or accept-all kernel filter.
+		 */
+		in.op = (in.op == CFX_EQ) ? CFX_NE : CFX_EQ;
+		in.field = CFX_F_ID;
+		in.mask = 0;
+		in.k = 0;
+	}
+
+	n = new_node(ps, N_CMP, -1, -1);
+	if (n >= 0)
+		ps->node[n].cmp = in;
+
+	return n;
+}
+
+static int parse_factor(struct parser *ps)
+{
+	int n;
+
+	if (++ps->depth > MAXDEPTH)
+		return error(ps, "expression nested too deep");
+
+	if (accept_tok(ps, "!") || accept_tok(ps, "not")) {
+		n = parse_factor(ps);
+		if (n >= 0)
+			n = new_node(ps, N_NOT, n, -1);
+	} else if (accept_tok(ps, "(")) {
+		n = parse_expr(ps);
+		if (n >= 0 && !accept_tok(ps, ")"))
+			n = error(ps, "')' expected");
+	} else
+		n = parse_cmp(ps);
+
+	ps->depth--;
+
+	return n;
+}
+
+static int parse_term(struct parser *ps)
+{
+	int l, r;
+
+	l = parse_factor(ps);
+
+	while (l >= 0 && (accept_tok(ps, "&&") || accept_tok(ps, "and"))) {
+		r = parse_factor(ps);
+		if (r < 0)
+			return -1;
+		l = new_node(ps, N_AND, l, r);
+	}
+
+	return l;
+}
+
+static int parse_expr(struct parser *ps)
+{
+	int l, r;
+
+	l = parse_term(ps);
+
+	while (l >= 0 && (accept_tok(ps, "||") || accept_tok(ps, "or"))) {
+		r = parse_term(ps);
+		if (r < 0)
+			return -1;
+		l = new_node(ps, N_OR, l, r);
+	}
+
+	return l;
+}
+
+/*
+ * Emit the code for node n which continues at t when the node is true and
+ * at f otherwise. The operands are emitted back to front so that all jump
+ * targets are known - the entry of the program is the last emitted node.
+ */
+static int gen(struct parser *ps, struct cfx_prog *prog, int n, int t, int f)
+{
+	struct node *nd = &ps->node[n];
+	int e;
+
+	switch (nd->type) {
+
+	case N_AND:
+		e = gen(ps, prog, nd->r, t, f);
+		return (e < 0) ? -1 : gen(ps, prog, nd->l, e, f);
+
+	case N_OR:
+		e = gen(ps, prog, nd->r, t, f);
+		return (e < 0) ? -1 : gen(ps, prog, nd->l, t, e);
+
+	case N_NOT:
+		return gen(ps, prog, nd->l, f, t);
+	}
+
+	if (prog->len == CFX_MAXINSN) {
+		fprintf(stderr, "filter expression: more than %d comparisons\n",
+			CFX_MAXINSN);
+		return -1;
+	}
+
+	prog->insn[prog->len] = nd->cmp;
+	prog->insn[prog->len].jt = t;
+	prog->insn[prog->len].jf = f;
+
+	return prog->len++;
+}
+
+static void kleaf(const struct cfx_insn *in, struct kset *ks)
+{
+	__u32 flag;
+
+	if (in->op != CFX_EQ && in->op != CFX_NE)
+		return;
+
+	switch (in->field) {
+
+	case CFX_F_ID:
+		ks->f[0].can_id = in->k & in->mask;
+		ks->f[0].can_mask = in->mask;
+		if (in->op == CFX_NE)
+			ks->f[0].can_id |= CAN_INV_FILTER;
+		break;
+
+	case CFX_F_EFF:
+	case CFX_F_RTR:
+		flag = (in->field == CFX_F_EFF) ? CAN_EFF_FLAG : CAN_RTR_FLAG;
+		if (!(in->mask & 1) || in->k > 1)
+			return;
+		ks->f[0].can_id = ((in->k == 1) == (in->op == CFX_EQ)) ? flag : 0;
+		ks->f[0].can_mask = flag;
+		break;
+
+	default:
+		/* DLC, data and error flag can not be checked by CAN_RAW_FILTER */
+		return;
+	}
+
+	ks->all = 0;
+	ks->exact = 1;
+	ks->n = 1;
+}
+
+static int has_inv(struct kset *ks)
+{
+	int i;
+
+	for (i = 0; i < ks->n; i++)
+		if (ks->f[i].can_id & CAN_INV_FILTER)
+			return 1;
+
+	return 0;
+}
+
+static int kintersect(struct kset *a, struct kset *b, struct kset *ks)
+{
+	struct can_filter *fa, *fb;
+	int i, j, n = 0;
+
+	for (i = 0; i < a->n; i++) {
+		for (j = 0; j < b->n; j++) {
+			fa = &a->f[i];
+			fb = &b->f[j];
+
+			/* contradicting bits in the common mask => no frame matches */
+			if ((fa->can_id ^ fb->can_id) & fa->can_mask & fb->can_mask)
+				continue;
+
+			if (n == CFX_MAXKF)
+				return 0;
+
+			ks->f[n].can_id = fa->can_id | fb->can_id;
+			ks->f[n].can_mask = fa->can_mask | fb->can_mask;
+			n++;
+		}
+	}
+
+	ks->all = 0;
+	ks->exact = a->exact && b->exact;
+	ks->n = n;
+
+	return 1;
+}
+
+static void kfilters(struct parser *ps, int n, struct kset *ks)
+{
+	struct node *nd = &ps->node[n];
+	struct kset a, b;
+
+	ks->all = 1;
+	ks->exact = 0;
+	ks->n = 0;
+
+	if (nd->type == N_CMP) {
+		kleaf(&nd->cmp, ks);
+		return;
+	}
+
+	kfilters(ps, nd->l, &a);
+
+	if (nd->type == N_NOT) {
+		/* only a single exact filter can be inverted */
+		if (!a.all && a.exact && a.n == 1) {
+			*ks = a;
+			if (a.f[0].can_mask && !(a.f[0].can_mask & (a.f[0].can_mask - 1)))
+				/* single bit mask (e.g. !eff) - flip the bit */
+				ks->f[0].can_id ^= a.f[0].can_mask;
+			else
+				ks->f[0].can_id ^= CAN_INV_FILTER;
+		}
+		return;
+	}
+
+	kfilters(ps, nd->r, &b);
+
+	if (nd->type == N_OR) {
+		if (a.all || b.all || a.n + b.n > CFX_MAXKF)
+			return;
+		*ks = a;
+		memcpy(&ks->f[a.n], b.f, b.n * sizeof(struct can_filter));
+		ks->n += b.n;
+		ks->exact = a.exact && b.exact;
+		return;
+	}
+
+	/* N_AND */
+	if (a.all || b.all) {
+		*ks = (a.all) ? b : a;
+		ks->exact = 0;
+		return;
+	}
+
+	/* inverted filters can not be combined bitwise */
+	if (!has_inv(&a) && !has_inv(&b) && kintersect(&a, &b, ks))
+		return;
+
+	/* either side is a superset of the conjunction */
+	*ks = (a.n <= b.n) ? a : b;
+	ks->exact = 0;
+}
+
+int cfx_compile(const char *expr, struct cfx_prog *prog,
+		struct can_filter *kf, int *nkf)
+{
+	struct parser *ps;
+	struct kset *ks;
+	int root, ret = -1;
+
+	ps = calloc(1, sizeof(*ps) + sizeof(*ks));
+	if (!ps) {
+		perror("filter expression");
+		return -1;
+	}
+	ks = (struct kset *)(ps + 1);
+
+	ps->expr = ps->p = expr;
+
+	root = parse_expr(ps);
+	if (root < 0)
+		goto out;
+
+	skip_space(ps);
+	if (*ps->p) {
+		error(ps, "syntax error");
+		goto out;
+	}
+
+	prog->len = 0;
+	prog->entry = gen(ps, prog, root, CFX_ACCEPT, CFX_REJECT);
+	if (prog->entry < 0)
+		goto out;
+
+	if (kf) {
+		kfilters(ps, root, ks);
+		if (ks->all)
+			*nkf = -1;
+		else {
+			memcpy(kf, ks->f, ks->n * sizeof(struct can_filter));
+			*nkf = cfx_minimize(kf, ks->n, 0);
+		}
+	}
+
+	ret = 0;
+out:
+	free(ps);
+	return ret;
+}
+
+static inline __u32 load(const struct can_frame *cf, int field)
+{
+	switch (field) {
+	case CFX_F_ID:
+		return cf->can_id & CAN_EFF_MASK;
+	case CFX_F_DLC:
+		return cf->can_dlc;
+	case CFX_F_EFF:
+		return (cf->can_id & CAN_EFF_FLAG) ? 1 : 0;
+	case CFX_F_RTR:
+		return (cf->can_id & CAN_RTR_FLAG) ? 1 : 0;
+	case CFX_F_ERR:
+		return (cf->can_id & CAN_ERR_FLAG) ? 1 : 0;
+	default:
+		return cf->data[field - CFX_F_DATA];
+	}
+}
+
+static inline int match(const struct cfx_prog *prog, const struct can_frame *cf)
+{
+	const struct cfx_insn *in;
+	unsigned int pc = prog->entry;
+	__u32 v;
+	int res;
+
+	while (1) {
+		in = &prog->insn[pc];
+		v = load(cf, in->field) & in->mask;
+
+		switch (in->op) {
+		case CFX_EQ: res = (v == in->k); break;
+		case CFX_NE: res = (v != in->k); break;
+		case CFX_LT: res = (v <  in->k); break;
+		case CFX_LE: res = (v <= in->k); break;
+		case CFX_GT: res = (v >  in->k); break;
+		default:     res = (v >= in->k); break;
+		}
+
+		pc = (res) ? in->jt : in->jf;
+		if (pc >= CFX_REJECT)
+			return pc == CFX_ACCEPT;
+	}
+}
+
+int cfx_match(const struct cfx_prog *prog, const struct can_frame *cf)
+{
+	return match(prog, cf);
+}
+
+int cfx_run(const struct cfx_prog *prog, const struct can_frame *cf,
+	    int nframes, unsigned char *res)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nframes; i++) {
+		res[i] = match(prog, &cf[i]);
+		n += res[i];
+	}
+
+	return n;
+}
+
+int cfx_parse_filterset(const char *spec, struct cfx_filterset *fs)
+{
+	const char *ptr = spec;
+	struct can_filter *f;
+	int n = 1;
+
+	memset(fs, 0, sizeof(*fs));
+
+	/* determine number of filters to alloc the filter space */
+	while ((ptr = strchr(ptr, ','))) {
+		n++;
+		ptr++;
+	}
+
+	fs->filter = malloc(sizeof(struct can_filter) * n);
+	if (!fs->filter) {
+		fprintf(stderr, "Failed to create filter space!\n");
+		return -1;
+	}
+
+	ptr = spec;
+	while (ptr) {
+		f = &fs->filter[fs->nfilter];
+
+		if (sscanf(ptr, "%x:%x", &f->can_id, &f->can_mask) == 2) {
+			f->can_mask &= ~CAN_ERR_FLAG;
+			fs->nfilter++;
+		} else if (sscanf(ptr, "%x~%x", &f->can_id, &f->can_mask) == 2) {
+			f->can_id |= CAN_INV_FILTER;
+			f->can_mask &= ~CAN_ERR_FLAG;
+			fs->nfilter++;
+		} else if ((*ptr == 'j' || *ptr == 'J') &&
+			   (ptr[1] == ',' || !ptr[1])) {
+			fs->join = 1;
+		} else if (sscanf(ptr, "#%x", &fs->err_mask) != 1) {
+			fprintf(stderr, "Error in filter option parsing: '%s'\n", ptr);
+			cfx_free_filterset(fs);
+			return -1;
+		}
+
+		ptr = strchr(ptr, ',');
+		if (ptr)
+			ptr++; /* hop behind the ',' */
+	}
+
+	return 0;
+}
+
+void cfx_free_filterset(struct cfx_filterset *fs)
+{
+	free(fs->filter);
+	fs->filter = NULL;
+	fs->nfilter = 0;
+}
+
+#define FILTER_BITS (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK)
+#define EFF_ID_BITS (CAN_EFF_MASK & ~CAN_SFF_MASK) /* always 0 in SFF frames */
+
+static inline int inverted(const struct can_filter *f)
+{
+	return (f->can_id & CAN_INV_FILTER) ? 1 : 0;
+}
+
+static inline canid_t fid(const struct can_filter *f)
+{
+	return f->can_id & ~CAN_INV_FILTER;
+}
+
+/* reduce the filter like the kernel does (can_rcv_list_find()) */
+static inline void normalize(struct can_filter *f)
+{
+	f->can_mask &= FILTER_BITS;
+
+	/*
+	 * SFF frames only - e.g. 123:C00007FF == 123:DFFFFFFF. The ID bits
+	 * above the SFF mask are dropped, not compared.
+	 */
+	if ((f->can_mask & CAN_EFF_FLAG) && !(f->can_id & CAN_EFF_FLAG))
+		f->can_mask &= ~EFF_ID_BITS;
+
+	/* the kernel only compares the masked bits */
+	f->can_id &= f->can_mask | CAN_INV_FILTER;
+}
+
+/* matches all data frames */
+static inline int match_all(const struct can_filter *f)
+{
+	return !inverted(f) && !f->can_mask;
+}
+
+/* matches no frame at all */
+static inline int match_none(const struct can_filter *f)
+{
+	return inverted(f) && !f->can_mask;
+}
+
+/* every frame matching b also matches a */
+static int covers(const struct can_filter *a, const struct can_filter *b)
+{
+	canid_t ma = a->can_mask, mb = b->can_mask;
+
+	if (match_all(a) || match_none(b))
+		return 1;
+
+	if (!inverted(a) && !inverted(b))
+		return !(ma & ~mb) && (fid(b) & ma) == fid(a);
+
+	if (inverted(a) && !inverted(b))
+		return !(ma & ~mb) && (fid(b) & ma) != fid(a);
+
+	if (inverted(a) && inverted(b))
+		return !(mb & ~ma) && (fid(a) & mb) == fid(b);
+
+	return 0;
+}
+
+/* no common bit of the masks contradicts */
+static inline int compatible(const struct can_filter *a, const struct can_filter *b)
+{
+	return !((fid(a) ^ fid(b)) & a->can_mask & b->can_mask);
+}
+
+/* try to replace a and b by one filter a (OR semantic) */
+static int merge_or(struct can_filter *a, struct can_filter *b)
+{
+	canid_t diff;
+
+	if (covers(a, b))
+		return 1;
+
+	if (covers(b, a)) {
+		*a = *b;
+		return 1;
+	}
+
+	if (!inverted(a) && !inverted(b) && a->can_mask == b->can_mask) {
+		/* e.g. 100:7FF + 101:7FF => 100:7FE */
+		diff = fid(a) ^ fid(b);
+		if (!(diff & (diff - 1))) {
+			a->can_mask &= ~diff;
+			a->can_id &= ~diff;
+			return 1;
+		}
+	}
+
+	if (inverted(a) && inverted(b)) {
+		/* !A || !B == !(A && B) */
+		if (compatible(a, b)) {
+			a->can_id |= fid(b);
+			a->can_mask |= b->can_mask;
+		} else {
+			a->can_id = 0; /* A && B is empty => all frames */
+			a->can_mask = 0;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/* try to replace a and b by one filter a (AND semantic) */
+static int merge_and(struct can_filter *a, struct can_filter *b)
+{
+	/* drop the weaker condition */
+	if (covers(b, a))
+		return 1;
+
+	if (covers(a, b)) {
+		*a = *b;
+		return 1;
+	}
+
+	if (!inverted(a) && !inverted(b)) {
+		if (compatible(a, b)) {
+			a->can_id |= fid(b);
+			a->can_mask |= b->can_mask;
+		} else {
+			a->can_id = CAN_INV_FILTER; /* contradiction => no frame */
+			a->can_mask = 0;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+int cfx_minimize(struct can_filter *filter, int nfilter, int join)
+{
+	int i, j, changed;
+
+	for (i = 0; i < nfilter; i++)
+		normalize(&filter[i]);
+
+	do {
+		changed = 0;
+		for (i = 0; i < nfilter; i++) {
+			for (j = i + 1; j < nfilter; j++) {
+				if (join ? merge_and(&filter[i], &filter[j]) :
+				    merge_or(&filter[i], &filter[j])) {
+					filter[j--] = filter[--nfilter];
+					changed = 1;
+				}
+			}
+		}
+	} while (changed);
+
+	return nfilter;
+}
+
+int cfx_match_filterset(const struct cfx_filterset *fs, canid_t can_id)
+{
+	struct can_filter f;
+	int i, m;
+
+	if (can_id & CAN_ERR_FLAG)
+		return (can_id & CAN_ERR_MASK & fs->err_mask) ? 1 : 0;
+
+	if (!fs->nfilter)
+		return 1;
+
+	for (i = 0; i < fs->nfilter; i++) {
+		f = fs->filter[i];
+		normalize(&f);
+		m = ((can_id & f.can_mask) == fid(&f)) ^ inverted(&f);
+		if (m != fs->join)
+			return m;
+	}
+
+	return fs->join;
+}
+
+int cfx_apply_filterset(int sock, struct cfx_filterset *fs)
+{
+	const int join = 1;
+
+	if (fs->err_mask &&
+	    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
+		       &fs->err_mask, sizeof(fs->err_mask)) < 0)
+		return -1;
+
+	if (!fs->nfilter)
+		return 0;
+
+	fs->nfilter = cfx_minimize(fs->filter, fs->nfilter, fs->join);
+
+	/* a single filter has the same semantic in both modes */
+	if (fs->join && fs->nfilter > 1 &&
+	    setsockopt(sock, SOL_CAN_RAW, CFX_RAW_JOIN_FILTERS,
+		       &join, sizeof(join)) < 0)
+		return -1;
+
+	return setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, fs->filter,
+			  fs->nfilter * sizeof(struct can_filter));
+}
@@ -0,0 +1,178 @@
+/*
+ * canfilter.h - compiled CAN frame filter expressions
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef CANFILTER_H
+#define CANFILTER_H
+
+#include <sys/socket.h>
+#include <linux/can.h>
+
+#define CFX_MAXINSN 256 /* max. number of instructions of a compiled expression */
+#define CFX_MAXKF   64  /* max. number of kernel filters derived from an expression */
+
+/* CAN_RAW_JOIN_FILTERS socket option (Linux 4.1+) - not in the local headers */
+#define CFX_RAW_JOIN_FILTERS 6
+
+/* jump targets terminating the program */
+#define CFX_REJECT 0xFFFE
+#define CFX_ACCEPT 0xFFFF
+
+/* frame fields - CFX_F_DATA + n addresses data[n] */
+enum { CFX_F_ID, CFX_F_DLC, CFX_F_EFF, CFX_F_RTR, CFX_F_ERR, CFX_F_DATA };
+
+/* comparison operators */
+enum { CFX_EQ, CFX_NE, CFX_LT, CFX_LE, CFX_GT, CFX_GE };
+
+struct cfx_insn {
+	unsigned char field;
+	unsigned char op;
+	unsigned short jt; /* next instruction when (field & mask) <op> k is true */
+	unsigned short jf; /* next instruction otherwise */
+	__u32 mask;
+	__u32 k;
+};
+
+struct cfx_prog {
+	int len;
+	int entry;
+	struct cfx_insn insn[CFX_MAXINSN];
+};
+
+int cfx_compile(const char *expr, struct cfx_prog *prog,
+		struct can_filter *kf, int *nkf);
+/*
+ * Compiles the filter expression 'expr' into the flat decision program
+ * 'prog'. The expression syntax is
+ *
+ * expr    := term { ( '||' | 'or' ) term }
+ * term    := factor { ( '&&' | 'and' ) factor }
+ * factor  := ( '!' | 'not' ) factor | '(' expr ')' | field [ '&' mask ] [ cmp ]
+ * cmp     := [ op ] value [ '/' mask ]
+ * op      := '==' | '!=' | '<' | '<=' | '>' | '>='
+ * field   := 'id' | 'dlc' | 'data[' n ']' | 'eff' | 'rtr' | 'err'
+ *
+ * Keywords are case insensitive, values are C style (0x.. for hex).
+ * 'id' is the CAN identifier without the EFF/RTR/ERR flags. A value
+ * without operator compares for equality and a field without comparison
+ * is true when it is not zero, e.g.
+ *
+ * id 0x02000000/0x1FF00000 and data[1] != 0
+ * eff && !rtr && (dlc < 8 || data[7]&0x80)
+ *
+ * When kf is not NULL it receives up to CFX_MAXKF CAN_RAW_FILTER entries
+ * matching a superset of the expression, which can be pushed down into
+ * the kernel. *nkf is set to the number of entries or to -1 when the
+ * expression can not be narrowed down by ID/mask filters.
+ *
+ * Returns 0 on success or -1 with an error message on stderr.
+ */
+
+int cfx_match(const struct cfx_prog *prog, const struct can_frame *cf);
+/*
+ * Returns 1 when the CAN frame matches the compiled expression, else 0.
+ */
+
+int cfx_run(const struct cfx_prog *prog, const struct can_frame *cf,
+	    int nframes, unsigned char *match);
+/*
+ * Evaluates the compiled expression for the array of 'nframes' CAN frames
+ * (e.g. a batch from recvmmsg()) and stores the results in match[].
+ * Returns the number of matching frames.
+ */
+
+/* kernel filter set of one CAN_RAW socket */
+struct cfx_filterset {
+	struct can_filter *filter;
+	int nfilter;
+	can_err_mask_t err_mask;
+	int join; /* a frame has to match all filters */
+};
+
+int cfx_parse_filterset(const char *spec, struct cfx_filterset *fs);
+/*
+ * Parses the comma separated filter list 'spec' (everything behind the
+ * interface name and its ',' in '<ifname>[,filter]*'):
+ *
+ * <can_id>:<can_mask> (matches when <received_can_id> & mask == can_id & mask)
+ * <can_id>~<can_mask> (matches when <received_can_id> & mask != can_id & mask)
+ * #<error_mask>       (set error frame filter, see include/linux/can/error.h)
+ * [j|J]               (join the given CAN filters - logical AND semantic)
+ *
+ * Values are hexadecimal. The filters are allocated in fs->filter and
+ * have to be released with cfx_free_filterset().
+ * Returns 0 on success or -1 with an error message on stderr.
+ */
+
+int cfx_minimize(struct can_filter *filter, int nfilter, int join);
+/*
+ * Reduces the filter list to an equivalent minimal set: normalizes the
+ * IDs to their masks, removes duplicates and filters covered by others
+ * and merges filters with equal masks differing in a single ID bit.
+ * Filters for SFF frames only (CAN_EFF_FLAG set in the mask but not in
+ * the ID) get their mask reduced to the SFF ID bits like in the kernel,
+ * i.e. ID bits above CAN_SFF_MASK are ignored.
+ * With 'join' set the AND semantic of CAN_RAW_JOIN_FILTERS is applied,
+ * i.e. compatible filters are intersected and filters matching a superset
+ * of another filter are removed.
+ * Returns the new number of filters (at least 1 when nfilter > 0).
+ */
+
+int cfx_apply_filterset(int sock, struct cfx_filterset *fs);
+/*
+ * Minimizes the filter set and sets the CAN_RAW_ERR_FILTER,
+ * CAN_RAW_JOIN_FILTERS and CAN_RAW_FILTER socket options. Without filters
+ * the kernel default (all data frames) is left untouched.
+ * Returns 0 on success or -1 with errno set from setsockopt().
+ */
+
+int cfx_match_filterset(const struct cfx_filterset *fs, canid_t can_id);
+/*
+ * Returns 1 when a CAN frame with the given can_id passes the filter set
+ * like it would pass a CAN_RAW socket configured with
+ * cfx_apply_filterset(): error frames are checked against the err_mask,
+ * data frames against the filters (all data frames without filters).
+ */
+
+void cfx_free_filterset(struct cfx_filterset *fs);
+
+#endif
@@ -45,6 +45,7 @@
  *
  */
 
+#define _GNU_SOURCE /* sendmmsg() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -56,6 +57,7 @@
 #include <libgen.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
@@ -67,6 +69,8 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include "lib.h"
+#include "timerwheel.h"
+#include "trafficmodel.h"
 
 #define DEFAULT_GAP 200 /* ms */
 
@@ -74,17 +78,73 @@
 #define MODE_INCREMENT	1
 #define MODE_FIX	2
 
+#define MAXBATCH 32      /* frames per sendmmsg() */
+#define MAXGEN   16      /* CAN interfaces / generator threads */
+#define BURST_NS 1000000 /* max. catch up after a delayed wakeup */
+
+#define MODEL_TICK_NS 100000 /* timer wheel resolution for -M */
+#define MODEL_SLOTS   4096
+
 extern int optind, opterr, optopt;
 
 static volatile int running = 1;
-static unsigned long long enobufs_count;
+
+/* one generator thread per CAN interface */
+struct generator {
+	pthread_t thread;
+	char *ifname;
+	int s;
+	uint64_t rng;            /* xorshift state */
+	struct can_frame frame;  /* template for the next frame */
+	uint64_t incdata;
+	unsigned long remaining; /* frames to send - 0 = infinite */
+	double tat;              /* pacing: theoretical arrival time in ns */
+
+	/* statistics - read by the main thread */
+	unsigned long long frames;
+	unsigned long long bits;
+	unsigned long long enobufs;
+	int failed;
+	uint64_t stop;           /* end of generation in ns */
+	int done;
+};
+
+static struct generator gen[MAXGEN];
+static int ngen;
+
+/* one periodic CAN ID of the traffic model (see -M) */
+struct source {
+	struct tw_timer timer; /* must be first */
+	struct tm_id *id;
+	struct can_frame frame;
+};
+
+static struct trafficmodel model;
+
+static unsigned long gap = DEFAULT_GAP;
+static double rate;            /* target frames/s (see -r) */
+static double load;            /* target bus load in percent (see -u) */
+static unsigned long bitrate;  /* see -b */
+static unsigned long polltimeout;
+static unsigned char ignore_enobufs;
+static unsigned char extended;
+static unsigned char id_mode = MODE_RANDOM;
+static unsigned char data_mode = MODE_RANDOM;
+static unsigned char dlc_mode = MODE_RANDOM;
+static unsigned char verbose;
 
 void print_usage(char *prg)
 {
 	fprintf(stderr, "\n%s: generate CAN frames\n\n", prg);
-	fprintf(stderr, "Usage: %s [options] <CAN interface>\n", prg);
+	fprintf(stderr, "Usage: %s [options] <CAN interface>+\n", prg);
 	fprintf(stderr, "Options: -g <ms>       (gap in milli seconds "
 		"- default: %d ms)\n", DEFAULT_GAP);
+	fprintf(stderr, "         -r <rate>     (send <rate> frames per second "
+		"- overrides -g)\n");
+	fprintf(stderr, "         -u <load>     (send with <load> percent bus load "
+		"- needs -b)\n");
+	fprintf(stderr, "         -b <bitrate>  (CAN bitrate for -u and the "
+		"statistics)\n");
 	fprintf(stderr, "         -e            (generate extended frame mode "
 		"(EFF) CAN frames)\n");
 	fprintf(stderr, "         -I <mode>     (CAN ID"
@@ -101,6 +161,12 @@ void print_usage(char *prg)
 		" write() syscalls)\n");
 	fprintf(stderr, "         -x            (disable local loopback of "
 		"generated CAN frames)\n");
+	fprintf(stderr, "         -S <seed>     (seed for random values "
+		"- default: time based)\n");
+	fprintf(stderr, "         -s <sec>      (print the achieved rate every "
+		"<sec> seconds)\n");
+	fprintf(stderr, "         -M <model>    (generate the traffic of a model "
+		"created by canprofile)\n");
 	fprintf(stderr, "         -v            (increment verbose level for "
 		"printing sent CAN frames)\n\n");
 	fprintf(stderr, "Generation modes:\n");
@@ -109,7 +175,13 @@ void print_usage(char *prg)
 	fprintf(stderr, "<hexvalue> => fix value using <hexvalue>\n\n");
 	fprintf(stderr, "When incrementing the CAN data the data length code "
 		"minimum is set to 1.\n");
-	fprintf(stderr, "CAN IDs and data content are given and expected in hexadecimal values.\n\n");
+	fprintf(stderr, "CAN IDs and data content are given and expected in hexadecimal values.\n");
+	fprintf(stderr, "With more than one CAN interface each interface gets "
+		"its own thread and\nthe rate, load and count apply per "
+		"interface.\n");
+	fprintf(stderr, "With -M each CAN ID of the model is sent with its "
+		"recorded period distribution,\ndata length code and byte change "
+		"probabilities (-g/-r/-u/-e/-I/-L/-D are ignored).\n\n");
 	fprintf(stderr, "Examples:\n");
 	fprintf(stderr, "%s vcan0 -g 4 -I 42A -L 1 -D i -v -v   ", prg);
 	fprintf(stderr, "(fixed CAN ID and length, inc. data)\n");
@@ -121,6 +193,8 @@ void print_usage(char *prg)
 	fprintf(stderr, "(full load test ignoring -ENOBUFS)\n");
 	fprintf(stderr, "%s vcan0 -g 0 -p 10 -x                 ", prg);
 	fprintf(stderr, "(full load test with polling, 10ms timeout)\n");
+	fprintf(stderr, "%s vcan0 vcan1 -b 500000 -u 40 -s 1   ", prg);
+	fprintf(stderr, "(40%% bus load on two buses)\n");
 	fprintf(stderr, "%s vcan0                               ", prg);
 	fprintf(stderr, "(my favourite default :)\n\n");
 }
@@ -130,42 +204,476 @@ void sigterm(int signo)
 	running = 0;
 }
 
+/* xorshift64* - fast and reproducible for a given seed */
+static inline uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* splitmix64 - derives independent xorshift states from one seed */
+static uint64_t seed_state(uint64_t seed)
+{
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+
+	return z ? z : 1; /* xorshift state must not be zero */
+}
+
+/* CAN frame length on the wire without stuff bits */
+static unsigned int frame_bits(struct can_frame *cf)
+{
+	unsigned int dlc = (cf->can_dlc > 8) ? 8 : cf->can_dlc;
+
+	if (cf->can_id & CAN_RTR_FLAG)
+		dlc = 0;
+
+	return ((cf->can_id & CAN_EFF_FLAG) ? 67 : 47) + dlc * 8;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* generate the next CAN frame from the generator template */
+static void next_frame(struct generator *g, struct can_frame *cf)
+{
+	struct can_frame *frame = &g->frame;
+	uint64_t rnd;
+	int i;
+
+	if (id_mode == MODE_RANDOM || dlc_mode == MODE_RANDOM) {
+
+		rnd = xorshift(&g->rng);
+
+		if (id_mode == MODE_RANDOM) {
+
+			frame->can_id = rnd;
+
+			if (extended) {
+				frame->can_id &= CAN_EFF_MASK;
+				frame->can_id |= CAN_EFF_FLAG;
+			} else
+				frame->can_id &= CAN_SFF_MASK;
+		}
+
+		if (dlc_mode == MODE_RANDOM) {
+
+			frame->can_dlc = (rnd >> 32) & 0xF;
+
+			if (frame->can_dlc & 8)
+				frame->can_dlc = 8; /* for about 50% of the frames */
+
+			if ((data_mode == MODE_INCREMENT) && !frame->can_dlc)
+				frame->can_dlc = 1; /* min dlc value for incr. data */
+		}
+	}
+
+	if (data_mode == MODE_RANDOM) {
+
+		/* that's what the 64 bit alignment of data[] is for ... :) */
+		*(uint64_t *)(&frame->data[0]) = xorshift(&g->rng);
+	}
+
+	*cf = *frame;
+
+	if (id_mode == MODE_INCREMENT) {
+
+		frame->can_id++;
+
+		if (extended) {
+			frame->can_id &= CAN_EFF_MASK;
+			frame->can_id |= CAN_EFF_FLAG;
+		} else
+			frame->can_id &= CAN_SFF_MASK;
+	}
+
+	if (dlc_mode == MODE_INCREMENT) {
+
+		frame->can_dlc++;
+		frame->can_dlc %= 9;
+
+		if ((data_mode == MODE_INCREMENT) && !frame->can_dlc)
+			frame->can_dlc = 1; /* min dlc value for incr. data */
+	}
+
+	if (data_mode == MODE_INCREMENT) {
+
+		g->incdata++;
+
+		for (i=0; i<8 ;i++)
+			frame->data[i] = (g->incdata >> i*8) & 0xFFULL;
+	}
+}
+
+/* pacing interval in ns which is 'used up' by sending this frame */
+static double frame_cost(struct can_frame *cf)
+{
+	if (load)
+		return frame_bits(cf) * 1e9 * 100.0 / (load * bitrate);
+
+	if (rate)
+		return 1e9 / rate;
+
+	return gap * 1e6;
+}
+
+/*
+ * send n frames with as few syscalls as possible
+ * returns the number of frames that have been sent or -1 on errors
+ */
+static int send_batch(struct generator *g, struct mmsghdr *msgs, int n)
+{
+	struct pollfd fds = { .fd = g->s, .events = POLLOUT };
+	int done = 0, sent = 0;
+	int ret;
+
+	/* the kernel sets msg_len of the sent frames */
+	for (ret = 0; ret < n; ret++)
+		msgs[ret].msg_len = 1;
+
+	while (done < n) {
+		ret = sendmmsg(g->s, &msgs[done], n - done, 0);
+		if (ret >= 0) {
+			done += ret;
+			sent += ret;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != ENOBUFS || (!ignore_enobufs && !polltimeout)) {
+			perror("write");
+			return -1;
+		}
+
+		if (polltimeout) {
+			/* wait for the write socket (with timeout) */
+			if (poll(&fds, 1, polltimeout) < 0) {
+				perror("poll");
+				return -1;
+			}
+		} else {
+			/* drop this frame */
+			__atomic_add_fetch(&g->enobufs, 1, __ATOMIC_RELAXED);
+			msgs[done].msg_len = 0;
+			done++;
+		}
+	}
+
+	return sent;
+}
+
+static void init_batch(struct can_frame *frames, struct iovec *iov,
+		       struct mmsghdr *msgs)
+{
+	int i;
+
+	memset(msgs, 0, MAXBATCH * sizeof(*msgs));
+	for (i = 0; i < MAXBATCH; i++) {
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = sizeof(struct can_frame);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+/*
+ * send, print and account cnt frames with 'bits' bits in total
+ * returns the number of sent frames or -1 on errors
+ */
+static int flush_frames(struct generator *g, struct can_frame *frames,
+			struct mmsghdr *msgs, int cnt, unsigned long long bits)
+{
+	int sent, i;
+
+	if (!cnt)
+		return 0;
+
+	sent = send_batch(g, msgs, cnt);
+	if (sent < 0) {
+		g->failed = 1;
+		running = 0;
+		return -1;
+	}
+
+	if (verbose) {
+		flockfile(stdout);
+		for (i = 0; i < cnt; i++) {
+			printf("  %s  ", g->ifname);
+
+			if (verbose > 1)
+				fprint_long_canframe(stdout, &frames[i], "\n", (verbose > 2)?1:0);
+			else
+				fprint_canframe(stdout, &frames[i], "\n", 1);
+		}
+		funlockfile(stdout);
+	}
+
+	/* dropped frames (ignored ENOBUFS) do not count */
+	for (i = 0; i < cnt; i++) {
+		if (!msgs[i].msg_len)
+			bits -= frame_bits(&frames[i]);
+	}
+	__atomic_add_fetch(&g->frames, sent, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&g->bits, bits, __ATOMIC_RELAXED);
+
+	return sent;
+}
+
+static void *generator_thread(void *arg)
+{
+	struct generator *g = arg;
+	struct can_frame frames[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	struct mmsghdr msgs[MAXBATCH];
+	unsigned long long bits;
+	struct timespec ts;
+	uint64_t now = 0;
+	int paced = (rate || load || gap);
+	int finished = 0;
+	int cnt;
+
+	init_batch(frames, iov, msgs);
+
+	g->tat = now_ns();
+
+	while (running && !finished) {
+
+		if (paced) {
+			/* token bucket: wait until the next frame is due */
+			now = now_ns();
+			if (g->tat > now) {
+				ts.tv_sec = (uint64_t)g->tat / 1000000000ULL;
+				ts.tv_nsec = (uint64_t)g->tat % 1000000000ULL;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+				continue; /* check 'running' and the time again */
+			}
+
+			/* do not catch up with long stalls in one burst */
+			if (g->tat < now - BURST_NS)
+				g->tat = now - BURST_NS;
+		}
+
+		/* collect all frames that are due */
+		for (cnt = 0, bits = 0; cnt < MAXBATCH; ) {
+			next_frame(g, &frames[cnt]);
+			bits += frame_bits(&frames[cnt]);
+			cnt++;
+
+			if (g->remaining && !--g->remaining) {
+				finished = 1;
+				break;
+			}
+
+			if (paced) {
+				g->tat += frame_cost(&frames[cnt - 1]);
+				if (g->tat > now)
+					break;
+			}
+		}
+
+		if (flush_frames(g, frames, msgs, cnt, bits) < 0)
+			break;
+	}
+
+	g->stop = now_ns();
+	__atomic_store_n(&g->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/* next frame of a traffic model source - payload bytes change randomly */
+static void model_frame(struct generator *g, struct source *src,
+			struct can_frame *cf)
+{
+	uint64_t pick[2], val;
+	unsigned int r, i;
+	unsigned char b;
+
+	pick[0] = xorshift(&g->rng);
+	pick[1] = xorshift(&g->rng);
+	val = xorshift(&g->rng);
+
+	for (i = 0; i < src->frame.can_dlc; i++) {
+		/* 16 random bits against the per mille probability */
+		r = (pick[i / 4] >> (16 * (i % 4))) & 0xFFFF;
+		if (r * 1000 >= src->id->change[i] * 65536U)
+			continue;
+
+		b = val >> (8 * i);
+		if (b == src->frame.data[i])
+			b ^= 1; /* a change has to change the value */
+		src->frame.data[i] = b;
+	}
+
+	*cf = src->frame;
+}
+
+static void *model_thread(void *arg)
+{
+	struct generator *g = arg;
+	struct can_frame frames[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	struct mmsghdr msgs[MAXBATCH];
+	unsigned long long bits = 0;
+	struct source *src;
+	struct timerwheel tw;
+	struct tw_timer *t, *next;
+	struct timespec ts;
+	uint64_t now, due;
+	unsigned int i, median;
+	int finished = 0;
+	int cnt = 0;
+
+	init_batch(frames, iov, msgs);
+
+	src = calloc(model.ids, sizeof(*src));
+	now = now_ns();
+	if (!src || tw_init(&tw, MODEL_SLOTS, MODEL_TICK_NS, now)) {
+		perror("traffic model");
+		g->failed = 1;
+		running = 0;
+		goto out;
+	}
+
+	for (i = 0; i < model.ids; i++) {
+		src[i].id = &model.id[i];
+
+		/* one-shot CAN IDs have no period */
+		if (!src[i].id->period[TM_QUANTILES - 1])
+			continue;
+
+		src[i].frame.can_id = src[i].id->can_id;
+		src[i].frame.can_dlc = src[i].id->dlc;
+		memcpy(src[i].frame.data, src[i].id->data, 8);
+
+		/* random phase - not all CAN IDs start at the same time */
+		median = src[i].id->period[TM_QUANTILES / 2];
+		tw_add(&tw, &src[i].timer,
+		       now + (xorshift(&g->rng) % (median + 1)) * 1000ULL);
+	}
+
+	while (running && !finished) {
+
+		now = now_ns();
+
+		for (t = tw_expire(&tw, now); t; t = next) {
+			struct source *s = (struct source *)t;
+
+			next = t->next;
+
+			model_frame(g, s, &frames[cnt]);
+			bits += frame_bits(&frames[cnt]);
+			cnt++;
+
+			/* drift free: the next period starts at this due time */
+			due = t->expires + tm_sample_period(s->id, xorshift(&g->rng)) * 1000ULL;
+			if (due < now - BURST_NS)
+				due = now; /* do not catch up with long stalls */
+			tw_add(&tw, t, due);
+
+			if (g->remaining && !--g->remaining)
+				finished = 1;
+
+			if (cnt == MAXBATCH || finished) {
+				if (flush_frames(g, frames, msgs, cnt, bits) < 0)
+					goto out;
+				cnt = 0;
+				bits = 0;
+				if (finished)
+					goto out;
+			}
+		}
+
+		if (flush_frames(g, frames, msgs, cnt, bits) < 0)
+			goto out;
+		cnt = 0;
+		bits = 0;
+
+		/* sleep until the next tick of the timer wheel */
+		due = tw.current + MODEL_TICK_NS;
+		ts.tv_sec = due / 1000000000ULL;
+		ts.tv_nsec = due % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+out:
+	tw_free(&tw);
+	free(src);
+	g->stop = now_ns();
+	__atomic_store_n(&g->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static void print_rates(double secs, unsigned long long *frames,
+			unsigned long long *bits)
+{
+	unsigned long long f, b;
+	int i;
+
+	for (i = 0; i < ngen; i++) {
+		f = __atomic_load_n(&gen[i].frames, __ATOMIC_RELAXED);
+		b = __atomic_load_n(&gen[i].bits, __ATOMIC_RELAXED);
+
+		fprintf(stderr, "%s: %.0f frames/s %.0f bit/s", gen[i].ifname,
+			(f - frames[i]) / secs, (b - bits[i]) / secs);
+		if (bitrate)
+			fprintf(stderr, " (%.1f%%)",
+				100.0 * (b - bits[i]) / secs / bitrate);
+		fprintf(stderr, "%s", (i == ngen - 1) ? "\n" : "  ");
+
+		frames[i] = f;
+		bits[i] = b;
+	}
+}
+
 int main(int argc, char **argv)
 {
-	unsigned long gap = DEFAULT_GAP; 
-	unsigned long polltimeout = 0;
-	unsigned char ignore_enobufs = 0;
-	unsigned char extended = 0;
-	unsigned char id_mode = MODE_RANDOM;
-	unsigned char data_mode = MODE_RANDOM;
-	unsigned char dlc_mode = MODE_RANDOM;
 	unsigned char loopback_disable = 0;
-	unsigned char verbose = 0;
-	int count = 0;
-	uint64_t incdata = 0;
+	unsigned long count = 0;
+	unsigned long stats = 0;
+	uint64_t seed = 0;
+	int have_seed = 0;
+	char *modelname = NULL;
+	FILE *mf;
 
 	int opt;
 	int s; /* socket */
-	struct pollfd fds;
 
 	struct sockaddr_can addr;
 	static struct can_frame frame;
-	int nbytes;
-	int i;
 	struct ifreq ifr;
+	int i;
 
+	unsigned long long enobufs_count = 0;
+	int failed = 0;
+	unsigned long long frames[MAXGEN], bits[MAXGEN];
+	uint64_t start, last, now;
 	struct timespec ts;
-	struct timeval now;
-
-	/* set seed value for pseudo random numbers */
-	gettimeofday(&now, NULL);
-	srandom(now.tv_usec);
+	struct timeval tv;
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
 
-	while ((opt = getopt(argc, argv, "ig:eI:L:D:xp:n:vh?")) != -1) {
+	while ((opt = getopt(argc, argv, "ig:r:u:b:eI:L:D:xp:n:S:s:M:vh?")) != -1) {
 		switch (opt) {
 
 		case 'i':
@@ -176,6 +684,26 @@ int main(int argc, char **argv)
 			gap = strtoul(optarg, NULL, 10);
 			break;
 
+		case 'r':
+			rate = strtod(optarg, NULL);
+			if (rate <= 0) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'u':
+			load = strtod(optarg, NULL);
+			if (load <= 0 || load > 100) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'b':
+			bitrate = strtoul(optarg, NULL, 10);
+			break;
+
 		case 'e':
 			extended = 1;
 			break;
@@ -229,13 +757,26 @@ int main(int argc, char **argv)
 			break;
 
 		case 'n':
-			count = atoi(optarg);
+			count = strtoul(optarg, NULL, 10);
 			if (count < 1) {
 				print_usage(basename(argv[0]));
 				return 1;
 			}
 			break;
 
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			have_seed = 1;
+			break;
+
+		case 's':
+			stats = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'M':
+			modelname = optarg;
+			break;
+
 		case '?':
 		case 'h':
 		default:
@@ -245,13 +786,41 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (optind == argc) {
+	if (optind == argc || argc - optind > MAXGEN) {
 		print_usage(basename(argv[0]));
 		return 1;
 	}
 
-	ts.tv_sec = gap / 1000;
-	ts.tv_nsec = (gap % 1000) * 1000000;
+	if (load && !bitrate) {
+		printf("The bus load (-u) needs the CAN bitrate (-b).\n");
+		return 1;
+	}
+
+	if (modelname) {
+		mf = fopen(modelname, "r");
+		if (!mf) {
+			perror("traffic model");
+			return 1;
+		}
+		if (tm_read(mf, &model))
+			return 1;
+		fclose(mf);
+
+		if (!model.ids) {
+			printf("The traffic model '%s' contains no CAN IDs.\n", modelname);
+			return 1;
+		}
+	}
+
+	if (!have_seed) {
+		/* set seed value for pseudo random numbers */
+		gettimeofday(&tv, NULL);
+		seed = tv.tv_sec * 1000000ULL + tv.tv_usec;
+	}
+
+	if (verbose > 1)
+		printf("random seed: %llu (use -S to reproduce)\n",
+		       (unsigned long long)seed);
 
 	if (id_mode == MODE_FIX) {
 
@@ -274,156 +843,117 @@ int main(int argc, char **argv)
 	if ((data_mode == MODE_INCREMENT) && !frame.can_dlc)
 		frame.can_dlc = 1; /* min dlc value for incr. data */
 
-	if (strlen(argv[optind]) >= IFNAMSIZ) {
-		printf("Name of CAN device '%s' is too long!\n\n", argv[optind]);
-		return 1;
-	}
-
-	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
-		perror("socket");
-		return 1;
-	}
-
-	addr.can_family = AF_CAN;
+	for (ngen = 0; optind + ngen < argc; ngen++) {
+		struct generator *g = &gen[ngen];
 
-	strcpy(ifr.ifr_name, argv[optind]);
-	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
-		perror("SIOCGIFINDEX");
-		return 1;
-	}
-	addr.can_ifindex = ifr.ifr_ifindex;
-
-	/* disable default receive filter on this RAW socket */
-	/* This is obsolete as we do not read from the socket at all, but for */
-	/* this reason we can remove the receive list in the Kernel to save a */
-	/* little (really a very little!) CPU usage.                          */
-	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
-
-	if (loopback_disable) {
-		int loopback = 0;
-
-		setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
-			   &loopback, sizeof(loopback));
-	}
-
-	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
-		return 1;
-	}
-
-	if (polltimeout) {
-		fds.fd = s;
-		fds.events = POLLOUT;
-	}
-
-	while (running) {
-
-		if (count && (--count == 0))
-			running = 0;
-
-		if (id_mode == MODE_RANDOM) {
+		g->ifname = argv[optind + ngen];
 
-			frame.can_id = random();
-
-			if (extended) {
-				frame.can_id &= CAN_EFF_MASK;
-				frame.can_id |= CAN_EFF_FLAG;
-			} else
-				frame.can_id &= CAN_SFF_MASK;
+		if (strlen(g->ifname) >= IFNAMSIZ) {
+			printf("Name of CAN device '%s' is too long!\n\n", g->ifname);
+			return 1;
 		}
 
-		if (dlc_mode == MODE_RANDOM) {
-
-			frame.can_dlc = random() & 0xF;
-
-			if (frame.can_dlc & 8)
-				frame.can_dlc = 8; /* for about 50% of the frames */
-
-			if ((data_mode == MODE_INCREMENT) && !frame.can_dlc)
-				frame.can_dlc = 1; /* min dlc value for incr. data */
+		if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+			perror("socket");
+			return 1;
 		}
 
-		if (data_mode == MODE_RANDOM) {
+		addr.can_family = AF_CAN;
 
-			/* that's what the 64 bit alignment of data[] is for ... :) */
-			*(unsigned long*)(&frame.data[0]) = random();
-			*(unsigned long*)(&frame.data[4]) = random();
+		strcpy(ifr.ifr_name, g->ifname);
+		if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+			perror("SIOCGIFINDEX");
+			return 1;
 		}
+		addr.can_ifindex = ifr.ifr_ifindex;
 
-		if (verbose) {
+		/* disable default receive filter on this RAW socket */
+		/* This is obsolete as we do not read from the socket at all, but for */
+		/* this reason we can remove the receive list in the Kernel to save a */
+		/* little (really a very little!) CPU usage.                          */
+		setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
 
-			printf("  %s  ", argv[optind]);
+		if (loopback_disable) {
+			int loopback = 0;
 
-			if (verbose > 1)
-				fprint_long_canframe(stdout, &frame, "\n", (verbose > 2)?1:0);
-			else
-				fprint_canframe(stdout, &frame, "\n", 1);
+			setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
+				   &loopback, sizeof(loopback));
 		}
 
-resend:
-		nbytes = write(s, &frame, sizeof(struct can_frame));
-		if (nbytes < 0) {
-			if (errno != ENOBUFS) {
-				perror("write");
-				return 1;
-			}
-			if (!ignore_enobufs && !polltimeout) {
-				perror("write");
-				return 1;
-			}
-			if (polltimeout) {
-				/* wait for the write socket (with timeout) */
-				if (poll(&fds, 1, polltimeout) < 0) {
-					perror("poll");
-					return 1;
-				} else
-					goto resend;
-			} else
-				enobufs_count++;
-
-		} else if (nbytes < sizeof(struct can_frame)) {
-			fprintf(stderr, "write: incomplete CAN frame\n");
+		if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("bind");
 			return 1;
 		}
 
-		if (gap) /* gap == 0 => performance test :-] */
-			if (nanosleep(&ts, NULL))
-				return 1;
-		    
-		if (id_mode == MODE_INCREMENT) {
+		g->s = s;
+		g->frame = frame;
+		g->remaining = count;
+		g->rng = seed_state(seed + ngen);
+	}
 
-			frame.can_id++;
+	/* large buffer instead of a write() for each printed frame */
+	if (verbose)
+		setvbuf(stdout, NULL, _IOFBF, 65536);
 
-			if (extended) {
-				frame.can_id &= CAN_EFF_MASK;
-				frame.can_id |= CAN_EFF_FLAG;
-			} else
-				frame.can_id &= CAN_SFF_MASK;
+	for (i = 0; i < ngen; i++) {
+		if (pthread_create(&gen[i].thread, NULL,
+				   (modelname) ? model_thread : generator_thread,
+				   &gen[i])) {
+			perror("pthread_create");
+			return 1;
 		}
+	}
 
-		if (dlc_mode == MODE_INCREMENT) {
+	memset(frames, 0, sizeof(frames));
+	memset(bits, 0, sizeof(bits));
+	start = last = now_ns();
+
+	/* live statistics - the generators stop on signals or -n */
+	for (i = 0; i < ngen; ) {
+		if (__atomic_load_n(&gen[i].done, __ATOMIC_ACQUIRE)) {
+			i++;
+			continue;
+		}
 
-			frame.can_dlc++;
-			frame.can_dlc %= 9;
+		ts.tv_sec = 0;
+		ts.tv_nsec = 100000000; /* 100ms */
+		nanosleep(&ts, NULL);
 
-			if ((data_mode == MODE_INCREMENT) && !frame.can_dlc)
-				frame.can_dlc = 1; /* min dlc value for incr. data */
+		if (stats) {
+			now = now_ns();
+			if (now - last >= stats * 1000000000ULL) {
+				print_rates((now - last) / 1e9, frames, bits);
+				last = now;
+			}
 		}
+	}
 
-		if (data_mode == MODE_INCREMENT) {
+	for (i = 0; i < ngen; i++) {
+		pthread_join(gen[i].thread, NULL);
+		enobufs_count += gen[i].enobufs;
+		failed |= gen[i].failed;
+		close(gen[i].s);
+	}
 
-			incdata++;
+	fflush(stdout);
 
-			for (i=0; i<8 ;i++)
-				frame.data[i] = (incdata >> i*8) & 0xFFULL;
+	if (stats) {
+		/* average over the whole run */
+		for (now = start, i = 0; i < ngen; i++) {
+			if (gen[i].stop > now)
+				now = gen[i].stop;
 		}
+		memset(frames, 0, sizeof(frames));
+		memset(bits, 0, sizeof(bits));
+		fprintf(stderr, "total: ");
+		print_rates((now - start) / 1e9, frames, bits);
 	}
 
 	if (enobufs_count)
 		printf("\nCounted %llu ENOBUFS return values on write().\n\n",
 		       enobufs_count);
 
-	close(s);
+	tm_free(&model);
 
-	return 0;
+	return failed;
 }
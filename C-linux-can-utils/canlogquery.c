@@ -0,0 +1,262 @@
+/*
+ * canlogquery.c - extract frames by time range and CAN ID using the log index
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "lib.h"
+#include "binlog.h"
+#include "logindex.h"
+
+#define BUFSZ 400 /* for one line in the logfile */
+#define MAXIDS 64
+
+extern int optind, opterr, optopt;
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "\nUsage: %s [options] <logfile>\n\n", prg);
+	fprintf(stderr, "Options: -f <time>     (start of time range)\n");
+	fprintf(stderr, "         -t <time>     (end of time range)\n");
+	fprintf(stderr, "         -i <id>[,id]* (only frames with these CAN IDs)\n");
+	fprintf(stderr, "         -r            (rebuild the index file)\n");
+	fprintf(stderr, "         -N            (nanosecond timestamps in output)\n");
+	fprintf(stderr, "         -v            (print index statistics on stderr)\n");
+	fprintf(stderr, "\nTimes are given in seconds relative to the start of the log"
+		" (e.g. '2400.5')\n");
+	fprintf(stderr, "or as absolute time '@<secs since epoch>'.\n");
+	fprintf(stderr, "CAN IDs with more than 3 hex digits are extended (EFF) IDs.\n");
+	fprintf(stderr, "The index '<logfile>.idx' is created on first use.\n\n");
+	fprintf(stderr, "Example: %s -f 2400 -t 2520 -i 02000100 candump.log\n\n", prg);
+}
+
+static int parse_ids(char *arg, canid_t *ids)
+{
+	char *tok, *end;
+	int n = 0;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (n == MAXIDS)
+			return -1;
+		ids[n] = strtoul(tok, &end, 16);
+		if (*end || end == tok)
+			return -1;
+		if (strlen(tok) > 3 || ids[n] > CAN_SFF_MASK)
+			ids[n] |= CAN_EFF_FLAG;
+		ids[n] = logidx_key(ids[n]);
+		n++;
+	}
+
+	return n;
+}
+
+static inline int id_match(canid_t *ids, int nids, canid_t can_id)
+{
+	canid_t key = logidx_key(can_id);
+	int i;
+
+	if (!nids)
+		return 1;
+
+	for (i = 0; i < nids; i++)
+		if (ids[i] == key)
+			return 1;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
+	static struct binlog_reader br;
+	static struct binlog_rec rec;
+	canid_t ids[MAXIDS];
+	struct logidx *li;
+	struct logidx_block *b;
+	struct can_frame cf;
+	struct timespec ts;
+	uint64_t from_ns = 0, to_ns = UINT64_MAX, ns;
+	char *from = NULL, *to = NULL;
+	unsigned long scanned = 0, skipped = 0, read = 0, matched = 0;
+	int nids = 0, rebuild = 0, verbose = 0, tsdigits = 6;
+	int opt, blk, n;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "f:t:i:rNv?")) != -1) {
+		switch (opt) {
+		case 'f':
+			from = optarg;
+			break;
+
+		case 't':
+			to = optarg;
+			break;
+
+		case 'i':
+			nids = parse_ids(optarg, ids);
+			if (nids < 0) {
+				fprintf(stderr, "Invalid CAN ID list (max. %d IDs)!\n", MAXIDS);
+				return 1;
+			}
+			break;
+
+		case 'r':
+			rebuild = 1;
+			break;
+
+		case 'N':
+			tsdigits = 9;
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
+	li = logidx_open(argv[optind], rebuild, verbose);
+	if (!li)
+		return 1;
+
+	if ((from && logidx_parse_time(from, li->start_ns, &from_ns)) ||
+	    (to && logidx_parse_time(to, li->start_ns, &to_ns))) {
+		fprintf(stderr, "Invalid time argument!\n");
+		return 1;
+	}
+
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		perror("logfile");
+		return 1;
+	}
+
+	if (li->binary && binlog_open(&br, f)) {
+		fprintf(stderr, "incorrect binary log file header\n");
+		return 1;
+	}
+
+	for (blk = logidx_find(li, from_ns); !logidx_beyond(li, blk, to_ns); blk++) {
+
+		b = &li->blk[blk];
+
+		/* skip blocks outside the time range or without the wanted IDs */
+		if (b->max_ns < from_ns || b->min_ns > to_ns ||
+		    !logidx_may_contain(b, ids, nids)) {
+			skipped++;
+			continue;
+		}
+
+		scanned++;
+
+		if (li->binary) {
+			if (binlog_seek(&br, b->offset))
+				break;
+		} else if (fseeko(f, b->offset, SEEK_SET))
+			break;
+
+		for (n = 0; n < b->frames; ) {
+
+			if (li->binary) {
+				if (binlog_read(&br, &rec) <= 0)
+					break;
+				if (rec.type != BINLOG_REC_FRAME)
+					continue;
+				ts = rec.ts;
+				strcpy(device, rec.ifname);
+				cf = rec.frame;
+			} else {
+				if (!fgets(buf, BUFSZ-1, f))
+					break;
+				if (buf[0] != '(')
+					continue;
+				if (parse_logline(buf, &ts, device, ascframe) ||
+				    parse_canframe(ascframe, &cf)) {
+					fprintf(stderr, "incorrect line format in logfile\n");
+					return 1;
+				}
+			}
+
+			n++;
+			read++;
+
+			ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			if (ns < from_ns || ns > to_ns || !id_match(ids, nids, cf.can_id))
+				continue;
+
+			sprint_canframe(ascframe, &cf, 0);
+			printf("(%ld.%0*ld) %s %s\n", ts.tv_sec, tsdigits,
+			       (tsdigits == 9) ? ts.tv_nsec : ts.tv_nsec / 1000,
+			       device, ascframe);
+			matched++;
+		}
+	}
+
+	fflush(stdout);
+
+	if (verbose)
+		fprintf(stderr, "%u blocks: %lu scanned, %lu skipped, "
+			"%lu frames read, %lu matched\n",
+			li->blocks, scanned, skipped, read, matched);
+
+	if (li->binary)
+		binlog_close(&br);
+	fclose(f);
+	logidx_free(li);
+
+	return 0;
+}
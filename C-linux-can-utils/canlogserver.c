@@ -45,6 +45,7 @@
  *
  */
 
+#define _GNU_SOURCE /* recvmmsg() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -53,32 +54,154 @@
 #include <ctype.h>
 #include <libgen.h>
 #include <time.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <endian.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <signal.h>
-#include <wait.h>
 #include <errno.h>
 
 #include "lib.h"
+#include "canfilter.h"
+#include "metrics.h"
 
-#define MAXDEV 6 /* change sscanf()'s manually if changed here */
+#define MAXSOCK 16    /* max. number of CAN interfaces given on the cmdline */
+#define MAXIFNAMES 30 /* size of receive name index to omit ioctls */
 #define ANYDEV "any"
 #define ANL "\r\n" /* newline in ASC mode */
 
 #define DEFPORT 28700
 
-static char devname[MAXDEV][IFNAMSIZ+1];
-static int  dindex[MAXDEV];
+#define RINGSIZE (4 << 20) /* formatted log lines shared by all clients */
+#define RECS (1 << 17)     /* frames in the ring (> max. lag / shortest line) */
+#define MAXCLIENTS 64      /* one bit in struct logrec 'clients' */
+#define MAXBATCH 64        /* CAN frames fetched with one recvmmsg() */
+#define MAXLINE 128        /* one formatted log line */
+#define MAXIOV 256         /* max. pieces gathered by one writev() */
+#define MAXWRITE (256 << 10) /* max. bytes gathered by one writev() */
+#define MAXREQ 1024        /* one client request line */
+#define BINBATCH 256       /* max. frames in one binary message */
+#define PENDSIZE 8192      /* binary message headers and cut frames */
+#define DEFLAG 1024        /* default max. client lag in kbytes */
+
+/* epoll event tags */
+#define TAG_LISTEN 0x10000
+#define TAG_CLIENT 0x20000
+
+/*
+ * Binary protocol (requested by the client with 'binary'):
+ *
+ * The stream consists of messages with a 8 byte header
+ *
+ *   u32 len (bytes following the header), u16 type, u16 count
+ *
+ * followed by 'count' elements. All values are little endian.
+ *
+ *   MSG_FRAMES: count * struct binrec (24 bytes each)
+ *   MSG_IFACE:  count * (u8 dev, char name[IFNAMSIZ]) - sent before the
+ *               first frames referencing new 'dev' numbers
+ *   MSG_DROP:   count = 0, u32 number of frames skipped due to lag
+ */
+#define MSG_FRAMES 1
+#define MSG_IFACE  2
+#define MSG_DROP   3
+
+struct binhdr {
+	uint32_t len;
+	uint16_t type;
+	uint16_t count;
+};
+
+struct binrec {
+	uint64_t ts;      /* timestamp in ns */
+	uint32_t can_id;  /* including EFF/RTR/ERR flags */
+	uint8_t dlc;
+	uint8_t dev;      /* interface number from MSG_IFACE */
+	uint8_t res[2];
+	uint8_t data[8];
+};
+
+static char devname[MAXIFNAMES][IFNAMSIZ+1];
+static int  dindex[MAXIFNAMES];
 static int  max_devname_len;
+static unsigned int ifgen = 1; /* changes of the interface index cache */
+
+/*
+ * Each received CAN frame is formatted once into the ring and encoded
+ * once into brec[]. 'head' is the total number of bytes written, the
+ * ring holds the last RINGSIZE. 'fhead' is the total number of frames,
+ * rec[] and brec[] hold the last RECS. Every client sends from its own
+ * position ('seq') in the frame sequence.
+ */
+static char ring[RINGSIZE];
+static unsigned long long head;
+
+struct logrec {
+	unsigned long long pos;      /* log line in ring[] */
+	unsigned short len;
+	uint64_t clients;            /* clients subscribed to this frame */
+};
+
+static struct logrec rec[RECS];
+static struct binrec brec[RECS];
+static unsigned long long fhead;
+
+struct client {
+	int fd;
+	struct sockaddr_in addr;
+	unsigned long long seq;      /* next frame to send */
+	unsigned int off;            /* bytes of this frame already sent */
+	unsigned char pend[PENDSIZE]; /* sent before the frames */
+	int plen, poff;
+	int pollout;                 /* waiting for EPOLLOUT */
+	struct timespec since;
+
+	/* requests */
+	char req[MAXREQ];
+	int rlen;
+	int binary, want_binary;
+	struct cfx_filterset fs;
+	int subscribed;
+
+	/* binary protocol state */
+	unsigned int batch;          /* frames left in the current message */
+	unsigned int ifgen;
+	unsigned long undelivered;   /* skipped frames not reported yet */
+
+	/* statistics */
+	unsigned long long sent;
+	unsigned long long maxlag;
+	unsigned long long dropped;
+	unsigned long drops;
+};
+
+static struct client client[MAXCLIENTS];
+static int clients;
+static int epfd;
+static unsigned long long maxlag = DEFLAG * 1024ULL;
+static int lag_disconnect;
+
+/* compiled subscriptions - one bit per client */
+static uint64_t sff_clients[2 * (CAN_SFF_MASK + 1)]; /* SFF ID, RTR + 0x800 */
+static uint64_t all_clients;  /* no subscription */
+static uint64_t eff_clients;  /* EFF and error frames checked per client */
+
+/* exported with -M - NULL when disabled */
+static struct metric *m_frames[MAXSOCK];
+static struct metric *m_bytes, *m_clients, *m_errors;
+static struct metric *m_dropped, *m_lagged;
 
 extern int optind, opterr, optopt;
 
@@ -86,20 +209,40 @@ static volatile int running = 1;
 
 void print_usage(char *prg)
 {
-	fprintf(stderr, "\nUsage: %s [options] <CAN interface>+\n", prg);
+	fprintf(stderr, "\nUsage: %s [options] <CAN interface>[,filter]*+\n", prg);
 	fprintf(stderr, "  (use CTRL-C to terminate %s)\n\n", prg);
 	fprintf(stderr, "Options: -m <mask>   (ID filter mask.  Default 0x00000000) *\n");
 	fprintf(stderr, "         -v <value>  (ID filter value. Default 0x00000000) *\n");
 	fprintf(stderr, "         -i <0|1>    (invert the specified ID filter) *\n");
 	fprintf(stderr, "         -e <emask>  (mask for error frames)\n");
 	fprintf(stderr, "         -p <port>   (listen on port <port>. Default: %d)\n", DEFPORT);
+	fprintf(stderr, "         -N          (nanosecond resolution for timestamps)\n");
+	fprintf(stderr, "         -H          (use hardware timestamps of the CAN controller if available)\n");
+	fprintf(stderr, "         -M <addr>   (export metrics in Prometheus format on unix:<path> or [<host>:]<port>)\n");
+	fprintf(stderr, "         -l <kbytes> (max. lag of a client. Default: %d kbytes)\n", DEFLAG);
+	fprintf(stderr, "         -d          (disconnect lagging clients instead of dropping data)\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "* The CAN ID filter matches, when ...\n");
 	fprintf(stderr, "       <received_can_id> & mask == value & mask\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "When using more than one CAN interface the options\n");
 	fprintf(stderr, "m/v/i/e have comma seperated values e.g. '-m 0,7FF,0'\n");
-	fprintf(stderr, "\nUse interface name '%s' to receive from all CAN interfaces.\n\n", ANYDEV);
+	fprintf(stderr, "\nUp to %d CAN interfaces can be specified. Alternatively to\n", MAXSOCK);
+	fprintf(stderr, "m/v/i/e each interface takes a comma separated filter set:\n");
+	fprintf(stderr, "       <can_id>:<can_mask> (matches when <received_can_id> & mask == can_id & mask)\n");
+	fprintf(stderr, "       <can_id>~<can_mask> (matches when <received_can_id> & mask != can_id & mask)\n");
+	fprintf(stderr, "       #<error_mask>       (set error frame filter, see include/linux/can/error.h)\n");
+	fprintf(stderr, "       [j|J]               (join the given CAN filters - logical AND semantic)\n");
+	fprintf(stderr, "e.g. '%s can0,123:7FF,400:700 can1,#FFFFFFFF'\n", prg);
+	fprintf(stderr, "\nUse interface name '%s' to receive from all CAN interfaces.\n", ANYDEV);
+	fprintf(stderr, "\nClients falling behind more than the max. lag skip the pending log lines\n");
+	fprintf(stderr, "(or are disconnected with -d). SIGUSR1 prints the client statistics.\n");
+	fprintf(stderr, "\nClients may send these requests (one per line):\n");
+	fprintf(stderr, "       filter <filterset>  (only send frames matching the filter set above)\n");
+	fprintf(stderr, "       filter              (send all frames again)\n");
+	fprintf(stderr, "       binary              (switch to the binary protocol)\n");
+	fprintf(stderr, "       ascii               (switch back to log lines)\n");
+	fprintf(stderr, "e.g. 'filter 123:7FF,400:700,#FFFFFFFF'\n\n");
 }
 
 int idx2dindex(int ifidx, int socket)
@@ -107,7 +250,7 @@ int idx2dindex(int ifidx, int socket)
 	int i;
 	struct ifreq ifr;
 
-	for (i=0; i<MAXDEV; i++) {
+	for (i=0; i<MAXIFNAMES; i++) {
 		if (dindex[i] == ifidx)
 			return i;
 	}
@@ -115,7 +258,7 @@ int idx2dindex(int ifidx, int socket)
 	/* create new interface index cache entry */
 
 	/* remove index cache zombies first */
-	for (i=0; i < MAXDEV; i++) {
+	for (i=0; i < MAXIFNAMES; i++) {
 		if (dindex[i]) {
 			ifr.ifr_ifindex = dindex[i];
 			if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
@@ -123,16 +266,17 @@ int idx2dindex(int ifidx, int socket)
 		}
 	}
 
-	for (i=0; i < MAXDEV; i++)
+	for (i=0; i < MAXIFNAMES; i++)
 		if (!dindex[i]) /* free entry */
 			break;
 
-	if (i == MAXDEV) {
-		printf("Interface index cache only supports %d interfaces.\n", MAXDEV);
+	if (i == MAXIFNAMES) {
+		printf("Interface index cache only supports %d interfaces.\n", MAXIFNAMES);
 		exit(1);
 	}
 
 	dindex[i] = ifidx;
+	ifgen++;
 
 	ifr.ifr_ifindex = ifidx;
 	if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
@@ -150,21 +294,532 @@ int idx2dindex(int ifidx, int socket)
 	return i;
 }
 
-/* 
- * This is a Signalhandler. When we get a signal, that a child
- * terminated, we wait for it, so the zombie will disappear.
+/*
+ * Parses the comma separated values of the m/v/i/e options into val[].
+ * Returns the number of values or -1 on a malformed list.
  */
-void childdied(int i)
+int parse_list(const char *arg, int base, __u32 *val)
 {
-	wait(NULL);
+	char *end;
+	int n = 0;
+
+	while (*arg) {
+		if (n == MAXSOCK)
+			return -1;
+		val[n++] = strtoul(arg, &end, base);
+		if (end == arg || (*end && *end != ','))
+			return -1;
+		arg = (*end) ? end + 1 : end;
+	}
+
+	return n;
 }
 
+static volatile int print_stats;
+
 /*
  * This is a Signalhandler for a cought SIGTERM
  */
 void shutdown_gra(int i)
 {
-	exit(0);
+	running = 0;
+}
+
+void request_stats(int i)
+{
+	print_stats = 1;
+}
+
+static void ring_append(const char *buf, int len)
+{
+	unsigned int pos = head % RINGSIZE;
+	unsigned int first = (len < RINGSIZE - pos) ? len : RINGSIZE - pos;
+
+	memcpy(&ring[pos], buf, first);
+	memcpy(ring, buf + first, len - first);
+	head += len;
+}
+
+/* recompile the subscription tables for client j */
+static void update_table(int j)
+{
+	struct client *c = &client[j];
+	uint64_t bit = 1ULL << j;
+	int active = (c->fd >= 0);
+	canid_t can_id;
+	int id;
+
+	all_clients &= ~bit;
+	eff_clients &= ~bit;
+	if (active && !c->subscribed)
+		all_clients |= bit;
+	if (active && c->subscribed)
+		eff_clients |= bit;
+
+	for (id = 0; id < 2 * (CAN_SFF_MASK + 1); id++) {
+		can_id = (id & CAN_SFF_MASK) | ((id > CAN_SFF_MASK) ? CAN_RTR_FLAG : 0);
+		if (active && (!c->subscribed || cfx_match_filterset(&c->fs, can_id)))
+			sff_clients[id] |= bit;
+		else
+			sff_clients[id] &= ~bit;
+	}
+}
+
+/* clients subscribed to a frame with this can_id */
+static uint64_t match_clients(canid_t can_id)
+{
+	uint64_t set, pending;
+	int j;
+
+	if (!(can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG)))
+		return sff_clients[(can_id & CAN_SFF_MASK) |
+				   ((can_id & CAN_RTR_FLAG) ? CAN_SFF_MASK + 1 : 0)];
+
+	set = all_clients;
+	for (pending = eff_clients; pending; pending &= pending - 1) {
+		j = __builtin_ctzll(pending);
+		if (cfx_match_filterset(&client[j].fs, can_id))
+			set |= 1ULL << j;
+	}
+
+	return set;
+}
+
+static inline int wants(struct client *c, unsigned long long seq)
+{
+	return (rec[seq % RECS].clients >> (c - client)) & 1;
+}
+
+static inline unsigned int frame_len(struct client *c, unsigned long long seq)
+{
+	return (c->binary) ? sizeof(struct binrec) : rec[seq % RECS].len;
+}
+
+static unsigned long long client_lag(struct client *c)
+{
+	return (c->seq == fhead) ? 0 : head - rec[c->seq % RECS].pos;
+}
+
+static void print_client(struct client *c, const char *event)
+{
+	struct timespec now;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - c->since.tv_sec) +
+		(now.tv_nsec - c->since.tv_nsec) / 1e9;
+
+	fprintf(stderr, "client %s:%d %s: %llu bytes in %.1f s (%.0f bytes/s), "
+		"lag %llu (max %llu) bytes, %lu drops (%llu frames)\n",
+		inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), event,
+		c->sent, secs, (secs > 0) ? c->sent / secs : 0.0,
+		client_lag(c), c->maxlag, c->drops, c->dropped);
+}
+
+static void close_client(struct client *c, const char *event)
+{
+	print_client(c, event);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	cfx_free_filterset(&c->fs);
+	c->subscribed = 0;
+	update_table(c - client);
+	clients--;
+	metric_set(m_clients, clients);
+}
+
+static void set_pollout(struct client *c, int on)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | ((on) ? EPOLLOUT : 0),
+		.data.u32 = TAG_CLIENT + (c - client),
+	};
+
+	if (c->pollout != on) {
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->pollout = on;
+	}
+}
+
+static void pend_append(struct client *c, const void *buf, int len)
+{
+	if (c->poff) {
+		memmove(c->pend, &c->pend[c->poff], c->plen - c->poff);
+		c->plen -= c->poff;
+		c->poff = 0;
+	}
+
+	memcpy(&c->pend[c->plen], buf, len);
+	c->plen += len;
+}
+
+/* queue a binary message header - 'len' bytes of payload have to follow */
+static void pend_msg(struct client *c, int type, int count, int len)
+{
+	struct binhdr hdr = {
+		.len = htole32(len),
+		.type = htole16(type),
+		.count = htole16(count),
+	};
+
+	pend_append(c, &hdr, sizeof(hdr));
+}
+
+/* copy the rest of frame 'seq' starting at byte 'off' to the pending data */
+static void pend_frame(struct client *c, unsigned long long seq, unsigned int off)
+{
+	unsigned int len = frame_len(c, seq) - off;
+	unsigned int pos, first;
+
+	if (c->binary) {
+		pend_append(c, (char *)&brec[seq % RECS] + off, len);
+		return;
+	}
+
+	pos = (rec[seq % RECS].pos + off) % RINGSIZE;
+	first = (len < RINGSIZE - pos) ? len : RINGSIZE - pos;
+	pend_append(c, &ring[pos], first);
+	pend_append(c, ring, len - first);
+}
+
+/*
+ * enforce the max. lag before the ring overwrites pending data
+ * returns -1 when the client has been disconnected
+ */
+static int check_lag(struct client *c)
+{
+	unsigned long long lag = client_lag(c);
+	unsigned long long seq = c->seq;
+	unsigned long n = 0;
+
+	if (lag > c->maxlag)
+		c->maxlag = lag;
+
+	if (lag <= maxlag)
+		return 0;
+
+	metric_add(m_lagged, 1);
+
+	if (lag_disconnect) {
+		close_client(c, "disconnected (lag)");
+		metric_add(m_errors, 1);
+		return -1;
+	}
+
+	/* keep the line (binary message) in progress complete */
+	while ((c->off || c->batch) && seq < fhead) {
+		if (wants(c, seq)) {
+			pend_frame(c, seq, c->off);
+			c->off = 0;
+			if (c->batch)
+				c->batch--;
+		}
+		seq++;
+	}
+
+	for (; seq < fhead; seq++)
+		n += wants(c, seq);
+
+	c->dropped += n;
+	c->undelivered += n;
+	c->drops++;
+	metric_add(m_dropped, n);
+	c->seq = fhead;
+
+	return 0;
+}
+
+/* binary protocol: queue the headers for the next message */
+static void start_batch(struct client *c)
+{
+	unsigned char iface[MAXIFNAMES * (1 + IFNAMSIZ)];
+	unsigned long long seq;
+	uint32_t dropped;
+	int i, n = 0;
+
+	if (c->undelivered) {
+		dropped = htole32(c->undelivered);
+		pend_msg(c, MSG_DROP, 0, sizeof(dropped));
+		pend_append(c, &dropped, sizeof(dropped));
+		c->undelivered = 0;
+	}
+
+	if (c->ifgen != ifgen) {
+		memset(iface, 0, sizeof(iface));
+		for (i = 0; i < MAXIFNAMES; i++) {
+			if (!dindex[i])
+				continue;
+			iface[n * (1 + IFNAMSIZ)] = i;
+			memcpy(&iface[n * (1 + IFNAMSIZ) + 1], devname[i],
+			       strnlen(devname[i], IFNAMSIZ));
+			n++;
+		}
+		pend_msg(c, MSG_IFACE, n, n * (1 + IFNAMSIZ));
+		pend_append(c, iface, n * (1 + IFNAMSIZ));
+		c->ifgen = ifgen;
+	}
+
+	for (n = 0, seq = c->seq; seq < fhead && n < BINBATCH; seq++)
+		n += wants(c, seq);
+
+	if (n) {
+		/* the frames are sent from brec[] */
+		pend_msg(c, MSG_FRAMES, n, n * sizeof(struct binrec));
+		c->batch = n;
+	}
+}
+
+/* add a piece of memory to iov[] - adjacent pieces are merged */
+static int add_iov(struct iovec *iov, int cnt, void *base, size_t len)
+{
+	if (cnt && (char *)iov[cnt-1].iov_base + iov[cnt-1].iov_len == base) {
+		iov[cnt-1].iov_len += len;
+		return cnt;
+	}
+
+	iov[cnt].iov_base = base;
+	iov[cnt].iov_len = len;
+
+	return cnt + 1;
+}
+
+/* add frame 'seq' starting at byte 'off' to iov[] - needs two free entries */
+static int add_frame(struct client *c, struct iovec *iov, int cnt,
+		     unsigned long long seq, unsigned int off)
+{
+	unsigned int len = frame_len(c, seq) - off;
+	unsigned int pos, first;
+
+	if (c->binary)
+		return add_iov(iov, cnt, (char *)&brec[seq % RECS] + off, len);
+
+	pos = (rec[seq % RECS].pos + off) % RINGSIZE;
+	first = (len < RINGSIZE - pos) ? len : RINGSIZE - pos;
+	cnt = add_iov(iov, cnt, &ring[pos], first);
+	if (first < len)
+		cnt = add_iov(iov, cnt, ring, len - first);
+
+	return cnt;
+}
+
+/*
+ * send the pending data of the client with as few writev() as possible
+ * returns -1 when the client has been disconnected
+ */
+static int flush_client(struct client *c)
+{
+	struct iovec iov[MAXIOV];
+	unsigned long long seq, end;
+	unsigned int off, left, len, bytes;
+	ssize_t n;
+	int cnt;
+
+	while (1) {
+		/* protocol changes take effect between frames */
+		if (!c->off && !c->batch && c->binary != c->want_binary) {
+			c->binary = c->want_binary;
+			c->ifgen = 0; /* resend the interface names */
+		}
+
+		if (c->binary && !c->batch && c->poff == c->plen)
+			start_batch(c);
+
+		cnt = 0;
+		if (c->poff < c->plen)
+			cnt = add_iov(iov, cnt, &c->pend[c->poff], c->plen - c->poff);
+
+		/* gather the subscribed frames (of the current message) */
+		off = c->off;
+		left = c->batch;
+		bytes = 0;
+		for (end = c->seq; end < fhead && cnt <= MAXIOV - 2 &&
+			     bytes < MAXWRITE; end++) {
+			if (!wants(c, end))
+				continue;
+			if (c->binary) {
+				if (!left)
+					break;
+				left--;
+			}
+			cnt = add_frame(c, iov, cnt, end, off);
+			bytes += frame_len(c, end) - off;
+			off = 0;
+		}
+
+		if (!cnt) {
+			c->seq = end; /* nothing subscribed up to here */
+			set_pollout(c, 0);
+			return 0;
+		}
+
+		n = writev(c->fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				set_pollout(c, 1);
+				return 0;
+			}
+			close_client(c, "write error");
+			metric_add(m_errors, 1);
+			return -1;
+		}
+
+		c->sent += n;
+		metric_add(m_bytes, n);
+
+		if (c->poff < c->plen) {
+			len = c->plen - c->poff;
+			if (n < len) {
+				c->poff += n;
+				continue;
+			}
+			c->poff = c->plen = 0;
+			n -= len;
+		}
+
+		for (seq = c->seq; seq < end; seq++) {
+			if (!wants(c, seq))
+				continue;
+			if (!n)
+				break;
+			len = frame_len(c, seq) - c->off;
+			if (n < len) {
+				c->off += n;
+				break;
+			}
+			n -= len;
+			c->off = 0;
+			if (c->batch)
+				c->batch--;
+		}
+		c->seq = seq;
+	}
+}
+
+/* set the subscription of a client: 'filter [<filterset>]' */
+static int subscribe(struct client *c, const char *spec)
+{
+	struct cfx_filterset fs;
+
+	memset(&fs, 0, sizeof(fs));
+	while (*spec == ' ')
+		spec++;
+
+	if (*spec) {
+		if (cfx_parse_filterset(spec, &fs) < 0)
+			return -1;
+		fs.nfilter = cfx_minimize(fs.filter, fs.nfilter, fs.join);
+	}
+
+	cfx_free_filterset(&c->fs);
+	c->fs = fs;
+	c->subscribed = (*spec != 0);
+	update_table(c - client);
+
+	return 0;
+}
+
+/*
+ * read and process the request lines of a client
+ * returns -1 when the client has been disconnected
+ */
+static int client_request(struct client *c)
+{
+	char *line, *nl;
+	int len;
+
+	len = read(c->fd, &c->req[c->rlen], sizeof(c->req) - 1 - c->rlen);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (len <= 0) {
+		close_client(c, "disconnected");
+		return -1;
+	}
+
+	c->rlen += len;
+	c->req[c->rlen] = 0;
+
+	line = c->req;
+	while ((nl = strchr(line, '\n'))) {
+		*nl = 0;
+		if (nl > line && nl[-1] == '\r')
+			nl[-1] = 0;
+
+		if (!strcmp(line, "binary"))
+			c->want_binary = 1;
+		else if (!strcmp(line, "ascii"))
+			c->want_binary = 0;
+		else if (strncmp(line, "filter", 6) ||
+			 (line[6] && line[6] != ' ') || subscribe(c, line + 6)) {
+			close_client(c, "bad request");
+			metric_add(m_errors, 1);
+			return -1;
+		}
+		line = nl + 1;
+	}
+
+	c->rlen -= line - c->req;
+	memmove(c->req, line, c->rlen);
+
+	if (c->rlen == sizeof(c->req) - 1) {
+		close_client(c, "request too long");
+		metric_add(m_errors, 1);
+		return -1;
+	}
+
+	/* a new protocol applies at once when idle */
+	if (!c->pollout)
+		return flush_client(c);
+
+	return 0;
+}
+
+static void accept_client(int socki)
+{
+	struct epoll_event ev;
+	struct sockaddr_in addr;
+	socklen_t sin_size = sizeof(addr);
+	struct client *c;
+	int fd, i;
+
+	for (i = 0; i < MAXCLIENTS && client[i].fd >= 0; i++)
+		;
+
+	fd = accept(socki, (struct sockaddr*)&addr, &sin_size);
+	if (fd < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			perror("accept");
+		return;
+	}
+
+	if (i == MAXCLIENTS) {
+		fprintf(stderr, "more than %d clients!\n", MAXCLIENTS);
+		close(fd);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = TAG_CLIENT + i;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl");
+		close(fd);
+		return;
+	}
+
+	c = &client[i];
+	memset(c, 0, sizeof(*c));
+	c->fd = fd;
+	c->addr = addr;
+	c->seq = fhead; /* new clients start with the next frame */
+	clock_gettime(CLOCK_MONOTONIC, &c->since);
+	update_table(i);
+
+	clients++;
+	metric_set(m_clients, clients);
 }
 
 
@@ -172,79 +827,92 @@ int main(int argc, char **argv)
 {
 	struct sigaction signalaction;
 	sigset_t sigset;
-	fd_set rdfs;
-	int s[MAXDEV];
-	int socki, accsocket;
-	canid_t mask[MAXDEV] = {0};
-	canid_t value[MAXDEV] = {0};
-	int inv_filter[MAXDEV] = {0};
-	can_err_mask_t err_mask[MAXDEV] = {0};
+	int s[MAXSOCK];
+	int socki;
+	__u32 mask[MAXSOCK] = {0};
+	__u32 value[MAXSOCK] = {0};
+	__u32 inv_filter[MAXSOCK] = {0};
+	__u32 err_mask[MAXSOCK] = {0};
+	struct cfx_filterset fs;
 	int opt, ret;
 	int currmax = 1; /* we assume at least one can bus ;-) */
-	struct sockaddr_can addr;
+	struct sockaddr_can addr[MAXBATCH];
 	struct can_filter rfilter;
-	struct can_frame frame;
-	int nbytes, i, j;
+	char *nptr;
+	static struct can_frame frame[MAXBATCH];
+	static char ctrlmsg[MAXBATCH][CMSG_SPACE(CANLIB_CMSG_TSTAMP_SPACE)];
+	struct iovec iov[MAXBATCH];
+	struct mmsghdr mmsg[MAXBATCH];
+	struct cmsghdr *cmsg;
+	struct epoll_event ev, events[MAXSOCK + MAXCLIENTS + 1];
+	int nevents, nframes, len, i, j, k;
 	struct ifreq ifr;
-	struct timeval tv, last_tv;
+	struct timespec ts;
+	struct logrec *r;
+	struct binrec *b;
+	int tsdigits = 6;
+	int hwstamp = 0;
 	int port = DEFPORT;
 	struct sockaddr_in inaddr;
-	struct sockaddr_in clientaddr;
-	socklen_t sin_size = sizeof(clientaddr);
-	char temp[128];
+	char temp[MAXLINE];
 
 	sigemptyset(&sigset);
-	signalaction.sa_handler = &childdied;
-	signalaction.sa_mask = sigset;
-	signalaction.sa_flags = 0;
-	sigaction(SIGCHLD, &signalaction, NULL);  /* install signal for dying child */
 	signalaction.sa_handler = &shutdown_gra;
 	signalaction.sa_mask = sigset;
 	signalaction.sa_flags = 0;
 	sigaction(SIGTERM, &signalaction, NULL); /* install Signal for termination */
 	sigaction(SIGINT, &signalaction, NULL); /* install Signal for termination */
+	signalaction.sa_handler = &request_stats;
+	sigaction(SIGUSR1, &signalaction, NULL);
+	signal(SIGPIPE, SIG_IGN); /* write errors are handled per client */
 
+	for (i = 0; i < MAXCLIENTS; i++)
+		client[i].fd = -1;
 
-	last_tv.tv_sec  = 0;
-	last_tv.tv_usec = 0;
-
-	while ((opt = getopt(argc, argv, "m:v:i:e:p:?")) != -1) {
+	while ((opt = getopt(argc, argv, "m:v:i:e:p:NHM:l:d?")) != -1) {
 
 		switch (opt) {
 		case 'm':
-			i = sscanf(optarg, "%x,%x,%x,%x,%x,%x",
-				   &mask[0], &mask[1], &mask[2],
-				   &mask[3], &mask[4], &mask[5]);
-			if (i > currmax)
-				currmax = i;
-			break;
-
 		case 'v':
-			i = sscanf(optarg, "%x,%x,%x,%x,%x,%x",
-				   &value[0], &value[1], &value[2],
-				   &value[3], &value[4], &value[5]);
-			if (i > currmax)
-				currmax = i;
-			break;
-
 		case 'i':
-			i = sscanf(optarg, "%d,%d,%d,%d,%d,%d",
-				   &inv_filter[0], &inv_filter[1], &inv_filter[2],
-				   &inv_filter[3], &inv_filter[4], &inv_filter[5]);
-			if (i > currmax)
-				currmax = i;
-			break;
-
 		case 'e':
-			i = sscanf(optarg, "%x,%x,%x,%x,%x,%x",
-				   &err_mask[0], &err_mask[1], &err_mask[2],
-				   &err_mask[3], &err_mask[4], &err_mask[5]);
+			i = parse_list(optarg, (opt == 'i') ? 10 : 16,
+				       (opt == 'm') ? mask :
+				       (opt == 'v') ? value :
+				       (opt == 'i') ? inv_filter : err_mask);
+			if (i < 0) {
+				printf("bad value list '%s' for option -%c!\n",
+				       optarg, opt);
+				return 1;
+			}
 			if (i > currmax)
 				currmax = i;
 			break;
+
 		case 'p':
 			port = atoi(optarg);
 			break;
+		case 'N':
+			tsdigits = 9;
+			break;
+		case 'H':
+			hwstamp = 1;
+			break;
+		case 'M':
+			if (metrics_open(optarg))
+				return 1;
+			break;
+		case 'l':
+			maxlag = strtoull(optarg, NULL, 10) * 1024;
+			if (!maxlag || maxlag > RINGSIZE / 2) {
+				printf("max. lag has to be 1 .. %d kbytes!\n",
+				       RINGSIZE / 2048);
+				return 1;
+			}
+			break;
+		case 'd':
+			lag_disconnect = 1;
+			break;
 		default:
 			print_usage(basename(argv[0]));
 			exit(1);
@@ -265,47 +933,36 @@ int main(int argc, char **argv)
 
 	currmax = argc - optind; /* find real number of CAN devices */
 
-	if (currmax > MAXDEV) {
-		printf("More than %d CAN devices!\n", MAXDEV);
+	if (currmax > MAXSOCK) {
+		printf("More than %d CAN devices!\n", MAXSOCK);
 		return 1;
 	}
 
-
-	socki = socket(PF_INET, SOCK_STREAM, 0);
-	if (socki < 0) {
-		perror("socket");
-		exit(1);
-	}
-
-	inaddr.sin_family = AF_INET;
-	inaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	inaddr.sin_port = htons(port);
-
-	while(bind(socki, (struct sockaddr*)&inaddr, sizeof(inaddr)) < 0) {
-		printf(".");fflush(NULL);
-		usleep(100000);
+	for (i=0; i<currmax; i++) {
+		temp[0] = 0;
+		metric_label(temp, sizeof(temp), "interface", argv[optind+i],
+			     strcspn(argv[optind+i], ","));
+		m_frames[i] = metric_counter("canlogserver_frames_total",
+					     "CAN frames sent to the clients", temp);
 	}
-
-	if (listen(socki, 3) != 0) {
-		perror("listen");
-		exit(1);
+	m_bytes = metric_counter("canlogserver_sent_bytes_total",
+				 "Bytes sent to the clients", NULL);
+	m_errors = metric_counter("canlogserver_client_errors_total",
+				  "Clients terminated by write errors, lag or bad requests", NULL);
+	m_clients = metric_gauge("canlogserver_clients",
+				 "Connected clients", NULL);
+	m_dropped = metric_counter("canlogserver_dropped_frames_total",
+				   "CAN frames skipped for lagging clients", NULL);
+	m_lagged = metric_counter("canlogserver_lag_events_total",
+				  "Clients exceeding the max. lag", NULL);
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return 1;
 	}
 
-	while(1) {
-		accsocket = accept(socki, (struct sockaddr*)&clientaddr, &sin_size);
-		if (accsocket > 0) {
-			//printf("accepted\n");
-			if (!fork())
-				break;
-			else
-				close(accsocket);
-		}
-		else if (errno != EINTR) {
-			perror("accept");
-			exit(1);
-		}
-	}
-  
+	/* the CAN sockets are opened once and shared by all clients */
 	for (i=0; i<currmax; i++) {
 
 #ifdef DEBUG
@@ -319,25 +976,44 @@ int main(int argc, char **argv)
 			return 1;
 		}
 
-		if (mask[i] || value[i]) {
+		memset(&fs, 0, sizeof(fs));
+		nptr = strchr(argv[optind+i], ',');
+
+		if (nptr) {
+			/* per interface filter set replaces the m/v/i/e options */
+			if (cfx_parse_filterset(nptr+1, &fs) < 0)
+				return 1;
+			*nptr = 0; /* terminate the interface name */
+
+		} else {
+			if (mask[i] || value[i]) {
 
-			printf("CAN ID filter[%d] for %s set to "
-			       "mask = %08X, value = %08X %s\n",
-			       i, argv[optind+i], mask[i], value[i],
-			       (inv_filter[i]) ? "(inv_filter)" : "");
+				printf("CAN ID filter[%d] for %s set to "
+				       "mask = %08X, value = %08X %s\n",
+				       i, argv[optind+i], mask[i], value[i],
+				       (inv_filter[i]) ? "(inv_filter)" : "");
 
-			rfilter.can_id   = value[i];
-			rfilter.can_mask = mask[i];
-			if (inv_filter[i])
-				rfilter.can_id |= CAN_INV_FILTER;
+				rfilter.can_id   = value[i];
+				rfilter.can_mask = mask[i];
+				if (inv_filter[i])
+					rfilter.can_id |= CAN_INV_FILTER;
 
-			setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_FILTER,
-				   &rfilter, sizeof(rfilter));
+				fs.filter = &rfilter;
+				fs.nfilter = 1;
+			}
+			fs.err_mask = err_mask[i];
+		}
+
+		if (cfx_apply_filterset(s[i], &fs) < 0) {
+			if (fs.join && errno == ENOPROTOOPT)
+				fprintf(stderr, "CAN_RAW_JOIN_FILTERS not supported by your Linux Kernel\n");
+			else
+				perror("setsockopt CAN_RAW_FILTER");
+			return 1;
 		}
 
-		if (err_mask[i])
-			setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
-				   &err_mask[i], sizeof(err_mask[i]));
+		if (nptr)
+			cfx_free_filterset(&fs);
 
 		j = strlen(argv[optind+i]);
 
@@ -349,7 +1025,7 @@ int main(int argc, char **argv)
 		if (j > max_devname_len)
 			max_devname_len = j; /* for nice printing */
 
-		addr.can_family = AF_CAN;
+		addr[0].can_family = AF_CAN;
 
 		if (strcmp(ANYDEV, argv[optind+i])) {
 			strcpy(ifr.ifr_name, argv[optind+i]);
@@ -357,80 +1033,193 @@ int main(int argc, char **argv)
 				perror("SIOCGIFINDEX");
 				exit(1);
 			}
-			addr.can_ifindex = ifr.ifr_ifindex;
+			addr[0].can_ifindex = ifr.ifr_ifindex;
 		}
 		else
-			addr.can_ifindex = 0; /* any can interface */
+			addr[0].can_ifindex = 0; /* any can interface */
+
+		if (set_rx_timestamping(s[i], hwstamp) < 0) {
+			perror("setsockopt SO_TIMESTAMPING");
+			return 1;
+		}
 
-		if (bind(s[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (bind(s[i], (struct sockaddr *)&addr[0], sizeof(addr[0])) < 0) {
 			perror("bindcan");
 			return 1;
 		}
+
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, s[i], &ev) < 0) {
+			perror("epoll_ctl");
+			return 1;
+		}
+	}
+
+	socki = socket(PF_INET, SOCK_STREAM, 0);
+	if (socki < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	inaddr.sin_family = AF_INET;
+	inaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	inaddr.sin_port = htons(port);
+
+	while(bind(socki, (struct sockaddr*)&inaddr, sizeof(inaddr)) < 0) {
+		printf(".");fflush(NULL);
+		usleep(100000);
+	}
+
+	if (listen(socki, 16) != 0) {
+		perror("listen");
+		exit(1);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = TAG_LISTEN;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, socki, &ev) < 0) {
+		perror("epoll_ctl");
+		return 1;
+	}
+
+	/* these settings are static and can be held out of the hot path */
+	memset(mmsg, 0, sizeof(mmsg));
+	for (k = 0; k < MAXBATCH; k++) {
+		iov[k].iov_base = &frame[k];
+		mmsg[k].msg_hdr.msg_name = &addr[k];
+		mmsg[k].msg_hdr.msg_iov = &iov[k];
+		mmsg[k].msg_hdr.msg_iovlen = 1;
+		mmsg[k].msg_hdr.msg_control = &ctrlmsg[k];
 	}
 
 	while (running) {
 
-		FD_ZERO(&rdfs);
-		for (i=0; i<currmax; i++)
-			FD_SET(s[i], &rdfs);
+		if (print_stats) {
+			print_stats = 0;
+			for (j = 0; j < MAXCLIENTS; j++)
+				if (client[j].fd >= 0)
+					print_client(&client[j], "statistics");
+		}
 
-		if ((ret = select(s[currmax-1]+1, &rdfs, NULL, NULL, NULL)) < 0) {
-			//perror("select");
-			running = 0;
-			continue;
+		nevents = epoll_wait(epfd, events, MAXSOCK + MAXCLIENTS + 1, -1);
+		if (nevents < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
 		}
 
-		for (i=0; i<currmax; i++) {  /* check all CAN RAW sockets */
+		for (ret = 0; ret < nevents; ret++) {
 
-			if (FD_ISSET(s[i], &rdfs)) {
+			unsigned int tag = events[ret].data.u32;
 
-				socklen_t len = sizeof(addr);
-				int idx;
+			if (tag == TAG_LISTEN) {
+				accept_client(socki);
+				continue;
+			}
 
-				if ((nbytes = recvfrom(s[i], &frame,
-						       sizeof(struct can_frame), 0,
-						       (struct sockaddr*)&addr, &len)) < 0) {
-					perror("read");
-					return 1;
-				}
+			if (tag >= TAG_CLIENT) {
+				struct client *c = &client[tag - TAG_CLIENT];
 
-				if (nbytes < sizeof(struct can_frame)) {
-					fprintf(stderr, "read: incomplete CAN frame\n");
-					return 1;
-				}
+				if (c->fd < 0)
+					continue; /* closed in this round */
 
-				if (ioctl(s[i], SIOCGSTAMP, &tv) < 0)
-					perror("SIOCGSTAMP");
+				if ((events[ret].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+				    client_request(c) < 0)
+					continue;
 
+				if (events[ret].events & EPOLLOUT)
+					flush_client(c);
+				continue;
+			}
 
-				idx = idx2dindex(addr.can_ifindex, s[i]);
+			/* CAN RAW socket i */
+			i = tag;
+
+			/* these settings may be modified by recvmmsg() */
+			for (k = 0; k < MAXBATCH; k++) {
+				iov[k].iov_len = sizeof(frame[k]);
+				mmsg[k].msg_hdr.msg_namelen = sizeof(addr[k]);
+				mmsg[k].msg_hdr.msg_controllen = sizeof(ctrlmsg[k]);
+				mmsg[k].msg_hdr.msg_flags = 0;
+			}
 
-				sprintf(temp, "(%ld.%06ld) %*s ",
-					tv.tv_sec, tv.tv_usec, max_devname_len, devname[idx]);
-				sprint_canframe(temp+strlen(temp), &frame, 0); 
-				strcat(temp, "\n");
+			nframes = recvmmsg(s[i], mmsg, MAXBATCH, MSG_DONTWAIT, NULL);
+			if (nframes < 0) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				perror("read");
+				return 1;
+			}
+
+			for (k = 0; k < nframes; k++) {
+
+				int idx;
 
-				if (write(accsocket, temp, strlen(temp)) < 0) {
-					perror("writeaccsock");
+				if (mmsg[k].msg_len < sizeof(struct can_frame)) {
+					fprintf(stderr, "read: incomplete CAN frame\n");
 					return 1;
 				}
-		    
-				/* printf("%s\n",temp2); */
-
-#if 0
-				/* print CAN frame in log file style to stdout */
-				printf("(%ld.%06ld) ", tv.tv_sec, tv.tv_usec);
-				printf("%*s ", max_devname_len, devname[idx]);
-				fprint_canframe(stdout, &frame, "\n", 0);
-#endif
+
+				/* timestamp comes with the frame - no SIOCGSTAMP syscall */
+				for (cmsg = CMSG_FIRSTHDR(&mmsg[k].msg_hdr);
+				     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
+				     cmsg = CMSG_NXTHDR(&mmsg[k].msg_hdr, cmsg))
+					cmsg_rx_timestamp(cmsg, &ts);
+
+				idx = idx2dindex(addr[k].can_ifindex, s[i]);
+
+				/* formatted once for all clients */
+				len = sprintf(temp, "(%ld.%0*ld) %*s ", ts.tv_sec, tsdigits,
+					      (tsdigits == 9) ? ts.tv_nsec : ts.tv_nsec / 1000,
+					      max_devname_len, devname[idx]);
+				sprint_canframe(temp+len, &frame[k], 0);
+				len += strlen(temp+len);
+				temp[len++] = '\n';
+
+				r = &rec[fhead % RECS];
+				r->pos = head;
+				r->len = len;
+				r->clients = match_clients(frame[k].can_id);
+
+				b = &brec[fhead % RECS];
+				b->ts = htole64(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+				b->can_id = htole32(frame[k].can_id);
+				b->dlc = frame[k].can_dlc;
+				b->dev = idx;
+				memcpy(b->data, frame[k].data, sizeof(b->data));
+
+				ring_append(temp, len);
+				fhead++;
+			}
+
+			metric_add(m_frames[i], nframes);
+
+			/* one writev() per client for the whole batch */
+			for (j = 0; j < MAXCLIENTS; j++) {
+				if (client[j].fd < 0 || client[j].pollout)
+					continue;
+				if (check_lag(&client[j]) == 0)
+					flush_client(&client[j]);
 			}
 
+			/* clients waiting for EPOLLOUT still may not fall behind */
+			for (j = 0; j < MAXCLIENTS; j++) {
+				if (client[j].fd >= 0 && client[j].pollout)
+					check_lag(&client[j]);
+			}
 		}
 	}
 
+	for (j = 0; j < MAXCLIENTS; j++)
+		if (client[j].fd >= 0)
+			close_client(&client[j], "closed");
+
 	for (i=0; i<currmax; i++)
 		close(s[i]);
 
-	close(accsocket);
+	close(socki);
+	close(epfd);
 	return 0;
 }
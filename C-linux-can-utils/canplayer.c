@@ -45,26 +45,41 @@
  *
  */
 
+#define _GNU_SOURCE /* sendmmsg() */
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
 #include <time.h>
 #include <libgen.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <getopt.h>
 
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/prctl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
 #include "lib.h"
+#include "binlog.h"
+#include "logindex.h"
 
 #define DEFAULT_GAP	1	/* ms */
 #define DEFAULT_LOOPS	1	/* only one replay */
 #define CHANNELS	20	/* anyone using more than 20 CAN interfaces at a time? */
 #define BUFSZ		400	/* for one line in the logfile */
 #define STDOUTIDX	65536	/* interface index for printing on stdout - bigger than max uint16 */
+#define SPIN_NS		50000	/* busy-wait before a frame is due (preload mode) */
+#define LEAD_NS		1000000	/* delay of the first frame (preload mode) */
+#define ERRBINS		10000	/* timing error histogram: 1us bins up to 10ms */
+#define MAXBATCH	32	/* frames per sendmmsg() in max throughput mode */
+#define TXBACKOFF_NS	100000	/* wait for the CAN bus on ENOBUFS */
 
 struct assignment {
 	char txif[IFNAMSIZ];
@@ -73,6 +88,73 @@ struct assignment {
 };
 static struct assignment asgn[CHANNELS];
 
+static int binary; /* infile is in binary log format */
+static struct binlog_reader br;
+static struct binlog_rec rec;
+
+static uint64_t from_ns;          /* replay time range (see --from/--to) */
+static uint64_t to_ns = UINT64_MAX;
+
+/* preloaded CAN frame (see -p) */
+struct replay {
+	uint64_t ts;   /* log timestamp in ns */
+	uint64_t rel;  /* send time relative to the replay start in ns */
+	int asgnidx;   /* resolved interface assignment */
+	struct can_frame frame;
+};
+
+static struct replay *replay;
+static unsigned long nreplay;
+
+/* achieved timing error in preload mode */
+struct timing {
+	unsigned long count;
+	unsigned long hist[ERRBINS + 1]; /* last bin: >= 10ms */
+	int64_t min, max;
+	int64_t sum;
+	unsigned long early;
+};
+
+static struct timing terr;
+
+/* per interface sender thread (see -P) */
+struct sender {
+	pthread_t thread;
+	int s;                 /* own socket - no shared tx buffer */
+	int cpu;               /* -1: not pinned */
+	int asgnidx;
+	struct replay *frames; /* frames of this interface in log order */
+	unsigned long count;
+	struct timing lag;
+};
+
+static pthread_barrier_t loop_barrier;
+static uint64_t loop_start;  /* common CLOCK_MONOTONIC start of a loop */
+static int loop_stop;
+static int loops_left;
+static int replay_failed;
+
+/* sent frames per interface assignment (preload mode) */
+static struct {
+	unsigned long frames;
+	unsigned long long bits;
+} txstat[CHANNELS];
+
+static double speed = 1.0;   /* replay speed factor (see -r) */
+static int maxrate;          /* max throughput mode (see -m) */
+static int parallel;         /* one sender thread per interface (see -P) */
+static int use_timestamps = 1;
+static int infinite_loops;
+static int verbose;
+static unsigned int bitrate; /* for the bus load report (see -b) */
+static unsigned long txwait; /* waits for free tx buffers */
+
+static const struct option long_options[] = {
+	{ "from", required_argument, NULL, 'F' },
+	{ "to",   required_argument, NULL, 'T' },
+	{ NULL, 0, NULL, 0 }
+};
+
 extern int optind, opterr, optopt;
 
 void print_usage(char *prg)
@@ -92,7 +174,27 @@ void print_usage(char *prg)
 	fprintf(stderr, "                      -x           (disable local "
 		"loopback of sent CAN frames)\n");
 	fprintf(stderr, "                      -v           (verbose: print "
-		"sent CAN frames)\n\n");
+		"sent CAN frames)\n");
+	fprintf(stderr, "                      -p           (preload the logfile "
+		"and replay with precise timing)\n");
+	fprintf(stderr, "                      -r <factor>  (replay speed factor "
+		"e.g. 2 or 0.5 - implies -p)\n");
+	fprintf(stderr, "                      -m           (max throughput: ignore "
+		"timestamps and send\n"
+		"                                    batches of frames - implies -p)\n");
+	fprintf(stderr, "                      -b <bitrate> (bitrate for the bus "
+		"load report in preload mode)\n");
+	fprintf(stderr, "                      -P           (parallel: one sender "
+		"thread per interface\n"
+		"                                    on a common clock - implies -p)\n");
+	fprintf(stderr, "                      --from <t>   (start replay at "
+		"time <t> - needs -I)\n");
+	fprintf(stderr, "                      --to <t>     (stop replay at "
+		"time <t> - needs -I)\n\n");
+	fprintf(stderr, "Times are seconds relative to the start of the logfile "
+		"or '@<secs since epoch>'.\n");
+	fprintf(stderr, "The index '<infile>.idx' is used to seek to the start "
+		"time (created on first use).\n\n");
 	fprintf(stderr, "Interface assignment:  0..n assignments like "
 		"<write-if>=<log-if>\n");
 	fprintf(stderr, "e.g. vcan2=can0 ( send frames received from can0 on "
@@ -102,7 +204,15 @@ void print_usage(char *prg)
 	fprintf(stderr, "No assignments => send frames to the interface(s) they "
 		"had been received from.\n\n");
 	fprintf(stderr, "Lines in the logfile not beginning with '(' (start of "
-		"timestamp) are ignored.\n\n");
+		"timestamp) are ignored.\n");
+	fprintf(stderr, "Timestamps may be given in micro- or nanosecond "
+		"resolution.\n");
+	fprintf(stderr, "Binary log files (see log2bin) are detected "
+		"automatically.\n");
+	fprintf(stderr, "With -p the frames are parsed and the interfaces are "
+		"resolved before the replay.\n");
+	fprintf(stderr, "The frames are then released on absolute CLOCK_MONOTONIC "
+		"times and the\nachieved timing error is reported at the end.\n\n");
 }
 
 /* copied from /usr/src/linux/include/linux/time.h ...
@@ -110,47 +220,47 @@ void print_usage(char *prg)
  * lhs == rhs: return 0
  * lhs > rhs:  return >0
  */
-static inline int timeval_compare(struct timeval *lhs, struct timeval *rhs)
+static inline int timespec_compare(struct timespec *lhs, struct timespec *rhs)
 {
 	if (lhs->tv_sec < rhs->tv_sec)
 		return -1;
 	if (lhs->tv_sec > rhs->tv_sec)
 		return 1;
-	return lhs->tv_usec - rhs->tv_usec;
+	return lhs->tv_nsec - rhs->tv_nsec;
 }
 
-static inline void create_diff_tv(struct timeval *today, struct timeval *diff,
-				  struct timeval *log) {
+static inline void create_diff_ts(struct timespec *today, struct timespec *diff,
+				  struct timespec *log) {
 
-	/* create diff_tv so that log_tv + diff_tv = today_tv */
+	/* create diff_ts so that log_ts + diff_ts = today_ts */
 	diff->tv_sec  = today->tv_sec  - log->tv_sec;
-	diff->tv_usec = today->tv_usec - log->tv_usec;
+	diff->tv_nsec = today->tv_nsec - log->tv_nsec;
 }
 
-static inline int frames_to_send(struct timeval *today, struct timeval *diff,
-				 struct timeval *log)
+static inline int frames_to_send(struct timespec *today, struct timespec *diff,
+				 struct timespec *log)
 {
 	/* return value <0 when log + diff < today */
 
-	struct timeval cmp;
+	struct timespec cmp;
 
 	cmp.tv_sec  = log->tv_sec  + diff->tv_sec;
-	cmp.tv_usec = log->tv_usec + diff->tv_usec;
+	cmp.tv_nsec = log->tv_nsec + diff->tv_nsec;
 
-	if (cmp.tv_usec > 1000000) {
-		cmp.tv_usec -= 1000000;
+	if (cmp.tv_nsec >= 1000000000) {
+		cmp.tv_nsec -= 1000000000;
 		cmp.tv_sec++;
 	}
 
-	if (cmp.tv_usec < 0) {
-		cmp.tv_usec += 1000000;
+	if (cmp.tv_nsec < 0) {
+		cmp.tv_nsec += 1000000000;
 		cmp.tv_sec--;
 	}
 
-	return timeval_compare(&cmp, today);
+	return timespec_compare(&cmp, today);
 }
 
-int get_txidx(char *logif_name) {
+int get_asgnidx(char *logif_name) {
 
 	int i;
 
@@ -162,6 +272,16 @@ int get_txidx(char *logif_name) {
 	}
 
 	if ((i == CHANNELS) || (asgn[i].rxif[0] == 0))
+		return -1; /* not found */
+
+	return i;
+}
+
+int get_txidx(char *logif_name) {
+
+	int i = get_asgnidx(logif_name);
+
+	if (i < 0)
 		return 0; /* not found */
 
 	return asgn[i].txifidx; /* return interface index */
@@ -169,16 +289,9 @@ int get_txidx(char *logif_name) {
 
 char *get_txname(char *logif_name) {
 
-	int i;
+	int i = get_asgnidx(logif_name);
 
-	for (i=0; i<CHANNELS; i++) {
-		if (asgn[i].rxif[0] == 0) /* end of table content */
-			break;
-		if (strcmp(asgn[i].rxif, logif_name) == 0) /* found device name */
-			break;
-	}
-
-	if ((i == CHANNELS) || (asgn[i].rxif[0] == 0))
+	if (i < 0)
 		return 0; /* not found */
 
 	return asgn[i].txif; /* return interface name */
@@ -231,27 +344,662 @@ int add_assignment(char *mode, int socket, char *txname, char *rxname,
 	return 0;
 }
 
+/*
+ * read next CAN frame entry from the ASCII or binary logfile
+ * ASCII: buf/log_ts/device/ascframe are set - frame is parsed by the caller
+ * binary: log_ts/device/frame are set
+ * returns 1 on success, 0 at end of file and -1 on errors
+ */
+static int read_logentry(FILE *infile, char *buf, struct timespec *log_ts,
+			 char *device, char *ascframe, struct can_frame *frame)
+{
+	char *fret;
+	uint64_t ns;
+	int ret;
+
+	do {
+		if (binary) {
+			/* skip text records (comments) */
+			while ((ret = binlog_read(&br, &rec)) == BINLOG_REC_TEXT)
+				;
+
+			if (ret < 0)
+				fprintf(stderr, "corrupt binary log file\n");
+			if (ret <= 0)
+				return ret;
+
+			*log_ts = rec.ts;
+			strcpy(device, rec.ifname);
+			*frame = rec.frame;
+		} else {
+			/* read next non-comment frame from logfile */
+			while ((fret = fgets(buf, BUFSZ-1, infile)) != NULL && buf[0] != '(') {
+				if (strlen(buf) >= BUFSZ-2) {
+					fprintf(stderr, "comment line too long for input buffer\n");
+					return -1;
+				}
+			}
+
+			if (!fret)
+				return 0; /* nothing to read */
+
+			if (parse_logline(buf, log_ts, device, ascframe)) {
+				fprintf(stderr, "incorrect line format in logfile\n");
+				return -1;
+			}
+		}
+
+		ns = (uint64_t)log_ts->tv_sec * 1000000000ULL + log_ts->tv_nsec;
+
+		if (ns > to_ns)
+			return 0; /* end of the selected time range */
+
+	} while (ns < from_ns);
+
+	return 1;
+}
+
+static inline uint64_t ts2ns(struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+/*
+ * wait until the CAN interface queues accept new frames again
+ * returns 0 on success and 1 on errors
+ */
+static int wait_txbuf(int s, int err)
+{
+	struct pollfd pfd = { .fd = s, .events = POLLOUT };
+	struct timespec backoff = { 0, TXBACKOFF_NS };
+
+	__atomic_add_fetch(&txwait, 1, __ATOMIC_RELAXED);
+
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+		perror("poll");
+		return 1;
+	}
+
+	/* a full tx queue (ENOBUFS) does not clear POLLOUT - let the bus drain */
+	if (err == ENOBUFS)
+		nanosleep(&backoff, NULL);
+
+	return 0;
+}
+
+static int send_frame(int s, struct can_frame *frame, struct sockaddr_can *addr)
+{
+	int nbytes;
+
+	while ((nbytes = sendto(s, frame, sizeof(struct can_frame), 0,
+				(struct sockaddr*)addr, sizeof(*addr))) < 0) {
+		if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR)
+			break;
+		if (wait_txbuf(s, errno))
+			return 1;
+	}
+
+	if (nbytes != sizeof(struct can_frame)) {
+		perror("sendto");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int send_batch(int s, struct mmsghdr *msgs, unsigned int n)
+{
+	unsigned int done = 0;
+	int ret;
+
+	while (done < n) {
+		ret = sendmmsg(s, &msgs[done], n - done, 0);
+		if (ret < 0) {
+			if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+				perror("sendmmsg");
+				return 1;
+			}
+			if (wait_txbuf(s, errno))
+				return 1;
+			continue;
+		}
+		done += ret;
+	}
+
+	return 0;
+}
+
+/* CAN frame length on the wire without stuff bits */
+static unsigned int frame_bits(struct can_frame *cf)
+{
+	unsigned int dlc = (cf->can_dlc > 8) ? 8 : cf->can_dlc;
+
+	if (cf->can_id & CAN_RTR_FLAG)
+		dlc = 0;
+
+	return ((cf->can_id & CAN_EFF_FLAG) ? 67 : 47) + dlc * 8;
+}
+
+/*
+ * parse the whole logfile into replay[] with resolved interfaces
+ * returns 0 on success and 1 on errors
+ */
+static int preload(FILE *infile, int s, int assignments, int verbose,
+		   int skipgap)
+{
+	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
+	static struct can_frame frame;
+	struct timespec log_ts;
+	struct replay *r;
+	unsigned long size = 0;
+	uint64_t last_ts = 0, rel = 0;
+	int ret, i;
+
+	while ((ret = read_logentry(infile, buf, &log_ts, device, ascframe, &frame)) > 0) {
+
+		if (strlen(device) >= IFNAMSIZ) {
+			fprintf(stderr, "log interface name '%s' too long!", device);
+			return 1;
+		}
+
+		i = get_asgnidx(device);
+		if (i < 0) {
+			if (assignments)
+				continue; /* not assigned by the user */
+
+			/* assign this device automatically */
+			if (add_assignment("auto", s, device, device, verbose))
+				return 1;
+			i = get_asgnidx(device);
+		}
+
+		if (!binary && parse_canframe(ascframe, &frame)) {
+			fprintf(stderr, "wrong CAN frame format: '%s'!", ascframe);
+			return 1;
+		}
+
+		if (nreplay == size) {
+			size = (size) ? 2 * size : 4096;
+			r = realloc(replay, size * sizeof(*replay));
+			if (!r) {
+				perror("preload");
+				return 1;
+			}
+			replay = r;
+		}
+
+		/*
+		 * timestamps jumping backwards and skipped gaps restart the
+		 * timing - the frame is sent right after its predecessor
+		 */
+		r = &replay[nreplay];
+		r->ts = ts2ns(&log_ts);
+		if (nreplay && r->ts >= last_ts &&
+		    (!skipgap || r->ts - last_ts <= skipgap * 1000000000ULL))
+			rel += r->ts - last_ts;
+		last_ts = r->ts;
+
+		r->rel = rel;
+		r->asgnidx = i;
+		r->frame = frame;
+		nreplay++;
+	}
+
+	if (ret < 0)
+		return 1;
+
+	if (verbose > 1) /* use -v -v to see this */
+		printf("preloaded %lu frames (%lu kB)\n", nreplay,
+		       nreplay * sizeof(*replay) / 1024);
+
+	return 0;
+}
+
+static void account_timing(struct timing *t, int64_t err)
+{
+	int64_t us = (err < 0) ? 0 : err / 1000;
+
+	if (!t->count || err < t->min)
+		t->min = err;
+	if (!t->count || err > t->max)
+		t->max = err;
+	if (err < 0)
+		t->early++;
+
+	t->sum += err;
+	t->hist[(us < ERRBINS) ? us : ERRBINS]++;
+	t->count++;
+}
+
+static long timing_percentile(struct timing *t, double p)
+{
+	unsigned long rank = t->count * p;
+	unsigned long sum = 0;
+	long us;
+
+	for (us = 0; us < ERRBINS; us++) {
+		sum += t->hist[us];
+		if (sum > rank)
+			break;
+	}
+
+	return us;
+}
+
+static void print_timing_report(const char *prefix, struct timing *t)
+{
+	if (!t->count)
+		return;
+
+	fprintf(stderr, "%stiming error of %lu frames (send completion - due time):\n",
+		prefix, t->count);
+	fprintf(stderr, "  min %lld ns, mean %lld ns, max %lld ns, early %lu\n",
+		(long long)t->min, (long long)(t->sum / (int64_t)t->count),
+		(long long)t->max, t->early);
+	fprintf(stderr, "  p50 < %ld us, p90 < %ld us, p99 < %ld us, p99.9 < %ld us\n",
+		timing_percentile(t, 0.5) + 1, timing_percentile(t, 0.9) + 1,
+		timing_percentile(t, 0.99) + 1, timing_percentile(t, 0.999) + 1);
+}
+
+static void print_frame(struct replay *r)
+{
+	struct assignment *a = &asgn[r->asgnidx];
+	char ascframe[BUFSZ];
+
+	sprint_canframe(ascframe, &r->frame, 0);
+	printf("(%llu.%09llu) %s %s\n",
+	       (unsigned long long)(r->ts / 1000000000ULL),
+	       (unsigned long long)(r->ts % 1000000000ULL),
+	       a->rxif, ascframe);
+	fflush(stdout);
+}
+
+static void print_sent_frame(struct replay *r)
+{
+	/* sender threads share stdout */
+	flockfile(stdout);
+	printf("%s (%s) ", asgn[r->asgnidx].txif, asgn[r->asgnidx].rxif);
+	fprint_long_canframe(stdout, &r->frame, "\n", 1);
+	funlockfile(stdout);
+}
+
+static void print_throughput_report(double secs)
+{
+	int i;
+
+	if (secs <= 0)
+		return;
+
+	fprintf(stderr, "sent in %.3f s (%lu waits for tx buffers):\n", secs, txwait);
+
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		if (!txstat[i].frames)
+			continue;
+
+		fprintf(stderr, "  %-*s %lu frames, %.0f frames/s, %.0f bit/s",
+			IFNAMSIZ, asgn[i].txif, txstat[i].frames,
+			txstat[i].frames / secs, txstat[i].bits / secs);
+		if (bitrate)
+			fprintf(stderr, ", bus load %.1f%%",
+				100.0 * txstat[i].bits / secs / bitrate);
+		fprintf(stderr, "\n");
+	}
+}
+
+/* send the cnt frames starting at first, prepared in msgs[] */
+static int flush_batch(int s, struct mmsghdr *msgs, struct replay *first,
+		       unsigned int cnt)
+{
+	struct replay *r;
+	unsigned int i;
+
+	if (!cnt)
+		return 0;
+
+	if (send_batch(s, msgs, cnt))
+		return 1;
+
+	for (i = 0; i < cnt; i++) {
+		r = &first[i];
+		txstat[r->asgnidx].frames++;
+		txstat[r->asgnidx].bits += frame_bits(&r->frame);
+		if (verbose)
+			print_sent_frame(r);
+	}
+
+	return 0;
+}
+
+/*
+ * send the frames as fast as the CAN interfaces take them
+ * returns 0 on success and 1 on errors
+ */
+static int replay_batched(int s, struct replay *frames, unsigned long count)
+{
+	struct sockaddr_can addr[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	struct mmsghdr msgs[MAXBATCH];
+	struct replay *r;
+	unsigned long n, first = 0;
+	unsigned int cnt = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (n = 0; n < count; n++) {
+
+		r = &frames[n];
+
+		if (asgn[r->asgnidx].txifidx == STDOUTIDX) {
+			/* keep the order of sent and printed frames */
+			if (flush_batch(s, msgs, &frames[first], cnt))
+				return 1;
+			cnt = 0;
+			print_frame(r);
+			continue;
+		}
+
+		if (!cnt)
+			first = n;
+
+		addr[cnt].can_family = AF_CAN;
+		addr[cnt].can_ifindex = asgn[r->asgnidx].txifidx;
+		iov[cnt].iov_base = &r->frame;
+		iov[cnt].iov_len = sizeof(struct can_frame);
+		msgs[cnt].msg_hdr.msg_name = &addr[cnt];
+		msgs[cnt].msg_hdr.msg_namelen = sizeof(addr[cnt]);
+		msgs[cnt].msg_hdr.msg_iov = &iov[cnt];
+		msgs[cnt].msg_hdr.msg_iovlen = 1;
+
+		if (++cnt == MAXBATCH) {
+			if (flush_batch(s, msgs, &frames[first], cnt))
+				return 1;
+			cnt = 0;
+		}
+	}
+
+	return flush_batch(s, msgs, &frames[first], cnt);
+}
+
+/*
+ * send the frames on their absolute due times relative to start
+ * returns 0 on success and 1 on errors
+ */
+static int replay_frames(int s, struct replay *frames, unsigned long count,
+			 uint64_t start, struct timing *t)
+{
+	struct sockaddr_can addr;
+	struct assignment *a;
+	struct replay *r;
+	struct timespec now_ts, due_ts;
+	uint64_t due = 0, now;
+	unsigned long n;
+
+	addr.can_family = AF_CAN;
+
+	if (maxrate)
+		return replay_batched(s, frames, count);
+
+	/* the default timer slack (50us) would swallow the spin interval */
+	if (use_timestamps)
+		prctl(PR_SET_TIMERSLACK, 1UL);
+
+	for (n = 0; n < count; n++) {
+
+		r = &frames[n];
+		a = &asgn[r->asgnidx];
+
+		if (use_timestamps) {
+			due = start + (uint64_t)(r->rel / speed);
+
+			/* sleep until shortly before - then spin */
+			if (due > SPIN_NS) {
+				due_ts.tv_sec = (due - SPIN_NS) / 1000000000ULL;
+				due_ts.tv_nsec = (due - SPIN_NS) % 1000000000ULL;
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+						       &due_ts, NULL) == EINTR)
+					;
+			}
+
+			do {
+				clock_gettime(CLOCK_MONOTONIC, &now_ts);
+				now = ts2ns(&now_ts);
+			} while (now < due);
+		}
+
+		if (a->txifidx == STDOUTIDX) { /* hook to print logfile lines on stdout */
+			print_frame(r);
+			continue;
+		}
+
+		addr.can_ifindex = a->txifidx; /* send via this interface */
+
+		if (send_frame(s, &r->frame, &addr))
+			return 1;
+
+		txstat[r->asgnidx].frames++;
+		txstat[r->asgnidx].bits += frame_bits(&r->frame);
+
+		if (use_timestamps) {
+			clock_gettime(CLOCK_MONOTONIC, &now_ts);
+			account_timing(t, (int64_t)(ts2ns(&now_ts) - due));
+		}
+
+		if (verbose)
+			print_sent_frame(r);
+	}
+
+	return 0;
+}
+
+/*
+ * open a CAN_RAW socket for sending on all CAN interfaces
+ * returns the socket or -1 on errors
+ */
+static int open_socket(int loopback_disable)
+{
+	struct sockaddr_can addr;
+	int s;
+
+	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	addr.can_family  = AF_CAN;
+	addr.can_ifindex = 0;
+
+	/* disable unneeded default receive filter on this RAW socket */
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+
+	if (loopback_disable) {
+		int loopback = 0;
+
+		setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
+			   &loopback, sizeof(loopback));
+	}
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+static uint64_t replay_start(void)
+{
+	struct timespec now_ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &now_ts);
+
+	return ts2ns(&now_ts) + LEAD_NS;
+}
+
+static void *sender_thread(void *arg)
+{
+	struct sender *snd = arg;
+	cpu_set_t set;
+
+	if (snd->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(snd->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) &&
+		    verbose)
+			fprintf(stderr, "%s: can not pin sender to CPU %d\n",
+				asgn[snd->asgnidx].txif, snd->cpu);
+	}
+
+	while (1) {
+		/* all senders agree on the loop end and the start time */
+		if (pthread_barrier_wait(&loop_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			loop_stop = __atomic_load_n(&replay_failed, __ATOMIC_RELAXED) ||
+				(!infinite_loops && !loops_left--);
+			loop_start = replay_start();
+		}
+		pthread_barrier_wait(&loop_barrier);
+
+		if (loop_stop)
+			break;
+
+		if (replay_frames(snd->s, snd->frames, snd->count, loop_start,
+				  &snd->lag))
+			__atomic_store_n(&replay_failed, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/*
+ * split the preloaded frames into per interface queues and replay them
+ * with one sender thread each
+ * returns 0 on success and 1 on errors
+ */
+static int replay_parallel(int loopback_disable, int loops)
+{
+	struct sender snd[CHANNELS];
+	cpu_set_t allowed;
+	unsigned long n;
+	int nsnd = 0, cpu = -1, i;
+
+	memset(snd, 0, sizeof(snd));
+
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		snd[i].asgnidx = i;
+		snd[i].s = -1;
+	}
+
+	for (n = 0; n < nreplay; n++)
+		snd[replay[n].asgnidx].count++;
+
+	/* copy the frames into one contiguous queue per interface */
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		if (!snd[i].count)
+			continue;
+		snd[i].frames = malloc(snd[i].count * sizeof(struct replay));
+		if (!snd[i].frames) {
+			perror("sender queue");
+			return 1;
+		}
+		snd[i].count = 0;
+	}
+
+	for (n = 0; n < nreplay; n++) {
+		struct sender *q = &snd[replay[n].asgnidx];
+
+		q->frames[q->count++] = replay[n];
+	}
+
+	free(replay);
+	replay = NULL;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		CPU_ZERO(&allowed);
+
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		if (!snd[i].count)
+			continue;
+
+		snd[i].s = open_socket(loopback_disable);
+		if (snd[i].s < 0)
+			return 1;
+
+		/* next allowed CPU - round robin */
+		snd[i].cpu = -1;
+		if (CPU_COUNT(&allowed)) {
+			do
+				cpu = (cpu + 1) % CPU_SETSIZE;
+			while (!CPU_ISSET(cpu, &allowed));
+			snd[i].cpu = cpu;
+		}
+		nsnd++;
+	}
+
+	if (!nsnd)
+		return 0;
+
+	loops_left = loops;
+	pthread_barrier_init(&loop_barrier, NULL, nsnd);
+
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		if (!snd[i].count)
+			continue;
+
+		if (verbose > 1) /* use -v -v to see this */
+			printf("%s: %lu frames on CPU %d\n", asgn[i].txif,
+			       snd[i].count, snd[i].cpu);
+
+		if (pthread_create(&snd[i].thread, NULL, sender_thread, &snd[i])) {
+			perror("sender thread");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		if (!snd[i].count)
+			continue;
+
+		pthread_join(snd[i].thread, NULL);
+		close(snd[i].s);
+		free(snd[i].frames);
+	}
+
+	pthread_barrier_destroy(&loop_barrier);
+
+	/* lag of each interface against the common clock */
+	for (i = 0; i < CHANNELS && asgn[i].rxif[0]; i++) {
+		char prefix[IFNAMSIZ + 3];
+
+		snprintf(prefix, sizeof(prefix), "%.*s: ", IFNAMSIZ, asgn[i].txif);
+		print_timing_report(prefix, &snd[i].lag);
+	}
+
+	return replay_failed;
+}
+
 int main(int argc, char **argv)
 {
 	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
 	struct sockaddr_can addr;
 	static struct can_frame frame;
-	static struct timeval today_tv, log_tv, last_log_tv, diff_tv;
+	static struct timespec today_ts, log_ts, last_log_ts, diff_ts;
+	struct timespec start_ts, end_ts;
 	struct timespec sleep_ts;
 	int s; /* CAN_RAW socket */
 	FILE *infile = stdin;
 	unsigned long gap = DEFAULT_GAP; 
-	int use_timestamps = 1;
-	static int verbose, opt, delay_loops, skipgap;
+	static int opt, delay_loops, skipgap;
 	static int loopback_disable = 0;
-	static int infinite_loops = 0;
+	static int preloaded = 0;
 	static int loops = DEFAULT_LOOPS;
 	int assignments; /* assignments defined on the commandline */
 	int txidx;       /* sendto() interface index */
-	int eof, nbytes, i, j;
-	char *fret;
+	int eof, i, j, ret;
+	char *infilename = NULL;
+	char *from = NULL, *to = NULL;
+	off_t start_offset = 0; /* file offset of the first frame to replay */
 
-	while ((opt = getopt(argc, argv, "I:l:tg:s:xv?")) != -1) {
+	while ((opt = getopt_long(argc, argv, "I:l:tg:s:xpr:mb:Pv?", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'I':
 			infile = fopen(optarg, "r");
@@ -259,6 +1007,15 @@ int main(int argc, char **argv)
 				perror("infile");
 				return 1;
 			}
+			infilename = optarg;
+			break;
+
+		case 'F':
+			from = optarg;
+			break;
+
+		case 'T':
+			to = optarg;
 			break;
 
 		case 'l':
@@ -291,6 +1048,33 @@ int main(int argc, char **argv)
 			loopback_disable = 1;
 			break;
 
+		case 'p':
+			preloaded = 1;
+			break;
+
+		case 'r':
+			speed = strtod(optarg, NULL);
+			if (speed <= 0) {
+				fprintf(stderr, "invalid speed factor '%s'!\n", optarg);
+				return 1;
+			}
+			preloaded = 1;
+			break;
+
+		case 'm':
+			maxrate = 1;
+			preloaded = 1;
+			break;
+
+		case 'P':
+			parallel = 1;
+			preloaded = 1;
+			break;
+
+		case 'b':
+			bitrate = strtoul(optarg, NULL, 10);
+			break;
+
 		case 'v':
 			verbose++;
 			break;
@@ -310,6 +1094,47 @@ int main(int argc, char **argv)
 		loops = 1;
 	}
 
+	if (binlog_is_binary(infile)) {
+		if (binlog_open(&br, infile)) {
+			fprintf(stderr, "incorrect binary log file header\n");
+			return 1;
+		}
+		binary = 1;
+		start_offset = BINLOG_HDRSZ;
+	}
+
+	if (from || to) {
+		struct logidx *li;
+
+		if (infile == stdin) {
+			fprintf(stderr, "--from/--to need a logfile given with -I !\n");
+			return 1;
+		}
+
+		li = logidx_open(infilename, 0, verbose > 1);
+		if (!li)
+			return 1;
+
+		if ((from && logidx_parse_time(from, li->start_ns, &from_ns)) ||
+		    (to && logidx_parse_time(to, li->start_ns, &to_ns))) {
+			fprintf(stderr, "Invalid argument for option --from/--to !\n");
+			return 1;
+		}
+
+		/* O(log n) seek to the first block containing the start time */
+		i = logidx_find(li, from_ns);
+		if (i < li->blocks)
+			start_offset = li->blk[i].offset;
+		else
+			start_offset = li->logsize; /* nothing to replay */
+
+		if (verbose > 1) /* use -v -v to see this */
+			printf("start replay in index block %d/%u at offset %lld\n",
+			       i, li->blocks, (long long)start_offset);
+
+		logidx_free(li);
+	}
+
 	if (verbose > 1) { /* use -v -v to see this */
 		if (infinite_loops)
 			printf("infinite_loops\n");
@@ -321,28 +1146,9 @@ int main(int argc, char **argv)
 	sleep_ts.tv_nsec = (gap % 1000) * 1000000;
 
 	/* open socket */
-	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
-		perror("socket");
+	s = open_socket(loopback_disable);
+	if (s < 0)
 		return 1;
-	}
-
-	addr.can_family  = AF_CAN;
-	addr.can_ifindex = 0;
-
-	/* disable unneeded default receive filter on this RAW socket */
-	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
-
-	if (loopback_disable) {
-		int loopback = 0;
-
-		setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
-			   &loopback, sizeof(loopback));
-	}
-
-	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
-		return 1;
-	}
 
 	if (assignments) {
 		/* add & check user assginments from commandline */
@@ -368,46 +1174,72 @@ int main(int argc, char **argv)
 		}
 	}
 
-	while (infinite_loops || loops--) {
+	if (preloaded) {
+		if (infile != stdin) {
+			if (binary)
+				binlog_seek(&br, start_offset);
+			else
+				fseeko(infile, start_offset, SEEK_SET);
+		}
 
-		if (infile != stdin)
-			rewind(infile); /* for each loop */
+		if (preload(infile, s, assignments, verbose, skipgap))
+			return 1;
 
-		if (verbose > 1) /* use -v -v to see this */
-			printf (">>>>>>>>> start reading file. remaining loops = %d\n", loops);
+		clock_gettime(CLOCK_MONOTONIC, &start_ts);
 
-		/* read first non-comment frame from logfile */
-		while ((fret = fgets(buf, BUFSZ-1, infile)) != NULL && buf[0] != '(') {
-			if (strlen(buf) >= BUFSZ-2) {
-				fprintf(stderr, "comment line too long for input buffer\n");
+		if (parallel) {
+			if (replay_parallel(loopback_disable, loops))
 				return 1;
+		} else {
+			while (infinite_loops || loops--) {
+				if (verbose > 1) /* use -v -v to see this */
+					printf (">>>>>>>>> start replay. remaining loops = %d\n", loops);
+				if (replay_frames(s, replay, nreplay, replay_start(), &terr))
+					return 1;
 			}
 		}
 
-		if (!fret)
-			goto out; /* nothing to read */
+		clock_gettime(CLOCK_MONOTONIC, &end_ts);
+		print_timing_report("", &terr);
+		print_throughput_report((ts2ns(&end_ts) - ts2ns(&start_ts)) / 1e9);
+		free(replay);
+		goto out;
+	}
 
-		eof = 0;
+	while (infinite_loops || loops--) {
 
-		if (sscanf(buf, "(%ld.%ld) %s %s", &log_tv.tv_sec, &log_tv.tv_usec,
-			   device, ascframe) != 4) {
-			fprintf(stderr, "incorrect line format in logfile\n");
-			return 1;
+		if (infile != stdin) { /* for each loop */
+			if (binary)
+				binlog_seek(&br, start_offset);
+			else
+				fseeko(infile, start_offset, SEEK_SET);
 		}
 
+		if (verbose > 1) /* use -v -v to see this */
+			printf (">>>>>>>>> start reading file. remaining loops = %d\n", loops);
+
+		/* read first non-comment frame from logfile */
+		ret = read_logentry(infile, buf, &log_ts, device, ascframe, &frame);
+		if (ret < 0)
+			return 1;
+		if (!ret)
+			goto out; /* nothing to read */
+
+		eof = 0;
+
 		if (use_timestamps) { /* throttle sending due to logfile timestamps */
 
-			gettimeofday(&today_tv, NULL);
-			create_diff_tv(&today_tv, &diff_tv, &log_tv);
-			last_log_tv = log_tv;
+			clock_gettime(CLOCK_REALTIME, &today_ts);
+			create_diff_ts(&today_ts, &diff_ts, &log_ts);
+			last_log_ts = log_ts;
 		}
 
 		while (!eof) {
 
 			while ((!use_timestamps) ||
-			       (frames_to_send(&today_tv, &diff_tv, &log_tv) < 0)) {
+			       (frames_to_send(&today_ts, &diff_ts, &log_ts) < 0)) {
 
-				/* log_tv/device/ascframe are valid here */
+				/* log_ts/device/ascframe are valid here */
 
 				if (strlen(device) >= IFNAMSIZ) {
 					fprintf(stderr, "log interface name '%s' too long!", device);
@@ -426,12 +1258,17 @@ int main(int argc, char **argv)
 
 				if (txidx == STDOUTIDX) { /* hook to print logfile lines on stdout */
 
-					printf("%s", buf); /* print the line AS-IS without extra \n */
+					if (binary) {
+						sprint_canframe(ascframe, &frame, 0);
+						printf("(%ld.%09ld) %s %s\n", log_ts.tv_sec,
+						       log_ts.tv_nsec, device, ascframe);
+					} else
+						printf("%s", buf); /* print the line AS-IS without extra \n */
 					fflush(stdout);
 
 				} else if (txidx > 0) { /* only send to valid CAN devices */
 
-					if (parse_canframe(ascframe, &frame)) {
+					if (!binary && parse_canframe(ascframe, &frame)) {
 						fprintf(stderr, "wrong CAN frame format: '%s'!", ascframe);
 						return 1;
 					}
@@ -439,13 +1276,8 @@ int main(int argc, char **argv)
 					addr.can_family  = AF_CAN;
 					addr.can_ifindex = txidx; /* send via this interface */
  
-					nbytes = sendto(s, &frame, sizeof(struct can_frame), 0,
-							(struct sockaddr*)&addr, sizeof(addr));
-
-					if (nbytes != sizeof(struct can_frame)) {
-						perror("sendto");
+					if (send_frame(s, &frame, &addr))
 						return 1;
-					}
 
 					if (verbose) {
 						printf("%s (%s) ", get_txname(device), device);
@@ -454,34 +1286,24 @@ int main(int argc, char **argv)
 				}
 
 				/* read next non-comment frame from logfile */
-				while ((fret = fgets(buf, BUFSZ-1, infile)) != NULL && buf[0] != '(') {
-					if (strlen(buf) >= BUFSZ-2) {
-						fprintf(stderr, "comment line too long for input buffer\n");
-						return 1;
-					}
-				}
-
-				if (!fret) {
+				ret = read_logentry(infile, buf, &log_ts, device, ascframe, &frame);
+				if (ret < 0)
+					return 1;
+				if (!ret) {
 					eof = 1; /* this file is completely processed */
 					break;
 				}
 
-				if (sscanf(buf, "(%ld.%ld) %s %s", &log_tv.tv_sec, &log_tv.tv_usec,
-					   device, ascframe) != 4) {
-					fprintf(stderr, "incorrect line format in logfile\n");
-					return 1;
-				}
-
 				if (use_timestamps) {
-					gettimeofday(&today_tv, NULL);
+					clock_gettime(CLOCK_REALTIME, &today_ts);
 
 					/* test for logfile timestamps jumping backwards OR      */
 					/* if the user likes to skip long gaps in the timestamps */
-					if ((last_log_tv.tv_sec > log_tv.tv_sec) ||
-					    (skipgap && abs(last_log_tv.tv_sec - log_tv.tv_sec) > skipgap))
-						create_diff_tv(&today_tv, &diff_tv, &log_tv);
+					if ((last_log_ts.tv_sec > log_ts.tv_sec) ||
+					    (skipgap && labs(last_log_ts.tv_sec - log_ts.tv_sec) > skipgap))
+						create_diff_ts(&today_ts, &diff_ts, &log_ts);
 
-					last_log_tv = log_tv;
+					last_log_ts = log_ts;
 				}
 
 			} /* while frames_to_send ... */
@@ -490,7 +1312,7 @@ int main(int argc, char **argv)
 				return 1;
 
 			delay_loops++; /* private statistics */
-			gettimeofday(&today_tv, NULL);
+			clock_gettime(CLOCK_REALTIME, &today_ts);
 
 		} /* while (!eof) */
 
@@ -498,6 +1320,8 @@ int main(int argc, char **argv)
 
 out:
 
+	if (binary)
+		binlog_close(&br);
 	close(s);
 	fclose(infile);
 
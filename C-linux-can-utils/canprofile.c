@@ -0,0 +1,438 @@
+/*
+ * canprofile.c - create a statistical traffic model from a CAN log file
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "lib.h"
+#include "binlog.h"
+#include "trafficmodel.h"
+
+#define BUFSZ 400       /* for one line in the logfile */
+#define MINIDS 1024     /* initial size of the CAN ID table */
+#define RESERVOIR 8192  /* max. period samples per CAN ID */
+
+extern int optind, opterr, optopt;
+
+/* statistics of one CAN ID while reading the log */
+struct profile {
+	canid_t can_id;
+	unsigned long frames;
+	unsigned long dlccnt[9];
+	unsigned char first[8];
+	struct can_frame last;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	unsigned long compared[8];  /* payload byte comparisons */
+	unsigned long changed[8];   /* ... and changes */
+	unsigned long deltas;       /* inter frame times seen */
+	unsigned int nsamples;      /* inter frame times kept */
+	unsigned int size;
+	unsigned int *sample;       /* reservoir of inter frame times in us */
+};
+
+static struct profile *prof;
+static unsigned int *hash;     /* index + 1 into prof[], 0 = empty */
+static unsigned int nprof, maxprof;
+static uint64_t rng = 0x853C49E6748FEA9BULL;
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "\n%s: create a statistical traffic model from a CAN log file\n\n", prg);
+	fprintf(stderr, "Usage: %s [options] [<logfile>]\n\n", prg);
+	fprintf(stderr, "Options: -i <ifname>   (only use frames of this interface)\n");
+	fprintf(stderr, "         -o <file>     (write the model to <file> "
+		"- default: stdout)\n");
+	fprintf(stderr, "         -m <frames>   (ignore CAN IDs with less than "
+		"<frames> frames - default: 2)\n");
+	fprintf(stderr, "         -v            (print statistics on stderr)\n");
+	fprintf(stderr, "\nThe logfile (ASCII or binary) is read from stdin when "
+		"not given.\n");
+	fprintf(stderr, "For each CAN ID the model contains the most frequent "
+		"data length code,\n");
+	fprintf(stderr, "the change probability of each payload byte and the "
+		"distribution of the\n");
+	fprintf(stderr, "inter frame time. Use the model with 'cangen -M "
+		"<file>'.\n\n");
+	fprintf(stderr, "Example: %s -i can0 -o rnet.model candump.log\n\n", prg);
+}
+
+/* xorshift64* for the reservoir sampling */
+static inline uint64_t xorshift(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+
+	return rng * 0x2545F4914F6CDD1DULL;
+}
+
+static inline unsigned int id_hash(canid_t can_id)
+{
+	return (can_id * 2654435761U) >> 8;
+}
+
+static int grow_table(void)
+{
+	unsigned int size = (maxprof) ? 2 * maxprof : MINIDS;
+	struct profile *p;
+	unsigned int i, h;
+
+	p = realloc(prof, size * sizeof(*p));
+	if (!p)
+		return 1;
+	prof = p;
+
+	free(hash);
+	hash = calloc(2 * size, sizeof(*hash));
+	if (!hash)
+		return 1;
+
+	maxprof = size;
+
+	/* rehash */
+	for (i = 0; i < nprof; i++) {
+		h = id_hash(prof[i].can_id) & (2 * maxprof - 1);
+		while (hash[h])
+			h = (h + 1) & (2 * maxprof - 1);
+		hash[h] = i + 1;
+	}
+
+	return 0;
+}
+
+static struct profile *get_profile(canid_t can_id)
+{
+	struct profile *p;
+	unsigned int h = 0;
+
+	if (maxprof) {
+		h = id_hash(can_id) & (2 * maxprof - 1);
+		while (hash[h]) {
+			if (prof[hash[h] - 1].can_id == can_id)
+				return &prof[hash[h] - 1];
+			h = (h + 1) & (2 * maxprof - 1);
+		}
+	}
+
+	if (nprof == maxprof) {
+		if (grow_table()) {
+			perror("CAN ID table");
+			exit(1);
+		}
+		h = id_hash(can_id) & (2 * maxprof - 1);
+		while (hash[h])
+			h = (h + 1) & (2 * maxprof - 1);
+	}
+
+	p = &prof[nprof];
+	memset(p, 0, sizeof(*p));
+	p->can_id = can_id;
+	hash[h] = ++nprof;
+
+	return p;
+}
+
+/* keep a uniform sample of all inter frame times (algorithm R) */
+static void add_sample(struct profile *p, unsigned int us)
+{
+	unsigned long pos;
+	unsigned int *s;
+
+	p->deltas++;
+
+	if (p->nsamples < RESERVOIR) {
+		if (p->nsamples == p->size) {
+			p->size = (p->size) ? 2 * p->size : 16;
+			s = realloc(p->sample, p->size * sizeof(*s));
+			if (!s) {
+				perror("period samples");
+				exit(1);
+			}
+			p->sample = s;
+		}
+		p->sample[p->nsamples++] = us;
+		return;
+	}
+
+	pos = xorshift() % p->deltas;
+	if (pos < RESERVOIR)
+		p->sample[pos] = us;
+}
+
+static void account_frame(struct can_frame *cf, uint64_t ns)
+{
+	struct profile *p;
+	canid_t can_id = cf->can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG |
+				       ((cf->can_id & CAN_EFF_FLAG) ?
+					CAN_EFF_MASK : CAN_SFF_MASK));
+	unsigned int dlc = (cf->can_dlc > 8) ? 8 : cf->can_dlc;
+	unsigned int i;
+
+	p = get_profile(can_id);
+
+	if (!p->frames) {
+		memcpy(p->first, cf->data, 8);
+		p->first_ns = ns;
+	} else {
+		/* bytes present in both frames */
+		for (i = 0; i < dlc && i < p->last.can_dlc; i++) {
+			p->compared[i]++;
+			if (cf->data[i] != p->last.data[i])
+				p->changed[i]++;
+		}
+
+		/* timestamps going backwards (e.g. joined logs) are ignored */
+		if (ns >= p->last_ns)
+			add_sample(p, (ns - p->last_ns) / 1000);
+	}
+
+	p->frames++;
+	p->dlccnt[dlc]++;
+	p->last = *cf;
+	p->last.can_dlc = dlc;
+	p->last_ns = ns;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_id(const void *a, const void *b)
+{
+	const struct tm_id *x = a;
+	const struct tm_id *y = b;
+
+	return (x->can_id > y->can_id) - (x->can_id < y->can_id);
+}
+
+/* reduce the collected statistics to the compact model */
+static void make_model(struct profile *p, struct tm_id *t)
+{
+	uint64_t span;
+	unsigned int i;
+
+	memset(t, 0, sizeof(*t));
+	t->can_id = p->can_id;
+	t->frames = p->frames;
+	memcpy(t->data, p->first, 8);
+
+	for (i = 1; i < 9; i++) {
+		if (p->dlccnt[i] > p->dlccnt[t->dlc])
+			t->dlc = i;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (p->compared[i])
+			t->change[i] = (p->changed[i] * 1000 + p->compared[i] / 2) /
+				p->compared[i];
+	}
+
+	if (!p->nsamples) {
+		/*
+		 * all timestamps went backwards - take the mean inter frame
+		 * time of the whole span as a single fixed period
+		 */
+		span = (p->first_ns > p->last_ns) ? p->first_ns - p->last_ns :
+			p->last_ns - p->first_ns;
+		for (i = 0; i < TM_QUANTILES; i++)
+			t->period[i] = span / 1000 / (p->frames - 1);
+		return;
+	}
+
+	qsort(p->sample, p->nsamples, sizeof(*p->sample), cmp_uint);
+
+	for (i = 0; i < TM_QUANTILES; i++)
+		t->period[i] = p->sample[(unsigned long)i * (p->nsamples - 1) /
+					 (TM_QUANTILES - 1)];
+}
+
+int main(int argc, char **argv)
+{
+	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
+	static struct binlog_reader br;
+	static struct binlog_rec rec;
+	static struct trafficmodel tm;
+	struct can_frame cf;
+	struct timespec ts;
+	char *ifname = NULL;
+	char *outname = NULL;
+	unsigned long minframes = 2;
+	unsigned long frames = 0, skipped = 0;
+	int binary, verbose = 0;
+	unsigned int i;
+	int opt;
+	FILE *infile = stdin;
+	FILE *outfile = stdout;
+
+	while ((opt = getopt(argc, argv, "i:o:m:v?")) != -1) {
+		switch (opt) {
+		case 'i':
+			ifname = optarg;
+			break;
+
+		case 'o':
+			outname = optarg;
+			break;
+
+		case 'm':
+			minframes = strtoul(optarg, NULL, 10);
+			if (minframes < 2)
+				minframes = 2; /* at least one inter frame time */
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
+	if (optind < argc) {
+		infile = fopen(argv[optind], "r");
+		if (!infile) {
+			perror("logfile");
+			return 1;
+		}
+	}
+
+	binary = binlog_is_binary(infile);
+	if (binary && binlog_open(&br, infile)) {
+		fprintf(stderr, "incorrect binary log file header\n");
+		return 1;
+	}
+
+	while (1) {
+		if (binary) {
+			if (binlog_read(&br, &rec) <= 0)
+				break;
+			if (rec.type != BINLOG_REC_FRAME)
+				continue;
+			ts = rec.ts;
+			strcpy(device, rec.ifname);
+			cf = rec.frame;
+		} else {
+			if (!fgets(buf, BUFSZ-1, infile))
+				break;
+			if (buf[0] != '(')
+				continue;
+			if (parse_logline(buf, &ts, device, ascframe) ||
+			    parse_canframe(ascframe, &cf)) {
+				fprintf(stderr, "incorrect line format in logfile\n");
+				return 1;
+			}
+		}
+
+		if (ifname && strcmp(device, ifname)) {
+			skipped++;
+			continue;
+		}
+
+		account_frame(&cf, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+		frames++;
+	}
+
+	tm.id = malloc((nprof + 1) * sizeof(*tm.id));
+	if (!tm.id) {
+		perror("traffic model");
+		return 1;
+	}
+
+	for (i = 0; i < nprof; i++) {
+		if (prof[i].frames < minframes)
+			continue;
+		make_model(&prof[i], &tm.id[tm.ids++]);
+	}
+
+	qsort(tm.id, tm.ids, sizeof(*tm.id), cmp_id);
+
+	if (outname) {
+		outfile = fopen(outname, "w");
+		if (!outfile) {
+			perror("model file");
+			return 1;
+		}
+	}
+
+	tm_write(outfile, &tm);
+
+	if (verbose)
+		fprintf(stderr, "%lu frames (%lu skipped), %u CAN IDs, "
+			"%u modelled\n", frames, skipped, nprof, tm.ids);
+
+	if (outfile != stdout && fclose(outfile)) {
+		perror("model file");
+		return 1;
+	}
+
+	if (binary)
+		binlog_close(&br);
+	if (infile != stdin)
+		fclose(infile);
+
+	for (i = 0; i < nprof; i++)
+		free(prof[i].sample);
+	free(prof);
+	free(hash);
+	tm_free(&tm);
+
+	return 0;
+}
@@ -54,6 +54,8 @@
 #include <ctype.h>
 #include <libgen.h>
 #include <time.h>
+#include <errno.h>
+#include <stdarg.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
@@ -64,29 +66,36 @@
 #include <net/if.h>
 
 #include <linux/can.h>
-#include <linux/can/bcm.h>
+#include <linux/can/raw.h>
 
 #include "terminal.h"
+#include "lib.h"
 
 #define U64_DATA(p) (*(unsigned long long*)(p)->data)
 
 #define SETFNAME "sniffset."
 #define ANYDEV   "any"
 
+#define MINIDS   256   /* initial size of the CAN-ID table */
+#define MAXIDS   65536 /* max. number of different CAN-IDs to be tracked */
+#define MAXRULES 64    /* remembered FILTER commands for unseen CAN-IDs */
+#define RXBURST  64    /* max. frames to read per select() wakeup */
+
 /* flags */
 
-#define ENABLE  1 /* by filter or user */
-#define DISPLAY 2 /* is on the screen */
-#define UPDATE  4 /* needs to be printed on the screen */
-#define CLRSCR  8 /* clear screen in next loop */
+#define ENABLE   1 /* by filter or user */
+#define DISPLAY  2 /* is on the screen */
+#define UPDATE   4 /* needs to be printed on the screen */
+#define CLRSCR   8 /* clear screen in next loop */
+#define RECEIVED 16 /* 'current' is valid for the change detection */
 
 /* flags testing & setting */
 
-#define is_set(id, flag) (sniftab[id].flags & flag)
-#define is_clr(id, flag) (!(sniftab[id].flags & flag))
+#define is_set(idx, flag) (sniftab[idx].flags & flag)
+#define is_clr(idx, flag) (!(sniftab[idx].flags & flag))
 
-#define do_set(id, flag) (sniftab[id].flags |= flag)
-#define do_clr(id, flag) (sniftab[id].flags &= ~flag)
+#define do_set(idx, flag) (sniftab[idx].flags |= flag)
+#define do_clr(idx, flag) (sniftab[idx].flags &= ~flag)
 
 /* time defaults */
 
@@ -99,9 +108,11 @@ const char anichar[MAXANI] = {'|', '/', '-', '\\', '|', '/', '-', '\\'};
 
 #define ATTCOLOR ATTBOLD FGRED
 
-#define STARTLINESTR "X  time    ID  data ... "
+#define STARTLINESTR     "X  time    ID  data ... "
+#define STARTLINESTR_EFF "X  time         ID  data ... "
 
 struct snif {
+	canid_t id; /* CAN-ID including CAN_EFF_FLAG */
 	int flags;
 	long hold;
 	long timeout;
@@ -111,8 +122,37 @@ struct snif {
 	struct can_frame current;
 	struct can_frame marker;
 	struct can_frame notch;
-} sniftab[2048];
+	struct can_frame toggled; /* bits that ever changed */
+	unsigned int bitcnt[64];  /* toggles per bit (byte * 8 + bit) */
+};
 
+/*
+ * Sparse CAN-ID table: sniftab[] holds the per-ID state contiguously in
+ * the order of appearance. idhash[] maps the CAN-ID to its sniftab[] index
+ * (open addressing with linear probing, 0 = empty, else index + 1) and
+ * idorder[] holds the sniftab[] indices sorted by CAN-ID for the display.
+ */
+static struct snif *sniftab;
+static int *idorder;
+static int *idhash;
+static int hashbits;
+static int nids;
+static int maxids;
+static unsigned long lostids; /* not tracked as the table was full */
+
+/*
+ * The +/- FILTER commands are applied to all known CAN-IDs and are
+ * remembered to set the ENABLE flag of CAN-IDs that show up later.
+ */
+struct rule {
+	int enable;
+	canid_t value;
+	canid_t mask;
+};
+
+static struct rule rules[MAXRULES];
+static int nrules;
+static int default_enable = 1;
 
 extern int optind, opterr, optopt;
 
@@ -120,22 +160,32 @@ static int running = 1;
 static int clearscreen = 1;
 static int notch;
 static int filter_id_only;
+static int eff_ids; /* extended CAN-IDs on the screen */
 static long timeout = TIMEOUT;
 static long hold = HOLD;
 static long loop = LOOP;
 static unsigned char binary;
 static unsigned char binary_gap;
 static unsigned char color;
+static unsigned char toggleview;
 static char *interface;
-
-void rx_setup (int fd, int id);
-void rx_delete (int fd, int id);
-void print_snifline(int id);
+static FILE *evfile; /* headless mode */
+
+/* the screen output is collected and written at once per refresh */
+static char *scrbuf;
+static size_t scrlen, scrsize;
+
+int find_id(canid_t id);
+int add_id(canid_t id);
+void enable_ids(int enable, canid_t value, canid_t mask);
+void print_snifline(int idx);
+void print_event(int idx, struct can_frame *cf, struct timespec *ts);
+void print_toggles(FILE *stream);
 int handle_keyb(int fd);
-int handle_bcm(int fd, long currcms);
+int handle_raw(int fd, long currcms);
 int handle_timeo(int fd, long currcms);
 void writesettings(char* name);
-void readsettings(char* name, int sockfd);
+void readsettings(char* name, int keyb);
 
 void print_usage(char *prg)
 {
@@ -148,6 +198,7 @@ void print_usage(char *prg)
 		"c<ENTER>       - toggle color mode\n"
 		"#<ENTER>       - notch currently marked/changed bits (can be used repeatedly)\n"
 		"*<ENTER>       - clear notched marked\n"
+		"T<ENTER>       - toggle display of the ASCII / ever toggled bits (HEX)\n"
 		"rMYNAME<ENTER> - read settings file (filter/notch)\n"
 		"wMYNAME<ENTER> - write settings file (filter/notch)\n"
 		"+FILTER<ENTER> - add CAN-IDs to sniff\n"
@@ -162,6 +213,11 @@ void print_usage(char *prg)
 		"+000000<ENTER> - add all CAN-IDs\n"
 		"-000000<ENTER> - remove all CAN-IDs\n"
 		"\n"
+		"Extended (29 bit) CAN-IDs are given with 8 hex digits:\n"
+		"+0C040100<ENTER>         - add extended CAN-ID 0x0C040100\n"
+		"-0000000000000000<ENTER> - remove all extended CAN-IDs\n"
+		"+0C0401001FFFFF00<ENTER> - add extended CAN-IDs 0x0C040100 - 0x0C0401FF\n"
+		"\n"
 		"if (id & filter) == (sniff-id & filter) the action (+/-) is performed,\n"
 		"which is quite easy when the filter is 000\n"
 		"\n"
@@ -179,7 +235,11 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -t <time>  (timeout for ID display [x100ms] default: %d, 0 = OFF)\n", TIMEOUT);
 	fprintf(stderr, "         -h <time>  (hold marker on changes [x100ms] default: %d)\n", HOLD);
 	fprintf(stderr, "         -l <time>  (loop time (display) [x100ms] default: %d)\n", LOOP);
+	fprintf(stderr, "         -o <file>  (headless: write changes and toggle counters to <file>, '-' = stdout)\n");
 	fprintf(stderr, "Use interface name '%s' to receive from all can-interfaces\n", ANYDEV);
+	fprintf(stderr, "The initial FILTER uses the CAN_EFF_FLAG (0x%08X) to select\n", CAN_EFF_FLAG);
+	fprintf(stderr, "standard or extended CAN-IDs e.g. '-m 80000000 -v 80000000'.\n");
+	fprintf(stderr, "Up to %d different CAN-IDs are tracked.\n", MAXIDS);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "%s", manual);
 }
@@ -202,17 +262,13 @@ int main(int argc, char **argv)
 	struct timeval timeo, start_tv, tv;
 	struct sockaddr_can addr;
 	struct ifreq ifr;
-	int i;
 
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
 
-	for (i=0; i < 2048 ;i++) /* default: check all CAN-IDs */
-		do_set(i, ENABLE);
-
-	while ((opt = getopt(argc, argv, "m:v:r:t:h:l:qbBcf?")) != -1) {
+	while ((opt = getopt(argc, argv, "m:v:r:t:h:l:o:qbBcf?")) != -1) {
 		switch (opt) {
 		case 'm':
 			sscanf(optarg, "%x", &mask);
@@ -223,7 +279,7 @@ int main(int argc, char **argv)
 			break;
 
 		case 'r':
-			readsettings(optarg, 0); /* no BCM-setting here */
+			readsettings(optarg, 0);
 			break;
 
 		case 't':
@@ -238,6 +294,15 @@ int main(int argc, char **argv)
 			sscanf(optarg, "%ld", &loop);
 			break;
 
+		case 'o':
+			if (!strcmp(optarg, "-"))
+				evfile = stdout;
+			else if (!(evfile = fopen(optarg, "w"))) {
+				perror("event file");
+				return 1;
+			}
+			break;
+
 		case 'q':
 			quiet = 1;
 			break;
@@ -275,17 +340,12 @@ int main(int argc, char **argv)
 	}
 	
 	if (mask || value) {
-		for (i=0; i < 2048 ;i++) {
-			if ((i & mask) ==  (value & mask))
-				do_set(i, ENABLE);
-			else
-				do_clr(i, ENABLE);
-		}
+		enable_ids(0, 0, 0);
+		enable_ids(1, value, mask);
 	}
 
 	if (quiet)
-		for (i=0; i < 2048 ;i++)
-			do_clr(i, ENABLE);
+		enable_ids(0, 0, 0);
 
 	if (strlen(argv[optind]) >= IFNAMSIZ) {
 		printf("name of CAN device '%s' is too long!\n", argv[optind]);
@@ -294,7 +354,7 @@ int main(int argc, char **argv)
 
 	interface = argv[optind];
 
-	if ((s = socket(PF_CAN, SOCK_DGRAM, CAN_BCM)) < 0) {
+	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
 		perror("socket");
 		return 1;
 	}
@@ -312,24 +372,29 @@ int main(int argc, char **argv)
 	else
 		addr.can_ifindex = 0; /* any can interface */
 
-	if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("connect");
+	if (set_rx_timestamping(s, 0) < 0) {
+		perror("setsockopt SO_TIMESTAMPING");
 		return 1;
 	}
 
-	for (i=0; i < 2048 ;i++) /* initial BCM setup */
-		if (is_set(i, ENABLE))
-			rx_setup(s, i);
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
 
 	gettimeofday(&start_tv, NULL);
 	tv.tv_sec = tv.tv_usec = 0;
 
-	printf("%s", CSR_HIDE); /* hide cursor */
+	if (evfile)
+		setvbuf(evfile, NULL, _IOFBF, 65536);
+	else
+		printf("%s", CSR_HIDE); /* hide cursor */
 
 	while (running) {
 
 		FD_ZERO(&rdfs);
-		FD_SET(0, &rdfs);
+		if (!evfile)
+			FD_SET(0, &rdfs);
 		FD_SET(s, &rdfs);
 
 		timeo.tv_sec  = 0;
@@ -348,54 +413,267 @@ int main(int argc, char **argv)
 			running &= handle_keyb(s);
 
 		if (FD_ISSET(s, &rdfs))
-			running &= handle_bcm(s, currcms);
+			running &= handle_raw(s, currcms);
 
 		if (currcms - lastcms >= loop) {
-			running &= handle_timeo(s, currcms);
+			if (evfile)
+				fflush(evfile);
+			else
+				running &= handle_timeo(s, currcms);
 			lastcms = currcms;
 		}
 	}
 
-	printf("%s", CSR_SHOW); /* show cursor */
+	if (evfile) {
+		print_toggles(evfile);
+		if (evfile != stdout)
+			fclose(evfile);
+	} else
+		printf("%s", CSR_SHOW); /* show cursor */
+
+	if (lostids)
+		printf("CAN-ID table full: %lu frames with new CAN-IDs not tracked.\n",
+		       lostids);
 
 	close(s);
 	return 0;
 }
 
-void rx_setup (int fd, int id){
+static void outf(const char *fmt, ...) __attribute__((format (printf, 1, 2)));
 
-	struct {
-		struct bcm_msg_head msg_head;
-		struct can_frame frame;
-	} txmsg;
+static int scrgrow(size_t len)
+{
+	size_t size = (scrsize) ? scrsize : 4096;
+	char *buf;
 
-	txmsg.msg_head.opcode  = RX_SETUP;
-	txmsg.msg_head.can_id  = id;
-	txmsg.msg_head.flags   = RX_CHECK_DLC;
-	txmsg.msg_head.ival1.tv_sec  = 0;
-	txmsg.msg_head.ival1.tv_usec = 0;
-	txmsg.msg_head.ival2.tv_sec  = 0;
-	txmsg.msg_head.ival2.tv_usec = 0;
-	txmsg.msg_head.nframes = 1;
-	U64_DATA(&txmsg.frame) = (__u64) 0xFFFFFFFFFFFFFFFFULL;
+	while (size < scrlen + len + 1)
+		size *= 2;
 
-	if (filter_id_only)
-		txmsg.msg_head.flags |= RX_FILTER_ID;
+	buf = realloc(scrbuf, size);
+	if (!buf)
+		return -1;
 
-	if (write(fd, &txmsg, sizeof(txmsg)) < 0)
-		perror("write");
-};
+	scrbuf = buf;
+	scrsize = size;
+	return 0;
+}
+
+static void outf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(scrbuf + scrlen, scrsize - scrlen, fmt, ap);
+	va_end(ap);
+
+	if (n < 0)
+		return;
+
+	if (scrlen + n >= scrsize) {
+		if (scrgrow(n) < 0)
+			return;
+		va_start(ap, fmt);
+		vsnprintf(scrbuf + scrlen, scrsize - scrlen, fmt, ap);
+		va_end(ap);
+	}
+
+	scrlen += n;
+}
+
+static inline void outc(char c)
+{
+	if (scrlen + 1 >= scrsize && scrgrow(1) < 0)
+		return;
+
+	scrbuf[scrlen++] = c;
+}
+
+static int outdown(int lines)
+{
+	/* move over unchanged lines with a single cursor command */
+	if (lines == 1)
+		outf("%s", CSR_DOWN);
+	else if (lines > 1)
+		outf("\33[%dB", lines);
+
+	return 0;
+}
+
+static void outflush(void)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	fflush(stdout); /* keep the order with former printf() output */
+
+	while (done < scrlen) {
+		n = write(STDOUT_FILENO, scrbuf + done, scrlen - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		done += n;
+	}
+
+	scrlen = 0;
+}
+
+static inline int id_match(canid_t id, canid_t value, canid_t mask)
+{
+	return !((id ^ value) & mask);
+}
+
+static inline unsigned int id_hash(canid_t id)
+{
+	/* multiplicative hashing - spreads the sequential CAN-IDs */
+	return (id * 0x9E3779B1U) >> (32 - hashbits);
+}
+
+static int id_cmp(canid_t a, canid_t b)
+{
+	/* standard CAN-IDs first, then extended CAN-IDs */
+	return (a < b) ? -1 : (a > b);
+}
+
+int find_id(canid_t id)
+{
+	unsigned int h, hmask;
+
+	/* no table yet - hashbits is 0 */
+	if (!nids)
+		return -1;
+
+	h = id_hash(id);
+	hmask = (1U << hashbits) - 1;
+
+	while (idhash[h]) {
+		if (sniftab[idhash[h] - 1].id == id)
+			return idhash[h] - 1;
+		h = (h + 1) & hmask;
+	}
+
+	return -1;
+}
+
+static int grow_table(void)
+{
+	struct snif *tab;
+	int *order, *hash;
+	int size = (maxids) ? 2 * maxids : MINIDS;
+	int bits = 1;
+	unsigned int h;
+	int i;
+
+	if (size > MAXIDS)
+		return -1;
+
+	/* hash table is kept at max. 50% load */
+	while ((1 << bits) < 2 * size)
+		bits++;
+
+	tab = realloc(sniftab, size * sizeof(*tab));
+	if (!tab)
+		return -1;
+	sniftab = tab;
+
+	order = realloc(idorder, size * sizeof(*order));
+	if (!order)
+		return -1;
+	idorder = order;
+
+	hash = calloc(1 << bits, sizeof(*hash));
+	if (!hash)
+		return -1;
+
+	free(idhash);
+	idhash = hash;
+	hashbits = bits;
+	maxids = size;
+
+	for (i = 0; i < nids; i++) {
+		h = id_hash(sniftab[i].id);
+		while (idhash[h])
+			h = (h + 1) & ((1U << hashbits) - 1);
+		idhash[h] = i + 1;
+	}
+
+	return 0;
+}
+
+int add_id(canid_t id)
+{
+	unsigned int h;
+	int lo, hi, mid, i;
+	int enable = default_enable;
+
+	if (nids == maxids && grow_table() < 0)
+		return -1;
+
+	h = id_hash(id);
+	while (idhash[h])
+		h = (h + 1) & ((1U << hashbits) - 1);
+	idhash[h] = nids + 1;
+
+	for (i = 0; i < nrules; i++)
+		if (id_match(id, rules[i].value, rules[i].mask))
+			enable = rules[i].enable;
+
+	memset(&sniftab[nids], 0, sizeof(sniftab[nids]));
+	sniftab[nids].id = id;
+	if (enable)
+		do_set(nids, ENABLE);
+
+	/* insert into the sorted display order */
+	lo = 0;
+	hi = nids;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (id_cmp(sniftab[idorder[mid]].id, id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memmove(&idorder[lo + 1], &idorder[lo], (nids - lo) * sizeof(*idorder));
+	idorder[lo] = nids;
+
+	return nids++;
+}
+
+void enable_ids(int enable, canid_t value, canid_t mask)
+{
+	int i;
+
+	for (i = 0; i < nids; i++) {
+		if (!id_match(sniftab[i].id, value, mask))
+			continue;
 
-void rx_delete (int fd, int id){
+		if (enable) {
+			if (is_clr(i, ENABLE))
+				do_clr(i, RECEIVED); /* report next frame */
+			do_set(i, ENABLE);
+		} else
+			do_clr(i, ENABLE);
+	}
 
-	struct bcm_msg_head msg_head;
+	if (!mask) {
+		/* all CAN-IDs: forget the former rules */
+		default_enable = enable;
+		nrules = 0;
+		return;
+	}
 
-	msg_head.opcode  = RX_DELETE;
-	msg_head.can_id  = id;
-	msg_head.nframes = 0;
+	if (nrules == MAXRULES) {
+		/* the oldest rule is most likely overruled anyway */
+		memmove(&rules[0], &rules[1], (MAXRULES - 1) * sizeof(rules[0]));
+		nrules--;
+	}
 
-	if (write(fd, &msg_head, sizeof(msg_head)) < 0)
-		perror("write");
+	rules[nrules].enable = enable;
+	rules[nrules].value = value;
+	rules[nrules].mask = mask;
+	nrules++;
 }
 
 int handle_keyb(int fd){
@@ -405,7 +683,7 @@ int handle_keyb(int fd){
 	unsigned int mask;
 	unsigned int value;
 
-	if (read(0, cmd, 19) > strlen("+123456\n"))
+	if (read(0, cmd, 19) > strlen("+1234567812345678\n"))
 		return 1; /* ignore */
 
 	if (strlen(cmd) > 0)
@@ -415,30 +693,35 @@ int handle_keyb(int fd){
 
 	case '+':
 	case '-':
-		sscanf(&cmd[1], "%x", &value);
-		if (strlen(&cmd[1]) > 3) {
-			mask = value & 0xFFF;
-			value >>= 12;
+		value = mask = 0;
+		if (strlen(&cmd[1]) > 8) {
+			/* extended CAN-ID with Bitmask */
+			sscanf(&cmd[9], "%x", &mask);
+			cmd[9] = 0;
+			sscanf(&cmd[1], "%x", &value);
+			value = (value & CAN_EFF_MASK) | CAN_EFF_FLAG;
+			mask = (mask & CAN_EFF_MASK) | CAN_EFF_FLAG;
 		}
-		else
-			mask = 0x7FF;
-
-		if (cmd[0] == '+') {
-			for (i=0; i < 2048 ;i++) {
-				if (((i & mask) == (value & mask)) && (is_clr(i, ENABLE))) {
-					do_set(i, ENABLE);
-					rx_setup(fd, i);
-				}
-			}
+		else if (strlen(&cmd[1]) > 6) {
+			/* single extended CAN-ID */
+			sscanf(&cmd[1], "%x", &value);
+			value = (value & CAN_EFF_MASK) | CAN_EFF_FLAG;
+			mask = CAN_EFF_MASK | CAN_EFF_FLAG;
 		}
-		else { /* '-' */
-			for (i=0; i < 2048 ;i++) {
-				if (((i & mask) == (value & mask)) && (is_set(i, ENABLE))) {
-					do_clr(i, ENABLE);
-					rx_delete(fd, i);
-				}
+		else {
+			sscanf(&cmd[1], "%x", &value);
+			if (strlen(&cmd[1]) > 3) {
+				mask = value & 0xFFF;
+				value >>= 12;
 			}
+			else
+				mask = 0x7FF;
+
+			if (mask)
+				mask |= CAN_EFF_FLAG; /* standard CAN-IDs only */
 		}
+
+		enable_ids(cmd[0] == '+', value, mask);
 		break;
 
 	case 'w' :
@@ -446,7 +729,7 @@ int handle_keyb(int fd){
 		break;
 
 	case 'r' :
-		readsettings(&cmd[1], fd);
+		readsettings(&cmd[1], 1);
 		break;
 
 	case 'q' :
@@ -483,8 +766,12 @@ int handle_keyb(int fd){
 		notch = 1;
 		break;
 
+	case 'T' :
+		toggleview ^= 1;
+		break;
+
 	case '*' :
-		for (i=0; i < 2048; i++)
+		for (i=0; i < nids; i++)
 			U64_DATA(&sniftab[i].notch) = (__u64) 0;
 		break;
 
@@ -497,77 +784,153 @@ int handle_keyb(int fd){
 	return 1; /* ok */
 };
 
-int handle_bcm(int fd, long currcms){
-
-	int nbytes, id;
+static void count_toggles(struct snif *sn, struct can_frame *cf)
+{
+	unsigned int x;
+	int i;
 
-	struct {
-		struct bcm_msg_head msg_head;
-		struct can_frame frame;
-	} bmsg;
+	U64_DATA(&sn->toggled) |= U64_DATA(cf) ^ U64_DATA(&sn->current);
 
-	if ((nbytes = read(fd, &bmsg, sizeof(bmsg))) < 0) {
-		perror("bcm read");
-		return 0; /* quit */
+	for (i = 0; i < 8; i++) {
+		x = cf->data[i] ^ sn->current.data[i];
+		while (x) {
+			sn->bitcnt[i * 8 + __builtin_ctz(x)]++;
+			x &= x - 1;
+		}
 	}
+}
 
-	id = bmsg.msg_head.can_id;
-	ioctl(fd, SIOCGSTAMP, &sniftab[id].currstamp);
+int handle_raw(int fd, long currcms){
+
+	struct can_frame frame;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	char ctrlmsg[CMSG_SPACE(CANLIB_CMSG_TSTAMP_SPACE)];
+	struct timespec ts;
+	canid_t id;
+	__u64 changed;
+	int nbytes, idx, n;
+
+	iov.iov_base = &frame;
+	msg.msg_name = NULL;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &ctrlmsg;
+
+	/* drain the socket - the change detection is done here */
+	for (n = 0; n < RXBURST; n++) {
+
+		iov.iov_len = sizeof(frame);
+		msg.msg_namelen = 0;
+		msg.msg_controllen = sizeof(ctrlmsg);
+		msg.msg_flags = 0;
+
+		if ((nbytes = recvmsg(fd, &msg, MSG_DONTWAIT)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			perror("raw read");
+			return 0; /* quit */
+		}
 
-	if (bmsg.msg_head.opcode != RX_CHANGED) {
-		printf("received strange BCM opcode %d!\n", bmsg.msg_head.opcode);
-		return 0; /* quit */
-	}
+		if (nbytes != sizeof(frame)) {
+			printf("received strange frame length %d!\n", nbytes);
+			return 0; /* quit */
+		}
 
-	if (nbytes != sizeof(bmsg)) {
-		printf("received strange BCM data length %d!\n", nbytes);
-		return 0; /* quit */
-	}
+		if (frame.can_id & CAN_EFF_FLAG)
+			id = frame.can_id & (CAN_EFF_MASK | CAN_EFF_FLAG);
+		else
+			id = frame.can_id & CAN_SFF_MASK;
+
+		idx = find_id(id);
+		if (idx < 0) {
+			idx = add_id(id);
+			if (idx < 0) {
+				lostids++;
+				continue;
+			}
+		}
 
-	sniftab[id].current = bmsg.frame;
-	U64_DATA(&sniftab[id].marker) |= 
-		U64_DATA(&sniftab[id].current) ^ U64_DATA(&sniftab[id].last);
-	sniftab[id].timeout = (timeout)?(currcms + timeout):0;
+		if (is_clr(idx, ENABLE))
+			continue;
 
-	if (is_clr(id, DISPLAY))
-		clearscreen = 1; /* new entry -> new drawing */
+		/* same semantic as the former BCM RX_CHANGED with RX_CHECK_DLC */
+		changed = U64_DATA(&frame) ^ U64_DATA(&sniftab[idx].current);
+		if (!filter_id_only && is_set(idx, RECEIVED) && !changed &&
+		    frame.can_dlc == sniftab[idx].current.can_dlc)
+			continue;
+
+		if (changed && is_set(idx, RECEIVED))
+			count_toggles(&sniftab[idx], &frame);
+
+		ts.tv_sec = ts.tv_nsec = 0;
+		for (cmsg = CMSG_FIRSTHDR(&msg);
+		     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
+		     cmsg = CMSG_NXTHDR(&msg,cmsg))
+			cmsg_rx_timestamp(cmsg, &ts);
+
+		if (evfile)
+			print_event(idx, &frame, &ts);
+
+		sniftab[idx].currstamp.tv_sec = ts.tv_sec;
+		sniftab[idx].currstamp.tv_usec = ts.tv_nsec / 1000;
+		sniftab[idx].current = frame;
+		U64_DATA(&sniftab[idx].marker) |= 
+			U64_DATA(&sniftab[idx].current) ^ U64_DATA(&sniftab[idx].last);
+		sniftab[idx].timeout = (timeout)?(currcms + timeout):0;
+
+		if (is_clr(idx, DISPLAY))
+			clearscreen = 1; /* new entry -> new drawing */
+
+		if ((id & CAN_EFF_FLAG) && !eff_ids) {
+			eff_ids = 1; /* wider ID column */
+			clearscreen = 1;
+		}
+
+		do_set(idx, DISPLAY);
+		do_set(idx, UPDATE);
+		do_set(idx, RECEIVED);
+	}
 
-	do_set(id, DISPLAY);
-	do_set(id, UPDATE);
-	
 	return 1; /* ok */
 };
 
 int handle_timeo(int fd, long currcms){
 
-	int i;
+	int i, n;
 	int force_redraw = 0;
+	int skip = 0;
 
 	if (clearscreen) {
 		char startline[80];
-		printf("%s%s", CLR_SCREEN, CSR_HOME);
+		const char *idline = (eff_ids) ? STARTLINESTR_EFF : STARTLINESTR;
+		outf("%s%s", CLR_SCREEN, CSR_HOME);
 		snprintf(startline, 79, "< cansniffer %s # l=%ld h=%ld t=%ld >", interface, loop, hold, timeout);
-		printf("%s%*s",STARTLINESTR, 79-(int)strlen(STARTLINESTR), startline);
+		outf("%s%*s", idline, 79-(int)strlen(idline), startline);
 		force_redraw = 1;
 		clearscreen = 0;
 	}
 
 	if (notch) {
-		for (i=0; i < 2048; i++)
+		for (i=0; i < nids; i++)
 			U64_DATA(&sniftab[i].notch) |= U64_DATA(&sniftab[i].marker);
 		notch = 0;
 	}
 
-	printf("%s", CSR_HOME);
-	printf("%c\n", anichar[currcms % MAXANI]); /* funny animation */
+	outf("%s", CSR_HOME);
+	outf("%c\n", anichar[currcms % MAXANI]); /* funny animation */
+
+	for (n=0; n < nids; n++) {
 
-	for (i=0; i < 2048; i++) {
+		i = idorder[n];
 
 		if is_set(i, ENABLE) {
 
 				if is_set(i, DISPLAY) {
 
 						if (is_set(i, UPDATE) || (force_redraw)){
+							skip = outdown(skip);
 							print_snifline(i);
 							sniftab[i].hold = currcms + hold;
 							do_clr(i, UPDATE);
@@ -575,11 +938,12 @@ int handle_timeo(int fd, long currcms){
 						else
 							if ((sniftab[i].hold) && (sniftab[i].hold < currcms)) {
 								U64_DATA(&sniftab[i].marker) = (__u64) 0;
+								skip = outdown(skip);
 								print_snifline(i);
 								sniftab[i].hold = 0; /* disable update by hold */
 							}
 							else
-								printf("%s", CSR_DOWN); /* skip my line */
+								skip++; /* skip my line */
 
 						if (sniftab[i].timeout && sniftab[i].timeout < currcms) {
 							do_clr(i, DISPLAY);
@@ -592,6 +956,8 @@ int handle_timeo(int fd, long currcms){
 			}
 	}
 
+	outflush(); /* one write() per refresh */
+
 	return 1; /* ok */
 
 };
@@ -612,7 +978,8 @@ void print_snifline(int id){
 	if (diffsec > 10)
 		diffsec = 9, diffusec = 999999;
 
-	printf("%ld.%06ld  %3x  ", diffsec, diffusec, id);
+	outf("%ld.%06ld  %*x  ", diffsec, diffusec, (eff_ids) ? 8 : 3,
+	       sniftab[id].id & CAN_EFF_MASK);
 
 	if (binary) {
 
@@ -621,17 +988,17 @@ void print_snifline(int id){
 				if ((color) && (sniftab[id].marker.data[i] & 1<<j) &&
 				    (!(sniftab[id].notch.data[i] & 1<<j)))
 					if (sniftab[id].current.data[i] & 1<<j)
-						printf("%s1%s", ATTCOLOR, ATTRESET);
+						outf("%s1%s", ATTCOLOR, ATTRESET);
 					else
-						printf("%s0%s", ATTCOLOR, ATTRESET);
+						outf("%s0%s", ATTCOLOR, ATTRESET);
 				else
 					if (sniftab[id].current.data[i] & 1<<j)
-						putchar('1');
+						outc('1');
 					else
-						putchar('0');
+						outc('0');
 			}
 			if (binary_gap)
-				putchar(' ');
+				outc(' ');
 		}
 
 		/*
@@ -639,68 +1006,130 @@ void print_snifline(int id){
 		 * we need to blank the former data printout
 		 */
 		for (i=0; i<dlc_diff; i++) {
-			printf("        ");
+			outf("        ");
 			if (binary_gap)
-				putchar(' ');
+				outc(' ');
 		}
 	}
 	else {
 
 		for (i=0; i<sniftab[id].current.can_dlc; i++)
 			if ((color) && (sniftab[id].marker.data[i]) && (!(sniftab[id].notch.data[i])))
-				printf("%s%02X%s ", ATTCOLOR, sniftab[id].current.data[i], ATTRESET);
+				outf("%s%02X%s ", ATTCOLOR, sniftab[id].current.data[i], ATTRESET);
 			else
-				printf("%02X ", sniftab[id].current.data[i]);
+				outf("%02X ", sniftab[id].current.data[i]);
 
 		if (sniftab[id].current.can_dlc < 8)
-			printf("%*s", (8 - sniftab[id].current.can_dlc) * 3, "");
+			outf("%*s", (8 - sniftab[id].current.can_dlc) * 3, "");
 
-		for (i=0; i<sniftab[id].current.can_dlc; i++)
-			if ((sniftab[id].current.data[i] > 0x1F) && 
-			    (sniftab[id].current.data[i] < 0x7F))
-				if ((color) && (sniftab[id].marker.data[i]) && (!(sniftab[id].notch.data[i])))
-					printf("%s%c%s", ATTCOLOR, sniftab[id].current.data[i], ATTRESET);
+		if (toggleview) {
+			/* bits that changed since start - for reverse engineering */
+			for (i=0; i<sniftab[id].current.can_dlc; i++)
+				outf("%02X", sniftab[id].toggled.data[i]);
+		}
+		else {
+			for (i=0; i<sniftab[id].current.can_dlc; i++)
+				if ((sniftab[id].current.data[i] > 0x1F) && 
+				    (sniftab[id].current.data[i] < 0x7F))
+					if ((color) && (sniftab[id].marker.data[i]) && (!(sniftab[id].notch.data[i])))
+						outf("%s%c%s", ATTCOLOR, sniftab[id].current.data[i], ATTRESET);
+					else
+						outc(sniftab[id].current.data[i]);
 				else
-					putchar(sniftab[id].current.data[i]);
-			else
-				putchar('.');
+					outc('.');
+		}
 
 		/*
 		 * when the can_dlc decreased (dlc_diff > 0),
 		 * we need to blank the former data printout
 		 */
-		for (i=0; i<dlc_diff; i++)
-			putchar(' ');
+		for (i=0; i<dlc_diff * (toggleview + 1); i++)
+			outc(' ');
 	}
 
-	putchar('\n');
+	outc('\n');
 
 	U64_DATA(&sniftab[id].marker) = (__u64) 0;
 
 };
 
+void print_event(int idx, struct can_frame *cf, struct timespec *ts){
+
+	char buf[40];
+	int i;
+
+	sprint_canframe(buf, cf, 0);
+	fprintf(evfile, "(%ld.%06ld) %s ", ts->tv_sec, ts->tv_nsec / 1000, buf);
+
+	if (is_clr(idx, RECEIVED)) {
+		fprintf(evfile, "new\n");
+		return;
+	}
+
+	/* changed bits */
+	for (i=0; i<cf->can_dlc; i++)
+		fprintf(evfile, "%02X", cf->data[i] ^ sniftab[idx].current.data[i]);
+	fputc('\n', evfile);
+};
+
+void print_toggles(FILE *stream){
+
+	struct snif *sn;
+	int i,j,n;
+
+	fprintf(stream, "# <CAN-ID> <toggled bits> <byte>.<bit>=<toggles> ...\n");
+
+	for (n=0; n < nids; n++) {
+		sn = &sniftab[idorder[n]];
+		if (!U64_DATA(&sn->toggled))
+			continue;
+
+		if (sn->id & CAN_EFF_FLAG)
+			fprintf(stream, "# %08X ", sn->id & CAN_EFF_MASK);
+		else
+			fprintf(stream, "# %03X ", sn->id);
+
+		for (i=0; i<8; i++)
+			fprintf(stream, "%02X", sn->toggled.data[i]);
+
+		for (i=0; i<8; i++)
+			for (j=7; j>=0; j--)
+				if (sn->bitcnt[i * 8 + j])
+					fprintf(stream, " %d.%d=%u", i, j, sn->bitcnt[i * 8 + j]);
+		fputc('\n', stream);
+	}
+};
+
+
+
 
 void writesettings(char* name){
 
 	int fd;
 	char fname[30] = SETFNAME;
-	int i,j;
-	char buf[8]= {0};
+	int i,j,n;
+	char buf[30]= {0};
 
 	strncat(fname, name, 29 - strlen(fname)); 
-	fd = open(fname,  O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	fd = open(fname,  O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
     
 	if (fd > 0) {
 
-		for (i=0; i < 2048 ;i++) {
-			sprintf(buf, "<%03X>%c.", i, (is_set(i, ENABLE))?'1':'0');
-			write(fd, buf, 7);
+		for (n=0; n < nids ;n++) {
+			i = idorder[n];
+			if (sniftab[i].id & CAN_EFF_FLAG)
+				j = sprintf(buf, "<%08X>%c.", sniftab[i].id & CAN_EFF_MASK,
+					    (is_set(i, ENABLE))?'1':'0');
+			else
+				j = sprintf(buf, "<%03X>%c.", sniftab[i].id,
+					    (is_set(i, ENABLE))?'1':'0');
+			write(fd, buf, j);
 			for (j=0; j<8 ; j++){
 				sprintf(buf, "%02X", sniftab[i].notch.data[j]);
 				write(fd, buf, 2);
 			}
 			write(fd, "\n", 1);
-			/* 7 + 16 + 1 = 24 bytes per entry */ 
+			/* 7 (12 for EFF) + 16 + 1 = 24 (29) bytes per entry */ 
 		}
 		close(fd);
 	}
@@ -708,52 +1137,65 @@ void writesettings(char* name){
 		printf("unable to write setting file '%s'!\n", fname);
 };
 
-void readsettings(char* name, int sockfd){
+void readsettings(char* name, int keyb){
 
-	int fd;
+	FILE *infile;
 	char fname[30] = SETFNAME;
-	char buf[25] = {0};
-	int i,j;
+	char buf[64];
+	char *ptr;
+	canid_t id;
+	int i,j,n = 0;
 
 	strncat(fname, name, 29 - strlen(fname)); 
-	fd = open(fname, O_RDONLY);
+	infile = fopen(fname, "r");
     
-	if (fd > 0) {
-		if (!sockfd)
+	if (infile) {
+		if (!keyb)
 			printf("reading setting file '%s' ... ", fname);
 
-		for (i=0; i < 2048 ;i++) {
-			if (read(fd, &buf, 24) == 24) {
-				if (buf[5] & 1) {
-					if (is_clr(i, ENABLE)) {
-						do_set(i, ENABLE);
-						if (sockfd)
-							rx_setup(sockfd, i);
-					}
-				}
-				else
-					if (is_set(i, ENABLE)) {
-						do_clr(i, ENABLE);
-						if (sockfd)
-							rx_delete(sockfd, i);
-					}
-				for (j=7; j>=0 ; j--){
-					sniftab[i].notch.data[j] =
-						(__u8) strtoul(&buf[2*j+7], (char **)NULL, 16) & 0xFF;
-					buf[2*j+7] = 0; /* cut off each time */
+		/* <123>1.0000000000000000 or <0C040100>1.0000000000000000 */
+		while (fgets(buf, sizeof(buf), infile)) {
+
+			if (buf[0] != '<' || !(ptr = strchr(buf, '>')) ||
+			    strlen(ptr) < 2 + 1 + 16) {
+				if (!keyb)
+					printf("was only able to read %d entries from setting file '%s'!\n",
+					       n, fname);
+				break;
+			}
+
+			id = strtoul(&buf[1], NULL, 16);
+			if (ptr - buf - 1 == 8)
+				id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+			else
+				id &= CAN_SFF_MASK;
+
+			i = find_id(id);
+			if (i < 0 && (i = add_id(id)) < 0)
+				break; /* CAN-ID table full */
+
+			if (ptr[1] & 1) {
+				if (is_clr(i, ENABLE)) {
+					do_set(i, ENABLE);
+					do_clr(i, RECEIVED);
 				}
 			}
-			else {
-				if (!sockfd)
-					printf("was only able to read until index %d from setting file '%s'!\n",
-					       i, fname);
+			else
+				do_clr(i, ENABLE);
+
+			ptr += 3; /* notch data */
+			for (j=7; j>=0 ; j--){
+				sniftab[i].notch.data[j] =
+					(__u8) strtoul(&ptr[2*j], (char **)NULL, 16) & 0xFF;
+				ptr[2*j] = 0; /* cut off each time */
 			}
+			n++;
 		}
     
-		if (!sockfd)
+		if (!keyb)
 			printf("done\n");
 
-		close(fd);
+		fclose(infile);
 	}
 	else
 		printf("unable to read setting file '%s'!\n", fname);
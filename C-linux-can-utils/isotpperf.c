@@ -0,0 +1,567 @@
+/*
+ * isotpperf.c - ISO-TP bulk transfer throughput benchmark
+ *
+ * Streams a payload (a mmap()ed file or generated data) as back-to-back
+ * PDUs from one ISO-TP socket to a second one with swapped CAN IDs on
+ * the same CAN interface and verifies the received data.
+ * The transfer is repeated for each combination of the given frame types,
+ * padding settings, block sizes and STmin values.
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <net/if.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+
+#include <linux/can.h>
+#include <linux/can/isotp.h>
+
+#define NO_CAN_ID 0xFFFFFFFFU
+
+#define MAXPDU 4095
+#define MAXLIST 16      /* values per sweep parameter */
+#define RESYNC 16       /* PDUs searched after a lost PDU */
+#define DEFAULT_SIZE 65536
+
+struct setting {
+	char type;               /* s, e, x, X */
+	int pad;                 /* padding byte, -1 = off */
+	int bs, stmin;
+};
+
+struct run {
+	int r;                   /* receiving socket */
+	unsigned long pdus;      /* PDUs to be sent */
+	struct timespec *stamp;  /* send() calls */
+	unsigned long long *lat; /* per PDU latency in ns */
+	volatile int tx_done;
+
+	/* results of the receiver thread */
+	unsigned long rxpdus, lost, bad, rxerrors;
+	unsigned long long rxbytes;
+	struct timespec last;    /* last reception */
+};
+
+static unsigned char *payload;
+static size_t size;
+static int pdulen = MAXPDU;
+
+static volatile int running = 1;
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "\nUsage: %s -s <can_id> -d <can_id> [options] <CAN interface>\n", prg);
+	fprintf(stderr, "Options: -s <can_id>  (source can_id. Use 8 digits for extended IDs)\n");
+	fprintf(stderr, "         -d <can_id>  (destination can_id. Use 8 digits for extended IDs)\n");
+	fprintf(stderr, "         -f <file>    (payload file. Default: %d bytes generated data)\n", DEFAULT_SIZE);
+	fprintf(stderr, "         -l <bytes>   (size of the generated payload)\n");
+	fprintf(stderr, "         -L <bytes>   (PDU length. Default: %d)\n", MAXPDU);
+	fprintf(stderr, "         -n <count>   (transfers of the payload per setting. Default: 1)\n");
+	fprintf(stderr, "         -T <types>   (frame types: (s)tandard/(e)xtended IDs, extended\n");
+	fprintf(stderr, "                       addressing with standard (x) or extended (X) IDs)\n");
+	fprintf(stderr, "         -x <addr>    (address for extended addressing. Default: 00)\n");
+	fprintf(stderr, "         -p <list>    (padding bytes. '-' = no padding. Default: -)\n");
+	fprintf(stderr, "         -b <list>    (blocksizes. 0 = off. Default: 0)\n");
+	fprintf(stderr, "         -m <list>    (STmin values in ms/ns. See spec. Default: 0)\n");
+	fprintf(stderr, "         -t <time ns> (frame transmit time (N_As) in nanosecs)\n");
+	fprintf(stderr, "         -w <ms>      (wait for missing PDUs at the end of a run. Min. 1, Default: 1000)\n");
+	fprintf(stderr, "\nCAN IDs, addresses, padding bytes, blocksizes and STmin values are given\n");
+	fprintf(stderr, "and expected in hexadecimal values. Lists are separated by commas.\n");
+	fprintf(stderr, "Each combination of frame type, padding, blocksize and STmin is measured.\n");
+	fprintf(stderr, "The PDU latency is the time from the start of the transfer (the send()\n");
+	fprintf(stderr, "call or the reception of the previous PDU) to the complete reception.\n");
+	fprintf(stderr, "Received PDUs are identified by their content. When the payload repeats\n");
+	fprintf(stderr, "PDU sized chunks (e.g. 0xFF filled regions of a firmware image) a lost\n");
+	fprintf(stderr, "PDU can be taken for its identical successor and is counted too late or\n");
+	fprintf(stderr, "not at all - use the generated data (-l) for exact loss figures.\n");
+	fprintf(stderr, "\nExample: %s -s 700 -d 701 -f firmware.bin -b 0,8,20 -m 0,1,F5 can0\n", prg);
+	fprintf(stderr, "\n");
+}
+
+void sigterm(int signo)
+{
+	running = 0;
+}
+
+static canid_t parse_id(const char *arg)
+{
+	canid_t id = strtoul(arg, (char **)NULL, 16);
+
+	if (strlen(arg) > 7)
+		id |= CAN_EFF_FLAG;
+
+	return id;
+}
+
+/* comma separated hex values, '-' = -1 */
+static int parse_list(char *arg, int *val)
+{
+	char *tok;
+	int n = 0;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (n == MAXLIST)
+			return -1;
+		if (!strcmp(tok, "-"))
+			val[n++] = -1;
+		else
+			val[n++] = strtoul(tok, (char **)NULL, 16) & 0xFF;
+	}
+
+	return n;
+}
+
+static unsigned long long elapsed_ns(struct timespec *from, struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000ULL +
+		to->tv_nsec - from->tv_nsec;
+}
+
+static int ts_after(struct timespec *a, struct timespec *b)
+{
+	return a->tv_sec > b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/* offset and length of PDU i */
+static size_t pdu_data(unsigned long i, int *len)
+{
+	unsigned long perpass = (size + pdulen - 1) / pdulen;
+	size_t off = (i % perpass) * pdulen;
+
+	*len = (size - off < pdulen) ? size - off : pdulen;
+	return off;
+}
+
+static int pdu_match(unsigned long i, unsigned long pdus,
+		     unsigned char *buf, int nbytes)
+{
+	size_t off;
+	int len;
+
+	if (i >= pdus)
+		return 0;
+
+	off = pdu_data(i, &len);
+	return (nbytes == len && !memcmp(buf, payload + off, len));
+}
+
+static void *receiver(void *arg)
+{
+	struct run *run = arg;
+	unsigned char buf[MAXPDU + 1];
+	struct timespec now, *start;
+	unsigned long next = 0, k;
+	int nbytes;
+
+	while (next < run->pdus) {
+
+		nbytes = recv(run->r, buf, sizeof(buf), 0);
+		if (nbytes < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				/* receive timeout */
+				if (run->tx_done || !running)
+					break;
+				continue;
+			}
+			/* e.g. timeouts of the ISO-TP protocol */
+			run->rxerrors++;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (!pdu_match(next, run->pdus, buf, nbytes)) {
+			for (k = next + 1; k <= next + RESYNC; k++)
+				if (pdu_match(k, run->pdus, buf, nbytes))
+					break;
+
+			if (k > next + RESYNC) {
+				/* corrupted PDU (or lost and out of sync) */
+				run->bad++;
+				next++;
+				continue;
+			}
+
+			run->lost += k - next;
+			next = k;
+		}
+
+		/* the transfer started with the send() call or after the previous PDU */
+		start = &run->stamp[next];
+		if (run->rxpdus && ts_after(&run->last, start))
+			start = &run->last;
+		run->lat[run->rxpdus] = elapsed_ns(start, &now);
+
+		run->last = now;
+		run->rxpdus++;
+		run->rxbytes += nbytes;
+		next++;
+	}
+
+	run->lost += run->pdus - next;
+
+	return NULL;
+}
+
+static int open_socket(struct sockaddr_can *addr, struct can_isotp_options *opts,
+		       struct can_isotp_fc_options *fcopts)
+{
+	int s;
+
+	if ((s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	setsockopt(s, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, opts, sizeof(*opts));
+	setsockopt(s, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, fcopts, sizeof(*fcopts));
+
+	if (bind(s, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+		perror("bind");
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	const unsigned long long *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static double percentile(unsigned long long *lat, unsigned long n, int p)
+{
+	if (!n)
+		return 0.0;
+
+	return lat[(n - 1) * p / 100] / 1e6;
+}
+
+static void print_result(struct setting *set, struct run *run,
+			 unsigned long txerrors, double secs)
+{
+	static const char *type[] = { "11bit", "29bit", "11bit/x", "29bit/x" };
+	char pad[9] = "-";
+
+	if (set->pad >= 0)
+		sprintf(pad, "%02X", set->pad);
+
+	qsort(run->lat, run->rxpdus, sizeof(*run->lat), cmp_ull);
+
+	printf("%-8s %3s  %02X  %02X %7lu %5lu %5lu %5lu %10llu %10.0f %8.1f  %7.3f %7.3f %7.3f %7.3f\n",
+	       type[strchr("sexX", set->type) - "sexX"], pad, set->bs, set->stmin,
+	       run->rxpdus, run->lost, run->bad, txerrors + run->rxerrors,
+	       run->rxbytes, run->rxbytes / secs, run->rxpdus / secs,
+	       percentile(run->lat, run->rxpdus, 50),
+	       percentile(run->lat, run->rxpdus, 90),
+	       percentile(run->lat, run->rxpdus, 99),
+	       percentile(run->lat, run->rxpdus, 100));
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_can addr, raddr;
+	struct ifreq ifr;
+	struct can_isotp_options opts;
+	struct can_isotp_fc_options fcopts;
+	struct setting set;
+	struct run run;
+	struct timeval tv;
+	struct timespec begin, end;
+	struct stat st;
+	pthread_t thread;
+	canid_t tx_id = NO_CAN_ID, rx_id = NO_CAN_ID;
+	char *file = NULL;
+	char *types = NULL;
+	int pads[MAXLIST] = { -1 }, npads = 1;
+	int bss[MAXLIST] = { 0 }, nbss = 1;
+	int stmins[MAXLIST] = { 0 }, nstmins = 1;
+	unsigned char ext_address = 0;
+	unsigned int frame_txtime = 0;
+	unsigned int count = 1, wait_ms = 1000;
+	unsigned long i, txerrors;
+	size_t off;
+	int opt, s, fd, len, ti, pi, bi, mi;
+	extern int optind, opterr, optopt;
+
+	signal(SIGTERM, sigterm);
+	signal(SIGHUP, sigterm);
+	signal(SIGINT, sigterm);
+
+	size = DEFAULT_SIZE;
+
+	while ((opt = getopt(argc, argv, "s:d:f:l:L:n:T:x:p:b:m:t:w:?")) != -1) {
+		switch (opt) {
+		case 's':
+			tx_id = parse_id(optarg);
+			break;
+
+		case 'd':
+			rx_id = parse_id(optarg);
+			break;
+
+		case 'f':
+			file = optarg;
+			break;
+
+		case 'l':
+			size = strtoul(optarg, (char **)NULL, 10);
+			break;
+
+		case 'L':
+			pdulen = strtoul(optarg, (char **)NULL, 10);
+			break;
+
+		case 'n':
+			count = strtoul(optarg, (char **)NULL, 10);
+			break;
+
+		case 'T':
+			types = optarg;
+			break;
+
+		case 'x':
+			ext_address = strtoul(optarg, (char **)NULL, 16) & 0xFF;
+			break;
+
+		case 'p':
+			npads = parse_list(optarg, pads);
+			break;
+
+		case 'b':
+			nbss = parse_list(optarg, bss);
+			break;
+
+		case 'm':
+			nstmins = parse_list(optarg, stmins);
+			break;
+
+		case 't':
+			frame_txtime = strtoul(optarg, (char **)NULL, 10);
+			break;
+
+		case 'w':
+			wait_ms = strtoul(optarg, (char **)NULL, 10);
+			break;
+
+		case '?':
+			print_usage(basename(argv[0]));
+			exit(0);
+			break;
+
+		default:
+			fprintf(stderr, "Unknown option %c\n", opt);
+			print_usage(basename(argv[0]));
+			exit(1);
+			break;
+		}
+	}
+
+	if ((argc - optind != 1) || (tx_id == NO_CAN_ID) || (rx_id == NO_CAN_ID) ||
+	    npads <= 0 || nbss <= 0 || nstmins <= 0 ||
+	    pdulen < 1 || pdulen > MAXPDU || !count || !wait_ms ||
+	    (types && strspn(types, "sexX") != strlen(types))) {
+		print_usage(basename(argv[0]));
+		exit(1);
+	}
+
+	if (!types)
+		types = (tx_id & CAN_EFF_FLAG) ? "e" : "s";
+
+	if (file) {
+		if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+			perror(file);
+			exit(1);
+		}
+		size = st.st_size;
+		if (!size) {
+			fprintf(stderr, "%s: empty file\n", file);
+			exit(1);
+		}
+		payload = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (payload == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		madvise(payload, size, MADV_SEQUENTIAL);
+		close(fd);
+	} else {
+		unsigned int x = 2463534242U;
+
+		if (!size || !(payload = malloc(size))) {
+			fprintf(stderr, "bad payload size\n");
+			exit(1);
+		}
+		/* xorshift data - repeated patterns would hide errors */
+		for (off = 0; off < size; off++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			payload[off] = x;
+		}
+	}
+
+	memset(&run, 0, sizeof(run));
+	run.pdus = (size + pdulen - 1) / pdulen * count;
+	run.stamp = malloc(run.pdus * sizeof(*run.stamp));
+	run.lat = malloc(run.pdus * sizeof(*run.lat));
+	if (!run.stamp || !run.lat) {
+		perror("malloc");
+		exit(1);
+	}
+
+	if ((s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+	strcpy(ifr.ifr_name, argv[optind]);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror("SIOCGIFINDEX");
+		exit(1);
+	}
+	close(s);
+
+	printf("%zu bytes payload in %lu PDUs of max. %d bytes per setting\n\n",
+	       size, run.pdus, pdulen);
+	printf("%-8s %3s  %2s  %2s %7s %5s %5s %5s %10s %10s %8s  %7s %7s %7s %7s\n",
+	       "type", "pad", "bs", "st", "PDUs", "lost", "bad", "err",
+	       "bytes", "bytes/s", "PDUs/s", "p50ms", "p90ms", "p99ms", "maxms");
+
+	for (ti = 0; types[ti] && running; ti++)
+	for (pi = 0; pi < npads && running; pi++)
+	for (bi = 0; bi < nbss && running; bi++)
+	for (mi = 0; mi < nstmins && running; mi++) {
+
+		set.type = types[ti];
+		set.pad = pads[pi];
+		set.bs = bss[bi];
+		set.stmin = stmins[mi];
+
+		memset(&opts, 0, sizeof(opts));
+		opts.frame_txtime = frame_txtime;
+		if (set.type == 'x' || set.type == 'X') {
+			opts.flags |= CAN_ISOTP_EXTEND_ADDR;
+			opts.ext_address = ext_address;
+		}
+		if (set.pad >= 0) {
+			opts.flags |= CAN_ISOTP_TX_PADDING | CAN_ISOTP_RX_PADDING;
+			opts.txpad_content = opts.rxpad_content = set.pad;
+		}
+
+		/* the receiver provides bs/stmin in its flow control frames */
+		memset(&fcopts, 0, sizeof(fcopts));
+		fcopts.bs = set.bs;
+		fcopts.stmin = set.stmin;
+
+		addr.can_family = AF_CAN;
+		addr.can_ifindex = ifr.ifr_ifindex;
+		addr.can_addr.tp.tx_id = tx_id & CAN_EFF_MASK;
+		addr.can_addr.tp.rx_id = rx_id & CAN_EFF_MASK;
+		if (set.type == 'e' || set.type == 'X') {
+			addr.can_addr.tp.tx_id |= CAN_EFF_FLAG;
+			addr.can_addr.tp.rx_id |= CAN_EFF_FLAG;
+		}
+		raddr = addr;
+		raddr.can_addr.tp.tx_id = addr.can_addr.tp.rx_id;
+		raddr.can_addr.tp.rx_id = addr.can_addr.tp.tx_id;
+
+		if ((run.r = open_socket(&raddr, &opts, &fcopts)) < 0)
+			exit(1);
+		if ((s = open_socket(&addr, &opts, &fcopts)) < 0)
+			exit(1);
+
+		/* let the receiver notice the end of a broken run (0 = no timeout) */
+		tv.tv_sec = wait_ms / 1000;
+		tv.tv_usec = (wait_ms % 1000) * 1000;
+		setsockopt(run.r, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		run.tx_done = 0;
+		run.rxpdus = run.lost = run.bad = run.rxerrors = 0;
+		run.rxbytes = 0;
+		txerrors = 0;
+
+		if (pthread_create(&thread, NULL, receiver, &run)) {
+			perror("pthread_create");
+			exit(1);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
+		for (i = 0; i < run.pdus && running; i++) {
+			off = pdu_data(i, &len);
+			clock_gettime(CLOCK_MONOTONIC, &run.stamp[i]);
+			if (write(s, payload + off, len) != len)
+				txerrors++;
+		}
+
+		run.tx_done = 1;
+		pthread_join(thread, NULL);
+
+		end = (run.rxpdus) ? run.last : begin;
+		print_result(&set, &run, txerrors,
+			     (run.rxpdus) ? elapsed_ns(&begin, &end) / 1e9 : 1.0);
+
+		close(s);
+		close(run.r);
+	}
+
+	return 0;
+}
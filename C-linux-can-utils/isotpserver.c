@@ -16,6 +16,12 @@
  *
  * Valid ISO 15625-2 PDUs have a length from 1-4095 bytes.
  *
+ * With option '-R' the PDUs are transferred as raw binary data instead,
+ * prefixed with their length as 16 bit value in network byte order.
+ *
+ * All clients and ISO-TP channels (see option '-c') are handled by one
+ * process. Each TCP connection gets its own ISO-TP socket.
+ *
  * Authors:
  * Andre Naujoks (the socket server stuff)
  * Oliver Hartkopp (the rest)
@@ -67,34 +73,139 @@
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <linux/can.h>
 #include <linux/can/isotp.h>
 
 #define NO_CAN_ID 0xFFFFFFFFU
 
+#define MAXPDU 4095
+#define MAXMSG (2 * MAXPDU + 2)  /* '<' hex data '>' */
+#define MAXCHANNELS 16
+#define MAXCLIENTS 64
+#define INSIZE 16384             /* received TCP data */
+#define OUTSIZE 65536            /* pending PDUs for the client */
+
+/* epoll event tags */
+#define TAG_LISTEN 0x10000
+#define TAG_TCP    0x20000
+#define TAG_ISOTP  0x30000
+
+struct channel {
+	int port;
+	canid_t tx_id, rx_id;
+	int sl;
+};
+
+struct client {
+	int sa, sc;              /* TCP and ISO-TP socket */
+	struct channel *ch;
+	struct sockaddr_in addr;
+	unsigned int ev_tcp, ev_isotp; /* current epoll events */
+
+	/* TCP -> ISO-TP */
+	char in[INSIZE];
+	int inlen;
+	unsigned char pdu[MAXPDU];
+	int pdulen;
+	int pending;             /* pdu[] waits for the ISO-TP socket */
+	struct timespec lastread;
+	struct timespec first;   /* first data of the next message */
+	struct timespec pdustart;
+
+	/* ISO-TP -> TCP */
+	char out[OUTSIZE];
+	int outlen, outoff;
+	int pollout;
+
+	/* statistics */
+	struct timespec since;
+	unsigned long txpdus, rxpdus, txerrors;
+	unsigned long long txbytes, rxbytes;
+	unsigned long long lat_min, lat_max, lat_sum; /* ns */
+};
+
+static struct channel channel[MAXCHANNELS];
+static int channels;
+static struct client client[MAXCLIENTS];
+static int epfd;
+
+static struct can_isotp_options opts;
+static struct can_isotp_fc_options fcopts;
+static int ifindex;
+static int raw;
+static int verbose;
+
+static volatile int running = 1;
+static volatile int print_stats;
+
+/* hex conversion tables */
+static unsigned char nibble[256]; /* 0x10 = no hex character */
+static char hexpair[256][2];
+
+static void init_hex(void)
+{
+	const char hex[] = "0123456789ABCDEF";
+	int i;
+
+	memset(nibble, 0x10, sizeof(nibble));
+	for (i = 0; i < 16; i++) {
+		nibble[(unsigned char)hex[i]] = i;
+		nibble[(unsigned char)tolower(hex[i])] = i;
+	}
+
+	for (i = 0; i < 256; i++) {
+		hexpair[i][0] = hex[i >> 4];
+		hexpair[i][1] = hex[i & 0xF];
+	}
+}
+
 int b64hex(char *asc, unsigned char *bin, int len)
 {
+	unsigned char h, l;
 	int i;
 
 	for (i = 0; i < len; i++) {
-		if (!sscanf(asc+(i*2), "%2hhx", bin+i))
-			return 1;	
+		h = nibble[(unsigned char)asc[2*i]];
+		l = nibble[(unsigned char)asc[2*i+1]];
+		if ((h | l) & 0x10)
+			return 1;
+		bin[i] = (h << 4) | l;
 	}
 	return 0;
 }
 
-void childdied(int i)
+static char *bin2hex(char *asc, unsigned char *bin, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		memcpy(asc, hexpair[bin[i]], 2);
+		asc += 2;
+	}
+	return asc;
+}
+
+void shutdown_gra(int i)
 {
-	wait(NULL);
+	running = 0;
+}
+
+void request_stats(int i)
+{
+	print_stats = 1;
 }
 
 void print_usage(char *prg)
@@ -109,6 +220,8 @@ void print_usage(char *prg)
 	fprintf(stderr, " *       -s <can_id>  (source can_id. Use 8 digits for extended IDs)\n");
 	fprintf(stderr, " *       -d <can_id>  (destination can_id. Use 8 digits for extended IDs)\n");
 	fprintf(stderr, "         -x <addr>    (extended addressing mode)\n");
+	fprintf(stderr, "         -c <port>:<can_id>:<can_id> (additional channel with port, source\n");
+	fprintf(stderr, "                                      and destination can_id)\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "padding:\n");
 	fprintf(stderr, "         -p <byte>    (set and enable tx padding byte)\n");
@@ -123,60 +236,428 @@ void print_usage(char *prg)
 	fprintf(stderr, "tx path: (config, which changes local tx settings)\n");
 	fprintf(stderr, "         -t <time ns> (transmit time in nanosecs)\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "All values except for '-l' and '-t' are expected in hexadecimal values.\n");
+	fprintf(stderr, "framing:\n");
+	fprintf(stderr, "         -R           (raw binary PDUs with 16 bit length prefix instead of ASCII hex)\n");
+	fprintf(stderr, "         -v           (verbose)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "All values except for '-l', '-t' and the port of '-c' are expected in hexadecimal values.\n");
+	fprintf(stderr, "SIGUSR1 prints the statistics of the connected clients.\n");
 	fprintf(stderr, "\n");
 }
 
-int main(int argc, char **argv)
+static canid_t parse_id(const char *arg, int len)
 {
-	extern int optind, opterr, optopt;
-	int opt;
+	canid_t id = strtoul(arg, (char **)NULL, 16);
 
-	int sl, sa, sc; /* (L)isten, (A)ccept, (C)AN sockets */ 
-	struct sockaddr_in  saddr, clientaddr;
-	struct sockaddr_can caddr;
-	static struct can_isotp_options opts;
-	static struct can_isotp_fc_options fcopts;
-	struct ifreq ifr;
-	socklen_t sin_size = sizeof(clientaddr);
-	socklen_t caddrlen = sizeof(caddr);
+	if (len > 7)
+		id |= CAN_EFF_FLAG;
 
-	struct sigaction signalaction;
-	sigset_t sigset;
+	return id;
+}
+
+/* <port>:<can_id>:<can_id> */
+static int parse_channel(char *arg, struct channel *ch)
+{
+	char *tx, *rx;
+
+	tx = strchr(arg, ':');
+	if (!tx)
+		return -1;
+	rx = strchr(++tx, ':');
+	if (!rx)
+		return -1;
+	rx++;
+
+	ch->port = strtoul(arg, (char **)NULL, 10);
+	ch->tx_id = parse_id(tx, rx - tx - 1);
+	ch->rx_id = parse_id(rx, strlen(rx));
+
+	return (ch->port) ? 0 : -1;
+}
+
+static unsigned long long elapsed_ns(struct timespec *from, struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000ULL +
+		to->tv_nsec - from->tv_nsec;
+}
+
+static void print_client(struct client *c, const char *event)
+{
+	struct timespec now;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = elapsed_ns(&c->since, &now) / 1e9;
+	if (secs <= 0)
+		secs = 1e-9;
+
+	fprintf(stderr, "client %s:%d (%X/%X) %s after %.1f s:\n",
+		inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port),
+		c->ch->tx_id, c->ch->rx_id, event, secs);
+	fprintf(stderr, "  TCP>CAN %lu PDUs %llu bytes (%.0f bytes/s), %lu errors, "
+		"assembly latency min/avg/max %.3f/%.3f/%.3f ms\n",
+		c->txpdus, c->txbytes, c->txbytes / secs, c->txerrors,
+		c->lat_min / 1e6,
+		(c->txpdus) ? c->lat_sum / 1e6 / c->txpdus : 0.0,
+		c->lat_max / 1e6);
+	fprintf(stderr, "  CAN>TCP %lu PDUs %llu bytes (%.0f bytes/s)\n",
+		c->rxpdus, c->rxbytes, c->rxbytes / secs);
+}
+
+static void close_client(struct client *c, const char *event)
+{
+	print_client(c, event);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->sa, NULL);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->sc, NULL);
+	close(c->sa);
+	close(c->sc);
+	c->sa = -1;
+}
+
+static void set_events(struct client *c)
+{
+	struct epoll_event ev;
+	unsigned int tcp, isotp;
+
+	/* no more TCP data while a PDU is waiting for the ISO-TP socket */
+	tcp = ((c->pending) ? 0 : EPOLLIN) | ((c->pollout) ? EPOLLOUT : 0);
+
+	/* no more PDUs when they may not fit into out[] */
+	isotp = ((OUTSIZE - (c->outlen - c->outoff) < MAXMSG + 1) ? 0 : EPOLLIN) |
+		((c->pending) ? EPOLLOUT : 0);
+
+	if (tcp != c->ev_tcp) {
+		ev.events = tcp;
+		ev.data.u32 = TAG_TCP + (c - client);
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->sa, &ev);
+		c->ev_tcp = tcp;
+	}
+
+	if (isotp != c->ev_isotp) {
+		ev.events = isotp;
+		ev.data.u32 = TAG_ISOTP + (c - client);
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->sc, &ev);
+		c->ev_isotp = isotp;
+	}
+}
+
+/*
+ * send the pending PDUs to the client
+ * returns -1 when the client has been closed
+ */
+static int flush_out(struct client *c)
+{
+	ssize_t n;
+
+	c->pollout = 0;
+
+	while (c->outoff < c->outlen) {
+		n = send(c->sa, c->out + c->outoff, c->outlen - c->outoff, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				c->pollout = 1;
+				break;
+			}
+			close_client(c, "closed (write error)");
+			return -1;
+		}
+		c->outoff += n;
+	}
 
-	fd_set readfds;
+	if (c->outoff == c->outlen)
+		c->outoff = c->outlen = 0;
 
-	int i, ret;
+	set_events(c);
+
+	return 0;
+}
+
+/*
+ * forward the PDUs received by the ISO-TP socket
+ * returns -1 when the client has been closed
+ */
+static int isotp_rx(struct client *c)
+{
+	unsigned char msg[MAXPDU + 1]; /* + test_for_too_long_byte */
+	char *p;
 	int nbytes;
 
-	int local_port = 0;
-	int verbose = 0;
+	if (c->outoff) {
+		memmove(c->out, c->out + c->outoff, c->outlen - c->outoff);
+		c->outlen -= c->outoff;
+		c->outoff = 0;
+	}
+
+	while (OUTSIZE - c->outlen >= MAXMSG + 1) {
+
+		nbytes = recv(c->sc, msg, sizeof(msg), MSG_DONTWAIT);
+		if (nbytes < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+
+		if (nbytes < 1 || nbytes > MAXPDU) {
+			perror("read from isotp socket");
+			close_client(c, "closed (isotp error)");
+			return -1;
+		}
+
+		p = c->out + c->outlen;
+
+		if (raw) {
+			*p++ = nbytes >> 8;
+			*p++ = nbytes;
+			memcpy(p, msg, nbytes);
+			p += nbytes;
+		} else {
+			*p++ = '<';
+			p = bin2hex(p, msg, nbytes);
+			*p++ = '>';
+			*p++ = '\n';
+		}
+
+		if (verbose) {
+			char hexmsg[2 * MAXPDU + 1];
+
+			*bin2hex(hexmsg, msg, nbytes) = 0;
+			printf("CAN>TCP <%s>\n", hexmsg);
+		}
+
+		c->outlen = p - c->out;
+		c->rxpdus++;
+		c->rxbytes += nbytes;
+	}
+
+	return flush_out(c);
+}
+
+/* hand pdu[] to the ISO-TP socket */
+static void send_pdu(struct client *c)
+{
+	struct timespec now;
+	unsigned long long lat;
+
+	if (verbose) {
+		char hexmsg[2 * MAXPDU + 1];
+
+		*bin2hex(hexmsg, c->pdu, c->pdulen) = 0;
+		printf("TCP>CAN <%s>\n", hexmsg);
+	}
+
+	/* MSG_DONTWAIT: EAGAIN while the previous PDU is still sent */
+	if (send(c->sc, c->pdu, c->pdulen, MSG_DONTWAIT) < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			c->pending = 1;
+			return;
+		}
+		c->txerrors++;
+		c->pending = 0;
+		return;
+	}
+
+	c->pending = 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	lat = elapsed_ns(&c->pdustart, &now);
+	if (!c->txpdus || lat < c->lat_min)
+		c->lat_min = lat;
+	if (lat > c->lat_max)
+		c->lat_max = lat;
+	c->lat_sum += lat;
+	c->txpdus++;
+	c->txbytes += c->pdulen;
+}
+
+/*
+ * extract the PDUs from the received TCP data
+ * returns -1 when the client has been closed
+ */
+static int process_input(struct client *c)
+{
+	char *p = c->in, *end = c->in + c->inlen;
+	char *start, *stop;
+	struct timespec first = c->first;
+	int len;
+
+	while (!c->pending && p < end) {
+
+		if (raw) {
+			if (end - p < 2)
+				break;
+			len = ((unsigned char)p[0] << 8) | (unsigned char)p[1];
+			if (!len || len > MAXPDU) {
+				close_client(c, "closed (bad PDU length)");
+				return -1;
+			}
+			if (end - p < 2 + len)
+				break;
+			memcpy(c->pdu, p + 2, len);
+			c->pdulen = len;
+			p += 2 + len;
+
+		} else {
+			start = memchr(p, '<', end - p);
+			if (!start) {
+				p = end;
+				break;
+			}
 
-	int idx = 0; /* index in txmsg[] */
+			len = (end - start < MAXMSG) ? end - start : MAXMSG;
+			stop = memchr(start, '>', len);
+			if (!stop) {
+				if (len < MAXMSG) {
+					p = start; /* wait for the rest */
+					break;
+				}
+				p = start + MAXMSG; /* too long */
+				continue;
+			}
+			p = stop + 1;
 
-	unsigned char msg[4096];   /* isotp socket message buffer (4095 + test_for_too_long_byte)*/
-	char rxmsg[8194]; /* isotp->tcp ASCII message buffer (4095*2 + < > \n null) */
-	char txmsg[8193]; /* tcp->isotp ASCII message buffer (4095*2 + < > null) */
+			/* must be an even number of bytes and at least one data byte <XX> */
+			len = stop - start + 1;
+			if (len < 4 || len % 2)
+				continue;
+
+			if (b64hex(start + 1, c->pdu, (len - 2) / 2))
+				continue;
+			c->pdulen = (len - 2) / 2;
+		}
+
+		c->pdustart = first;
+		first = c->lastread; /* following messages started with the last read() */
+
+		send_pdu(c);
+	}
+
+	c->first = first;
+	c->inlen = end - p;
+	memmove(c->in, p, c->inlen);
+
+	set_events(c);
+
+	return 0;
+}
+
+/*
+ * read TCP data from the client
+ * returns -1 when the client has been closed
+ */
+static int tcp_rx(struct client *c)
+{
+	int n;
+
+	n = read(c->sa, c->in + c->inlen, INSIZE - c->inlen);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (n <= 0) {
+		close_client(c, "disconnected");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &c->lastread);
+	if (!c->inlen)
+		c->first = c->lastread;
+	c->inlen += n;
+
+	return process_input(c);
+}
+
+static void accept_client(struct channel *ch)
+{
+	struct sockaddr_in clientaddr;
+	socklen_t sin_size = sizeof(clientaddr);
+	struct sockaddr_can caddr;
+	struct epoll_event ev;
+	struct client *c;
+	int sa, sc, i;
+
+	sa = accept(ch->sl, (struct sockaddr *)&clientaddr, &sin_size);
+	if (sa < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			perror("accept");
+		return;
+	}
+
+	for (i = 0; i < MAXCLIENTS && client[i].sa >= 0; i++)
+		;
+
+	if (i == MAXCLIENTS) {
+		fprintf(stderr, "more than %d clients!\n", MAXCLIENTS);
+		close(sa);
+		return;
+	}
+
+	if ((sc = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+		perror("socket");
+		close(sa);
+		return;
+	}
+
+	setsockopt(sc, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts));
+	setsockopt(sc, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fcopts, sizeof(fcopts));
+
+	memset(&caddr, 0, sizeof(caddr));
+	caddr.can_family = AF_CAN;
+	caddr.can_ifindex = ifindex;
+	caddr.can_addr.tp.tx_id = ch->tx_id;
+	caddr.can_addr.tp.rx_id = ch->rx_id;
+
+	if (bind(sc, (struct sockaddr *)&caddr, sizeof(caddr)) < 0) {
+		perror("bind");
+		close(sc);
+		close(sa);
+		return;
+	}
+
+	c = &client[i];
+	memset(c, 0, sizeof(*c));
+	c->sa = sa;
+	c->sc = sc;
+	c->ch = ch;
+	c->addr = clientaddr;
+	clock_gettime(CLOCK_MONOTONIC, &c->since);
+
+	/* the TCP socket is nonblocking, the ISO-TP socket uses MSG_DONTWAIT */
+	fcntl(sa, F_SETFL, fcntl(sa, F_GETFL) | O_NONBLOCK);
+
+	ev.events = c->ev_tcp = EPOLLIN;
+	ev.data.u32 = TAG_TCP + i;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sa, &ev);
+	ev.events = c->ev_isotp = EPOLLIN;
+	ev.data.u32 = TAG_ISOTP + i;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sc, &ev);
+}
+
+int main(int argc, char **argv)
+{
+	extern int optind, opterr, optopt;
+	int opt;
+
+	struct sockaddr_in saddr;
+	struct ifreq ifr;
+	struct sigaction signalaction;
+	sigset_t sigset;
+	struct epoll_event ev, events[2 * MAXCLIENTS + MAXCHANNELS];
+	struct channel *ch = &channel[0];
+	struct client *c;
+	int i, n;
 
 	/* mark missing mandatory commandline options as missing */
-	caddr.can_addr.tp.tx_id = caddr.can_addr.tp.rx_id = NO_CAN_ID;
+	ch->tx_id = ch->rx_id = NO_CAN_ID;
+	channels = 1;
 
-	while ((opt = getopt(argc, argv, "l:s:d:x:p:r:P:b:m:w:t:v?")) != -1) {
+	while ((opt = getopt(argc, argv, "l:s:d:x:c:p:r:P:b:m:w:t:Rv?")) != -1) {
 		switch (opt) {
 		case 'l':
-			local_port = strtoul(optarg, (char **)NULL, 10);
+			ch->port = strtoul(optarg, (char **)NULL, 10);
 			break;
 
 		case 's':
-			caddr.can_addr.tp.tx_id = strtoul(optarg, (char **)NULL, 16);
-			if (strlen(optarg) > 7)
-				caddr.can_addr.tp.tx_id |= CAN_EFF_FLAG;
+			ch->tx_id = parse_id(optarg, strlen(optarg));
 			break;
 
 		case 'd':
-			caddr.can_addr.tp.rx_id = strtoul(optarg, (char **)NULL, 16);
-			if (strlen(optarg) > 7)
-				caddr.can_addr.tp.rx_id |= CAN_EFF_FLAG;
+			ch->rx_id = parse_id(optarg, strlen(optarg));
 			break;
 
 		case 'x':
@@ -184,6 +665,16 @@ int main(int argc, char **argv)
 			opts.ext_address = strtoul(optarg, (char **)NULL, 16) & 0xFF;
 			break;
 
+		case 'c':
+			if (channels == MAXCHANNELS ||
+			    parse_channel(optarg, &channel[channels]) < 0) {
+				printf("bad channel '%s' (max. %d channels).\n",
+				       optarg, MAXCHANNELS);
+				exit(1);
+			}
+			channels++;
+			break;
+
 		case 'p':
 			opts.flags |= CAN_ISOTP_TX_PADDING;
 			opts.txpad_content = strtoul(optarg, (char **)NULL, 16) & 0xFF;
@@ -224,6 +715,10 @@ int main(int argc, char **argv)
 			opts.frame_txtime = strtoul(optarg, (char **)NULL, 10);
 			break;
 
+		case 'R':
+			raw = 1;
+			break;
+
 		case 'v':
 			verbose = 1;
 			break;
@@ -241,157 +736,133 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if ((argc - optind != 1) || (local_port == 0) ||
-	    (caddr.can_addr.tp.tx_id == NO_CAN_ID) ||
-	    (caddr.can_addr.tp.rx_id == NO_CAN_ID)) {
+	if ((argc - optind != 1) || (channel[0].port == 0) ||
+	    (channel[0].tx_id == NO_CAN_ID) ||
+	    (channel[0].rx_id == NO_CAN_ID)) {
 		print_usage(basename(argv[0]));
 		exit(1);
 	}
-  
+
+	init_hex();
+
 	sigemptyset(&sigset);
-	signalaction.sa_handler = &childdied;
+	signalaction.sa_handler = &shutdown_gra;
 	signalaction.sa_mask = sigset;
 	signalaction.sa_flags = 0;
-	sigaction(SIGCHLD, &signalaction, NULL);  /* signal for dying child */
-
-	if((sl = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-		perror("inetsocket");
-		exit(1);
-	}
-
-	saddr.sin_family = AF_INET;
-	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	saddr.sin_port = htons(local_port);
-
-	while(bind(sl,(struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
-		printf(".");
-		fflush(NULL);
-		usleep(100000);
-	}
-
-	if (listen(sl, 3) != 0) {
-		perror("listen");
+	sigaction(SIGTERM, &signalaction, NULL);
+	sigaction(SIGINT, &signalaction, NULL);
+	signalaction.sa_handler = &request_stats;
+	sigaction(SIGUSR1, &signalaction, NULL);
+	signal(SIGPIPE, SIG_IGN); /* write errors close the client */
+
+	for (i = 0; i < MAXCLIENTS; i++)
+		client[i].sa = -1;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
 		exit(1);
 	}
 
-	while (1) { 
-		sa = accept(sl,(struct sockaddr *)&clientaddr, &sin_size);
-		if (sa > 0 ){
+	for (i = 0; i < channels; i++) {
+		ch = &channel[i];
 
-			if (fork())
-				close(sa);
-			else
-				break;
+		if((ch->sl = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+			perror("inetsocket");
+			exit(1);
 		}
-		else {
-			if (errno != EINTR) {
-				/*
-				 * If the cause for the error was NOT the
-				 * signal from a dying child => give an error
-				 */
-				perror("accept");
+
+		/* the interface is checked once for all connections */
+		if (!i) {
+			strcpy(ifr.ifr_name, argv[optind]);
+			if (ioctl(ch->sl, SIOCGIFINDEX, &ifr) < 0) {
+				perror("SIOCGIFINDEX");
 				exit(1);
 			}
+			ifindex = ifr.ifr_ifindex;
 		}
-	}
 
-	if ((sc = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
-		perror("socket");
-		exit(1);
-	}
+		saddr.sin_family = AF_INET;
+		saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		saddr.sin_port = htons(ch->port);
 
-	setsockopt(sc, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts));
-	setsockopt(sc, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fcopts, sizeof(fcopts));
+		while(bind(ch->sl,(struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+			printf(".");
+			fflush(NULL);
+			usleep(100000);
+		}
 
-	caddr.can_family = AF_CAN;
-	strcpy(ifr.ifr_name, argv[optind]);
-	if (ioctl(sc, SIOCGIFINDEX, &ifr) < 0) {
-		perror("SIOCGIFINDEX");
-		exit(1);
-	}
-	caddr.can_ifindex = ifr.ifr_ifindex;
+		if (listen(ch->sl, 16) != 0) {
+			perror("listen");
+			exit(1);
+		}
 
-	if (bind(sc, (struct sockaddr *)&caddr, caddrlen) < 0) {
-		perror("bind");
-		exit(1);
+		ev.events = EPOLLIN;
+		ev.data.u32 = TAG_LISTEN + i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, ch->sl, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
 	}
 
-	while (1) {
-
-		FD_ZERO(&readfds);
-		FD_SET(sc, &readfds);
-		FD_SET(sa, &readfds);
-
-		ret = select((sc > sa)?sc+1:sa+1, &readfds, NULL, NULL, NULL);
-
-		if (FD_ISSET(sc, &readfds)) {
-
-
-			nbytes = read(sc, &msg, 4096);
-
-			if (nbytes < 1 || nbytes > 4095) {
-				perror("read from isotp socket");
-				exit(1);
-			}
-
-			rxmsg[0] = '<';
-
-			for ( i = 0; i < nbytes; i++)
-				sprintf(rxmsg + 1 + 2*i, "%02X", msg[i]);
+	while (running) {
 
-			/* finalize string for sending */
-			strcat(rxmsg, ">\n");
-
-			if (verbose)
-				printf("CAN>TCP %s", rxmsg);
-
-			send(sa, rxmsg, strlen(rxmsg), 0);
+		if (print_stats) {
+			print_stats = 0;
+			for (i = 0; i < MAXCLIENTS; i++)
+				if (client[i].sa >= 0)
+					print_client(&client[i], "statistics");
 		}
 
+		n = epoll_wait(epfd, events, 2 * MAXCLIENTS + MAXCHANNELS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
 
-		if (FD_ISSET(sa, &readfds)) {
-
-			if (read(sa, txmsg+idx, 1) < 1) {
-				perror("read from tcp/ip socket");
-				exit(1);
-			}
+		for (i = 0; i < n; i++) {
 
-			if (!idx) {
-				if (txmsg[0] == '<')
-					idx = 1;
+			unsigned int tag = events[i].data.u32;
 
+			if (tag < TAG_TCP) {
+				accept_client(&channel[tag - TAG_LISTEN]);
 				continue;
 			}
 
-			/* max len is 4095*2 + '<' + '>' = 8192. The buffer index starts with 0 */
-			if (idx > 8191) {
-				idx = 0;
+			c = &client[tag & 0xFFFF];
+			if (c->sa < 0)
+				continue; /* closed in this round */
+
+			if (tag >= TAG_ISOTP) {
+				/* the previous PDU has been sent */
+				if (c->pending && (events[i].events & EPOLLOUT)) {
+					send_pdu(c);
+					if (process_input(c) < 0)
+						continue;
+				}
+				if (events[i].events & (EPOLLIN | EPOLLERR))
+					isotp_rx(c);
 				continue;
 			}
 
-			if (txmsg[idx] != '>') {
-				idx++;
+			if ((events[i].events & EPOLLOUT) && flush_out(c) < 0)
 				continue;
-			}
-
-			txmsg[idx+1] = 0;
-			idx = 0;
 
-			/* must be an even number of bytes and at least one data byte <XX> */
-			if (strlen(txmsg) < 4 || strlen(txmsg) % 2)
-				continue;
-
-			if (verbose)
-				printf("TCP>CAN %s\n", txmsg);
-
-			nbytes = (strlen(txmsg)-2)/2;
-			if (b64hex(txmsg+1, msg, nbytes) == 0)
-				send(sc, msg, nbytes, 0);
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				tcp_rx(c);
 		}
 	}
 
-	close(sc);
-	close(sa);
+	for (i = 0; i < MAXCLIENTS; i++)
+		if (client[i].sa >= 0)
+			close_client(&client[i], "closed");
+
+	for (i = 0; i < channels; i++)
+		close(channel[i].sl);
+
+	close(epfd);
 
 	return 0;
 }
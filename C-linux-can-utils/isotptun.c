@@ -11,6 +11,14 @@
  * Use e.g. "ifconfig ctun0 123.123.123.1 pointopoint 123.123.123.2 up"
  * to create a point-to-point IP connection on CAN.
  *
+ * With additional channels (-c) the IP traffic is striped across several
+ * ISO-TP connections. Packets of the same flow (addresses, protocol and
+ * TCP/UDP ports) always use the same channel to avoid reordering.
+ * Both ends of the tunnel have to use the same channel list.
+ * SIGUSR1 (and the program termination) prints per channel statistics.
+ * The latency is measured from reading the packet from the tun device
+ * until the ISO-TP socket has finished the transfer of the PDU.
+ *
  * Copyright (c) 2008 Volkswagen Group Electronic Research
  * All rights reserved.
  *
@@ -55,15 +63,18 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <libgen.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
 
 #include <net/if.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 
 #include <linux/can.h>
 #include <linux/can/isotp.h>
@@ -72,7 +83,49 @@
 #define NO_CAN_ID 0xFFFFFFFFU
 #define DEFAULT_NAME "ctun%d"
 
+#define MAXPKT 4096      /* read buffer - ISO-TP PDUs are max. 4095 bytes */
+#define MAXCHANNELS 16
+#define TXQLEN 16        /* packets waiting for a busy channel */
+#define BATCH 64         /* packets per wakeup and direction */
+
+/* epoll event tags */
+#define TAG_TUN   0x10000
+#define TAG_ISOTP 0x20000
+
+struct packet {
+	int len;
+	struct timespec stamp;   /* read from the tun device */
+	unsigned char data[MAXPKT];
+};
+
+struct channel {
+	canid_t tx_id, rx_id;
+	int s;
+	unsigned int events;     /* current epoll events */
+
+	/* tun -> CAN */
+	struct packet txq[TXQLEN];
+	unsigned int head, tail;
+	int busy;                /* PDU handed to the socket, not yet sent */
+	struct timespec stamp;   /* tun timestamp of the busy PDU */
+
+	/* statistics */
+	unsigned long txpkts, txdrops, txerrors;
+	unsigned long rxpkts, rxdrops, rxerrors;
+	unsigned long long txbytes, rxbytes;
+	unsigned long long lat_min, lat_max, lat_sum; /* ns */
+	unsigned long sent;
+};
+
+static struct channel channel[MAXCHANNELS];
+static int channels;
+static int epfd, t;
+static int verbose;
+static struct packet pkt;
+static struct timespec since;
+
 static volatile int running = 1;
+static volatile int print_stats;
 
 void print_usage(char *prg)
 {
@@ -81,6 +134,8 @@ void print_usage(char *prg)
 	fprintf(stderr, "ethernet frames inside ISO15765-2 (unreliable) datagrams on CAN.\n\n");
 	fprintf(stderr, "Options: -s <can_id>  (source can_id. Use 8 digits for extended IDs)\n");
 	fprintf(stderr, "         -d <can_id>  (destination can_id. Use 8 digits for extended IDs)\n");
+	fprintf(stderr, "         -c <can_id>:<can_id> (additional channel with source and\n");
+	fprintf(stderr, "                               destination can_id. Max. %d channels)\n", MAXCHANNELS);
 	fprintf(stderr, "         -n <name>    (name of created IP netdevice. Default: '%s')\n", DEFAULT_NAME);
 	fprintf(stderr, "         -x <addr>    (extended addressing mode.)\n");
 	fprintf(stderr, "         -p <byte>    (padding byte rx path)\n");
@@ -89,12 +144,19 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -t <time ns> (transmit time in nanosecs)\n");
 	fprintf(stderr, "         -b <bs>      (blocksize. 0 = off)\n");
 	fprintf(stderr, "         -m <val>     (STmin in ms/ns. See spec.)\n");
+	fprintf(stderr, "         -M <time ns> (force tx STmin in nanosecs. Ignores the STmin of the receiver)\n");
 	fprintf(stderr, "         -w <num>     (max. wait frame transmissions.)\n");
 	fprintf(stderr, "         -h           (half duplex mode.)\n");
 	fprintf(stderr, "         -v           (verbose mode. Print symbols for tunneled msgs.)\n");
 	fprintf(stderr, "\nCAN IDs and addresses are given and expected in hexadecimal values.\n");
 	fprintf(stderr, "Use e.g. 'ifconfig ctun0 123.123.123.1 pointopoint 123.123.123.2 up'\n");
 	fprintf(stderr, "to create a point-to-point IP connection on CAN.\n");
+	fprintf(stderr, "The tunnel end points need the same channels with swapped can_ids.\n");
+	fprintf(stderr, "Packets are assigned to the channels by a hash over the IP addresses,\n");
+	fprintf(stderr, "the protocol and the TCP/UDP ports. Fragmented IPv4 packets are hashed\n");
+	fprintf(stderr, "on the addresses and the protocol only, so a UDP flow that mixes\n");
+	fprintf(stderr, "fragmented and unfragmented datagrams can be reordered across channels.\n");
+	fprintf(stderr, "SIGUSR1 prints the channel statistics.\n");
 	fprintf(stderr, "\n");
 }
 
@@ -103,39 +165,285 @@ void sigterm(int signo)
 	running = 0;
 }
 
+void sigusr1(int signo)
+{
+	print_stats = 1;
+}
+
+static canid_t parse_id(const char *arg, int len)
+{
+	canid_t id = strtoul(arg, (char **)NULL, 16);
+
+	if (len > 7)
+		id |= CAN_EFF_FLAG;
+
+	return id;
+}
+
+/* <can_id>:<can_id> */
+static int parse_channel(char *arg, struct channel *ch)
+{
+	char *rx = strchr(arg, ':');
+
+	if (!rx || rx == arg || !rx[1])
+		return -1;
+
+	ch->tx_id = parse_id(arg, rx - arg);
+	rx++;
+	ch->rx_id = parse_id(rx, strlen(rx));
+
+	return 0;
+}
+
+static unsigned long long elapsed_ns(struct timespec *from, struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000ULL +
+		to->tv_nsec - from->tv_nsec;
+}
+
+static void print_channels(void)
+{
+	struct channel *ch;
+	struct timespec now;
+	double secs;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = elapsed_ns(&since, &now) / 1e9;
+	if (secs <= 0)
+		secs = 1e-9;
+
+	for (i = 0; i < channels; i++) {
+		ch = &channel[i];
+		fprintf(stderr, "channel %d (%X/%X) after %.1f s:\n",
+			i, ch->tx_id, ch->rx_id, secs);
+		fprintf(stderr, "  tun>CAN %lu packets %llu bytes (%.0f bytes/s), "
+			"%lu drops, %lu errors, latency min/avg/max %.3f/%.3f/%.3f ms\n",
+			ch->txpkts, ch->txbytes, ch->txbytes / secs,
+			ch->txdrops, ch->txerrors,
+			ch->lat_min / 1e6, (ch->sent) ? ch->lat_sum / 1e6 / ch->sent : 0.0,
+			ch->lat_max / 1e6);
+		fprintf(stderr, "  CAN>tun %lu packets %llu bytes (%.0f bytes/s), "
+			"%lu drops, %lu errors\n",
+			ch->rxpkts, ch->rxbytes, ch->rxbytes / secs,
+			ch->rxdrops, ch->rxerrors);
+	}
+}
+
+static inline unsigned int mix(unsigned int h, const unsigned char *p, int len)
+{
+	unsigned int w;
+
+	for (; len >= 4; p += 4, len -= 4) {
+		memcpy(&w, p, 4);
+		h = (h ^ w) * 0x9E3779B1U;
+	}
+	return h;
+}
+
+/*
+ * Flow hash over the IP addresses, the protocol and - for unfragmented
+ * TCP/UDP datagrams - the ports. Everything else is sent on channel 0.
+ */
+static int flow_channel(const unsigned char *p, int len)
+{
+	unsigned int h, hl;
+	unsigned char proto;
+
+	if (channels == 1)
+		return 0;
+
+	if (len >= 20 && (p[0] >> 4) == 4) {
+		hl = (p[0] & 0x0F) * 4;
+		proto = p[9];
+		h = mix(proto, p + 12, 8);
+		if ((proto == 6 || proto == 17) && len >= hl + 4 &&
+		    !(p[6] & 0x3F) && !p[7])
+			h = mix(h, p + hl, 4);
+	} else if (len >= 40 && (p[0] >> 4) == 6) {
+		proto = p[6];
+		h = mix(proto, p + 8, 32);
+		if ((proto == 6 || proto == 17) && len >= 44)
+			h = mix(h, p + 40, 4);
+	} else
+		return 0;
+
+	return (h ^ (h >> 16)) % channels;
+}
+
+static void set_events(struct channel *ch)
+{
+	struct epoll_event ev;
+	unsigned int events = EPOLLIN;
+
+	/* wait for the end of the current transfer */
+	if (ch->busy || ch->head != ch->tail)
+		events |= EPOLLOUT;
+
+	if (events == ch->events)
+		return;
+
+	ch->events = events;
+	ev.events = events;
+	ev.data.u32 = TAG_ISOTP + (ch - channel);
+	epoll_ctl(epfd, EPOLL_CTL_MOD, ch->s, &ev);
+}
+
+/* returns 1 when the PDU has been handed over, 0 when the socket is busy */
+static int send_pdu(struct channel *ch, struct packet *p)
+{
+	if (send(ch->s, p->data, p->len, MSG_DONTWAIT) < 0) {
+		if (errno == EAGAIN)
+			return 0;
+		ch->txerrors++;
+		return 1;
+	}
+
+	ch->busy = 1;
+	ch->stamp = p->stamp;
+	return 1;
+}
+
+/* the socket is writable again - send the next queued packet */
+static void isotp_tx(struct channel *ch)
+{
+	struct timespec now;
+	unsigned long long lat;
+
+	if (ch->busy) {
+		ch->busy = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		lat = elapsed_ns(&ch->stamp, &now);
+		if (!ch->lat_min || lat < ch->lat_min)
+			ch->lat_min = lat;
+		if (lat > ch->lat_max)
+			ch->lat_max = lat;
+		ch->lat_sum += lat;
+		ch->sent++;
+	}
+
+	while (ch->head != ch->tail && !ch->busy) {
+		if (!send_pdu(ch, &ch->txq[ch->head % TXQLEN]))
+			break;
+		ch->head++;
+	}
+
+	set_events(ch);
+}
+
+static void tun_rx(void)
+{
+	struct channel *ch;
+	int i;
+
+	for (i = 0; i < BATCH; i++) {
+		pkt.len = read(t, pkt.data, MAXPKT);
+		if (pkt.len < 0) {
+			if (errno != EAGAIN && errno != EINTR) {
+				perror("read tunfd");
+				running = 0;
+			}
+			break;
+		}
+
+		ch = &channel[flow_channel(pkt.data, pkt.len)];
+		clock_gettime(CLOCK_MONOTONIC, &pkt.stamp);
+		ch->txpkts++;
+		ch->txbytes += pkt.len;
+
+		if (pkt.len > 4095) {
+			/* does not fit into a PDU - check the tun MTU */
+			ch->txerrors++;
+			continue;
+		}
+
+		if (ch->head == ch->tail && !ch->busy && send_pdu(ch, &pkt)) {
+			if (verbose)
+				putchar('.');
+			set_events(ch);
+			continue;
+		}
+
+		if (ch->tail - ch->head == TXQLEN) {
+			ch->txdrops++;
+			if (verbose)
+				putchar(':');
+			continue;
+		}
+
+		memcpy(&ch->txq[ch->tail % TXQLEN], &pkt,
+		       offsetof(struct packet, data) + pkt.len);
+		ch->tail++;
+		if (verbose)
+			putchar('.');
+		set_events(ch);
+	}
+}
+
+static void isotp_rx(struct channel *ch)
+{
+	int i;
+
+	for (i = 0; i < BATCH; i++) {
+		pkt.len = recv(ch->s, pkt.data, MAXPKT, MSG_DONTWAIT);
+		if (pkt.len < 0) {
+			/* e.g. reception timeouts are reported here */
+			if (errno != EAGAIN && errno != EINTR)
+				ch->rxerrors++;
+			break;
+		}
+
+		ch->rxpkts++;
+		ch->rxbytes += pkt.len;
+
+		if (write(t, pkt.data, pkt.len) < 0) {
+			ch->rxdrops++;
+			if (verbose)
+				putchar(';');
+		} else if (verbose)
+			putchar(',');
+	}
+}
+
 int main(int argc, char **argv)
 {
-	fd_set rdfs;
-	int s, t;
 	struct sockaddr_can addr;
 	struct ifreq ifr;
+	struct epoll_event ev, events[MAXCHANNELS + 1];
 	static struct can_isotp_options opts;
 	static struct can_isotp_fc_options fcopts;
-	int opt, ret;
+	static __u32 force_tx_stmin;
+	struct channel *ch;
+	int opt, i, n;
 	extern int optind, opterr, optopt;
-	static int verbose;
-	unsigned char buffer[4096];
 	static char name[IFNAMSIZ] = DEFAULT_NAME;
-	int nbytes;
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
+	signal(SIGUSR1, sigusr1);
 
-	addr.can_addr.tp.tx_id = addr.can_addr.tp.rx_id = NO_CAN_ID;
+	channel[0].tx_id = channel[0].rx_id = NO_CAN_ID;
+	channels = 1;
 
-	while ((opt = getopt(argc, argv, "s:d:n:x:p:q:P:t:b:m:whv?")) != -1) {
+	while ((opt = getopt(argc, argv, "s:d:c:n:x:p:q:P:t:b:m:M:whv?")) != -1) {
 		switch (opt) {
 		case 's':
-			addr.can_addr.tp.tx_id = strtoul(optarg, (char **)NULL, 16);
-			if (strlen(optarg) > 7)
-				addr.can_addr.tp.tx_id |= CAN_EFF_FLAG;
+			channel[0].tx_id = parse_id(optarg, strlen(optarg));
 			break;
 
 		case 'd':
-			addr.can_addr.tp.rx_id = strtoul(optarg, (char **)NULL, 16);
-			if (strlen(optarg) > 7)
-				addr.can_addr.tp.rx_id |= CAN_EFF_FLAG;
+			channel[0].rx_id = parse_id(optarg, strlen(optarg));
+			break;
+
+		case 'c':
+			if (channels == MAXCHANNELS ||
+			    parse_channel(optarg, &channel[channels]) < 0) {
+				printf("bad channel '%s' (max. %d channels).\n",
+				       optarg, MAXCHANNELS);
+				exit(1);
+			}
+			channels++;
 			break;
 
 		case 'n':
@@ -183,6 +491,11 @@ int main(int argc, char **argv)
 			fcopts.stmin = strtoul(optarg, (char **)NULL, 16) & 0xFF;
 			break;
 
+		case 'M':
+			opts.flags |= CAN_ISOTP_FORCE_TXSTMIN;
+			force_tx_stmin = strtoul(optarg, (char **)NULL, 10);
+			break;
+
 		case 'w':
 			fcopts.wftmax = strtoul(optarg, (char **)NULL, 16) & 0xFF;
 			break;
@@ -209,35 +522,58 @@ int main(int argc, char **argv)
 	}
 
 	if ((argc - optind != 1) ||
-	    (addr.can_addr.tp.tx_id == NO_CAN_ID) ||
-	    (addr.can_addr.tp.rx_id == NO_CAN_ID)) {
+	    (channel[0].tx_id == NO_CAN_ID) ||
+	    (channel[0].rx_id == NO_CAN_ID)) {
 		print_usage(basename(argv[0]));
 		exit(1);
 	}
-  
-	if ((s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
-		perror("socket");
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
 		exit(1);
 	}
 
-	setsockopt(s, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts));
-	setsockopt(s, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fcopts, sizeof(fcopts));
+	for (i = 0; i < channels; i++) {
+		ch = &channel[i];
 
-	addr.can_family = AF_CAN;
-	strcpy(ifr.ifr_name, argv[optind]);
-	ioctl(s, SIOCGIFINDEX, &ifr);
-	addr.can_ifindex = ifr.ifr_ifindex;
+		if ((ch->s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+			perror("socket");
+			exit(1);
+		}
 
-	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
-		close(s);
-		exit(1);
+		setsockopt(ch->s, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts));
+		setsockopt(ch->s, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fcopts, sizeof(fcopts));
+		if (opts.flags & CAN_ISOTP_FORCE_TXSTMIN)
+			setsockopt(ch->s, SOL_CAN_ISOTP, CAN_ISOTP_TX_STMIN,
+				   &force_tx_stmin, sizeof(force_tx_stmin));
+
+		/* the interface is checked once for all channels */
+		if (!i) {
+			strcpy(ifr.ifr_name, argv[optind]);
+			ioctl(ch->s, SIOCGIFINDEX, &ifr);
+		}
+
+		addr.can_family = AF_CAN;
+		addr.can_ifindex = ifr.ifr_ifindex;
+		addr.can_addr.tp.tx_id = ch->tx_id;
+		addr.can_addr.tp.rx_id = ch->rx_id;
+
+		if (bind(ch->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("bind");
+			exit(1);
+		}
+
+		ch->events = ev.events = EPOLLIN;
+		ev.data.u32 = TAG_ISOTP + i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, ch->s, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
 	}
 
-	if ((t = open("/dev/net/tun", O_RDWR)) < 0) {
+	if ((t = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0) {
 		perror("open tunfd");
-		close(s);
-		close(t);
 		exit(1);
 	}
 
@@ -247,60 +583,61 @@ int main(int argc, char **argv)
 
 	if (ioctl(t, TUNSETIFF, (void *) &ifr) < 0) {
 		perror("ioctl tunfd");
-		close(s);
-		close(t);
 		exit(1);
 	}
 
-	while (running) {
+	ev.events = EPOLLIN;
+	ev.data.u32 = TAG_TUN;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, t, &ev) < 0) {
+		perror("epoll_ctl");
+		exit(1);
+	}
 
-		FD_ZERO(&rdfs);
-		FD_SET(s, &rdfs);
-		FD_SET(t, &rdfs);
+	clock_gettime(CLOCK_MONOTONIC, &since);
 
-		if ((ret = select(t+1, &rdfs, NULL, NULL, NULL)) < 0) {
-			perror("select");
-			continue;
+	while (running) {
+
+		if (print_stats) {
+			print_stats = 0;
+			print_channels();
 		}
 
-		if (FD_ISSET(s, &rdfs)) {
-			nbytes = read(s, buffer, 4096);
-			if (nbytes < 0) {
-				perror("read isotp socket");
-				return -1;
-			}
-			if (nbytes > 4095)
-				return -1;
-			ret = write(t, buffer, nbytes);
-			if (verbose) {
-				if (ret < 0 && errno == EAGAIN)
-					printf(";");
-				else
-					printf(",");
-				fflush(stdout);
-			}
+		n = epoll_wait(epfd, events, MAXCHANNELS + 1, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
 		}
 
-		if (FD_ISSET(t, &rdfs)) {
-			nbytes = read(t, buffer, 4096);
-			if (nbytes < 0) {
-				perror("read tunfd");
-				return -1;
-			}
-			if (nbytes > 4095)
-				return -1;
-			ret = write(s, buffer, nbytes);
-			if (verbose) {
-				if (ret < 0 && errno == EAGAIN)
-					printf(":");
-				else
-					printf(".");
-				fflush(stdout);
+		for (i = 0; i < n; i++) {
+
+			unsigned int tag = events[i].data.u32;
+
+			if (tag == TAG_TUN) {
+				tun_rx();
+				continue;
 			}
+
+			ch = &channel[tag - TAG_ISOTP];
+
+			if (events[i].events & (EPOLLIN | EPOLLERR))
+				isotp_rx(ch);
+
+			if (events[i].events & (EPOLLOUT | EPOLLERR))
+				isotp_tx(ch);
 		}
+
+		if (verbose)
+			fflush(stdout);
 	}
 
-	close(s);
+	print_channels();
+
+	for (i = 0; i < channels; i++)
+		close(channel[i].s);
 	close(t);
+	close(epfd);
+
 	return 0;
 }
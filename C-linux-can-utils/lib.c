@@ -48,10 +48,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 
+#include <sys/time.h>
 #include <sys/socket.h> /* for sa_family_t */
 #include <linux/can.h>
 #include <linux/can/error.h>
+#include <linux/net_tstamp.h>
 
 #include "lib.h"
 
@@ -166,6 +169,84 @@ int parse_canframe(char *cs, struct can_frame *cf) {
 	return 0;
 }
 
+int parse_logline(char *buf, struct timespec *ts, char *device, char *ascframe) {
+	/* documentation see lib.h */
+
+	char frac[10];
+	int i, digits;
+	long sec, nsec;
+
+	if (sscanf(buf, "(%ld.%9[0-9]) %s %s", &sec, frac, device, ascframe) != 4)
+		return 1;
+
+	digits = strlen(frac);
+	nsec = 0;
+	for (i = 0; i < 9; i++)
+		nsec = nsec * 10 + ((i < digits) ? frac[i] - '0' : 0);
+
+	ts->tv_sec = sec;
+	ts->tv_nsec = nsec;
+
+	return 0;
+}
+
+int set_rx_timestamping(int s, int hwstamp) {
+	/* documentation see lib.h */
+
+	const int on = 1;
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+	if (hwstamp)
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (!setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)))
+		return 0;
+
+	if (!setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)))
+		return 0;
+
+	return setsockopt(s, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+}
+
+int cmsg_rx_timestamp(struct cmsghdr *cmsg, struct timespec *ts) {
+	/* documentation see lib.h */
+
+	if (cmsg->cmsg_level != SOL_SOCKET)
+		return 0;
+
+	switch (cmsg->cmsg_type) {
+
+	case SO_TIMESTAMPING:
+	{
+		/* ts[0] software, ts[1] deprecated, ts[2] raw hardware */
+		struct timespec *stamp = (struct timespec *)CMSG_DATA(cmsg);
+
+		if (stamp[2].tv_sec || stamp[2].tv_nsec) {
+			*ts = stamp[2];
+			return 2;
+		}
+		*ts = stamp[0];
+		return 1;
+	}
+
+	case SO_TIMESTAMPNS:
+		*ts = *(struct timespec *)CMSG_DATA(cmsg);
+		return 1;
+
+	case SO_TIMESTAMP:
+	{
+		struct timeval *tv = (struct timeval *)CMSG_DATA(cmsg);
+
+		ts->tv_sec = tv->tv_sec;
+		ts->tv_nsec = tv->tv_usec * 1000;
+		return 1;
+	}
+
+	default:
+		return 0;
+	}
+}
+
 void fprint_canframe(FILE *stream , struct can_frame *cf, char *eol, int sep) {
 	/* documentation see lib.h */
 
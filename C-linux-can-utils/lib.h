@@ -153,3 +153,46 @@ void snprintf_can_error_frame(char *buf, size_t len, struct can_frame *cf,
 /*
  * Creates a CAN error frame output in user readable format.
  */
+
+int parse_logline(char *buf, struct timespec *ts, char *device, char *ascframe);
+/*
+ * Splits a log file line into timestamp, device name and CAN frame string.
+ *
+ * (1345212884.318850) can0 123#1122334455667788
+ * (1345212884.318850123) can0 123#1122334455667788
+ *
+ * The fractional part of the timestamp is given in microseconds (6 digits)
+ * or nanoseconds (9 digits) and is returned as struct timespec.
+ * device and ascframe need to provide the space of strlen(buf)+1.
+ *
+ * Return values:
+ * 0 = success
+ * 1 = error (incorrect line format)
+ */
+
+int set_rx_timestamping(int s, int hwstamp);
+/*
+ * Enables nanosecond resolution receive timestamps for socket s via
+ * SO_TIMESTAMPING. When hwstamp is set, raw hardware timestamps of the
+ * CAN controller are requested additionally.
+ * Falls back to SO_TIMESTAMPNS / SO_TIMESTAMP on older kernels.
+ *
+ * Return values:
+ * 0 = success
+ * -1 = error (see errno)
+ */
+
+int cmsg_rx_timestamp(struct cmsghdr *cmsg, struct timespec *ts);
+/*
+ * Extracts the receive timestamp from a control message delivered by
+ * recvmsg() on a socket set up with set_rx_timestamping().
+ * Hardware timestamps are preferred over software timestamps.
+ *
+ * Return values:
+ * 0 = no timestamp in this control message
+ * 1 = software timestamp written to ts
+ * 2 = hardware timestamp written to ts
+ */
+
+#define CANLIB_CMSG_TSTAMP_SPACE (3 * sizeof(struct timespec))
+/* payload size to be passed to CMSG_SPACE() for the receive timestamp */
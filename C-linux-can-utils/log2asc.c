@@ -55,6 +55,7 @@
 #include <linux/can.h>
 
 #include "lib.h"
+#include "binlog.h"
 
 #define BUFSZ 400 /* for one line in the logfile */
 
@@ -63,7 +64,7 @@ extern int optind, opterr, optopt;
 void print_usage(char *prg)
 {
 	fprintf(stderr, "Usage: %s [can-interfaces]\n", prg);
-	fprintf(stderr, "Options: -I <infile>  (default stdin)\n");
+	fprintf(stderr, "Options: -I <infile>  (default stdin - ASCII or binary log format)\n");
 	fprintf(stderr, "         -O <outfile> (default stdout)\n");
 	fprintf(stderr, "         -4 (reduce decimal place to 4 digits)\n");
 	fprintf(stderr, "         -n (set newline to cr/lf - default lf)\n");
@@ -74,7 +75,10 @@ int main(int argc, char **argv)
 	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ], id[10];
 
 	struct can_frame cf;
-	static struct timeval tv, start_tv;
+	static struct binlog_reader br;
+	static struct binlog_rec rec;
+	static struct timespec ts, start_ts;
+	static int binary, ret;
 	FILE *infile = stdin;
 	FILE *outfile = stdout;
 	static int maxdev, devno, i, crlf, d4, opt;
@@ -128,26 +132,55 @@ int main(int argc, char **argv)
 	
 	//printf("Found %d CAN devices!\n", maxdev);
 
-	while (fgets(buf, BUFSZ-1, infile)) {
-
-		if (strlen(buf) >= BUFSZ-2) {
-			fprintf(stderr, "line too long for input buffer\n");
+	if (binlog_is_binary(infile)) {
+		if (binlog_open(&br, infile)) {
+			fprintf(stderr, "incorrect binary log file header\n");
 			return 1;
 		}
+		binary = 1;
+	}
 
-		/* check for a comment line */
-		if (buf[0] != '(')
-			continue;
+	while (1) {
 
-		if (sscanf(buf, "(%ld.%ld) %s %s", &tv.tv_sec, &tv.tv_usec,
-			   device, ascframe) != 4) {
-			fprintf(stderr, "incorrect line format in logfile\n");
-			return 1;
+		if (binary) {
+			ret = binlog_read(&br, &rec);
+			if (ret < 0) {
+				fprintf(stderr, "corrupt binary log file\n");
+				return 1;
+			}
+			if (!ret)
+				break;
+
+			/* skip text records (comments) */
+			if (ret != BINLOG_REC_FRAME)
+				continue;
+
+			ts = rec.ts;
+			strcpy(device, rec.ifname);
+
+		} else {
+
+			if (!fgets(buf, BUFSZ-1, infile))
+				break;
+
+			if (strlen(buf) >= BUFSZ-2) {
+				fprintf(stderr, "line too long for input buffer\n");
+				return 1;
+			}
+
+			/* check for a comment line */
+			if (buf[0] != '(')
+				continue;
+
+			if (parse_logline(buf, &ts, device, ascframe)) {
+				fprintf(stderr, "incorrect line format in logfile\n");
+				return 1;
+			}
 		}
 
-		if (!start_tv.tv_sec) { /* print banner */
-			start_tv = tv;
-			fprintf(outfile, "date %s", ctime(&start_tv.tv_sec));
+		if (!start_ts.tv_sec) { /* print banner */
+			start_ts = ts;
+			fprintf(outfile, "date %s", ctime(&start_ts.tv_sec));
 			fprintf(outfile, "base hex  timestamps absolute%s",
 				(crlf)?"\r\n":"\n");
 			fprintf(outfile, "no internal events logged%s",
@@ -162,20 +195,22 @@ int main(int argc, char **argv)
 		}
 
 		if (devno) { /* only convert for selected CAN devices */
-			if (parse_canframe(ascframe, &cf))
+			if (binary)
+				cf = rec.frame;
+			else if (parse_canframe(ascframe, &cf))
 				return 1;
 
-			tv.tv_sec  = tv.tv_sec - start_tv.tv_sec;
-			tv.tv_usec = tv.tv_usec - start_tv.tv_usec;
-			if (tv.tv_usec < 0)
-				tv.tv_sec--, tv.tv_usec += 1000000;
-			if (tv.tv_sec < 0)
-				tv.tv_sec = tv.tv_usec = 0;
+			ts.tv_sec  = ts.tv_sec - start_ts.tv_sec;
+			ts.tv_nsec = ts.tv_nsec - start_ts.tv_nsec;
+			if (ts.tv_nsec < 0)
+				ts.tv_sec--, ts.tv_nsec += 1000000000;
+			if (ts.tv_sec < 0)
+				ts.tv_sec = ts.tv_nsec = 0;
 
 			if (d4)
-				fprintf(outfile, "%4ld.%04ld ", tv.tv_sec, tv.tv_usec/100);
+				fprintf(outfile, "%4ld.%04ld ", ts.tv_sec, ts.tv_nsec/100000);
 			else
-				fprintf(outfile, "%4ld.%06ld ", tv.tv_sec, tv.tv_usec);
+				fprintf(outfile, "%4ld.%06ld ", ts.tv_sec, ts.tv_nsec/1000);
 
 			fprintf(outfile, "%-2d ", devno); /* channel number left aligned */
 
@@ -0,0 +1,171 @@
+/*
+ * log2bin.c - convert compact CAN frame logfile to binary log format
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "lib.h"
+#include "binlog.h"
+
+#define BUFSZ 400 /* for one line in the logfile */
+
+extern int optind, opterr, optopt;
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prg);
+	fprintf(stderr, "Options: -I <infile>  (default stdin)\n");
+	fprintf(stderr, "         -O <outfile> (default stdout)\n");
+	fprintf(stderr, "         -v           (print conversion statistics on stderr)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
+	static struct binlog_writer bw;
+	unsigned char hdr[BINLOG_HDRSZ];
+	struct can_frame cf;
+	struct timespec ts, start, end;
+	FILE *infile = stdin;
+	FILE *outfile = stdout;
+	unsigned long long inbytes = 0, outbytes = 0;
+	unsigned long frames = 0;
+	int verbose = 0;
+	int opt, n;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "I:O:v?")) != -1) {
+		switch (opt) {
+		case 'I':
+			infile = fopen(optarg, "r");
+			if (!infile) {
+				perror("infile");
+				return 1;
+			}
+			break;
+
+		case 'O':
+			outfile = fopen(optarg, "w");
+			if (!outfile) {
+				perror("outfile");
+				return 1;
+			}
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		case '?':
+			print_usage(basename(argv[0]));
+			return 0;
+			break;
+
+		default:
+			fprintf(stderr, "Unknown option %c\n", opt);
+			print_usage(basename(argv[0]));
+			return 1;
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	outbytes = fwrite(hdr, 1, binlog_header(hdr), outfile);
+	binlog_writer_init(&bw, outfile);
+
+	while (fgets(buf, BUFSZ-1, infile)) {
+
+		if (strlen(buf) >= BUFSZ-2) {
+			fprintf(stderr, "line too long for input buffer\n");
+			return 1;
+		}
+
+		inbytes += strlen(buf);
+
+		/* keep comments and DROPCOUNT lines as text records */
+		if (buf[0] != '(') {
+			n = binlog_write_text(&bw, buf);
+		} else {
+			if (parse_logline(buf, &ts, device, ascframe)) {
+				fprintf(stderr, "incorrect line format in logfile\n");
+				return 1;
+			}
+
+			if (parse_canframe(ascframe, &cf)) {
+				fprintf(stderr, "wrong CAN frame format: '%s'!\n", ascframe);
+				return 1;
+			}
+
+			n = binlog_write_frame(&bw, &ts, device, &cf);
+			frames++;
+		}
+
+		if (n < 0) {
+			perror("write");
+			return 1;
+		}
+		outbytes += n;
+	}
+
+	fflush(outfile);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (verbose) {
+		secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "%lu frames: %llu bytes ASCII -> %llu bytes binary "
+			"(%.1f%%, %.1f vs. %.1f bytes/frame) in %.3fs\n",
+			frames, inbytes, outbytes,
+			(inbytes) ? 100.0 * outbytes / inbytes : 0.0,
+			(frames) ? (double)inbytes / frames : 0.0,
+			(frames) ? (double)outbytes / frames : 0.0, secs);
+	}
+
+	return 0;
+}
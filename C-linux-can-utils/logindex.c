@@ -0,0 +1,422 @@
+/*
+ * logindex.c - time and CAN-ID index for CAN log files
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+
+#include "lib.h"
+#include "binlog.h"
+#include "logindex.h"
+
+#define BUFSZ 400 /* for one line in the logfile */
+#define IDXMAGIC "CANLIDX1"
+#define IDXVERSION 1
+
+struct idxhdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t binary;
+	uint64_t logsize;
+	uint64_t start_ns;
+	uint32_t blocks;
+	uint32_t pad;
+};
+
+static inline uint32_t idhash(canid_t key)
+{
+	uint32_t h = key;
+
+	h ^= h >> 16;
+	h *= 0x7feb352d;
+	h ^= h >> 15;
+	h *= 0x846ca68b;
+	h ^= h >> 16;
+
+	return h;
+}
+
+canid_t logidx_key(canid_t can_id)
+{
+	if (can_id & CAN_EFF_FLAG)
+		return can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+
+	return can_id & CAN_SFF_MASK;
+}
+
+static inline void bloom_add(struct logidx_block *b, canid_t key)
+{
+	uint32_t h = idhash(key);
+
+	b->bloom[(h >> 6) & 7] |= 1ULL << (h & 63);
+	h >>= 9;
+	b->bloom[(h >> 6) & 7] |= 1ULL << (h & 63);
+}
+
+int logidx_may_contain(struct logidx_block *b, canid_t *ids, int nids)
+{
+	uint32_t h;
+	int i;
+
+	if (!nids)
+		return 1;
+
+	for (i = 0; i < nids; i++) {
+		h = idhash(logidx_key(ids[i]));
+		if (!(b->bloom[(h >> 6) & 7] & (1ULL << (h & 63))))
+			continue;
+		h >>= 9;
+		if (b->bloom[(h >> 6) & 7] & (1ULL << (h & 63)))
+			return 1;
+	}
+
+	return 0;
+}
+
+static struct logidx_block *new_block(struct logidx *li, uint32_t *alloc,
+				      uint64_t offset)
+{
+	struct logidx_block *b;
+
+	if (li->blocks == *alloc) {
+		*alloc = (*alloc) ? *alloc * 2 : 256;
+		b = realloc(li->blk, *alloc * sizeof(*b));
+		if (!b)
+			return NULL;
+		li->blk = b;
+	}
+
+	b = &li->blk[li->blocks++];
+	memset(b, 0, sizeof(*b));
+	b->offset = offset;
+
+	return b;
+}
+
+static inline void add_frame(struct logidx_block *b, struct timespec *ts,
+			     struct can_frame *cf)
+{
+	uint64_t ns = (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+
+	if (!b->frames || ns < b->min_ns)
+		b->min_ns = ns;
+	if (!b->frames || ns > b->max_ns)
+		b->max_ns = ns;
+	b->frames++;
+
+	bloom_add(b, logidx_key(cf->can_id));
+}
+
+static int build(struct logidx *li, FILE *f)
+{
+	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
+	static struct binlog_reader br;
+	static struct binlog_rec rec;
+	struct logidx_block *b = NULL;
+	struct can_frame cf;
+	struct timespec ts;
+	uint32_t alloc = 0;
+	off_t pos = 0, linepos;
+	off_t sync = -1;
+	int ret, i;
+
+	if (li->binary) {
+		if (binlog_open(&br, f))
+			return -1;
+
+		while ((ret = binlog_read(&br, &rec)) > 0) {
+			if (ret != BINLOG_REC_FRAME)
+				continue;
+			if (br.sync != sync) {
+				sync = br.sync;
+				b = new_block(li, &alloc, sync);
+				if (!b)
+					break;
+			}
+			add_frame(b, &rec.ts, &rec.frame);
+		}
+
+		binlog_close(&br);
+		if (ret) /* corrupt log or out of memory */
+			return -1;
+
+	} else {
+		while (fgets(buf, BUFSZ-1, f)) {
+
+			linepos = pos;
+			pos += strlen(buf);
+
+			if (buf[0] != '(')
+				continue;
+
+			if (parse_logline(buf, &ts, device, ascframe) ||
+			    parse_canframe(ascframe, &cf)) {
+				fprintf(stderr, "incorrect line format in logfile\n");
+				return -1;
+			}
+
+			if (!b || b->frames == LOGIDX_BLOCK) {
+				b = new_block(li, &alloc, linepos);
+				if (!b)
+					return -1;
+			}
+			add_frame(b, &ts, &cf);
+		}
+	}
+
+	if (!li->blocks)
+		return 0;
+
+	li->blk[0].maxpre_ns = li->blk[0].max_ns;
+	for (i = 1; i < li->blocks; i++) {
+		b = &li->blk[i];
+		b->maxpre_ns = b->max_ns;
+		if (li->blk[i - 1].maxpre_ns > b->maxpre_ns)
+			b->maxpre_ns = li->blk[i - 1].maxpre_ns;
+	}
+
+	i = li->blocks - 1;
+	li->blk[i].minsuf_ns = li->blk[i].min_ns;
+	for (i--; i >= 0; i--) {
+		b = &li->blk[i];
+		b->minsuf_ns = b->min_ns;
+		if (li->blk[i + 1].minsuf_ns < b->minsuf_ns)
+			b->minsuf_ns = li->blk[i + 1].minsuf_ns;
+	}
+
+	li->start_ns = li->blk[0].minsuf_ns;
+
+	return 0;
+}
+
+static int load(struct logidx *li, const char *idxname)
+{
+	struct idxhdr hdr;
+	FILE *f;
+
+	f = fopen(idxname, "r");
+	if (!f)
+		return -1;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, IDXMAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != IDXVERSION || hdr.logsize != li->logsize)
+		goto fail;
+
+	li->blk = malloc((hdr.blocks + 1) * sizeof(*li->blk));
+	if (!li->blk ||
+	    fread(li->blk, sizeof(*li->blk), hdr.blocks, f) != hdr.blocks)
+		goto fail;
+
+	li->binary = hdr.binary;
+	li->start_ns = hdr.start_ns;
+	li->blocks = hdr.blocks;
+	fclose(f);
+
+	return 0;
+
+fail:
+	free(li->blk);
+	li->blk = NULL;
+	fclose(f);
+
+	return -1;
+}
+
+static int save(struct logidx *li, const char *idxname)
+{
+	char tmpname[FILENAME_MAX + sizeof(".tmp")];
+	struct idxhdr hdr;
+	FILE *f;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, IDXMAGIC, sizeof(hdr.magic));
+	hdr.version = IDXVERSION;
+	hdr.binary = li->binary;
+	hdr.logsize = li->logsize;
+	hdr.start_ns = li->start_ns;
+	hdr.blocks = li->blocks;
+
+	/* write to a temporary file to never expose a half written index */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", idxname);
+	f = fopen(tmpname, "w");
+	if (!f)
+		return -1;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(li->blk, sizeof(*li->blk), li->blocks, f) != li->blocks) {
+		fclose(f);
+		unlink(tmpname);
+		return -1;
+	}
+
+	if (fclose(f) || rename(tmpname, idxname)) {
+		unlink(tmpname);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct logidx *logidx_open(const char *logname, int rebuild, int verbose)
+{
+	char idxname[FILENAME_MAX];
+	struct logidx *li;
+	struct stat st;
+	FILE *f;
+
+	if (stat(logname, &st)) {
+		perror(logname);
+		return NULL;
+	}
+
+	li = calloc(1, sizeof(*li));
+	if (!li)
+		return NULL;
+
+	li->logsize = st.st_size;
+	snprintf(idxname, sizeof(idxname), "%s.idx", logname);
+
+	if (!rebuild && !load(li, idxname))
+		return li;
+
+	f = fopen(logname, "r");
+	if (!f) {
+		perror(logname);
+		free(li);
+		return NULL;
+	}
+
+	li->binary = binlog_is_binary(f);
+
+	if (verbose)
+		fprintf(stderr, "building index '%s' ...\n", idxname);
+
+	if (build(li, f)) {
+		fprintf(stderr, "failed to index '%s'\n", logname);
+		fclose(f);
+		logidx_free(li);
+		return NULL;
+	}
+	fclose(f);
+
+	if (save(li, idxname))
+		fprintf(stderr, "could not write index '%s' - using it in memory only\n",
+			idxname);
+
+	if (verbose)
+		fprintf(stderr, "indexed %u blocks\n", li->blocks);
+
+	return li;
+}
+
+void logidx_free(struct logidx *li)
+{
+	free(li->blk);
+	free(li);
+}
+
+int logidx_find(struct logidx *li, uint64_t from_ns)
+{
+	int lo = 0, hi = li->blocks, mid;
+
+	/* first block with maxpre_ns >= from_ns (maxpre_ns is sorted) */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (li->blk[mid].maxpre_ns < from_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int logidx_beyond(struct logidx *li, int blk, uint64_t to_ns)
+{
+	if (blk >= li->blocks)
+		return 1;
+
+	return li->blk[blk].minsuf_ns > to_ns;
+}
+
+int logidx_parse_time(const char *arg, uint64_t start_ns, uint64_t *ns)
+{
+	uint64_t sec, frac = 0;
+	int absolute = 0, digits = 0;
+	char *end;
+
+	if (*arg == '@') {
+		absolute = 1;
+		arg++;
+	}
+
+	sec = strtoull(arg, &end, 10);
+	if (end == arg)
+		return 1;
+
+	if (*end == '.') {
+		for (end++; *end >= '0' && *end <= '9'; end++) {
+			if (digits++ < 9)
+				frac = frac * 10 + (*end - '0');
+		}
+	}
+
+	if (*end)
+		return 1;
+
+	for (; digits < 9; digits++)
+		frac *= 10;
+
+	*ns = sec * 1000000000ULL + frac;
+	if (!absolute)
+		*ns += start_ns;
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * logindex.h - time and CAN-ID index for CAN log files
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/can.h>
+
+/*
+ * The index is a sidecar file <logfile>.idx for ASCII and binary logs.
+ * It splits the log into blocks (LOGIDX_BLOCK frame lines for ASCII
+ * logs, the SYNC blocks of binary logs) and stores for each block the
+ * file offset, earliest/latest timestamp, frame count and a 512 bit bloom
+ * filter of the contained CAN IDs.
+ *
+ * The running maximum of the latest timestamps and the running minimum
+ * (from the end) of the earliest timestamps make the block table sortable,
+ * so the first block of a time range is found by binary search even for
+ * logs with slightly unordered timestamps (e.g. merged interfaces).
+ *
+ * The index file is written in host byte order.
+ */
+
+#define LOGIDX_BLOCK 1024 /* frame lines per block in ASCII logs */
+#define LOGIDX_BLOOMWORDS 8
+
+struct logidx_block {
+	uint64_t offset;    /* file offset of the block start */
+	uint64_t min_ns;    /* earliest frame timestamp in the block */
+	uint64_t max_ns;    /* latest frame timestamp in the block */
+	uint64_t maxpre_ns; /* max. max_ns of this and all previous blocks */
+	uint64_t minsuf_ns; /* min. min_ns of this and all following blocks */
+	uint32_t frames;
+	uint32_t pad;
+	uint64_t bloom[LOGIDX_BLOOMWORDS];
+};
+
+struct logidx {
+	int binary;         /* indexed log is in binary format */
+	uint64_t logsize;   /* size of the indexed log file */
+	uint64_t start_ns;  /* earliest frame timestamp in the log */
+	uint32_t blocks;
+	struct logidx_block *blk;
+};
+
+struct logidx *logidx_open(const char *logname, int rebuild, int verbose);
+/*
+ * Loads the index <logname>.idx. When it does not exist, does not match
+ * the current log file size or 'rebuild' is set, the index is (re)built
+ * by scanning the log file once.
+ * Returns NULL on error.
+ */
+
+void logidx_free(struct logidx *li);
+
+int logidx_find(struct logidx *li, uint64_t from_ns);
+/*
+ * Returns the first block which may contain frames with timestamps
+ * >= from_ns (binary search - O(log n)) or li->blocks if there is none.
+ */
+
+int logidx_beyond(struct logidx *li, int blk, uint64_t to_ns);
+/*
+ * Returns 1 when block 'blk' and all following blocks only contain
+ * frames with timestamps > to_ns.
+ */
+
+int logidx_may_contain(struct logidx_block *b, canid_t *ids, int nids);
+/*
+ * Returns 1 when the block may contain one of the given CAN IDs (bloom
+ * filter check, no false negatives). nids == 0 matches every block.
+ * IDs are given as can_id with CAN_EFF_FLAG for extended frames.
+ */
+
+canid_t logidx_key(canid_t can_id);
+/*
+ * Returns the normalized CAN ID (identifier + CAN_EFF_FLAG) used as
+ * index key for the given can_id.
+ */
+
+int logidx_parse_time(const char *arg, uint64_t start_ns, uint64_t *ns);
+/*
+ * Converts a time argument into an absolute timestamp in ns:
+ * "<secs>[.<fraction>]"  seconds relative to the log start (start_ns)
+ * "@<secs>[.<fraction>]" absolute time (seconds since the epoch)
+ * Returns 0 on success, 1 on error.
+ */
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * logrotate.c - size/time based rotation of CAN log files
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <time.h>
+
+#include "logrotate.h"
+
+#define MAXNAME 256 /* max. length of a segment file name */
+#define CLOSEQ  8   /* finished segments waiting for the helper thread */
+
+struct segment {
+	FILE *file;
+	char name[MAXNAME];
+	struct timespec first;
+	struct timespec last;
+	unsigned long frames;
+	unsigned long long bytes;
+};
+
+struct logrot {
+	char base[MAXNAME - 32];
+	char ext[16];
+	unsigned char hdr[64];  /* written at the start of each file */
+	size_t hdrlen;
+	unsigned long long maxsize;
+	unsigned int interval;
+	time_t deadline;      /* next interval boundary (frame timestamp) */
+	int rotating;         /* helper thread active */
+	int pending;          /* rotation due but next segment not ready */
+	unsigned long late;
+
+	struct segment cur;   /* only touched by the capture thread */
+
+	/* shared with the helper thread - protected by 'lock' */
+	pthread_t helper;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int running;
+	unsigned int seq;     /* sequence number of the next segment */
+	int next_ready;
+	struct segment next;
+	struct segment closeq[CLOSEQ];
+	unsigned int cq_head, cq_tail;
+
+	FILE *manifest;       /* only touched by the helper thread */
+};
+
+static void segment_name(struct logrot *lr, unsigned int seq, char *name)
+{
+	snprintf(name, MAXNAME, "%s-%03u%s", lr->base, seq, lr->ext);
+}
+
+static FILE *open_file(struct logrot *lr, struct segment *seg)
+{
+	seg->file = fopen(seg->name, "w");
+	if (!seg->file)
+		return NULL;
+
+	if (lr->hdrlen) {
+		fwrite(lr->hdr, 1, lr->hdrlen, seg->file);
+		seg->bytes = lr->hdrlen;
+	}
+
+	return seg->file;
+}
+
+static void manifest_add(struct logrot *lr, struct segment *seg)
+{
+	fprintf(lr->manifest, "%s (%ld.%09ld) (%ld.%09ld) %lu\n", seg->name,
+		seg->first.tv_sec, seg->first.tv_nsec,
+		seg->last.tv_sec, seg->last.tv_nsec, seg->frames);
+	fflush(lr->manifest);
+}
+
+static void *helper_thread(void *arg)
+{
+	struct logrot *lr = arg;
+	struct segment seg;
+	unsigned int seq;
+
+	pthread_mutex_lock(&lr->lock);
+
+	while (lr->running || lr->cq_head != lr->cq_tail) {
+
+		if (lr->cq_head != lr->cq_tail) {
+			/* close finished segment outside the lock */
+			seg = lr->closeq[lr->cq_head % CLOSEQ];
+			pthread_mutex_unlock(&lr->lock);
+
+			if (fclose(seg.file))
+				perror("logfile close");
+			manifest_add(lr, &seg);
+
+			pthread_mutex_lock(&lr->lock);
+			lr->cq_head++;
+			continue;
+		}
+
+		if (!lr->next_ready) {
+			/* open the next segment ahead of time */
+			seq = lr->seq;
+			pthread_mutex_unlock(&lr->lock);
+
+			memset(&seg, 0, sizeof(seg));
+			segment_name(lr, seq, seg.name);
+			if (!open_file(lr, &seg)) {
+				perror("logfile");
+				sleep(1); /* retry later - capture continues */
+			}
+
+			pthread_mutex_lock(&lr->lock);
+			if (seg.file) {
+				lr->next = seg;
+				lr->next_ready = 1;
+				lr->seq++;
+			}
+			continue;
+		}
+
+		pthread_cond_wait(&lr->cond, &lr->lock);
+	}
+
+	pthread_mutex_unlock(&lr->lock);
+
+	return NULL;
+}
+
+struct logrot *logrot_open(const char *base, const char *ext,
+			   const void *hdr, size_t hdrlen,
+			   unsigned long long maxsize, unsigned int interval)
+{
+	struct logrot *lr;
+	char name[MAXNAME];
+
+	if (strlen(base) >= sizeof(lr->base) ||
+	    strlen(ext) >= sizeof(lr->ext) || hdrlen > sizeof(lr->hdr)) {
+		fprintf(stderr, "log file name '%s%s' too long!\n", base, ext);
+		return NULL;
+	}
+
+	lr = calloc(1, sizeof(*lr));
+	if (!lr) {
+		perror("logrotate");
+		return NULL;
+	}
+
+	strcpy(lr->base, base);
+	strcpy(lr->ext, ext);
+	if (hdrlen)
+		memcpy(lr->hdr, hdr, hdrlen);
+	lr->hdrlen = hdrlen;
+	lr->maxsize = maxsize;
+	lr->interval = interval;
+
+	if (!maxsize && !interval) {
+		/* classic single log file */
+		snprintf(lr->cur.name, MAXNAME, "%s%s", base, ext);
+		if (!open_file(lr, &lr->cur)) {
+			perror("logfile");
+			free(lr);
+			return NULL;
+		}
+		return lr;
+	}
+
+	snprintf(name, MAXNAME, "%s.manifest", base);
+	lr->manifest = fopen(name, "w");
+	if (!lr->manifest) {
+		perror("manifest");
+		free(lr);
+		return NULL;
+	}
+	fprintf(lr->manifest, "# <segment> (<first timestamp>) (<last timestamp>) <frames>\n");
+	fflush(lr->manifest);
+
+	segment_name(lr, 0, lr->cur.name);
+	if (!open_file(lr, &lr->cur)) {
+		perror("logfile");
+		fclose(lr->manifest);
+		free(lr);
+		return NULL;
+	}
+
+	lr->seq = 1;
+	lr->running = 1;
+	pthread_mutex_init(&lr->lock, NULL);
+	pthread_cond_init(&lr->cond, NULL);
+
+	if (pthread_create(&lr->helper, NULL, helper_thread, lr)) {
+		perror("logrotate thread");
+		fclose(lr->cur.file);
+		fclose(lr->manifest);
+		free(lr);
+		return NULL;
+	}
+
+	lr->rotating = 1;
+
+	return lr;
+}
+
+static int rotation_due(struct logrot *lr, struct timespec *ts)
+{
+	if (lr->maxsize && lr->cur.bytes >= lr->maxsize)
+		return 1;
+
+	if (lr->interval && ts) {
+		if (!lr->deadline)
+			lr->deadline = (ts->tv_sec / lr->interval + 1) * lr->interval;
+		else if (ts->tv_sec >= lr->deadline)
+			return 1;
+	}
+
+	return 0;
+}
+
+FILE *logrot_file(struct logrot *lr, struct timespec *ts)
+{
+	if (!lr->rotating || !rotation_due(lr, ts))
+		return lr->cur.file;
+
+	pthread_mutex_lock(&lr->lock);
+
+	if (!lr->next_ready || lr->cq_tail - lr->cq_head == CLOSEQ) {
+		/* helper is behind - keep writing into the current segment */
+		pthread_mutex_unlock(&lr->lock);
+		if (!lr->pending) {
+			lr->pending = 1;
+			lr->late++;
+		}
+		return lr->cur.file;
+	}
+
+	lr->closeq[lr->cq_tail % CLOSEQ] = lr->cur;
+	lr->cq_tail++;
+	lr->cur = lr->next;
+	lr->next_ready = 0;
+	pthread_cond_signal(&lr->cond);
+
+	pthread_mutex_unlock(&lr->lock);
+
+	lr->pending = 0;
+	if (lr->interval && ts)
+		lr->deadline = (ts->tv_sec / lr->interval + 1) * lr->interval;
+
+	return lr->cur.file;
+}
+
+void logrot_account(struct logrot *lr, struct timespec *ts, size_t bytes)
+{
+	lr->cur.bytes += bytes;
+
+	if (ts) {
+		if (!lr->cur.frames)
+			lr->cur.first = *ts;
+		lr->cur.last = *ts;
+		lr->cur.frames++;
+	}
+}
+
+unsigned long logrot_late(struct logrot *lr)
+{
+	return lr->late;
+}
+
+void logrot_close(struct logrot *lr)
+{
+	if (!lr->rotating) {
+		fclose(lr->cur.file);
+		free(lr);
+		return;
+	}
+
+	pthread_mutex_lock(&lr->lock);
+	lr->running = 0;
+	pthread_cond_signal(&lr->cond);
+	pthread_mutex_unlock(&lr->lock);
+
+	pthread_join(lr->helper, NULL);
+
+	fclose(lr->cur.file);
+	manifest_add(lr, &lr->cur);
+
+	if (lr->next_ready) {
+		/* remove the pre-opened (empty) segment */
+		fclose(lr->next.file);
+		unlink(lr->next.name);
+	}
+
+	fclose(lr->manifest);
+	pthread_mutex_destroy(&lr->lock);
+	pthread_cond_destroy(&lr->cond);
+	free(lr);
+}
+
+unsigned long long logrot_parse_size(const char *arg)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(arg, &end, 10);
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		size <<= 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		size <<= 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		size <<= 30;
+		end++;
+		break;
+	}
+
+	if (*end)
+		return 0;
+
+	return size;
+}
@@ -0,0 +1,110 @@
+/*
+ * logrotate.h - size/time based rotation of CAN log files
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef LOGROTATE_H
+#define LOGROTATE_H
+
+#include <stdio.h>
+#include <time.h>
+
+struct logrot;
+
+struct logrot *logrot_open(const char *base, const char *ext,
+			   const void *hdr, size_t hdrlen,
+			   unsigned long long maxsize, unsigned int interval);
+/*
+ * Opens a (rotating) log file set named <base><ext>.
+ * When hdrlen is not zero, each file starts with the given header
+ * (e.g. the binary log file header).
+ *
+ * With maxsize == 0 and interval == 0 a single file <base><ext> is written
+ * and no helper thread is started (classic candump -l behaviour).
+ *
+ * Otherwise the log is split into segments <base>-NNN<ext> which are
+ * switched when the current segment reaches maxsize bytes or when the
+ * frame timestamps cross the next multiple of 'interval' seconds.
+ * A helper thread opens the next segment ahead of time and closes the
+ * finished ones, so the capture path never calls fopen()/fclose().
+ * Each closed segment is recorded in <base>.manifest as
+ *
+ * <segment file> (<first timestamp>) (<last timestamp>) <frame count>
+ *
+ * with the timestamps given in nanosecond resolution.
+ *
+ * Returns NULL on error (with errno/perror output).
+ */
+
+FILE *logrot_file(struct logrot *lr, struct timespec *ts);
+/*
+ * Returns the stream to write the next entry to. ts is the timestamp of
+ * the CAN frame to be written (NULL for other log entries).
+ * Switches to the pre-opened next segment when a rotation is due.
+ * When the next segment is not ready yet, writing simply continues in
+ * the current segment - no frame is lost and the caller never blocks.
+ */
+
+void logrot_account(struct logrot *lr, struct timespec *ts, size_t bytes);
+/*
+ * Accounts 'bytes' written to the stream returned by logrot_file().
+ * When ts is not NULL the written data was a CAN frame with the given
+ * timestamp.
+ */
+
+unsigned long logrot_late(struct logrot *lr);
+/*
+ * Returns the number of deferred rotations (next segment was not ready).
+ */
+
+void logrot_close(struct logrot *lr);
+/*
+ * Closes the current segment, stops the helper thread, removes the unused
+ * pre-opened segment and completes the manifest.
+ */
+
+unsigned long long logrot_parse_size(const char *arg);
+/*
+ * Converts a size like "500000", "64k", "100M" or "2G" into bytes.
+ * Returns 0 on error.
+ */
+
+#endif
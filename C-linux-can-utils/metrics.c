@@ -0,0 +1,448 @@
+/*
+ * metrics.c - runtime metrics in Prometheus text format
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+#define MAXMETRICS 256 /* registry size */
+#define MAXREQUEST 2048 /* max. HTTP request header length we wait for */
+
+struct registry {
+	int nmetrics;
+	struct metric metric[MAXMETRICS];
+};
+
+static struct registry *reg;
+static int listenfd = -1;
+static int http;
+static char unixpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pid_t owner; /* forked children must not remove the socket */
+static pthread_t exporter;
+
+static void remove_socket(void)
+{
+	if (unixpath[0] && getpid() == owner)
+		unlink(unixpath);
+}
+
+static int open_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "metrics socket path '%s' too long!\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("metrics socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path); /* stale socket of a former run */
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("metrics bind");
+		close(fd);
+		return -1;
+	}
+
+	strcpy(unixpath, path);
+	owner = getpid();
+	atexit(remove_socket);
+
+	return fd;
+}
+
+static int open_http(const char *addr)
+{
+	struct sockaddr_in in;
+	const char *port = strrchr(addr, ':');
+	char host[64] = "127.0.0.1";
+	int fd, on = 1;
+
+	if (port) {
+		if (port - addr >= sizeof(host)) {
+			fprintf(stderr, "metrics host '%s' too long!\n", addr);
+			return -1;
+		}
+		memcpy(host, addr, port - addr);
+		host[port - addr] = 0;
+		port++;
+	} else
+		port = addr;
+
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_port = htons(atoi(port));
+	if (!atoi(port) || !inet_aton(host, &in.sin_addr)) {
+		fprintf(stderr, "invalid metrics address '%s'!\n", addr);
+		return -1;
+	}
+
+	fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("metrics socket");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if (bind(fd, (struct sockaddr *)&in, sizeof(in)) < 0) {
+		perror("metrics bind");
+		close(fd);
+		return -1;
+	}
+
+	http = 1;
+
+	return fd;
+}
+
+static void print_value(FILE *stream, struct metric *m, const char *suffix,
+			const char *extra, unsigned long long val)
+{
+	fprintf(stream, "%s%s", m->name, suffix);
+
+	if (m->labels[0] || extra)
+		fprintf(stream, "{%s%s%s}", m->labels,
+			(m->labels[0] && extra) ? "," : "", (extra) ? extra : "");
+
+	fprintf(stream, " %llu\n", val);
+}
+
+static void print_metric(FILE *stream, struct metric *m)
+{
+	unsigned long long cum = 0, count;
+	char le[32];
+	int i;
+
+	if (m->type != METRIC_HISTOGRAM) {
+		print_value(stream, m, "", NULL,
+			    __atomic_load_n(&m->value, __ATOMIC_RELAXED));
+		return;
+	}
+
+	/*
+	 * count first - metric_observe() increments it after the bucket, so
+	 * buckets loaded later can only be ahead. They are capped at the count
+	 * to keep the cumulative buckets <= +Inf.
+	 */
+	count = __atomic_load_n(&m->count, __ATOMIC_RELAXED);
+
+	for (i = 0; i < m->nbounds; i++) {
+		cum += __atomic_load_n(&m->bucket[i], __ATOMIC_RELAXED);
+		if (cum > count)
+			cum = count;
+		snprintf(le, sizeof(le), "le=\"%llu\"", m->bound[i]);
+		print_value(stream, m, "_bucket", le, cum);
+	}
+
+	print_value(stream, m, "_bucket", "le=\"+Inf\"", count);
+	print_value(stream, m, "_sum", NULL,
+		    __atomic_load_n(&m->value, __ATOMIC_RELAXED));
+	print_value(stream, m, "_count", NULL, count);
+}
+
+void metrics_print(FILE *stream)
+{
+	static const char *type[] = { "counter", "gauge", "histogram" };
+	int n, i, j;
+
+	if (!reg)
+		return;
+
+	n = __atomic_load_n(&reg->nmetrics, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < n; i++) {
+
+		/* families are printed at their first occurrence */
+		for (j = 0; j < i; j++)
+			if (!strcmp(reg->metric[j].name, reg->metric[i].name))
+				break;
+		if (j < i)
+			continue;
+
+		fprintf(stream, "# HELP %s %s\n", reg->metric[i].name,
+			reg->metric[i].help);
+		fprintf(stream, "# TYPE %s %s\n", reg->metric[i].name,
+			type[reg->metric[i].type]);
+
+		for (j = i; j < n; j++)
+			if (!strcmp(reg->metric[j].name, reg->metric[i].name))
+				print_metric(stream, &reg->metric[j]);
+	}
+}
+
+static void serve(int fd)
+{
+	char req[MAXREQUEST + 1];
+	struct timeval tv = { 1, 0 };
+	char *body = NULL;
+	size_t len = 0, done;
+	ssize_t n;
+	FILE *stream;
+	int got = 0;
+
+	if (http) {
+		/* wait for the end of the request header - the path is ignored */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		while (got < MAXREQUEST) {
+			n = read(fd, req + got, MAXREQUEST - got);
+			if (n <= 0)
+				return;
+			got += n;
+			req[got] = 0;
+			if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+				break;
+		}
+	}
+
+	stream = open_memstream(&body, &len);
+	if (!stream)
+		return;
+
+	metrics_print(stream);
+	fclose(stream);
+
+	if (http) {
+		dprintf(fd, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", len);
+	}
+
+	for (done = 0; done < len; done += n) {
+		n = write(fd, body + done, len - done);
+		if (n <= 0)
+			break;
+	}
+
+	free(body);
+}
+
+static void *exporter_thread(void *arg)
+{
+	int fd;
+
+	while (1) {
+		fd = accept(listenfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("metrics accept");
+			return NULL;
+		}
+
+		serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int metrics_open(const char *addr)
+{
+	sigset_t all, old;
+
+	if (reg)
+		return 0;
+
+	/* shared memory to see the updates of forked children as well */
+	reg = mmap(NULL, sizeof(*reg), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (reg == MAP_FAILED) {
+		perror("metrics mmap");
+		reg = NULL;
+		return -1;
+	}
+
+	if (!strncmp(addr, "unix:", 5))
+		listenfd = open_unix(addr + 5);
+	else if (addr[0] == '/')
+		listenfd = open_unix(addr);
+	else
+		listenfd = open_http(addr);
+
+	if (listenfd < 0 || listen(listenfd, 8) < 0) {
+		if (listenfd >= 0) {
+			perror("metrics listen");
+			close(listenfd);
+		}
+		munmap(reg, sizeof(*reg));
+		reg = NULL;
+		return -1;
+	}
+
+	/* the signals are handled by the application threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&exporter, NULL, exporter_thread, NULL)) {
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		perror("metrics thread");
+		close(listenfd);
+		munmap(reg, sizeof(*reg));
+		reg = NULL;
+		return -1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_detach(exporter);
+
+	return 0;
+}
+
+static struct metric *metric_new(int type, const char *name, const char *help,
+				 const char *labels)
+{
+	struct metric *m;
+
+	if (!reg || reg->nmetrics == MAXMETRICS)
+		return NULL;
+
+	m = &reg->metric[reg->nmetrics];
+	memset(m, 0, sizeof(*m));
+	m->type = type;
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	snprintf(m->help, sizeof(m->help), "%s", help);
+	snprintf(m->labels, sizeof(m->labels), "%s", (labels) ? labels : "");
+
+	return m;
+}
+
+static struct metric *metric_publish(struct metric *m)
+{
+	/* make the initialized entry visible to the exporter thread */
+	if (m)
+		__atomic_store_n(&reg->nmetrics, reg->nmetrics + 1,
+				 __ATOMIC_RELEASE);
+	return m;
+}
+
+int metric_label(char *buf, size_t size, const char *name,
+		 const char *value, int len)
+{
+	size_t pos = strlen(buf);
+	int i;
+
+	if (len < 0)
+		len = strlen(value);
+
+	/* worst case: ',' name '="' every char escaped '"' and the NUL */
+	if (pos + 1 + strlen(name) + 2 + 2 * len + 2 > size)
+		return -1;
+
+	if (pos)
+		buf[pos++] = ',';
+	pos += sprintf(buf + pos, "%s=\"", name);
+
+	for (i = 0; i < len && value[i]; i++) {
+		switch (value[i]) {
+		case '\\':
+		case '"':
+			buf[pos++] = '\\';
+			buf[pos++] = value[i];
+			break;
+		case '\n':
+			buf[pos++] = '\\';
+			buf[pos++] = 'n';
+			break;
+		default:
+			buf[pos++] = value[i];
+		}
+	}
+
+	buf[pos++] = '"';
+	buf[pos] = 0;
+
+	return 0;
+}
+
+struct metric *metric_counter(const char *name, const char *help,
+			      const char *labels)
+{
+	return metric_publish(metric_new(METRIC_COUNTER, name, help, labels));
+}
+
+struct metric *metric_gauge(const char *name, const char *help,
+			    const char *labels)
+{
+	return metric_publish(metric_new(METRIC_GAUGE, name, help, labels));
+}
+
+struct metric *metric_histogram(const char *name, const char *help,
+				const char *labels,
+				const unsigned long long *bounds, int nbounds)
+{
+	struct metric *m = metric_new(METRIC_HISTOGRAM, name, help, labels);
+
+	if (!m)
+		return NULL;
+
+	if (nbounds > METRICS_MAXBUCKETS)
+		nbounds = METRICS_MAXBUCKETS;
+
+	m->nbounds = nbounds;
+	memcpy(m->bound, bounds, nbounds * sizeof(*bounds));
+
+	return metric_publish(m);
+}
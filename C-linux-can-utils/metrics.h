@@ -0,0 +1,146 @@
+/*
+ * metrics.h - runtime metrics in Prometheus text format
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+#define METRICS_MAXBUCKETS 16 /* max. number of histogram bucket bounds */
+
+enum {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+/*
+ * A single time series. The values are updated with relaxed atomic
+ * operations from any thread (or forked process - the registry lives in
+ * shared memory) and read by the exporter thread without locking.
+ */
+struct metric {
+	int type;
+	char name[64];
+	char help[128];
+	char labels[96];          /* e.g. interface="can0" */
+	unsigned long long value; /* counter, gauge or histogram sum */
+	unsigned long long count; /* histogram: number of observations */
+	int nbounds;
+	unsigned long long bound[METRICS_MAXBUCKETS];
+	unsigned long long bucket[METRICS_MAXBUCKETS]; /* not cumulative */
+};
+
+int metrics_open(const char *addr);
+/*
+ * Creates the metrics registry and starts the exporter thread listening
+ * on 'addr' which is either
+ *
+ * unix:<path> or /<path>  (Unix domain socket - plain text exposition)
+ * [<host>:]<port>          (HTTP server, default host 127.0.0.1)
+ *
+ * Each connection gets the current values in the Prometheus text format.
+ * Without metrics_open() all metric_*() constructors return NULL and the
+ * update functions do nothing.
+ * Returns 0 on success or -1 with an error message on stderr.
+ */
+
+int metric_label(char *buf, size_t size, const char *name,
+		 const char *value, int len);
+/*
+ * Appends the label name="value" to the (initially empty) label string
+ * in buf, separated by ',' from previous labels. The first 'len' chars of
+ * value are used (len < 0 uses the whole string) with '\', '"' and
+ * newline escaped as required by the Prometheus text format.
+ * Returns 0 on success or -1 when buf is too small.
+ */
+
+struct metric *metric_counter(const char *name, const char *help,
+			      const char *labels);
+struct metric *metric_gauge(const char *name, const char *help,
+			    const char *labels);
+struct metric *metric_histogram(const char *name, const char *help,
+				const char *labels,
+				const unsigned long long *bounds, int nbounds);
+/*
+ * Register a new time series. Series with the same name (but different
+ * labels) are grouped into one metric family. The histogram bounds have
+ * to be given in ascending order ('le' upper bounds, +Inf is implicit).
+ * Returns NULL when the registry is not open or full.
+ */
+
+void metrics_print(FILE *stream);
+/*
+ * Writes all registered time series in the Prometheus text format.
+ */
+
+static inline void metric_add(struct metric *m, unsigned long long val)
+{
+	if (m)
+		__atomic_fetch_add(&m->value, val, __ATOMIC_RELAXED);
+}
+
+static inline void metric_set(struct metric *m, unsigned long long val)
+{
+	if (m)
+		__atomic_store_n(&m->value, val, __ATOMIC_RELAXED);
+}
+
+static inline void metric_observe(struct metric *m, unsigned long long val)
+{
+	int i;
+
+	if (!m)
+		return;
+
+	for (i = 0; i < m->nbounds; i++)
+		if (val <= m->bound[i])
+			break;
+
+	if (i < m->nbounds)
+		__atomic_fetch_add(&m->bucket[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&m->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&m->value, val, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * spscring.h - lock-free single producer/single consumer ring buffer
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stdlib.h>
+
+/*
+ * Fixed size ring of fixed size elements between exactly one producer and
+ * one consumer thread. The indices are free running and only published
+ * with release/acquire semantics, so no locks are needed. Each side owns
+ * its own statistics to keep the cache lines separated.
+ */
+struct spsc_ring {
+	/* consumer side */
+	unsigned int head __attribute__((aligned(64)));
+	unsigned int maxdepth;
+	unsigned long long depthsum;
+	unsigned long long reads;
+
+	/* producer side */
+	unsigned int tail __attribute__((aligned(64)));
+	unsigned long full;
+
+	unsigned int mask __attribute__((aligned(64)));
+	size_t esize;
+	unsigned char *buf;
+};
+
+static inline int spsc_init(struct spsc_ring *r, unsigned int size, size_t esize)
+{
+	unsigned int n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	r->head = r->tail = 0;
+	r->maxdepth = 0;
+	r->depthsum = r->reads = 0;
+	r->full = 0;
+	r->mask = n - 1;
+	r->esize = esize;
+	r->buf = calloc(n, esize);
+
+	return (r->buf) ? 0 : -1;
+}
+
+static inline void spsc_free(struct spsc_ring *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+static inline unsigned int spsc_size(struct spsc_ring *r)
+{
+	return r->mask + 1;
+}
+
+/* producer: returns the next free element or NULL when the ring is full */
+static inline void *spsc_write_slot(struct spsc_ring *r)
+{
+	if (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) > r->mask) {
+		r->full++;
+		return NULL;
+	}
+
+	return r->buf + (r->tail & r->mask) * r->esize;
+}
+
+/* producer: publishes the element returned by spsc_write_slot() */
+static inline void spsc_write_commit(struct spsc_ring *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* consumer: returns the oldest element or NULL when the ring is empty */
+static inline void *spsc_read_slot(struct spsc_ring *r)
+{
+	unsigned int depth = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - r->head;
+
+	if (!depth)
+		return NULL;
+
+	if (depth > r->maxdepth)
+		r->maxdepth = depth;
+
+	return r->buf + (r->head & r->mask) * r->esize;
+}
+
+/* consumer: releases the element returned by spsc_read_slot() */
+static inline void spsc_read_commit(struct spsc_ring *r)
+{
+	/* depth statistics per consumed element */
+	r->depthsum += __atomic_load_n(&r->tail, __ATOMIC_RELAXED) - r->head;
+	r->reads++;
+
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
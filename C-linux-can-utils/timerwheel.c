@@ -0,0 +1,152 @@
+/*
+ * timerwheel.c - hashed timer wheel for scheduling CAN frames
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdlib.h>
+
+#include "timerwheel.h"
+
+int tw_init(struct timerwheel *tw, unsigned int slots, unsigned long long tick,
+	    unsigned long long now)
+{
+	unsigned int n = 1, i;
+
+	while (n < slots)
+		n <<= 1;
+
+	tw->slot = malloc(n * sizeof(struct tw_slot));
+	if (!tw->slot)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		tw->slot[i].head = NULL;
+		tw->slot[i].tail = &tw->slot[i].head;
+	}
+
+	tw->tick = tick;
+	tw->current = now - now % tick;
+	tw->mask = n - 1;
+	tw->pending = 0;
+
+	return 0;
+}
+
+void tw_free(struct timerwheel *tw)
+{
+	free(tw->slot);
+	tw->slot = NULL;
+}
+
+static inline struct tw_slot *tw_slot(struct timerwheel *tw, unsigned long long t)
+{
+	return &tw->slot[(t / tw->tick) & tw->mask];
+}
+
+void tw_add(struct timerwheel *tw, struct tw_timer *t, unsigned long long expires)
+{
+	struct tw_slot *slot;
+
+	t->expires = expires;
+	t->next = NULL;
+
+	/* timers in the past go into the current slot */
+	slot = tw_slot(tw, (expires < tw->current) ? tw->current : expires);
+	*slot->tail = t;
+	slot->tail = &t->next;
+
+	tw->pending++;
+}
+
+/* move the timers of the slot expired at 'now' to the end of the list */
+static void tw_expire_slot(struct timerwheel *tw, struct tw_slot *slot,
+			   unsigned long long now, struct tw_timer ***tail)
+{
+	struct tw_timer **pt = &slot->head;
+	struct tw_timer *t;
+
+	while ((t = *pt)) {
+		if (t->expires > now) {
+			/* later revolution or later in the current tick */
+			pt = &t->next;
+			continue;
+		}
+
+		*pt = t->next;
+		t->next = NULL;
+		**tail = t;
+		*tail = &t->next;
+		tw->pending--;
+	}
+
+	slot->tail = pt;
+}
+
+struct tw_timer *tw_expire(struct timerwheel *tw, unsigned long long now)
+{
+	struct tw_timer *list = NULL;
+	struct tw_timer **tail = &list;
+	unsigned long long span = (tw->mask + 1ULL) * tw->tick;
+	unsigned int i;
+
+	if (now < tw->current)
+		return NULL;
+
+	if (now - tw->current >= span) {
+		/* more than one revolution - visit each slot once */
+		for (i = 0; i <= tw->mask && tw->pending; i++) {
+			tw_expire_slot(tw, tw_slot(tw, tw->current), now, &tail);
+			tw->current += tw->tick;
+		}
+		tw->current = now - now % tw->tick;
+		return list;
+	}
+
+	while (1) {
+		if (tw->pending)
+			tw_expire_slot(tw, tw_slot(tw, tw->current), now, &tail);
+		if (tw->current + tw->tick > now)
+			break;
+		tw->current += tw->tick;
+	}
+
+	return list;
+}
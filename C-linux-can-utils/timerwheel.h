@@ -0,0 +1,94 @@
+/*
+ * timerwheel.h - hashed timer wheel for scheduling CAN frames
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+/* timer to be embedded into the user's data structure */
+struct tw_timer {
+	struct tw_timer *next;
+	unsigned long long expires; /* absolute expiry time in ns */
+};
+
+struct tw_slot {
+	struct tw_timer *head;
+	struct tw_timer **tail;
+};
+
+struct timerwheel {
+	unsigned long long tick;    /* length of one slot in ns */
+	unsigned long long current; /* start of the current tick in ns */
+	unsigned int mask;          /* number of slots - 1 */
+	unsigned long pending;      /* number of queued timers */
+	struct tw_slot *slot;
+};
+
+int tw_init(struct timerwheel *tw, unsigned int slots, unsigned long long tick,
+	    unsigned long long now);
+/*
+ * Initializes the timer wheel with 'slots' slots (rounded up to a power
+ * of two) of 'tick' ns each, starting at the time 'now' (ns).
+ * Timers further away than slots * tick simply stay in their slot for
+ * more revolutions. Returns 0 on success or -1 when out of memory.
+ */
+
+void tw_free(struct timerwheel *tw);
+/*
+ * Frees the slots. Pending timers are not touched.
+ */
+
+void tw_add(struct timerwheel *tw, struct tw_timer *t, unsigned long long expires);
+/*
+ * Queues the timer t to expire at 'expires' (ns). Timers with the same
+ * expiry time expire in the order they have been added. Timers in the
+ * past expire with the next call of tw_expire().
+ */
+
+struct tw_timer *tw_expire(struct timerwheel *tw, unsigned long long now);
+/*
+ * Advances the wheel to 'now' (ns) and returns the list of expired timers
+ * (linked by 'next', NULL terminated) ordered by their slot - i.e. by
+ * expiry time with tick resolution. Returns NULL when nothing expired.
+ */
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * trafficmodel.c - statistical CAN traffic model (per CAN ID periods and payload changes)
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trafficmodel.h"
+
+#define LINESZ 512
+
+static int parse_list(char *arg, unsigned int *val, int n)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		val[i] = strtoul(arg, &end, 10);
+		if (end == arg || (*end != ',' && i < n - 1) || (*end && i == n - 1))
+			return 1;
+		arg = end + 1;
+	}
+
+	return 0;
+}
+
+int tm_read(FILE *f, struct trafficmodel *tm)
+{
+	char line[LINESZ], id[16], data[24], change[64], period[256];
+	unsigned int val[TM_QUANTILES], dlc;
+	unsigned int size = 0, lineno = 0;
+	unsigned long frames;
+	struct tm_id *t;
+	size_t len;
+	int i;
+
+	tm->id = NULL;
+	tm->ids = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%15s %u %lu %23s %63s %255s", id, &dlc,
+			   &frames, data, change, period) != 6 ||
+		    dlc > 8 || strlen(data) != 16)
+			goto error;
+
+		if (tm->ids == size) {
+			size = (size) ? 2 * size : 256;
+			t = realloc(tm->id, size * sizeof(*t));
+			if (!t) {
+				perror("traffic model");
+				tm_free(tm);
+				return 1;
+			}
+			tm->id = t;
+		}
+
+		t = &tm->id[tm->ids];
+		memset(t, 0, sizeof(*t));
+
+		len = strlen(id);
+		if (id[len - 1] == 'R') {
+			id[--len] = 0;
+			t->can_id = CAN_RTR_FLAG;
+		}
+		if (!len || len > 8 || strspn(id, "0123456789ABCDEFabcdef") != len)
+			goto error;
+
+		t->can_id |= strtoul(id, NULL, 16);
+		if (len > 3)
+			t->can_id |= CAN_EFF_FLAG;
+		t->dlc = dlc;
+		t->frames = frames;
+
+		for (i = 0; i < 8; i++) {
+			if (sscanf(&data[2 * i], "%2hhx", &t->data[i]) != 1)
+				goto error;
+		}
+
+		if (parse_list(change, val, 8))
+			goto error;
+		for (i = 0; i < 8; i++)
+			t->change[i] = (val[i] > 1000) ? 1000 : val[i];
+
+		if (parse_list(period, t->period, TM_QUANTILES))
+			goto error;
+
+		tm->ids++;
+	}
+
+	return 0;
+
+error:
+	fprintf(stderr, "traffic model: wrong format in line %u\n", lineno);
+	tm_free(tm);
+	return 1;
+}
+
+void tm_write(FILE *f, struct trafficmodel *tm)
+{
+	struct tm_id *t;
+	unsigned int n;
+	int i;
+
+	fprintf(f, "# CAN traffic model: %u CAN IDs\n", tm->ids);
+	fprintf(f, "# <can_id> <dlc> <frames> <data> <byte change per mille> "
+		"<period quantiles in us>\n");
+
+	for (n = 0; n < tm->ids; n++) {
+		t = &tm->id[n];
+
+		if (t->can_id & CAN_EFF_FLAG)
+			fprintf(f, "%08X", t->can_id & CAN_EFF_MASK);
+		else
+			fprintf(f, "%03X", t->can_id & CAN_SFF_MASK);
+
+		if (t->can_id & CAN_RTR_FLAG)
+			fprintf(f, "R");
+
+		fprintf(f, " %u %lu ", t->dlc, t->frames);
+
+		for (i = 0; i < 8; i++)
+			fprintf(f, "%02X", t->data[i]);
+
+		for (i = 0; i < 8; i++)
+			fprintf(f, "%c%u", (i) ? ',' : ' ', t->change[i]);
+
+		for (i = 0; i < TM_QUANTILES; i++)
+			fprintf(f, "%c%u", (i) ? ',' : ' ', t->period[i]);
+
+		fprintf(f, "\n");
+	}
+}
+
+void tm_free(struct trafficmodel *tm)
+{
+	free(tm->id);
+	tm->id = NULL;
+	tm->ids = 0;
+}
+
+unsigned int tm_sample_period(struct tm_id *id, uint32_t rnd)
+{
+	/* position within the quantile table in 1/65536 steps */
+	uint64_t pos = (uint64_t)rnd * (TM_QUANTILES - 1) >> 16;
+	unsigned int i = pos >> 16;
+	unsigned int frac = pos & 0xFFFF;
+	unsigned int lo = id->period[i];
+	unsigned int hi = id->period[i + 1];
+
+	if (hi < lo) /* not sorted - e.g. edited by hand */
+		return lo;
+
+	return lo + (uint64_t)(hi - lo) * frac / 65536;
+}
@@ -0,0 +1,101 @@
+/*
+ * trafficmodel.h - statistical CAN traffic model (per CAN ID periods and payload changes)
+ *
+ * Copyright (c) 2002-2007 Volkswagen Group Electronic Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Volkswagen nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * Alternatively, provided that this notice is retained in full, this
+ * software may be distributed under the terms of the GNU General
+ * Public License ("GPL") version 2, in which case the provisions of the
+ * GPL apply INSTEAD OF those given above.
+ *
+ * The provided data structures and external interfaces from this code
+ * are not restricted to be used by modules with a GPL compatible license.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#ifndef TRAFFICMODEL_H
+#define TRAFFICMODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+
+#define TM_QUANTILES 17 /* period quantiles 0%, 6.25%, 12.5% ... 100% */
+
+/* traffic model of one CAN ID */
+struct tm_id {
+	canid_t can_id;       /* incl. CAN_EFF_FLAG / CAN_RTR_FLAG */
+	unsigned char dlc;    /* most frequent data length code */
+	unsigned char data[8];/* first payload seen */
+	unsigned short change[8]; /* per mille probability of a byte change */
+	unsigned long frames;
+	unsigned int period[TM_QUANTILES]; /* inter frame time in us */
+};
+
+struct trafficmodel {
+	struct tm_id *id;
+	unsigned int ids;
+};
+
+int tm_read(FILE *f, struct trafficmodel *tm);
+/*
+ * Reads a traffic model as written by tm_write() into tm->id[] (malloc'ed).
+ * Returns 0 on success and 1 on errors (with a message on stderr).
+ */
+
+void tm_write(FILE *f, struct trafficmodel *tm);
+/*
+ * Writes the traffic model in a line based text format:
+ *
+ * <can_id> <dlc> <frames> <data> <change>,.. <period>,..
+ *
+ * can_id: hex (3 digits SFF, 8 digits EFF) followed by 'R' for remote
+ * frames, data: 16 hex digits,
+ * change: 8 byte change probabilities in per mille,
+ * period: TM_QUANTILES quantiles of the inter frame time in us.
+ * Lines starting with '#' are comments.
+ */
+
+void tm_free(struct trafficmodel *tm);
+/*
+ * Frees the CAN ID table.
+ */
+
+unsigned int tm_sample_period(struct tm_id *id, uint32_t rnd);
+/*
+ * Draws an inter frame time in us from the period distribution of id.
+ * rnd is a uniformly distributed random number. The quantiles are
+ * interpolated linearly (inverse transform sampling).
+ */
+
+#endif